@@ -0,0 +1,265 @@
+#include "stdafx.h"
+#include <stdlib.h>
+#include <time.h>
+#include "BenchmarkHistory.h"
+#include "Paths.h"
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#elif !defined(WIN32)
+#include <unistd.h>
+#endif
+using namespace std;
+
+static const char* HistoryHeader = "# BenchmarkHistory v3";
+
+static bool ReadLine(FILE* fp, OUT string& line)
+{
+	line.clear();
+	int c;
+	while ((c = fgetc(fp)) != EOF && c != '\n')
+		line += (char)c;
+	return c != EOF || !line.empty();
+}
+
+static void SplitTabs(const string& line, OUT vector<string>& fields)
+{
+	fields.clear();
+	size_t start = 0, tab;
+	while ((tab = line.find('\t', start)) != string::npos) {
+		fields.push_back(line.substr(start, tab - start));
+		start = tab + 1;
+	}
+	fields.push_back(line.substr(start));
+}
+
+// Tabs and newlines would corrupt the file format
+static string Sanitize(const string& s)
+{
+	string out(s);
+	for (size_t i = 0; i < out.size(); i++)
+		if (out[i] == '\t' || out[i] == '\n' || out[i] == '\r')
+			out[i] = ' ';
+	return out;
+}
+
+enum { FixedFields = 19 };
+
+bool BenchmarkHistory::Load(const string& filename)
+{
+	_entries.clear();
+	FILE* fp = fopen(filename.c_str(), "rt");
+	if (!fp)
+		return false;
+
+	string line;
+	vector<string> f;
+	bool valid = ReadLine(fp, line) && line == HistoryHeader;
+	while (valid && ReadLine(fp, line))
+	{
+		SplitTabs(line, OUT f);
+		if (f.size() < FixedFields)
+			continue;
+		Entry& e = _entries[f[0]];
+		e.Fingerprint = (uint32)strtoul(f[1].c_str(), NULL, 16);
+
+		BenchmarkStatistic s;
+		s.Count        = atoi(f[3].c_str());
+		s.Errors       = atoi(f[4].c_str());
+		s.First        = strtod(f[5].c_str(), NULL);
+		s.Last         = strtod(f[6].c_str(), NULL);
+		s.Min          = strtod(f[7].c_str(), NULL);
+		s.Max          = strtod(f[8].c_str(), NULL);
+		s.SumTotal     = strtod(f[9].c_str(), NULL);
+		s.SumOfSquares = strtod(f[10].c_str(), NULL);
+		s.Usage.UserSec             = strtod(f[11].c_str(), NULL);
+		s.Usage.SystemSec           = strtod(f[12].c_str(), NULL);
+		s.Usage.CpuCycles           = (int64)strtod(f[13].c_str(), NULL);
+		s.Usage.ProcessPageFaults   = (int64)strtod(f[14].c_str(), NULL);
+		s.Latency.Samples = (int64)strtod(f[15].c_str(), NULL);
+		s.Latency.P50     = strtod(f[16].c_str(), NULL);
+		s.Latency.P99     = strtod(f[17].c_str(), NULL);
+		s.Latency.Max     = strtod(f[18].c_str(), NULL);
+		for (size_t i = FixedFields; i < f.size(); i++)
+			s.UserData.insert(f[i]);
+		e.Results.push_back(make_pair(f[2], s));
+	}
+	fclose(fp);
+	if (!valid)
+		_entries.clear();
+	return valid;
+}
+
+bool BenchmarkHistory::Save(const string& filename) const
+{
+	FILE* fp = fopen(filename.c_str(), "wt");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "%s\n", HistoryHeader);
+	map<string, Entry>::const_iterator it;
+	for (it = _entries.begin(); it != _entries.end(); ++it)
+	{
+		const Rows& rows = it->second.Results;
+		for (size_t r = 0; r < rows.size(); r++)
+		{
+			const BenchmarkStatistic& s = rows[r].second;
+			fprintf(fp, "%s\t%08x\t%s\t%d\t%d\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.17g\t%.0f\t%.0f\t%.0f\t%.17g\t%.17g\t%.17g",
+				Sanitize(it->first).c_str(), it->second.Fingerprint, Sanitize(rows[r].first).c_str(),
+				s.Count, s.Errors, s.First, s.Last, s.Min, s.Max, s.SumTotal, s.SumOfSquares,
+				s.Usage.UserSec, s.Usage.SystemSec, (double)s.Usage.CpuCycles, (double)s.Usage.ProcessPageFaults,
+				(double)s.Latency.Samples, s.Latency.P50, s.Latency.P99, s.Latency.Max);
+			set<string>::const_iterator d;
+			for (d = s.UserData.begin(); d != s.UserData.end(); ++d)
+				fprintf(fp, "\t%s", Sanitize(*d).c_str());
+			fprintf(fp, "\n");
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+bool BenchmarkHistory::TryGet(const string& benchmarkName, uint32 fingerprint, OUT Rows& rows) const
+{
+	map<string, Entry>::const_iterator it = _entries.find(benchmarkName);
+	if (it == _entries.end() || it->second.Fingerprint != fingerprint)
+		return false;
+	rows = it->second.Results;
+	return true;
+}
+
+void BenchmarkHistory::Set(const string& benchmarkName, uint32 fingerprint, const Rows& rows)
+{
+	Entry& e = _entries[benchmarkName];
+	e.Fingerprint = fingerprint;
+	e.Results = rows;
+}
+
+uint32 BenchmarkHistory::Hash(const void* data, size_t size, uint32 hash)
+{
+	// FNV-1a
+	const uint8* p = (const uint8*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+
+uint32 BenchmarkHistory::Fingerprint(const BenchmarkInfo& info, int numTrials, const string& buildFlags)
+{
+	uint32 hash = Hash(info.Name, 2166136261u);
+	hash = Hash(&numTrials, sizeof(numTrials), hash);
+	hash = Hash(buildFlags, hash);
+	hash = Hash(HardwareId(), hash);
+	if (!info.Version.empty())
+		hash = Hash(info.Version, hash);
+	else
+		hash ^= BuildId();
+	return hash;
+}
+
+uint32 BenchmarkHistory::BuildId()
+{
+	static bool known = false;
+	static uint32 id;
+	if (!known) {
+		string path;
+		#ifdef WIN32
+		path = GetPathOfEXE();
+		#else
+		char buf[4096];
+		ssize_t length = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+		if (length > 0)
+			path.assign(buf, (size_t)length);
+		#endif
+		FILE* fp = path.empty() ? NULL : fopen(path.c_str(), "rb");
+		if (fp) {
+			id = 2166136261u;
+			char chunk[65536];
+			size_t n;
+			while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+				id = Hash(chunk, n, id);
+			fclose(fp);
+		} else
+			id = (uint32)time(NULL) * 2654435761u ^ (uint32)clock();
+		known = true;
+	}
+	return id;
+}
+
+string BenchmarkHistory::DefaultBuildFlags()
+{
+	string flags;
+	#if defined(_MSC_VER)
+	flags += printstring("MSC %d", _MSC_VER);
+	#elif defined(__VERSION__)
+	flags += "GCC " __VERSION__;
+	#endif
+	#if defined(_M_X64) || defined(__x86_64__)
+	flags += " x64";
+	#elif defined(_M_IX86) || defined(__i386__)
+	flags += " x86";
+	#elif defined(_M_ARM) || defined(__arm__)
+	flags += " ARM";
+	#endif
+	#ifdef _DEBUG
+	flags += " DEBUG";
+	#endif
+	#ifdef NDEBUG
+	flags += " NDEBUG";
+	#endif
+	#if _SECURE_SCL
+	flags += " SECURE_SCL";
+	#endif
+	#if _HAS_ITERATOR_DEBUGGING
+	flags += " ITERATOR_DEBUGGING";
+	#endif
+	#ifdef _M_IX86_FP
+	flags += printstring(" arch:%d", _M_IX86_FP);
+	#endif
+	#ifdef __AVX2__
+	flags += " AVX2";
+	#endif
+	return flags;
+}
+
+string BenchmarkHistory::HardwareId()
+{
+	static string cached;
+	if (!cached.empty())
+		return cached;
+	string id;
+	int cores;
+	#ifdef WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	cores = (int)info.dwNumberOfProcessors;
+	#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if ((unsigned)regs[0] >= 0x80000004u) {
+		char brand[49] = { 0 };
+		for (int i = 0; i < 3; i++)
+			__cpuid((int*)&brand[i * 16], 0x80000002 + i);
+		id = brand;
+	}
+	#endif
+	#else
+	cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	FILE* fp = fopen("/proc/cpuinfo", "rt");
+	if (fp) {
+		string line;
+		while (ReadLine(fp, line))
+			if (line.compare(0, 10, "model name") == 0) {
+				// "model name\t: brand", but don't count on the spacing
+				size_t colon = line.find(':'), start = string::npos;
+				if (colon != string::npos)
+					start = line.find_first_not_of(" \t", colon + 1);
+				if (start != string::npos)
+					id = line.substr(start);
+				break;
+			}
+		fclose(fp);
+	}
+	#endif
+	cached = id + printstring(" x%d", cores);
+	return cached;
+}
@@ -0,0 +1,72 @@
+#ifndef _BENCHMARKHISTORY_H
+#define _BENCHMARKHISTORY_H
+
+#include <string>
+#include <vector>
+#include "Benchmarker.h"
+
+/// <summary>
+/// A file that remembers the results of each top-level benchmark together
+/// with a fingerprint of the benchmark, so that Benchmarker can skip
+/// benchmarks that have not changed since they were last measured (see
+/// <see cref="Benchmarker::HistoryFile"/>).
+/// </summary>
+/// <remarks>
+/// The fingerprint combines the benchmark's name and number of trials, the
+/// build flags, a hardware identifier, and either the user-supplied version
+/// tag (BenchmarkInfo::Version) or, if there is no tag, a hash of the whole
+/// executable (BuildId).
+/// <para/>
+/// Machine code alone cannot tell whether a benchmark changed: the kernels,
+/// inlined helpers and headers it depends on are spread all over the
+/// executable. So an untagged benchmark is re-run after every rebuild that
+/// changes the executable, and a tagged one only when its tag changes. To
+/// iterate on one kernel, tag the other benchmarks and leave it untagged.
+/// Benchmarks.cpp leaves its benchmarks untagged unless they are listed in
+/// BenchmarkVersions there, which takes effect with INCREMENTAL_BENCHMARKS.
+/// <para/>
+/// The file is plain text, one result row per line, with tab-separated
+/// fields: benchmark name, fingerprint, row name, Count, Errors, First, Last,
+/// Min, Max, SumTotal, SumOfSquares, the four ResourceUsage counters, the
+/// four LatencySummary fields, and then any number of user data strings.
+/// </remarks>
+class BenchmarkHistory
+{
+public:
+	typedef std::vector< std::pair<std::string, BenchmarkStatistic> > Rows;
+
+	/// <summary>Reads a history file. Returns false if it could not be
+	/// opened (e.g. on the first run), in which case the history is empty.</summary>
+	bool Load(const std::string& filename);
+	bool Save(const std::string& filename) const;
+
+	/// <summary>Gets the rows recorded for a benchmark, if its recorded
+	/// fingerprint matches.</summary>
+	bool TryGet(const std::string& benchmarkName, uint32 fingerprint, OUT Rows& rows) const;
+	void Set(const std::string& benchmarkName, uint32 fingerprint, const Rows& rows);
+	bool Remove(const std::string& benchmarkName) { return _entries.Remove(benchmarkName); }
+
+	static uint32 Fingerprint(const BenchmarkInfo& info, int numTrials, const std::string& buildFlags);
+	/// <summary>A hash of the running executable's file, computed once. If
+	/// the file cannot be read, a value that differs on every run.</summary>
+	static uint32 BuildId();
+	/// <summary>Describes the compiler and the settings that affect speed.</summary>
+	static std::string DefaultBuildFlags();
+	/// <summary>Identifies the processor (brand string and core count),
+	/// which is read once.</summary>
+	static std::string HardwareId();
+
+protected:
+	struct Entry
+	{
+		Entry() : Fingerprint(0) { }
+		uint32 Fingerprint;
+		Rows Results;
+	};
+	EasyMap<std::string, Entry> _entries;
+
+	static uint32 Hash(const void* data, size_t size, uint32 hash = 2166136261u);
+	static uint32 Hash(const std::string& s, uint32 hash) { return Hash(s.c_str(), s.size() + 1, hash); }
+};
+
+#endif
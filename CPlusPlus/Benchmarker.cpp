@@ -4,6 +4,8 @@
 #include <algorithm>
 #include "Misc.h"
 #include "Benchmarker.h"
+#include "BenchmarkHistory.h"
+#include "MetricsExporter.h"
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -18,6 +20,8 @@ void BenchmarkStatistic::Clear()
 	Statistic::Clear();
 	First = Last = Errors = 0;
 	UserData.clear();
+	Usage.Clear();
+	Latency.Clear();
 }
 
 void BenchmarkStatistic::Add(double nextValue, const string& userDatum)
@@ -38,6 +42,7 @@ void BenchmarkStatistic::Add(double nextValue, const string& userDatum)
 ////////////////////////////////////////////////////////////////////////////////
 
 const std::string Benchmarker::DiscardResult("(discard result)");
+const std::string Benchmarker::CachedResult("(cached)");
 
 Benchmarker::Benchmarker()
 {
@@ -49,6 +54,13 @@ Benchmarker::Benchmarker()
 	DefaultNumTrials = 5;
 	#endif
 	UserDataColumnName = "Comment";
+	MeasureResourceUsage = false;
+	BuildFlags = BenchmarkHistory::DefaultBuildFlags();
+	_pauseDepth = 0;
+	_pausedMillisec = 0;
+	_reporterThread = NULL;
+	_trialsCompleted = 0;
+	Metrics = NULL;
 }
 
 void Benchmarker::MeasureAndRecord(string name, FastDelegate0<string> code)
@@ -59,25 +71,141 @@ void Benchmarker::MeasureAndRecord(string name, FastDelegate0<string> code)
 	else
 		_activeBenchmark = name;
 
+	// Operations sampled while this benchmark runs are recorded here,
+	// not in the histogram of an outer benchmark
+	LatencyHistogram latency;
+	LatencyHistogram* oldLatency = Sampler.Histogram();
+	Sampler.SetHistogram(&latency);
+
 	try {
 		string userData;
-		double time = Measure(code, OUT userData);
-		if (userData != DiscardResult)
-			Tally(_activeBenchmark, time, userData);
+		TrialResult result(TrialResult::Timing, _activeBenchmark);
+		result.Seconds = Measure(code, OUT userData, OUT result.Usage);
+		if (userData != DiscardResult) {
+			result.UserData = userData;
+			if (latency.Count() > 0)
+				result.Latency = latency.Summarize(LatencySampler::MicrosecPerTick(), LatencySampler::OverheadTicks());
+			Record(result);
+		}
 	}
 	catch(exception& e)
 	{
-		++_errors.GetOrAdd(string(e.what()), 0);
-		TallyError(_activeBenchmark, typeid(e).name());
+		Record(TrialResult(TrialResult::Error, _activeBenchmark, 0, typeid(e).name(), e.what()));
 	}
+	Sampler.SetHistogram(oldLatency);
 	_activeBenchmark = oldActive;
 }
 
+void Benchmarker::MeasureAndRecord(string name, FastDelegate0<string> code, const BenchmarkFixture& fixture)
+{
+	string fullName = _activeBenchmark.empty() ? name : _activeBenchmark + ": " + name;
+
+	// Pause so that an outer benchmark doesn't count the fixture either
+	PauseTiming();
+	bool ready = SetupFixture(fullName, fixture);
+	ResumeTiming();
+	if (!ready)
+		return;
+
+	MeasureAndRecord(name, code);
+
+	if (!fixture.Shared) {
+		PauseTiming();
+		TeardownFixture(fixture);
+		ResumeTiming();
+	}
+}
+
+bool Benchmarker::SetupFixture(const string& name, const BenchmarkFixture& fixture)
+{
+	if (fixture.Shared && _sharedFixtures.Contains(name))
+		return true;
+	try {
+		if (fixture.Setup)
+			fixture.Setup();
+	}
+	catch(exception& e)
+	{
+		Record(TrialResult(TrialResult::Error, name, 0, typeid(e).name(), e.what()));
+		return false;
+	}
+	if (fixture.Shared)
+		_sharedFixtures[name] = fixture.Teardown;
+	return true;
+}
+
+void Benchmarker::TeardownFixture(const BenchmarkFixture& fixture)
+{
+	if (fixture.Teardown)
+		fixture.Teardown();
+}
+
+void Benchmarker::TeardownSharedFixtures()
+{
+	map<string, FastDelegate0<> >::iterator it = _sharedFixtures.begin();
+	for (; it != _sharedFixtures.end(); ++it)
+		if (it->second)
+			it->second();
+	_sharedFixtures.clear();
+}
+
+void Benchmarker::PauseTiming()
+{
+	if (_pauseDepth++ == 0) {
+		if (MeasureResourceUsage)
+			_pauseStartUsage = ResourceUsage::Now();
+		_pauseTimer.Reset();
+	}
+}
+
+void Benchmarker::ResumeTiming()
+{
+	assert(_pauseDepth > 0);
+	if (--_pauseDepth == 0) {
+		_pausedMillisec += _pauseTimer.Millisec();
+		if (MeasureResourceUsage)
+			_pausedUsage += ResourceUsage::Now() - _pauseStartUsage;
+	}
+}
+
+int Benchmarker::PausedMillisec() const
+{
+	return _pausedMillisec + (_pauseDepth > 0 ? _pauseTimer.Millisec() : 0);
+}
+
+ResourceUsage Benchmarker::PausedUsage() const
+{
+	if (_pauseDepth > 0 && MeasureResourceUsage)
+		return _pausedUsage + (ResourceUsage::Now() - _pauseStartUsage);
+	return _pausedUsage;
+}
+
 double Benchmarker::Measure(FastDelegate0<string> code, OUT string& message)
 {
+	ResourceUsage unused;
+	return Measure(code, OUT message, OUT unused);
+}
+
+double Benchmarker::Measure(FastDelegate0<string> code, OUT string& message, OUT ResourceUsage& usage)
+{
+	// Sample the counters outside the timed region
+	usage.Clear();
+	ResourceUsage before, pausedUsageBefore;
+	if (MeasureResourceUsage) {
+		pausedUsageBefore = PausedUsage();
+		before = ResourceUsage::Now();
+	}
+
+	int pausedBefore = PausedMillisec();
 	SimpleTimer timer;
 	message = code();
-	double time = timer.Millisec() / 1000.0;
+	int elapsed = timer.Millisec() - (PausedMillisec() - pausedBefore);
+	double time = elapsed / 1000.0;
+	if (MeasureResourceUsage) {
+		// Leave out the untimed setup between PauseTiming and ResumeTiming
+		usage = ResourceUsage::Now() - before;
+		usage -= PausedUsage() - pausedUsageBefore;
+	}
 	
 	if (message.size() > 2 && message[0] == 'o' && message[1] == ':')
 	{
@@ -97,9 +225,109 @@ void Benchmarker::Tally(const string& name, double seconds, const string& userDa
 	// For once, this is easier in C++ than C#
 	_results[name].Add(seconds, userData);
 }
+void Benchmarker::Tally(const string& name, double seconds, const string& userData, const ResourceUsage& usage, const LatencySummary& latency)
+{
+	_results[name].Add(seconds, userData, usage, latency);
+}
+
+void Benchmarker::Record(const TrialResult& result)
+{
+	if (_reporterThread == NULL)
+		Report(result);
+	else
+		while (!_resultQueue.TryPush(result))
+			Sleep(ReporterPollMillisec); // the reporter has fallen far behind
+}
+
+void Benchmarker::Report(const TrialResult& result)
+{
+	switch (result.Kind) {
+	case TrialResult::Timing:
+		Tally(result.Name, result.Seconds, result.UserData, result.Usage, result.Latency);
+		break;
+	case TrialResult::Error:
+		++_errors.GetOrAdd(result.ErrorMessage, 0);
+		TallyError(result.Name, result.UserData);
+		break;
+	case TrialResult::EndOfTrial:
+		_trialsCompleted++;
+		if (Metrics != NULL)
+			Metrics->Publish(_results, _errors, _trialsCompleted);
+		if (_postprocess)
+			_postprocess();
+		break;
+	case TrialResult::EndOfRun:
+		break; // ReporterThread stops when it sees this
+	}
+}
+
+void Benchmarker::StartReporter(FastDelegate0<> postprocess)
+{
+	assert(_reporterThread == NULL);
+	_postprocess = postprocess;
+	// If the thread cannot be created, Record() simply reports synchronously.
+	_reporterThread = CreateThread(NULL, 0, &ReporterThread, this, 0, NULL);
+	if (_reporterThread != NULL)
+		SetThreadPriority(_reporterThread, THREAD_PRIORITY_LOWEST);
+}
+
+void Benchmarker::StopReporter()
+{
+	if (_reporterThread != NULL) {
+		Record(TrialResult(TrialResult::EndOfRun));
+		WaitForSingleObject(_reporterThread, INFINITE);
+		CloseHandle(_reporterThread);
+		_reporterThread = NULL;
+	}
+	_postprocess.clear();
+}
+
+DWORD WINAPI Benchmarker::ReporterThread(LPVOID param)
+{
+	Benchmarker* self = (Benchmarker*)param;
+	TrialResult result;
+	for (;;) {
+		if (!self->_resultQueue.TryPop(result))
+			Sleep(ReporterPollMillisec);
+		else if (result.Kind == TrialResult::EndOfRun)
+			return 0;
+		else
+			self->Report(result);
+	}
+}
 
 void Benchmarker::RunAllBenchmarks(const vector<BenchmarkInfo> &methods, bool randomOrder, FastDelegate0<> postprocess)
 {
+	Clear();
+
+	// Report saved results for benchmarks that have not changed
+	BenchmarkHistory history;
+	vector<uint32> fingerprints(methods.size());
+	vector<bool> cached(methods.size());
+	if (!HistoryFile.empty()) {
+		history.Load(HistoryFile);
+		for (int i = 0; i < (int)methods.size(); i++)
+		{
+			int trials = methods[i].NumTrials < 0 ? DefaultNumTrials : methods[i].NumTrials;
+			fingerprints[i] = BenchmarkHistory::Fingerprint(methods[i], trials, BuildFlags);
+			BenchmarkHistory::Rows rows;
+			if (history.TryGet(methods[i].Name, fingerprints[i], OUT rows)) {
+				cached[i] = true;
+				for (int r = 0; r < (int)rows.size(); r++) {
+					rows[r].second.UserData.insert(CachedResult);
+					_results[rows[r].first] = rows[r].second;
+				}
+			}
+		}
+		if (find(cached.begin(), cached.end(), true) != cached.end()) {
+			// show the cached results right away
+			if (Metrics != NULL)
+				Metrics->Publish(_results, _errors, _trialsCompleted);
+			if (postprocess)
+				postprocess();
+		}
+	}
+
 	// Prepare the coallated order to do them in
 	vector<BenchmarkInfo> order;
 	bool done = false;
@@ -108,7 +336,7 @@ void Benchmarker::RunAllBenchmarks(const vector<BenchmarkInfo> &methods, bool ra
 		for (int i = 0; i < (int)methods.size(); i++)
 		{
 			int trials = methods[i].NumTrials < 0 ? DefaultNumTrials : methods[i].NumTrials;
-			if (j < trials) {
+			if (j < trials && !cached[i]) {
 				order.push_back(methods[i]);
 				done = false;
 			}
@@ -124,14 +352,39 @@ void Benchmarker::RunAllBenchmarks(const vector<BenchmarkInfo> &methods, bool ra
 		}
 	}
 
-	Clear();
-
 	// Finally, do the benchmarks
+	StartReporter(postprocess);
 	for (int i = 0; i < (int)order.size(); i++)
 	{
-		MeasureAndRecord(order[i].Name, order[i].Method);
-		postprocess();
+		MeasureAndRecord(order[i].Name, order[i].Method, order[i].Fixture);
+		Record(TrialResult(TrialResult::EndOfTrial));
 	}
+	StopReporter();
+	TeardownSharedFixtures();
+
+	if (!HistoryFile.empty()) {
+		for (int i = 0; i < (int)methods.size(); i++)
+			if (!cached[i])
+				SaveToHistory(history, methods[i].Name, fingerprints[i]);
+		history.Save(HistoryFile);
+	}
+}
+
+void Benchmarker::SaveToHistory(BenchmarkHistory& history, const string& name, uint32 fingerprint)
+{
+	// Collect the benchmark's own row and the rows of its sub-benchmarks
+	BenchmarkHistory::Rows rows;
+	string prefix = name + ": ";
+	ResultMap::const_iterator it;
+	for (it = _results.begin(); it != _results.end(); ++it)
+		if (it->first == name || it->first.compare(0, prefix.size(), prefix) == 0) {
+			if (it->second.Errors > 0) {
+				history.Remove(name); // re-run it next time
+				return;
+			}
+			rows.push_back(*it);
+		}
+	history.Set(name, fingerprint, rows);
 }
 
 void Benchmarker::RunAllBenchmarksInConsole(const vector<BenchmarkInfo> &methods, bool randomOrder)
@@ -152,8 +405,10 @@ void Benchmarker::RabicHelper()
 
 void Benchmarker::Clear()
 {
+	TeardownSharedFixtures();
 	_errors.clear();
 	_results.clear();
+	_trialsCompleted = 0;
 }
 
 void Benchmarker::PrintResults(FILE* writer, const string& separator, bool addPadding)
@@ -181,21 +436,24 @@ void Benchmarker::PrintResults(FILE* writer, const string& separator, bool addPa
 	// Print errors
 	if (_errors.size() > 0) {
 		printf("Errors occurred:");
-		map<string,int>::iterator it = _errors.begin();
+		ErrorMap::const_iterator it = _errors.begin();
 		for (; it != _errors.end(); ++it)
-			printf("%s x%d", it->first, it->second);
+			printf("%s x%d", it->first.c_str(), it->second);
 	}
 }
 
-void Benchmarker::PrintResults(FILE* writer, const EasyMap<string, BenchmarkStatistic>& results, const string& separator, 
+void Benchmarker::PrintResults(FILE* writer, const ResultMap& results, const string& separator, 
 	bool addPadding, FastDelegate1<vector<string>&, string> userDataFormatter, const string& userDataColumnName)
 {
-	map<string, BenchmarkStatistic>::const_iterator it;
+	ResultMap::const_iterator it;
 	int maxCount = 0;
-	bool haveUserData = false;
+	bool haveUserData = false, haveLatency = false;
+	ResourceUsage totalUsage;
 	for (it = results.begin(); it != results.end(); ++it) {
 		maxCount = max(maxCount, it->second.Count);
 		haveUserData |= it->second.UserData.size() != 0;
+		haveLatency |= it->second.Latency.Samples != 0;
+		totalUsage += it->second.Usage;
 	}
 			
 	// Prepare a list of columns
@@ -210,6 +468,22 @@ void Benchmarker::PrintResults(FILE* writer, const EasyMap<string, BenchmarkStat
 		columns.push_back(ColInfo("Min", GetColumn(&PrMin)));
 		columns.push_back(ColInfo("Std.Dev", GetColumn(&PrStdDev)));
 	}
+	// Resource usage columns appear only for counters that were measured
+	if (totalUsage.UserSec != 0)
+		columns.push_back(ColInfo("User s", GetColumn(&PrUserSec)));
+	if (totalUsage.SystemSec != 0)
+		columns.push_back(ColInfo("Sys s", GetColumn(&PrSysSec)));
+	if (totalUsage.CpuCycles != 0)
+		columns.push_back(ColInfo("Mcycles", GetColumn(&PrMcycles)));
+	// Page faults of the whole process, not just the benchmark thread
+	if (totalUsage.ProcessPageFaults != 0)
+		columns.push_back(ColInfo("ProcFlt", GetColumn(&PrProcFlt)));
+	// Per-operation latency, in microseconds (see Sampler)
+	if (haveLatency) {
+		columns.push_back(ColInfo("p50 us", GetColumn(&PrP50)));
+		columns.push_back(ColInfo("p99 us", GetColumn(&PrP99)));
+		columns.push_back(ColInfo("Max us", GetColumn(&PrMaxLat)));
+	}
 	if (haveUserData) {
 		GetColumn gc(this, &Benchmarker::PrUserData);
 		columns.push_back(ColInfo(userDataColumnName, gc));
@@ -228,12 +502,10 @@ void Benchmarker::PrintResults(FILE* writer, const EasyMap<string, BenchmarkStat
 			columns[i].Width = max;
 		}
 
-	// Now sort (case insensitively) and print the results
+	// Now print the results, which are already sorted case-insensitively
 	PrintRow(writer, columns, separator, NULL, NULL, GetColumn2(&PrColName));
-	vector< pair<string, BenchmarkStatistic> > results2(results.begin(), results.end());
-	sort(results2.begin(), results2.end(), &IsKeyLessCaseInsensitive<BenchmarkStatistic>);
-	for (size_t i = 0; i < results2.size(); i++)
-		PrintRow(writer, columns, separator, &results2[i].first, &results2[i].second, GetColumn2(&PrColGetter));
+	for (it = results.begin(); it != results.end(); ++it)
+		PrintRow(writer, columns, separator, &it->first, &it->second, GetColumn2(&PrColGetter));
 }
 
 string Benchmarker::PrUserData(const string&, const BenchmarkStatistic& s)
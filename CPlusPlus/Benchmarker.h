@@ -5,21 +5,57 @@
 #include <vector>
 #include <string>
 #include "EasyMap.h"
+#include "flat_map.h"
 #include "FastDelegate.h"
 #include "Misc.h"
+#include "spsc_queue.h"
+#include "ResourceUsage.h"
+#include "LatencySampler.h"
 using namespace fastdelegate;
 
+class BenchmarkHistory;
+class MetricsExporter;
+
 class BenchmarkStatistic : public Statistic {
 public:
 	int Errors; // Number of trials that ended in an exception
 	double First;
 	double Last;
 	std::set<std::string> UserData;
+	ResourceUsage Usage; // Total over all trials (if Benchmarker::MeasureResourceUsage)
+	LatencySummary Latency; // Of the operations sampled by Benchmarker::Sampler, if any
 	
 	BenchmarkStatistic();
 	void Clear();
 	void Add(double nextValue) { Add(nextValue, NULL); }
 	void Add(double nextValue, const std::string& userDatum);
+	void Add(double nextValue, const std::string& userDatum, const ResourceUsage& usage, const LatencySummary& latency)
+	{
+		Add(nextValue, userDatum);
+		Usage += usage;
+		Latency += latency;
+	}
+	// Average resource usage per successful trial (failed trials add no usage)
+	double AvgUsage(double ResourceUsage::*field) const { return Count ? Usage.*field / Count : 0; }
+	double AvgUsage(int64 ResourceUsage::*field) const { return Count ? (double)(Usage.*field) / Count : 0; }
+};
+
+/// <summary>Code that prepares data for a benchmark and cleans it up again,
+/// outside the timed region.</summary>
+/// <remarks>Setup runs just before the benchmark is measured and Teardown runs
+/// just after. If Shared is true, Setup runs only before the first trial and
+/// Teardown runs when RunAllBenchmarks finishes (or Clear() is called), so the
+/// same data is reused by every trial. Only share a fixture if the benchmark
+/// does not modify the data that Setup produced. Either delegate may be empty.
+/// </remarks>
+struct BenchmarkFixture
+{
+	BenchmarkFixture() : Shared(false) { }
+	BenchmarkFixture(FastDelegate0<> setup, FastDelegate0<> teardown = FastDelegate0<>(), bool shared = false)
+		: Setup(setup), Teardown(teardown), Shared(shared) { }
+	FastDelegate0<> Setup;
+	FastDelegate0<> Teardown;
+	bool Shared;
 };
 
 struct BenchmarkInfo
@@ -27,9 +63,17 @@ struct BenchmarkInfo
 	BenchmarkInfo() : NumTrials(-1) { } // -1 for default # of trials
 	BenchmarkInfo(const std::string& name, FastDelegate0<std::string> method, int numTrials = -1)
 		: Name(name), Method(method), NumTrials(numTrials) { }
+	BenchmarkInfo(const std::string& name, FastDelegate0<std::string> method, const BenchmarkFixture& fixture, int numTrials = -1)
+		: Name(name), Method(method), Fixture(fixture), NumTrials(numTrials) { }
 	std::string Name;
 	FastDelegate0<std::string> Method;
+	BenchmarkFixture Fixture;
 	int NumTrials;
+	// When Benchmarker::HistoryFile is in use, the saved results of the
+	// benchmark are reused until this tag changes; change it whenever the
+	// benchmark or anything it calls changes. If empty, the results are
+	// reused only until the executable changes.
+	std::string Version;
 };
 
 /// <summary>
@@ -71,6 +115,12 @@ struct BenchmarkInfo
 /// userDataFormatter parameter. The <see cref="UserDataColumnName"/> attribute 
 /// controls the name of this final column. The final column will not be shown 
 /// if none of the benchmarks returned any (non-null) data.
+/// <para/>
+/// While RunAllBenchmarks is running, the benchmark thread does not tally
+/// results, print them or call the postprocess method itself. Each result is
+/// pushed into a lock-free queue that a low-priority reporter thread drains,
+/// so that formatting and console I/O do not disturb the caches and branch
+/// predictor right before the next timed region.
 /// </remarks>
 class Benchmarker {
 public:
@@ -85,13 +135,84 @@ public:
 	/// column, which is given this column heading.</summary>
 	std::string UserDataColumnName;
 
+	/// <summary>If true, the CPU time, CPU cycles and page faults of 
+	/// each trial are measured (see <see cref="ResourceUsage"/>), and 
+	/// PrintResults() adds a column with the average per trial for each 
+	/// counter that is nonzero for some benchmark.</summary>
+	bool MeasureResourceUsage;
+
+	/// <summary>If not empty, RunAllBenchmarks keeps the results of each
+	/// benchmark in this file (see <see cref="BenchmarkHistory"/>) and, instead
+	/// of re-running a benchmark whose fingerprint has not changed since its
+	/// results were saved, it reports the saved results with the user datum
+	/// <see cref="CachedResult"/>.</summary>
+	std::string HistoryFile;
+	/// <summary>Part of the fingerprint of every benchmark. Defaults to a
+	/// description of the compiler and build configuration; append anything
+	/// else that affects the results (e.g. the number of iterations).</summary>
+	std::string BuildFlags;
+
+	/// <summary>If not NULL, RunAllBenchmarks publishes the results to this
+	/// exporter after every trial (from the reporter thread).</summary>
+	MetricsExporter* Metrics;
+
+	/// <summary>Times individual operations that benchmarks wrap in a
+	/// LatencySample (see <see cref="LatencySampler"/>). MeasureAndRecord
+	/// collects the samples taken while each benchmark runs, and PrintResults()
+	/// adds p50, p99 and max latency columns if any benchmark was sampled.
+	/// Sampling is off until Sampler.SetPeriod() is called.</summary>
+	LatencySampler Sampler;
+
+	// Results by benchmark name, in the order in which they are printed
+	typedef flat_map<std::string, BenchmarkStatistic, case_insensitive_less> ResultMap;
+	// Number of times each error message occurred
+	typedef flat_map<std::string, int> ErrorMap;
+
 	static const std::string DiscardResult;
+	static const std::string CachedResult;
 	static std::string SubtractOverhead(int millisec) { return printstring("o:%d", millisec); }
 
 protected:
 	std::string _activeBenchmark;
-	EasyMap<std::string, BenchmarkStatistic> _results;
-	EasyMap<std::string, int> _errors;
+	ResultMap _results;
+	ErrorMap _errors;
+	// Teardown delegates of shared fixtures that have been set up, by benchmark name
+	EasyMap<std::string, FastDelegate0<> > _sharedFixtures;
+
+	// State used by PauseTiming() and ResumeTiming(). _pausedMillisec is the
+	// total time spent paused since the Benchmarker was created; Measure()
+	// subtracts the portion that elapsed during its own measurement. The
+	// same goes for _pausedUsage if MeasureResourceUsage is set.
+	int _pauseDepth;
+	int _pausedMillisec;
+	SimpleTimer _pauseTimer;
+	ResourceUsage _pausedUsage;
+	ResourceUsage _pauseStartUsage;
+
+	// A trial result, or another event, sent from the benchmark thread to the
+	// reporter thread. For errors, UserData is the exception type.
+	struct TrialResult
+	{
+		enum EventKind { Timing, Error, EndOfTrial, EndOfRun };
+		TrialResult() : Kind(Timing), Seconds(0) { }
+		TrialResult(EventKind kind, const std::string& name = std::string(), double seconds = 0, 
+		            const std::string& userData = std::string(), const std::string& errorMessage = std::string())
+			: Kind(kind), Name(name), Seconds(seconds), UserData(userData), ErrorMessage(errorMessage) { }
+		EventKind Kind;
+		std::string Name;
+		double Seconds;
+		std::string UserData;
+		std::string ErrorMessage;
+		ResourceUsage Usage;
+		LatencySummary Latency;
+	};
+	// Results travel through _resultQueue while _reporterThread is running;
+	// otherwise Record() reports them immediately on the calling thread.
+	spsc_queue<TrialResult, 256> _resultQueue;
+	HANDLE _reporterThread;
+	FastDelegate0<> _postprocess;
+	int _trialsCompleted;
+	enum { ReporterPollMillisec = 10 };
 
 	// Stuff used within PrintResults()
 	struct ColInfo;
@@ -107,7 +228,7 @@ protected:
 	};
 
 public:
-	const EasyMap<std::string, BenchmarkStatistic>& Results() const { return _results; }
+	const ResultMap& Results() const { return _results; }
 
 	/// <summary>
 	/// Measures and records the time required for a given piece of code to run.
@@ -121,13 +242,50 @@ public:
 	/// outer benchmark's time will include time used by the sub-benchmark.</remarks>
 	void MeasureAndRecord(std::string name, FastDelegate0<std::string> code);
 
+	/// <summary>
+	/// Measures and records the time required for a given piece of code to run,
+	/// excluding the time required to set up and tear down its fixture.
+	/// </summary>
+	/// <remarks>If the fixture is shared, it is set up the first time this
+	/// benchmark runs and torn down by TeardownSharedFixtures().</remarks>
+	void MeasureAndRecord(std::string name, FastDelegate0<std::string> code, const BenchmarkFixture& fixture);
+
 	/// <summary>Runs a piece of code and returns the number of seconds it required.</summary>
 	/// <remarks>Garbage-collects before the test if DoGC is true.</remarks>
 	double Measure(FastDelegate0<std::string> code, OUT std::string& message);
+	/// <summary>Runs a piece of code and returns the number of seconds it
+	/// required. Also measures its resource usage if MeasureResourceUsage 
+	/// is true (otherwise, usage is cleared).</summary>
+	double Measure(FastDelegate0<std::string> code, OUT std::string& message, OUT ResourceUsage& usage);
+
+	/// <summary>Stops the clock for all benchmarks that are currently being
+	/// measured, so that code which is not part of the kernel under test (e.g.
+	/// generating input data) can run without being counted.</summary>
+	/// <remarks>Calls may be nested; timing resumes when every PauseTiming()
+	/// has been matched by a call to ResumeTiming(). The timer has the same
+	/// resolution as SimpleTimer, so pausing inside a tight loop would add more
+	/// error than it removes; pause around coarse-grained phases instead.</remarks>
+	void PauseTiming();
+	/// <summary>Restarts the clock after a call to PauseTiming().</summary>
+	void ResumeTiming();
+
+	/// <summary>Runs the Teardown of every shared fixture that has been set up.</summary>
+	void TeardownSharedFixtures();
 
 protected:
 	void TallyError(const std::string& name, const std::string& excType);
 	void Tally(const std::string& name, double seconds, const std::string& userData);
+	void Tally(const std::string& name, double seconds, const std::string& userData, const ResourceUsage& usage, const LatencySummary& latency);
+	void Record(const TrialResult& result);
+	void Report(const TrialResult& result);
+	void StartReporter(FastDelegate0<> postprocess);
+	void SaveToHistory(BenchmarkHistory& history, const std::string& name, uint32 fingerprint);
+	void StopReporter();
+	static DWORD WINAPI ReporterThread(LPVOID self);
+	bool SetupFixture(const std::string& name, const BenchmarkFixture& fixture);
+	void TeardownFixture(const BenchmarkFixture& fixture);
+	int PausedMillisec() const;
+	ResourceUsage PausedUsage() const;
 
 public:
 	/// <summary>
@@ -139,8 +297,13 @@ public:
 	/// is randomized, different trials are even mixed together. If false, the
 	/// methods are run in order, collated, sorted by method name.</param>
 	/// <param name="postprocess">A method to run after each trial, if desired, 
-	/// or null.</param>
-	/// <remarks>Existing results are clear()ed before running the benchmarks.</remarks>
+	/// or null. It runs on the reporter thread, after the trial's results have
+	/// been tallied.</param>
+	/// <remarks>Existing results are clear()ed before running the benchmarks.
+	/// Each benchmark's fixture (if any) is set up and torn down around every
+	/// trial, outside the timed region. If HistoryFile is set, unchanged 
+	/// benchmarks are not run; their previous results are reported instead.
+	/// Results of benchmarks in which an error occurred are not saved.</remarks>
 	void RunAllBenchmarks(const std::vector<BenchmarkInfo> &methods, bool randomOrder, FastDelegate0<> postprocess);
 
 	/// <summary>Runs all public benchmark methods (static and nonstatic) in the
@@ -186,7 +349,7 @@ public:
 	/// user-defined data to a std::string, or null for the default behavior, which
 	/// converts the data to strings and concatenates them.</param>
 	/// <param name="userDataColumnName">Name of user-defined data column.</param>
-	void PrintResults(FILE* writer, const EasyMap<std::string, BenchmarkStatistic>& results, const std::string& separator, 
+	void PrintResults(FILE* writer, const ResultMap& results, const std::string& separator, 
 		bool addPadding, FastDelegate1<std::vector<std::string>&, std::string> userDataFormatter, const std::string& userDataColumnName);
 
 private:
@@ -198,6 +361,13 @@ private:
 	static std::string PrMax     (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.3f", s.Max); }
 	static std::string PrMin     (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.3f", s.Min); }
 	static std::string PrStdDev  (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.3f", s.StdDeviation()); }
+	static std::string PrUserSec (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.3f", s.AvgUsage(&ResourceUsage::UserSec)); }
+	static std::string PrSysSec  (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.3f", s.AvgUsage(&ResourceUsage::SystemSec)); }
+	static std::string PrMcycles (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.1f", s.AvgUsage(&ResourceUsage::CpuCycles) / 1e6); }
+	static std::string PrProcFlt (const std::string&, const BenchmarkStatistic& s) { return printstring("%0.0f", s.AvgUsage(&ResourceUsage::ProcessPageFaults)); }
+	static std::string PrP50     (const std::string&, const BenchmarkStatistic& s) { return s.Latency.Samples ? printstring("%0.3f", s.Latency.P50) : std::string(); }
+	static std::string PrP99     (const std::string&, const BenchmarkStatistic& s) { return s.Latency.Samples ? printstring("%0.3f", s.Latency.P99) : std::string(); }
+	static std::string PrMaxLat  (const std::string&, const BenchmarkStatistic& s) { return s.Latency.Samples ? printstring("%0.1f", s.Latency.Max) : std::string(); }
 
 	// Helper functions for PrintResults() that take additional information
 	FastDelegate1<std::vector<std::string>&, std::string> _userDataFormatter;
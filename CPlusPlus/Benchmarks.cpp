@@ -1,8 +1,10 @@
 #include "stdafx.h"
 #include "Benchmarker.h"
+#include "MetricsExporter.h"
 #include <time.h>
 #include <fstream>
 #include <algorithm>
+#include <stdexcept>
 #include "FixedPoint.h"
 #include "Paths.h"
 using namespace std;
@@ -31,6 +33,96 @@ const int MapSizeLimit = Iterations / 4; // CE has per-process heap size limit,
 const int MapSizeLimit = Iterations / 2; // Desktop can do more, but 50% misses is still a reasonable test
 #endif
 
+// Define INCREMENTAL_BENCHMARKS to skip the benchmarks whose results were
+// saved in BenchmarkHistory.txt by an earlier run and have not changed since
+// (see BenchmarkHistory). By default a benchmark counts as changed whenever
+// the executable changes, which is always safe. A benchmark listed in
+// BenchmarkVersions opts out of that: it counts as changed only when its tag
+// changes, so bump the tag whenever you change the benchmark or a container
+// or header it uses. Tag only benchmarks that are slow and rarely change.
+#ifdef INCREMENTAL_BENCHMARKS
+const char* const BenchmarkVersions[][2] = {
+	{ "String hash quality", "1" },
+};
+#endif
+
+// Define NO_BENCHMARK_WORKLOADS to leave out the workload suites, whose
+// traces and string keys take about 180 MB.
+#ifndef NO_BENCHMARK_WORKLOADS
+#define BENCHMARK_WORKLOADS
+#endif
+#ifdef BENCHMARK_WORKLOADS
+// Pre-generated operation traces (see Workload.h) that the "workload" suites
+// of hashtable_inc.cxx replay against every hashtable, so that all of them
+// run exactly the same reads, writes and deletes on the same keys.
+#include "Workload.h"
+namespace Workloads
+{
+	enum { YcsbA, YcsbB, YcsbC, YcsbD, YcsbE, YcsbF, Hotspot, ShiftingHotspot, Churn, Count };
+	const int RecordCount = MapSizeLimit / 4;
+	const int OperationCount = Iterations / 4;
+
+	WorkloadTrace _traces[Count];
+	vector<string> _stringKeys; // _stringKeys[i] is the string key of key index i
+
+	WorkloadSpec Spec(int workload)
+	{
+		if (workload <= YcsbF)
+			return WorkloadSpec::Ycsb((char)('A' + workload), RecordCount, OperationCount);
+
+		WorkloadSpec spec;
+		spec.RecordCount = RecordCount;
+		spec.OperationCount = OperationCount;
+		spec.ReadFraction = 0.8;
+		spec.UpdateFraction = 0.2;
+		if (workload == Churn) {
+			// Keys come and go, so about a sixth of the reads miss
+			spec.Name = "Churn";
+			spec.ReadFraction = 0.5;
+			spec.UpdateFraction = 0;
+			spec.InsertFraction = 0.25;
+			spec.DeleteFraction = 0.25;
+		} else if (workload == ShiftingHotspot) {
+			spec.Name = "Shifting hotspot";
+			spec.Distribution = ShiftingHotspotKeys;
+			spec.HotKeyFraction = 0.01;
+			spec.HotOpFraction = 0.9;
+			spec.ShiftPeriod = OperationCount / 20;
+		} else {
+			spec.Name = "Hotspot";
+			spec.Distribution = HotspotKeys;
+		}
+		return spec;
+	}
+
+	// Shared fixture of every workload suite: generates the traces and the
+	// string keys of every key index that any trace uses, once per run. The
+	// string keys vary in length from 6 to 40 characters, most of them short.
+	void Generate()
+	{
+		if (!_traces[0].Ops().empty())
+			return;
+		int keyCount = 0;
+		for (int w = 0; w < Count; w++) {
+			_traces[w].Generate(Spec(w));
+			keyCount = max(keyCount, _traces[w].KeyCount());
+		}
+		WorkloadSpec keySpec;
+		keySpec.KeyLengths = ZipfianLength;
+		keySpec.MinKeyLength = WorkloadTrace::KeyIdLength;
+		keySpec.MaxKeyLength = 40;
+		WorkloadTrace::StringKeys(keySpec, keyCount, _stringKeys);
+	}
+	void Free()
+	{
+		for (int w = 0; w < Count; w++)
+			_traces[w].Clear();
+		vector<string>().swap(_stringKeys);
+	}
+	BenchmarkFixture Fixture() { return BenchmarkFixture(&Generate, &Free, true); }
+}
+#endif
+
 // Standard hashtable test
 #define HASHTABLE_NAMESPACE HashtableTest
 // http://stackoverflow.com/questions/724465/how-to-check-for-tr1-while-compiling
@@ -51,7 +143,1015 @@ const int MapSizeLimit = Iterations / 2; // Desktop can do more, but 50% misses
 #undef HASHTABLE
 #define HASHTABLE_NAMESPACE CustomHashtableTest
 #define HASHTABLE hash_map
+#define HASHTABLE_LOOKUP_KEYS
+#define HASHTABLE_BATCH_LOOKUP
+#define HASHTABLE_INSERT_LATENCY
+#define HASHTABLE_COMPACT
+#define HASHTABLE_STATS
+#define HASHTABLE_MISS_FILTER
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_LOOKUP_KEYS
+#undef HASHTABLE_BATCH_LOOKUP
+#undef HASHTABLE_INSERT_LATENCY
+#undef HASHTABLE_COMPACT
+#undef HASHTABLE_MISS_FILTER
+
+// hash_map with other bucket policies (int keys only). C++03 has no template
+// aliases, so each policy gets a derived class.
+#define HASHTABLE_INT_ONLY
+template<class K, class V> class fibonacci_hash_map : public hash_map<K, V, hash_traits<K>, fibonacci_bucket_policy> {};
+template<class K, class V> class murmur_hash_map    : public hash_map<K, V, hash_traits<K>, murmur_bucket_policy> {};
+template<class K, class V> class fastrange_hash_map : public hash_map<K, V, hash_traits<K>, fastrange_bucket_policy> {};
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE FibonacciHashtableTest
+#define HASHTABLE fibonacci_hash_map
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE MurmurHashtableTest
+#define HASHTABLE murmur_hash_map
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE FastrangeHashtableTest
+#define HASHTABLE fastrange_hash_map
+#include "hashtable_inc.cxx"
+
+// hash_map with incremental resizing (int keys only), with insert latency
+template<class K, class V> class incremental_hash_map : public hash_map<K, V>
+	{ public: incremental_hash_map() { this->SetIncrementalResize(true); } };
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE IncrementalHashtableTest
+#define HASHTABLE incremental_hash_map
+#define HASHTABLE_INSERT_LATENCY
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_INT_ONLY
+#undef HASHTABLE_INSERT_LATENCY
+#undef HASHTABLE_STATS
+
+// Open-addressing flat_hash_map test
+#include "flat_hash_map.h"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE FlatHashtableTest
+#define HASHTABLE flat_hash_map
+#include "hashtable_inc.cxx"
+
+// compact_hash_map test (16-bit links, move-to-front)
+#include "compact_hash_map.h"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE CompactHashtableTest
+#define HASHTABLE compact_hash_map
+#include "hashtable_inc.cxx"
+
+// Bucketized cuckoo hash map test (int keys only)
+#include "cuckoo_hash_map.h"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE CuckooHashtableTest
+#define HASHTABLE cuckoo_hash_map
+#define HASHTABLE_INT_ONLY
+#define HASHTABLE_STATS
 #include "hashtable_inc.cxx"
+#undef HASHTABLE_INT_ONLY
+#undef HASHTABLE_STATS
+
+// hash_map with the seeded string hashes of string_hash.h (string keys only)
+#include "string_hash.h"
+#define HASHTABLE_STRING_ONLY
+#define HASHTABLE_STATS
+template<class K, class V> class wyhash_hash_map : public hash_map<K, V, seeded_string_hash_traits<char, wy_hasher> > {};
+template<class K, class V> class aeshash_hash_map : public hash_map<K, V, seeded_string_hash_traits<char, aes_hasher> > {};
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE WyhashHashtableTest
+#define HASHTABLE wyhash_hash_map
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_NAMESPACE
+#undef HASHTABLE
+#define HASHTABLE_NAMESPACE AeshashHashtableTest
+#define HASHTABLE aeshash_hash_map
+#include "hashtable_inc.cxx"
+#undef HASHTABLE_STRING_ONLY
+#undef HASHTABLE_STATS
+
+// String hashtable test with interned strings (see string_pool.h): each key
+// and value is copied once into the pool's arena, the table holds two handles
+// per entry, and clearing frees the arena in a few large blocks. It uses the
+// keys generated for the String custom HT suite.
+#include "string_pool.h"
+namespace StringInternedHashtableTest
+{
+	typedef pooled_string<char> pstring;
+	using StringCustomHashtableTest::_keys;
+	string_pool<char> _pool;
+	hash_map<pstring, pstring> _dict;
+
+	string TestAddSet()
+	{
+		hash_map<pstring, pstring>& dict = _dict;
+		for (int i = 0; i < Iterations; i++) {
+			if ((int)dict.size() >= MapSizeLimit) {
+				dict.clear();
+				_pool.Clear();
+			}
+			pstring s = _pool.Intern(_keys[i]);
+			dict[s] = s;
+		}
+		return string();
+	}
+	string TestPoolSize()
+	{
+		return printstring("%d strings, %d KB arena", _pool.Count(), (int)(_pool.ArenaBytes() / 1024));
+	}
+	string TestStats()
+	{
+		return _dict.stats().ToString();
+	}
+	// Looks up std::strings without interning them (heterogeneous lookup)
+	string TestQueries()
+	{
+		hash_map<pstring, pstring>& dict = _dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			hash_map<pstring, pstring>::iterator it = dict.find(_keys[i]);
+			if (it == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	string TestRemoval()
+	{
+		hash_map<pstring, pstring>& dict = _dict;
+		int removed = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.Remove(_keys[i]))
+				removed++;
+		return printstring("%d removed", removed);
+	}
+	string TestClearing()
+	{
+		_b.PauseTiming();
+		hash_map<pstring, pstring>& dict = _dict;
+		for (int i = 0; i < MapSizeLimit; i++) {
+			pstring s = _pool.Intern(_keys[i]);
+			dict[s] = s;
+		}
+		_b.ResumeTiming();
+		dict.clear();
+		_pool.Clear();
+		return string();
+	}
+	string Tests()
+	{
+		_dict.clear();
+		_pool.Clear();
+		_b.MeasureAndRecord("1 Adding/setting", TestAddSet);
+		_b.MeasureAndRecord("1 Pool size", TestPoolSize);
+		_b.MeasureAndRecord("1 Table stats", TestStats);
+		_b.MeasureAndRecord("2 Running queries", TestQueries);
+		_b.MeasureAndRecord("3 Removing items", TestRemoval);
+		_b.MeasureAndRecord("4 Clearing", TestClearing);
+		return Benchmarker::DiscardResult;
+	}
+}
+
+// Ordered maps: std::map versus the B+ tree of btree_map.h
+#include <map>
+#include "btree_map.h"
+#define SORTEDMAP_NAMESPACE IntSortedMapTest
+#define SORTEDMAP map
+#include "sortedmap_inc.cxx"
+#undef SORTEDMAP_NAMESPACE
+#undef SORTEDMAP
+#define SORTEDMAP_NAMESPACE IntBtreeMapTest
+#define SORTEDMAP btree_map
+#define SORTEDMAP_BULK_LOAD
+#include "sortedmap_inc.cxx"
+#undef SORTEDMAP_NAMESPACE
+#undef SORTEDMAP
+#undef SORTEDMAP_BULK_LOAD
+
+// Lookups in maps of 8 to a million int keys: flat_map (with a binary search
+// or an Eytzinger index) versus std::map and hash_map, and the cost of
+// building each kind of map.
+#include "flat_map.h"
+
+namespace FlatMapTest
+{
+	typedef flat_map<int, int, std::less<int>, flat_eytzinger_search<int> > eytzinger_flat_map;
+
+	// The i-th key added to a map of size keys. Since size is a power of two,
+	// the keys are 0, 2, 4 ... 2 * (size - 1) in a scrambled order.
+	inline int Key(int i, int size) { return (int)((uint32)i * 2654435761u & (uint32)(size - 1)) * 2; }
+
+	template<class Map> void Fill(Map& dict, int size)
+	{
+		for (int i = 0; i < size; i++)
+			dict[Key(i, size)] = i;
+	}
+	template<class Search> void Fill(flat_map<int, int, std::less<int>, Search>& dict, int size)
+	{
+		for (int i = 0; i < size; i++)
+			dict.Append(Key(i, size), i);
+		dict.Sort();
+	}
+
+	template<class Map, int Size> string TestQueries()
+	{
+		_b.PauseTiming();
+		Map dict;
+		Fill(dict, Size);
+		_b.ResumeTiming();
+
+		// Half of the keys looked up are in the map
+		int hits = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.find((int)((uint32)i * 2654435761u & (uint32)(Size * 2 - 1))) != dict.end())
+				hits++;
+		return printstring("%d%% hits", (int)((int64)hits * 100 / Iterations));
+	}
+	// Builds maps of Size keys, Iterations / 4 keys in all (or one map)
+	template<class Map, int Size> string TestBuilding()
+	{
+		int maps = max(Iterations / 4 / Size, 1);
+		for (int m = 0; m < maps; m++) {
+			Map dict;
+			Fill(dict, Size);
+		}
+		return printstring("%d maps", maps);
+	}
+	// Builds flat_maps by inserting the keys one at a time instead
+	template<int Size> string TestInserting()
+	{
+		int maps = max(Iterations / 4 / Size, 1);
+		for (int m = 0; m < maps; m++) {
+			flat_map<int, int> dict;
+			for (int i = 0; i < Size; i++)
+				dict[Key(i, Size)] = i;
+		}
+		return printstring("%d maps", maps);
+	}
+
+	template<int Size> void TestSize(int step, const char* size)
+	{
+		string prefix = printstring("%d %s pairs, ", step, size);
+		_b.MeasureAndRecord(prefix + "query std::map", TestQueries<map<int, int>, Size>);
+		_b.MeasureAndRecord(prefix + "query hash_map", TestQueries<hash_map<int, int>, Size>);
+		_b.MeasureAndRecord(prefix + "query flat_map", TestQueries<flat_map<int, int>, Size>);
+		_b.MeasureAndRecord(prefix + "query flat_map (Eytzinger)", TestQueries<eytzinger_flat_map, Size>);
+		_b.MeasureAndRecord(prefix + "build std::map", TestBuilding<map<int, int>, Size>);
+		_b.MeasureAndRecord(prefix + "build hash_map", TestBuilding<hash_map<int, int>, Size>);
+		_b.MeasureAndRecord(prefix + "build flat_map (Append, Sort)", TestBuilding<flat_map<int, int>, Size>);
+		// Inserting in random order is quadratic
+		if (Size <= 4096)
+			_b.MeasureAndRecord(prefix + "build flat_map (insert)", TestInserting<Size>);
+	}
+	string Tests()
+	{
+		TestSize<8>(1, "8");
+		TestSize<128>(2, "128");
+		TestSize<4096>(3, "4K");
+		TestSize<1048576>(4, "1M");
+		return Benchmarker::DiscardResult;
+	}
+}
+
+// Memory and lookup time of int to int tables filled as far as they go
+// without growing: hash_map versus cuckoo_hash_map. Both are filled to the
+// last size before they would grow past MapSizeLimit / 2 items, which is
+// when each uses the least memory per item.
+namespace FullTableTest
+{
+	template<class Map> struct Full
+	{
+		static Map Dict;
+		static int Size;
+	};
+	template<class Map> Map Full<Map>::Dict;
+	template<class Map> int Full<Map>::Size;
+
+	inline int Key(int i) { return (int)((uint32)i * 2654435761u); }
+
+	// Finds the number of items that fills a Map the most before it grows
+	// past MapSizeLimit / 2 items
+	template<class Map> int FullSize()
+	{
+		Map dict;
+		int full = 0;
+		unsigned capacity = (unsigned)dict.capacity();
+		for (int i = 0; ; i++) {
+			dict[Key(i)] = i;
+			if ((unsigned)dict.capacity() != capacity) {
+				if (i >= MapSizeLimit / 2 && full > 0)
+					return full;
+				capacity = (unsigned)dict.capacity();
+			}
+			full = i + 1;
+		}
+	}
+
+	template<class Map> string TestFilling()
+	{
+		_b.PauseTiming();
+		Full<Map>::Size = FullSize<Map>();
+		_b.ResumeTiming();
+
+		Map& dict = Full<Map>::Dict;
+		for (int i = 0; i < Full<Map>::Size; i++)
+			dict[Key(i)] = i;
+		return printstring("%d items", Full<Map>::Size);
+	}
+	template<class Map> string TestStats()
+	{
+		return Full<Map>::Dict.stats().ToString();
+	}
+	// Half of the keys looked up are in the map
+	template<class Map> string TestQueries()
+	{
+		Map& dict = Full<Map>::Dict;
+		int hits = 0;
+		uint32 range = (uint32)Full<Map>::Size * 2;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.find(Key((int)((uint32)i * 2654435761u % range))) != dict.end())
+				hits++;
+		return printstring("%d%% hits", (int)((int64)hits * 100 / Iterations));
+	}
+	template<class Map> string TestClearing()
+	{
+		Full<Map>::Dict.clear();
+		return string();
+	}
+
+	template<class Map> void TestMap(int step, const char* name)
+	{
+		string prefix = printstring("%d %s, ", step, name);
+		_b.MeasureAndRecord(prefix + "fill", TestFilling<Map>);
+		_b.MeasureAndRecord(prefix + "stats", TestStats<Map>);
+		_b.MeasureAndRecord(prefix + "query", TestQueries<Map>);
+		_b.MeasureAndRecord(prefix + "clear", TestClearing<Map>);
+	}
+	string Tests()
+	{
+		TestMap<hash_map<int, int> >(1, "hash_map");
+		TestMap<cuckoo_hash_map<int, int> >(2, "cuckoo_hash_map");
+		return Benchmarker::DiscardResult;
+	}
+}
+
+// cuckoo_hash_map with keys that all have the same hash code, which no table
+// size can separate: the first 2 * SlotsPerBucket keys fill their two
+// buckets, the next SlotsPerBucket go in the stash, and one more throws.
+namespace CuckooCollisionTest
+{
+	struct SameHashTraits : public hash_traits<int>
+	{
+		unsigned hash_value(int) const { return 12345; }
+	};
+	typedef cuckoo_hash_map<int, int, SameHashTraits> Map;
+	const int SlotsPerBucket = Map::SlotsPerBucket;
+	const int MaxKeys = 3 * SlotsPerBucket;
+
+	string Test()
+	{
+		int rejected = 0, tables = Iterations / 1000;
+		for (int t = 0; t < tables; t++)
+		{
+			Map dict;
+			for (int k = 0; k < MaxKeys; k++)
+				dict[k] = k;
+			assert(dict.Count() == MaxKeys && dict.stats().InStash == SlotsPerBucket);
+			for (int k = 0; k < MaxKeys; k++)
+				assert(dict.Get(k, -1) == k);
+			assert(!dict.Contains(MaxKeys));
+			try {
+				dict[MaxKeys] = MaxKeys;
+			} catch(...) {
+				rejected++;
+			}
+			assert(dict.Count() == MaxKeys && dict.capacity() <= (unsigned)(MaxKeys * 2));
+
+			// Removing any key leaves room for one more
+			dict.Remove(0);
+			dict[MaxKeys] = MaxKeys;
+			assert(dict.Contains(MaxKeys) && !dict.Contains(0));
+		}
+		assert(rejected == tables);
+		return printstring("%d of %d tables rejected key %d", rejected, tables, MaxKeys + 1);
+	}
+}
+
+// Multithreaded hashtable test: throughput of concurrent_hash_map, and of a
+// hash_map guarded by one lock, as the number of threads grows.
+#include "concurrent_hash_map.h"
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+namespace ConcurrentHashtableTest
+{
+	const int KeyRange = MapSizeLimit;
+
+	// A hash_map that every thread shares through a single lock, which is
+	// what concurrent_hash_map is meant to replace.
+	class locked_hash_map
+	{
+		hash_map<int, int> _map;
+		CRITICAL_SECTION _lock;
+	public:
+		locked_hash_map() { InitializeCriticalSection(&_lock); }
+		~locked_hash_map() { DeleteCriticalSection(&_lock); }
+		bool TryGet(int key, int& value)
+		{
+			EnterCriticalSection(&_lock);
+			bool found = _map.TryGet(key, value);
+			LeaveCriticalSection(&_lock);
+			return found;
+		}
+		bool Set(int key, int value)
+		{
+			EnterCriticalSection(&_lock);
+			bool added = _map.Set(key, value);
+			LeaveCriticalSection(&_lock);
+			return added;
+		}
+		bool Remove(int key)
+		{
+			EnterCriticalSection(&_lock);
+			bool removed = _map.Remove(key);
+			LeaveCriticalSection(&_lock);
+			return removed;
+		}
+	};
+
+	int ProcessorCount()
+	{
+		#ifdef WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return (int)info.dwNumberOfProcessors;
+		#else
+		return (int)sysconf(_SC_NPROCESSORS_ONLN);
+		#endif
+	}
+
+	template<class Map>
+	struct Suite
+	{
+		struct Worker
+		{
+			Map* map;
+			int ops;
+			int readPercent;
+			unsigned seed;
+			HANDLE start; // Signaled when every thread has been created
+			int hits; // Stored so that the lookups cannot be optimized away
+		};
+		static Map* _map;
+		static int _threads, _readPercent;
+
+		// Each thread reads, sets or removes random keys. Sets and removes are
+		// equally likely, so the map stays about half full.
+		static DWORD WINAPI Work(LPVOID param)
+		{
+			Worker& w = *(Worker*)param;
+			WaitForSingleObject(w.start, INFINITE);
+			unsigned x = w.seed;
+			int hits = 0, value;
+			for (int i = 0; i < w.ops; i++) {
+				x ^= x << 13; x ^= x >> 17; x ^= x << 5; // xorshift
+				int key = (int)(x % (unsigned)KeyRange);
+				int dice = (int)((x >> 24) % 100u);
+				if (dice < w.readPercent) {
+					if (w.map->TryGet(key, value))
+						hits++;
+				} else if (dice & 1)
+					w.map->Set(key, i);
+				else
+					w.map->Remove(key);
+			}
+			w.hits = hits;
+			return 0;
+		}
+		static string RunThreads()
+		{
+			// The same total work is divided among the threads (the last one
+			// also does the remainder). Creating and closing the threads is
+			// not timed: they wait for the 'start' event, so that only the
+			// work itself is measured.
+			_b.PauseTiming();
+			HANDLE start = CreateEvent(NULL, TRUE, FALSE, NULL);
+			if (start == NULL) {
+				_b.ResumeTiming();
+				throw runtime_error("CreateEvent failed");
+			}
+			vector<Worker> workers(_threads);
+			vector<HANDLE> threads(_threads);
+			int started = 0;
+			for (; started < _threads; started++) {
+				int ops = Iterations / _threads + (started == _threads - 1 ? Iterations % _threads : 0);
+				Worker w = { _map, ops, _readPercent, 2463534242u + started * 7919u, start, 0 };
+				workers[started] = w;
+				threads[started] = CreateThread(NULL, 0, &Work, &workers[started], 0, NULL);
+				if (threads[started] == NULL)
+					break;
+			}
+			_b.ResumeTiming();
+
+			SimpleTimer timer;
+			SetEvent(start);
+			for (int t = 0; t < started; t++)
+				WaitForSingleObject(threads[t], INFINITE);
+			int ms = timer.Millisec();
+
+			_b.PauseTiming();
+			for (int t = 0; t < started; t++)
+				CloseHandle(threads[t]);
+			CloseHandle(start);
+			_b.ResumeTiming();
+			if (started < _threads)
+				throw runtime_error("CreateThread failed");
+			if (ms == 0)
+				return string();
+			return printstring("%.1f Mops/s", Iterations / 1000.0 / ms);
+		}
+		static string Tests()
+		{
+			Map map;
+			_map = &map;
+			for (int i = 0; i < KeyRange; i += 2)
+				map.Set(i, i);
+
+			int maxThreads = max(ProcessorCount(), 4);
+			for (int workload = 0; workload < 2; workload++) {
+				_readPercent = workload == 0 ? 90 : 50;
+				for (_threads = 1; _threads <= maxThreads; _threads *= 2) {
+					string name = printstring("%d %s, %02d thread(s)", workload + 1,
+						workload == 0 ? "Read-heavy" : "Mixed", _threads);
+					_b.MeasureAndRecord(name, &RunThreads);
+				}
+			}
+			_map = NULL;
+			return Benchmarker::DiscardResult;
+		}
+	};
+	template<class Map> Map* Suite<Map>::_map;
+	template<class Map> int Suite<Map>::_threads;
+	template<class Map> int Suite<Map>::_readPercent;
+
+	string ConcurrentTests() { return Suite< concurrent_hash_map<int, int> >::Tests(); }
+	string LockedTests()     { return Suite< locked_hash_map >::Tests(); }
+}
+
+// String hash functions: throughput by key length, and quality (avalanche,
+// and how evenly dictionary words and numeric strings fill the buckets).
+namespace StringHashTest
+{
+	typedef hash_traits<string> DefaultTraits;
+	typedef seeded_string_hash_traits<char, wy_hasher> WyTraits;
+	typedef seeded_string_hash_traits<char, aes_hasher> AesTraits;
+
+	const int KeyLengths[] = { 4, 8, 16, 32, 64, 256, 1024 };
+	const int MaxKeyLength = 1024;
+	vector<char> _text;
+	int _keyLength;
+	unsigned _total;
+	const vector<string>* _keySet;
+	vector<string> _words, _numbers;
+
+	unsigned XorShift(unsigned& x) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; }
+	const char* AesName() { return aes_hasher::is_supported() ? "AES" : "AES (no AES-NI: wyhash)"; }
+
+	// Every key length hashes the same number of bytes in total, so the
+	// times show throughput: short keys are dominated by per-call overhead.
+	template<class Traits>
+	string HashText()
+	{
+		Traits traits;
+		int count = (int)((int64)Iterations * 16 / _keyLength);
+		const char* text = &_text[0];
+		unsigned total = 0;
+		for (int i = 0; i < count; i++)
+			total += traits.hash_chars(text + (i & (MaxKeyLength - 1)), _keyLength);
+		_total += total;
+		return string();
+	}
+	string SpeedTests()
+	{
+		unsigned x = 2463534242u;
+		_text.resize(MaxKeyLength * 2);
+		for (int i = 0; i < (int)_text.size(); i++)
+			_text[i] = (char)XorShift(x);
+
+		for (int k = 0; k < (int)(sizeof(KeyLengths) / sizeof(KeyLengths[0])); k++) {
+			_keyLength = KeyLengths[k];
+			_b.MeasureAndRecord(printstring("%04d bytes, default", _keyLength), &HashText<DefaultTraits>);
+			_b.MeasureAndRecord(printstring("%04d bytes, wyhash", _keyLength), &HashText<WyTraits>);
+			_b.MeasureAndRecord(printstring("%04d bytes, %s", _keyLength, AesName()), &HashText<AesTraits>);
+		}
+		return Benchmarker::DiscardResult;
+	}
+
+	// Flips each bit of random keys and counts how often each bit of the hash
+	// code changes as a result; ideally each changes half the time. Bias is
+	// |2*P(flip) - 1|; with 4000 samples, pure chance gives a mean of about
+	// 1.3% and a worst case of about 10%. Lengths just past a multiple of 16
+	// or 32 exercise the tail handling of block-at-a-time hashes, and the
+	// bytes after each key are changed to check that the hash ignores them.
+	template<class Traits>
+	string Avalanche()
+	{
+		const int Samples = 4000;
+		const int Lengths[] = { 3, 8, 16, 33, 40, 47, 65, 100 };
+		Traits traits;
+		unsigned x = 88675123u;
+		char key[100 + 32];
+		vector<int> flips;
+		double sum = 0, worst = 0;
+		int cells = 0;
+		for (int l = 0; l < (int)(sizeof(Lengths) / sizeof(Lengths[0])); l++) {
+			int length = Lengths[l], bits = length * 8;
+			flips.assign(bits * 32, 0);
+			for (int s = 0; s < Samples; s++) {
+				for (int i = 0; i < length; i++)
+					key[i] = (char)XorShift(x);
+				unsigned hash = traits.hash_chars(key, length);
+				for (int i = length; i < (int)sizeof(key); i++)
+					key[i] = (char)XorShift(x);
+				if (traits.hash_chars(key, length) != hash)
+					return printstring("hash of %d bytes depends on the bytes after them", length);
+				for (int bit = 0; bit < bits; bit++) {
+					key[bit >> 3] ^= (char)(1 << (bit & 7));
+					unsigned diff = hash ^ traits.hash_chars(key, length);
+					key[bit >> 3] ^= (char)(1 << (bit & 7));
+					int* row = &flips[bit * 32];
+					for (int o = 0; o < 32; o++)
+						row[o] += (diff >> o) & 1;
+				}
+			}
+			for (int c = 0; c < (int)flips.size(); c++, cells++) {
+				double bias = fabs(2.0 * flips[c] / Samples - 1);
+				sum += bias;
+				worst = max(worst, bias);
+			}
+		}
+		return printstring("bias %.1f%% mean, %.1f%% worst", sum / cells * 100, worst * 100);
+	}
+
+	// Hashes the keys of _keySet into a power-of-two number of buckets using
+	// the low bits of the hash code, as a table with a mask would. A random
+	// function gives chi-squared per degree of freedom near 1.
+	template<class Traits>
+	string Distribution()
+	{
+		const vector<string>& keys = *_keySet;
+		if (keys.empty())
+			return "no keys (TestDict.txt not found)";
+		Traits traits;
+		int buckets = 1 << (Log2Floor((uint32)keys.size() - 1) + 1);
+		vector<int> counts(buckets);
+		for (int i = 0; i < (int)keys.size(); i++)
+			counts[traits.hash_value(keys[i]) & (buckets - 1)]++;
+		double expected = (double)keys.size() / buckets, chi2 = 0;
+		int longest = 0;
+		for (int b = 0; b < buckets; b++) {
+			chi2 += (counts[b] - expected) * (counts[b] - expected) / expected;
+			longest = max(longest, counts[b]);
+		}
+		return printstring("chi2/df %.2f, longest chain %d", chi2 / (buckets - 1), longest);
+	}
+
+	// Fixture: loads the words of TestDict.txt ("word:=translation" lines),
+	// which is found in the folder of the EXE or one of its parents.
+	void LoadKeys()
+	{
+		string folder = GetFolderOfEXE();
+		FILE* fp = NULL;
+		for (int depth = 0; depth < 8 && fp == NULL && !folder.empty(); depth++) {
+			fp = fopen(CombinePaths(folder, "TestDict.txt").c_str(), "rt");
+			string parent = RemoveLastPath(folder);
+			if (parent == folder)
+				break;
+			folder = parent;
+		}
+		if (fp != NULL) {
+			char line[1024];
+			while (fgets(line, sizeof(line), fp)) {
+				char* word = line;
+				if ((uchar)word[0] == 0xEF && (uchar)word[1] == 0xBB && (uchar)word[2] == 0xBF)
+					word += 3; // UTF-8 byte order mark
+				char* end = strstr(word, ":=");
+				if (end != NULL && end != word)
+					_words.push_back(string(word, end));
+			}
+			fclose(fp);
+			sort(_words.begin(), _words.end());
+			_words.erase(unique(_words.begin(), _words.end()), _words.end());
+		}
+		for (int i = 0; i < MapSizeLimit / 16; i++)
+			_numbers.push_back(printstring("%d", i ^ 314159));
+	}
+	void FreeKeys()
+	{
+		vector<string>().swap(_words);
+		vector<string>().swap(_numbers);
+	}
+	string QualityTests()
+	{
+		_b.MeasureAndRecord("1 Avalanche, default", &Avalanche<DefaultTraits>);
+		_b.MeasureAndRecord("1 Avalanche, wyhash", &Avalanche<WyTraits>);
+		_b.MeasureAndRecord(printstring("1 Avalanche, %s", AesName()), &Avalanche<AesTraits>);
+		_keySet = &_words;
+		_b.MeasureAndRecord("2 Dictionary words, default", &Distribution<DefaultTraits>);
+		_b.MeasureAndRecord("2 Dictionary words, wyhash", &Distribution<WyTraits>);
+		_b.MeasureAndRecord(printstring("2 Dictionary words, %s", AesName()), &Distribution<AesTraits>);
+		_keySet = &_numbers;
+		_b.MeasureAndRecord("3 Numeric strings, default", &Distribution<DefaultTraits>);
+		_b.MeasureAndRecord("3 Numeric strings, wyhash", &Distribution<WyTraits>);
+		_b.MeasureAndRecord(printstring("3 Numeric strings, %s", AesName()), &Distribution<AesTraits>);
+		return Benchmarker::DiscardResult;
+	}
+}
+
+#include "hash_map_snapshot.h"
+
+// The startup cost of a large lookup table: building it (as in "1 Adding
+// items" of the hashtable tests) versus opening a snapshot of it, and the
+// speed of queries on the snapshot versus the table. The first queries after
+// opening a snapshot also pay for mapping its pages into the process (the
+// file itself is normally still in the OS file cache).
+namespace SnapshotTest
+{
+	vector<string> _keys; // string keys, as in the string hashtable tests
+
+	template<class K> struct Tables
+	{
+		static hash_map<K, int> Dict;
+		static hash_map_snapshot<K, int> Snapshot;
+		static string Path;
+	};
+	template<class K> hash_map<K, int> Tables<K>::Dict;
+	template<class K> hash_map_snapshot<K, int> Tables<K>::Snapshot;
+	template<class K> string Tables<K>::Path;
+
+	int Key(int i, int*) { return i ^ 314159; }
+	const string& Key(int i, string*) { return _keys[i]; }
+	void GenerateKeys(int*) {}
+	void GenerateKeys(string*)
+	{
+		char temp[20];
+		_keys.resize(Iterations);
+		for (int i = 0; i < Iterations; i++)
+			_keys[i] = _itoa(i ^ 314159, temp, 10);
+	}
+
+	template<class K> void Setup()
+	{
+		Tables<K>::Path = CombinePaths(GetHomeFolder(), Math::num_traits<K>::is_numeric ? "IntSnapshot.tmp" : "StringSnapshot.tmp");
+		GenerateKeys((K*)NULL);
+	}
+	template<class K> void Teardown()
+	{
+		Tables<K>::Snapshot.Close();
+		Tables<K>::Dict.Clear();
+		remove(Tables<K>::Path.c_str());
+		vector<string>().swap(_keys);
+	}
+
+	template<class K> string Build()
+	{
+		hash_map<K, int>& dict = Tables<K>::Dict;
+		dict.Clear();
+		for (int i = 0; i < MapSizeLimit; i++)
+			dict[Key(i, (K*)NULL)] = i;
+		return string();
+	}
+	template<class K> string Save()
+	{
+		Tables<K>::Snapshot.Close(); // Windows cannot replace a mapped file
+		if (!hash_map_snapshot<K, int>::Save(Tables<K>::Dict, Tables<K>::Path.c_str()))
+			return "Save failed";
+		return string();
+	}
+	// Opening is too quick to time once, so open and close repeatedly
+	template<class K> string Open()
+	{
+		const int Opens = 100;
+		hash_map_snapshot<K, int>& snapshot = Tables<K>::Snapshot;
+		for (int i = 0; i < Opens; i++) {
+			snapshot.Close();
+			if (!snapshot.Open(Tables<K>::Path.c_str()))
+				return "Open failed";
+		}
+		return printstring("%d opens, %.1f MB", Opens, snapshot.FileSize() / 1048576.0);
+	}
+	// The optional full check of an untrusted file, which reads all of it
+	template<class K> string Verify()
+	{
+		if (!Tables<K>::Snapshot.Verify())
+			return "Verify failed";
+		return string();
+	}
+	template<class K> string QuerySnapshot()
+	{
+		const hash_map_snapshot<K, int>& snapshot = Tables<K>::Snapshot;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (snapshot.Find(Key(i, (K*)NULL)) == NULL)
+				misses++;
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	template<class K> string QueryTable()
+	{
+		hash_map<K, int>& dict = Tables<K>::Dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.find(Key(i, (K*)NULL)) == dict.end())
+				misses++;
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	template<class K> string Tests()
+	{
+		_b.MeasureAndRecord("1 Building table", &Build<K>);
+		_b.MeasureAndRecord("1 Saving snapshot", &Save<K>);
+		_b.MeasureAndRecord("1 Opening snapshot", &Open<K>);
+		_b.MeasureAndRecord("2 Queries, snapshot (first)", &QuerySnapshot<K>);
+		_b.MeasureAndRecord("2 Queries, snapshot", &QuerySnapshot<K>);
+		_b.MeasureAndRecord("2 Queries, table", &QueryTable<K>);
+		// Last, since reading the whole file would page it in for the queries
+		_b.MeasureAndRecord("3 Verifying snapshot", &Verify<K>);
+		Tables<K>::Snapshot.Close();
+		Tables<K>::Dict.Clear();
+		return Benchmarker::DiscardResult;
+	}
+}
+
+// Hashtables whose memory comes from the heap (std::allocator), a monotonic
+// arena (arena_allocator) or a pool (pool_allocator), and, where the C++17
+// library is available, from the equivalent std::pmr memory resources. The
+// large-table tests follow the hashtable suites; the table is created in
+// "1 Adding items" and destroyed in "4 Destroying table", which also releases
+// the arena. An arena never reuses memory, so a growing table leaves its old
+// arrays behind (about twice the final size in all). "5 Small tables" creates
+// many short-lived 8-entry tables, as a server might for each request,
+// releasing the arena after each.
+#include "arena_allocator.h"
+#if defined(HASH_MAP_HAS_STRING_VIEW) && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define BENCHMARK_PMR
+#endif
+#endif
+namespace AllocatorTest
+{
+	typedef std::pair<const int, int> Pair;
+
+	// A Resource supplies the allocator of the tables, prepares it in Setup()
+	// and frees everything in Release() (for an arena) and Teardown().
+	struct HeapResource
+	{
+		typedef std::allocator<Pair> allocator_type;
+		static void Setup() {}
+		static void Teardown() {}
+		static void Release() {}
+		static allocator_type Get() { return allocator_type(); }
+	};
+	struct ArenaResource
+	{
+		typedef arena_allocator<Pair> allocator_type;
+		static memory_arena* _arena;
+		static void Setup() { _arena = new memory_arena(); }
+		static void Teardown() { delete _arena; _arena = NULL; }
+		static void Release() { _arena->release(); }
+		static allocator_type Get() { return allocator_type(_arena); }
+	};
+	memory_arena* ArenaResource::_arena;
+	struct PoolResource
+	{
+		typedef pool_allocator<Pair> allocator_type;
+		static memory_pool* _pool;
+		static void Setup() { _pool = new memory_pool(); }
+		static void Teardown() { delete _pool; _pool = NULL; }
+		static void Release() {}
+		static allocator_type Get() { return allocator_type(_pool); }
+	};
+	memory_pool* PoolResource::_pool;
+
+	#ifdef BENCHMARK_PMR
+	enum PmrKind { PmrHeap, PmrArena, PmrPool };
+	template<int Kind> struct PmrResource
+	{
+		typedef std::pmr::polymorphic_allocator<Pair> allocator_type;
+		static std::pmr::memory_resource* _resource;
+		static void Setup()
+		{
+			if (Kind == PmrArena)
+				_resource = new std::pmr::monotonic_buffer_resource();
+			else if (Kind == PmrPool)
+				_resource = new std::pmr::unsynchronized_pool_resource();
+			else
+				_resource = std::pmr::new_delete_resource();
+		}
+		static void Teardown()
+		{
+			if (Kind != PmrHeap)
+				delete _resource;
+			_resource = NULL;
+		}
+		static void Release()
+		{
+			if (Kind == PmrArena)
+				static_cast<std::pmr::monotonic_buffer_resource*>(_resource)->release();
+		}
+		static allocator_type Get() { return allocator_type(_resource); }
+	};
+	template<int Kind> std::pmr::memory_resource* PmrResource<Kind>::_resource;
+	#endif
+
+	template<class Resource> struct Table
+	{
+		typedef hash_map<int, int, hash_traits<int>, prime_bucket_policy,
+			typename Resource::allocator_type> Map;
+		static Map* Dict;
+	};
+	template<class Resource> typename Table<Resource>::Map* Table<Resource>::Dict;
+
+	template<class Resource> void Setup()
+	{
+		Resource::Setup();
+	}
+	template<class Resource> void Teardown()
+	{
+		delete Table<Resource>::Dict;
+		Table<Resource>::Dict = NULL;
+		Resource::Teardown();
+	}
+
+	template<class Resource> string TestAdding()
+	{
+		typedef typename Table<Resource>::Map Map;
+		delete Table<Resource>::Dict;
+		Table<Resource>::Dict = new Map(Resource::Get());
+		Map& dict = *Table<Resource>::Dict;
+		for (int i = 0; i < MapSizeLimit; i++)
+			dict[i ^ 314159] = i;
+		return string();
+	}
+	template<class Resource> string TestQueries()
+	{
+		typename Table<Resource>::Map& dict = *Table<Resource>::Dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.find(i ^ 314159) == dict.end())
+				misses++;
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	template<class Resource> string TestRemoving()
+	{
+		typename Table<Resource>::Map& dict = *Table<Resource>::Dict;
+		int removed = 0;
+		for (int i = 0; i < Iterations; i++)
+			if (dict.Remove(i ^ 314159))
+				removed++;
+		return printstring("%d removed", removed);
+	}
+	template<class Resource> string TestDestroying()
+	{
+		delete Table<Resource>::Dict;
+		Table<Resource>::Dict = NULL;
+		Resource::Release();
+		return string();
+	}
+	template<class Resource> string TestSmallTables()
+	{
+		const int TableSize = 8;
+		int64 total = 0;
+		for (int t = 0; t < Iterations / TableSize; t++) {
+			{
+				typename Table<Resource>::Map dict(Resource::Get());
+				for (int i = 0; i < TableSize; i++)
+					dict[t + i * 7] = i;
+				for (int i = 0; i < TableSize * 2; i++)
+					total += dict.Contains(t + i * 7);
+			}
+			Resource::Release();
+		}
+		return printstring("%d tables", (int)(total / TableSize));
+	}
+	template<class Resource> string Tests()
+	{
+		_b.MeasureAndRecord("1 Adding items", TestAdding<Resource>);
+		_b.MeasureAndRecord("2 Running queries", TestQueries<Resource>);
+		_b.MeasureAndRecord("3 Removing items", TestRemoving<Resource>);
+		_b.MeasureAndRecord("4 Destroying table", TestDestroying<Resource>);
+		_b.MeasureAndRecord("5 Small tables", TestSmallTables<Resource>);
+		return Benchmarker::DiscardResult;
+	}
+}
 
 namespace SquareRootTest
 {
@@ -235,16 +1335,24 @@ namespace GenericSumTest
 	string TestDouble() { return TestGeneric(listD); }
 	string TestFPI8() { return TestGeneric(listF8); }
 
-	string Tests()
+	// The lists are only read by the tests, so a shared fixture fills them once.
+	void Setup()
 	{
-		const int ListSize = 500000;
-		
 		listI.resize(ListSize);
 		listD.resize(ListSize);
 		listF8.resize(ListSize);
 		for (int i = 0; i < ListSize; i++)
 			listF8[i] = listD[i] = listI[i] = i+1;
+	}
+	void Teardown()
+	{
+		vector<int>().swap(listI);
+		vector<double>().swap(listD);
+		vector<FPI8>().swap(listF8);
+	}
 
+	string Tests()
+	{
 		_b.MeasureAndRecord("int", TestInt);
 		_b.MeasureAndRecord("int without template", TestNonGeneric);
 		_b.MeasureAndRecord("double", TestDouble);
@@ -342,38 +1450,67 @@ namespace MatrixMultiplyTest
 		return x;
 	}
 	
+	// Input matrices. They are generated by shared fixtures, outside the timed
+	// region, and the multiplication does not modify them.
+	double* DoubleA, * DoubleB;
+	void GenerateDoubleMatrices()
+	{
+		DoubleA = GenerateMatrix(MatrixSize);
+		DoubleB = GenerateMatrix(MatrixSize);
+	}
+	void DeleteDoubleMatrices()
+	{
+		delete[] DoubleA;
+		delete[] DoubleB;
+		DoubleA = DoubleB = NULL;
+	}
+	template<typename T>
+	struct Operands
+	{
+		static T* A, * B;
+		static void Generate()
+		{
+			A = GenerateMatrix<T>(MatrixSize);
+			B = GenerateMatrix<T>(MatrixSize);
+		}
+		static void Delete()
+		{
+			delete[] A;
+			delete[] B;
+			A = B = NULL;
+		}
+		static BenchmarkFixture Fixture()
+			{ return BenchmarkFixture(&Generate, &Delete, true); }
+	};
+	template<typename T> T* Operands<T>::A = NULL;
+	template<typename T> T* Operands<T>::B = NULL;
+
 	string TestDoubleMatrix()
 	{
-		double* a, * b, * x;
-		a = GenerateMatrix(MatrixSize);
-		b = GenerateMatrix(MatrixSize);
-		x = MultiplyMatrix(a, b, MatrixSize, MatrixSize, MatrixSize);
+		double* x = MultiplyMatrix(DoubleA, DoubleB, MatrixSize, MatrixSize, MatrixSize);
+		_b.PauseTiming();
 		double result = x[MatrixSize / 2 * MatrixSize + MatrixSize / 2];
-		delete[] a;
-		delete[] b;
 		delete[] x;
+		_b.ResumeTiming();
 		return printstring("%f", result);
 	}
 	template<typename T>
 	string TestMatrix()
 	{
-		T* a, * b, * x;
-		a = GenerateMatrix<T>(MatrixSize);
-		b = GenerateMatrix<T>(MatrixSize);
-		x = MultiplyMatrix<T>(a, b, MatrixSize, MatrixSize, MatrixSize);
+		T* x = MultiplyMatrix<T>(Operands<T>::A, Operands<T>::B, MatrixSize, MatrixSize, MatrixSize);
+		_b.PauseTiming();
 		T result = x[MatrixSize / 2 * MatrixSize + MatrixSize / 2];
-		delete[] a;
-		delete[] b;
 		delete[] x;
+		_b.ResumeTiming();
 		return printstring("%0.0f", (double)result);
 	}
 
 	string Tests()
 	{
-		_b.MeasureAndRecord("double[n*n]",   TestDoubleMatrix);
-		_b.MeasureAndRecord("<double>[n*n]", TestMatrix<double>);
-		_b.MeasureAndRecord("<float>[n*n]",  TestMatrix<float>);
-		_b.MeasureAndRecord("<int>[n*n]",    TestMatrix<int>);
+		_b.MeasureAndRecord("double[n*n]",   TestDoubleMatrix, BenchmarkFixture(GenerateDoubleMatrices, DeleteDoubleMatrices, true));
+		_b.MeasureAndRecord("<double>[n*n]", TestMatrix<double>, Operands<double>::Fixture());
+		_b.MeasureAndRecord("<float>[n*n]",  TestMatrix<float>,  Operands<float>::Fixture());
+		_b.MeasureAndRecord("<int>[n*n]",    TestMatrix<int>,    Operands<int>::Fixture());
 		return Benchmarker::DiscardResult;
 	}
 }
@@ -632,12 +1769,105 @@ void Run()
     #define ONE_TRIAL_UNDER_CE
     #endif
 
+	_b.MeasureResourceUsage = true;
+	// Time about one container operation in 1000 (see LatencySample), at
+	// random, to show p50/p99/max latency next to the totals
+	_b.Sampler.SetPeriod(1000, true);
+	#ifdef INCREMENTAL_BENCHMARKS
+	// Reuse the saved results of benchmarks that have not changed
+	_b.HistoryFile = "BenchmarkHistory.txt";
+	_b.BuildFlags += printstring(" Iterations=%d", Iterations);
+	#endif
+	#ifdef METRICS_PORT
+	// Serve live results, e.g. curl http://127.0.0.1:9464/metrics
+	static MetricsExporter metrics;
+	if (metrics.Start(METRICS_PORT)) {
+		printf("Serving metrics at http://127.0.0.1:%d/metrics\n", METRICS_PORT);
+		_b.Metrics = &metrics;
+	}
+	#endif
 	srand(GetTickCount());
 	methods.push_back(BenchmarkInfo("Simple arithmetic",     SimpleArithmeticTest::Tests, 3));
-	methods.push_back(BenchmarkInfo("Generic sum",           GenericSumTest::Tests,  3));
+	methods.push_back(BenchmarkInfo("Generic sum",           GenericSumTest::Tests,
+		BenchmarkFixture(GenericSumTest::Setup, GenericSumTest::Teardown, true), 3));
 	methods.push_back(BenchmarkInfo("Matrix multiply",       MatrixMultiplyTest::Tests, 3));
 	methods.push_back(BenchmarkInfo("Sudoku",                Sudoku::Test, 3));
 	methods.push_back(BenchmarkInfo("Polynomials",           Polynomials::Test, 3));
+	methods.push_back(BenchmarkInfo("Int hashtable",         IntHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT",         IntCustomHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (Fibonacci)", IntFibonacciHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (murmur)",    IntMurmurHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (fastrange)", IntFastrangeHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (incremental)", IntIncrementalHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (heap)",      AllocatorTest::Tests<AllocatorTest::HeapResource>,
+		BenchmarkFixture(AllocatorTest::Setup<AllocatorTest::HeapResource>, AllocatorTest::Teardown<AllocatorTest::HeapResource>) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (arena)",     AllocatorTest::Tests<AllocatorTest::ArenaResource>,
+		BenchmarkFixture(AllocatorTest::Setup<AllocatorTest::ArenaResource>, AllocatorTest::Teardown<AllocatorTest::ArenaResource>) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (pool)",      AllocatorTest::Tests<AllocatorTest::PoolResource>,
+		BenchmarkFixture(AllocatorTest::Setup<AllocatorTest::PoolResource>, AllocatorTest::Teardown<AllocatorTest::PoolResource>) ONE_TRIAL_UNDER_CE));
+	#ifdef BENCHMARK_PMR
+	methods.push_back(BenchmarkInfo("Int custom HT (pmr heap)",  AllocatorTest::Tests< AllocatorTest::PmrResource<AllocatorTest::PmrHeap> >,
+		BenchmarkFixture(AllocatorTest::Setup< AllocatorTest::PmrResource<AllocatorTest::PmrHeap> >, AllocatorTest::Teardown< AllocatorTest::PmrResource<AllocatorTest::PmrHeap> >) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (pmr arena)", AllocatorTest::Tests< AllocatorTest::PmrResource<AllocatorTest::PmrArena> >,
+		BenchmarkFixture(AllocatorTest::Setup< AllocatorTest::PmrResource<AllocatorTest::PmrArena> >, AllocatorTest::Teardown< AllocatorTest::PmrResource<AllocatorTest::PmrArena> >) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (pmr pool)",  AllocatorTest::Tests< AllocatorTest::PmrResource<AllocatorTest::PmrPool> >,
+		BenchmarkFixture(AllocatorTest::Setup< AllocatorTest::PmrResource<AllocatorTest::PmrPool> >, AllocatorTest::Teardown< AllocatorTest::PmrResource<AllocatorTest::PmrPool> >) ONE_TRIAL_UNDER_CE));
+	#endif
+	methods.push_back(BenchmarkInfo("Int flat HT",           IntFlatHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int compact HT",        IntCompactHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int cuckoo HT",         IntCuckooHashtableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int full tables",       FullTableTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int cuckoo HT collisions", CuckooCollisionTest::Test ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int concurrent HT",     ConcurrentHashtableTest::ConcurrentTests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int locked HT",         ConcurrentHashtableTest::LockedTests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int sorted map",        IntSortedMapTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int B+ tree map",       IntBtreeMapTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int flat map",          FlatMapTest::Tests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String hashtable",      StringHashtableTest::Tests,
+		BenchmarkFixture(StringHashtableTest::GenerateKeys, StringHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT",      StringCustomHashtableTest::Tests,
+		BenchmarkFixture(StringCustomHashtableTest::GenerateKeys, StringCustomHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String interned HT",    StringInternedHashtableTest::Tests,
+		BenchmarkFixture(StringCustomHashtableTest::GenerateKeys, StringCustomHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String flat HT",        StringFlatHashtableTest::Tests,
+		BenchmarkFixture(StringFlatHashtableTest::GenerateKeys, StringFlatHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String compact HT",     StringCompactHashtableTest::Tests,
+		BenchmarkFixture(StringCompactHashtableTest::GenerateKeys, StringCompactHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT (wyhash)", StringWyhashHashtableTest::Tests,
+		BenchmarkFixture(StringWyhashHashtableTest::GenerateKeys, StringWyhashHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT (AES)", StringAeshashHashtableTest::Tests,
+		BenchmarkFixture(StringAeshashHashtableTest::GenerateKeys, StringAeshashHashtableTest::FreeKeys) ONE_TRIAL_UNDER_CE));
+	#ifdef BENCHMARK_WORKLOADS
+	methods.push_back(BenchmarkInfo("Int hashtable workloads",   IntWorkloadHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT workloads",   IntWorkloadCustomHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (Fibonacci) workloads", IntWorkloadFibonacciHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (murmur) workloads",    IntWorkloadMurmurHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (fastrange) workloads", IntWorkloadFastrangeHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int custom HT (incremental) workloads", IntWorkloadIncrementalHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int flat HT workloads",     IntWorkloadFlatHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int compact HT workloads",  IntWorkloadCompactHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("Int cuckoo HT workloads",   IntWorkloadCuckooHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String hashtable workloads", StringWorkloadHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT workloads", StringWorkloadCustomHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String flat HT workloads",  StringWorkloadFlatHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String compact HT workloads", StringWorkloadCompactHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT (wyhash) workloads", StringWorkloadWyhashHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String custom HT (AES) workloads", StringWorkloadAeshashHashtableTest::Tests, Workloads::Fixture() ONE_TRIAL_UNDER_CE));
+	#endif
+	methods.push_back(BenchmarkInfo("Int snapshot",          SnapshotTest::Tests<int>,
+		BenchmarkFixture(SnapshotTest::Setup<int>, SnapshotTest::Teardown<int>) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String snapshot",       SnapshotTest::Tests<string>,
+		BenchmarkFixture(SnapshotTest::Setup<string>, SnapshotTest::Teardown<string>) ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String hash speed",     StringHashTest::SpeedTests ONE_TRIAL_UNDER_CE));
+	methods.push_back(BenchmarkInfo("String hash quality",   StringHashTest::QualityTests,
+		BenchmarkFixture(StringHashTest::LoadKeys, StringHashTest::FreeKeys), 1));
+
+	#ifdef INCREMENTAL_BENCHMARKS
+	for (size_t i = 0; i < methods.size(); i++)
+		for (size_t v = 0; v < sizeof(BenchmarkVersions) / sizeof(BenchmarkVersions[0]); v++)
+			if (methods[i].Name == BenchmarkVersions[v][0])
+				methods[i].Version = BenchmarkVersions[v][1];
+	#endif
 
 	_b.RunAllBenchmarksInConsole(methods, true);
 
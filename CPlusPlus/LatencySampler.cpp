@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include <string.h>
+#include <math.h>
+#include "LatencySampler.h"
+
+LatencySummary& LatencySummary::operator+=(const LatencySummary& b)
+{
+	if (b.Samples > 0) {
+		double total = (double)(Samples + b.Samples);
+		P50 = (P50 * Samples + b.P50 * b.Samples) / total;
+		P99 = (P99 * Samples + b.P99 * b.Samples) / total;
+		if (Max < b.Max)
+			Max = b.Max;
+		Samples += b.Samples;
+	}
+	return *this;
+}
+
+void LatencyHistogram::Clear()
+{
+	memset(_counts, 0, sizeof(_counts));
+	_count = 0;
+	_max = 0;
+}
+
+uint64 LatencyHistogram::Percentile(double p) const
+{
+	if (_count == 0)
+		return 0;
+	int64 rank = (int64)ceil(p * _count);
+	if (rank < 1)
+		rank = 1;
+	int64 seen = 0;
+	for (int b = 0; b < Buckets; b++) {
+		seen += _counts[b];
+		if (seen >= rank) {
+			uint64 end = BucketEnd(b);
+			return end < _max ? end : _max;
+		}
+	}
+	return _max;
+}
+
+LatencySummary LatencyHistogram::Summarize(double microsecPerTick, uint64 overheadTicks) const
+{
+	LatencySummary s;
+	if (_count > 0) {
+		uint64 p50 = Percentile(0.5), p99 = Percentile(0.99);
+		s.Samples = _count;
+		s.P50 = (p50 > overheadTicks ? p50 - overheadTicks : 0) * microsecPerTick;
+		s.P99 = (p99 > overheadTicks ? p99 - overheadTicks : 0) * microsecPerTick;
+		s.Max = (_max > overheadTicks ? _max - overheadTicks : 0) * microsecPerTick;
+	}
+	return s;
+}
+
+void LatencySampler::SetPeriod(int period, bool random)
+{
+	_period = period > 0 ? period : 0;
+	_random = random;
+	_countdown = 1; // Rearm() on the next operation
+	if (_period > 0) {
+		// Calibrate now rather than in the middle of a benchmark
+		MicrosecPerTick();
+		OverheadTicks();
+	}
+}
+
+double LatencySampler::MicrosecPerTick()
+{
+	#ifdef LATENCY_RDTSC
+	static double perTick = 0;
+	if (perTick == 0) {
+		PreciseTimer timer;
+		uint64 start = Now();
+		Sleep(20);
+		uint64 ticks = Now() - start;
+		perTick = timer.Microsec() / (double)(int64)ticks;
+	}
+	return perTick;
+	#else
+	return PreciseTimer::MicrosecPerTick();
+	#endif
+}
+
+uint64 LatencySampler::OverheadTicks()
+{
+	static uint64 overhead = ~(uint64)0;
+	if (overhead == ~(uint64)0) {
+		uint64 least = ~(uint64)0;
+		for (int i = 0; i < 1000; i++) {
+			uint64 start = Now();
+			uint64 ticks = Now() - start;
+			if (least > ticks)
+				least = ticks;
+		}
+		overhead = least;
+	}
+	return overhead;
+}
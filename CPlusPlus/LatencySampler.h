@@ -0,0 +1,208 @@
+#ifndef _LATENCYSAMPLER_H
+#define _LATENCYSAMPLER_H
+
+#include <limits.h>
+#include "Misc.h"
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <intrin.h>
+	#define LATENCY_RDTSC() __rdtsc()
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#include <x86intrin.h>
+	#define LATENCY_RDTSC() __rdtsc()
+#endif
+
+/// <summary>Per-operation latency of a benchmark, in microseconds.</summary>
+/// <remarks>BenchmarkStatistic adds up the summaries of its trials with
+/// operator+=, which keeps the largest Max and averages the percentiles,
+/// weighted by the number of samples of each trial. (An average of
+/// percentiles is not a percentile of the combined samples, but trials
+/// of the same benchmark are similar enough for this not to matter.)</remarks>
+struct LatencySummary
+{
+	int64 Samples;
+	double P50;
+	double P99;
+	double Max;
+
+	LatencySummary() { Clear(); }
+	void Clear()
+	{
+		Samples = 0;
+		P50 = P99 = Max = 0;
+	}
+	LatencySummary& operator+=(const LatencySummary& b);
+};
+
+/// <summary>
+/// A histogram of latencies measured in LatencySampler ticks.
+/// </summary>
+/// <remarks>
+/// Values below 2*SubBuckets are counted exactly. Above that, every power of
+/// two is divided into SubBuckets buckets of equal width, so a percentile is
+/// within 1/SubBuckets (about 6%) of the true value, and any 64-bit value can
+/// be recorded with a fixed Buckets counters (about 4 KB).
+/// </remarks>
+class LatencyHistogram
+{
+public:
+	enum { SubBucketBits = 4, SubBuckets = 1 << SubBucketBits,
+	       Buckets = (64 - SubBucketBits + 1) * SubBuckets };
+
+	LatencyHistogram() { Clear(); }
+	void Clear();
+
+	void Add(uint64 ticks)
+	{
+		_counts[BucketOf(ticks)]++;
+		_count++;
+		if (_max < ticks)
+			_max = ticks;
+	}
+
+	int64 Count() const { return _count; }
+	uint64 Max() const { return _max; }
+	/// <summary>Returns the smallest value that at least a fraction p of the
+	/// samples do not exceed (rounded up to the end of its bucket, but never
+	/// more than Max()).</summary>
+	uint64 Percentile(double p) const;
+	/// <summary>Converts the percentiles to microseconds, after subtracting
+	/// the cost of reading the clock.</summary>
+	LatencySummary Summarize(double microsecPerTick, uint64 overheadTicks) const;
+
+protected:
+	uint32 _counts[Buckets];
+	int64 _count;
+	uint64 _max;
+
+	static int BucketOf(uint64 v)
+	{
+		if (v < 2 * SubBuckets)
+			return (int)v;
+		int shift = Math::Log2Floor(v) - SubBucketBits;
+		return shift * SubBuckets + (int)(v >> shift);
+	}
+	static uint64 BucketEnd(int bucket)
+	{
+		if (bucket < 2 * SubBuckets)
+			return (uint64)bucket;
+		int shift = bucket / SubBuckets - 1;
+		uint64 next = (uint64)(bucket % SubBuckets + SubBuckets + 1) << shift;
+		return next - 1;
+	}
+};
+
+/// <summary>
+/// Times a sample of the individual operations of a benchmark, so that
+/// stalls (e.g. a resize, a page fault or a burst of frees) show up as a
+/// high p99 or max latency instead of being averaged away in the total.
+/// </summary>
+/// <remarks>
+/// Benchmarker owns a sampler (<see cref="Benchmarker::Sampler"/>) and points
+/// it at a fresh histogram whenever MeasureAndRecord starts a benchmark, so
+/// the samples of an operation are reported on the row of the innermost
+/// benchmark that is running. A benchmark opts in by declaring a
+/// LatencySample around each operation:
+/// <code>
+///     for (int i = 0; i < Iterations; i++) {
+///         LatencySample sample(_b.Sampler);
+///         dict[i] = i;
+///     }
+/// </code>
+/// An operation that is not sampled costs one decrement and one branch; a
+/// sampled one also reads the clock twice and updates the histogram. The
+/// clock is the processor's timestamp counter (rdtsc) on x86 and x64, and
+/// QueryPerformanceCounter elsewhere, which is much slower and coarser.
+/// rdtsc does not wait for earlier instructions to finish, so a latency can
+/// be off by a few dozen cycles, but not by a stall.
+/// <para/>
+/// Sampling is off until SetPeriod() is called.
+/// </remarks>
+class LatencySampler
+{
+public:
+	LatencySampler() : _period(0), _random(false), _countdown(INT_MAX), _rng(2463534242u), _histogram(NULL) { }
+
+	/// <summary>Samples one operation out of every 'period', or none if
+	/// period is 0.</summary>
+	/// <remarks>If random is true, the gap between two samples is chosen
+	/// uniformly from 1 to 2*period - 1, so that the samples cannot fall
+	/// into step with something periodic in the code under test, such as a
+	/// resize at every power of two.</remarks>
+	void SetPeriod(int period, bool random = false);
+	int Period() const { return _period; }
+
+	/// <summary>Where the samples go; Benchmarker sets this. If it is
+	/// NULL, nothing is sampled.</summary>
+	void SetHistogram(LatencyHistogram* histogram) { _histogram = histogram; }
+	LatencyHistogram* Histogram() const { return _histogram; }
+
+	/// <summary>Call before an operation. Returns 0 if the operation is not
+	/// sampled, or otherwise its start time, to be passed to End().</summary>
+	uint64 Begin()
+	{
+		if (--_countdown > 0)
+			return 0;
+		return Rearm();
+	}
+	void End(uint64 start)
+	{
+		if (start != 0)
+			_histogram->Add(Now() - start);
+	}
+
+	/// <summary>Reads the clock.</summary>
+	static uint64 Now()
+	{
+		#ifdef LATENCY_RDTSC
+		return LATENCY_RDTSC();
+		#else
+		return (uint64)PreciseTimer::Now();
+		#endif
+	}
+	/// <summary>Length of a tick of Now(). The timestamp counter's rate is
+	/// measured the first time this is called, which takes 20 ms.</summary>
+	static double MicrosecPerTick();
+	/// <summary>The least number of ticks between two calls to Now(),
+	/// which every sample includes.</summary>
+	static uint64 OverheadTicks();
+
+protected:
+	int _period;
+	bool _random;
+	int _countdown; // Operations left until the next sample
+	uint32 _rng;
+	LatencyHistogram* _histogram;
+
+	uint64 Rearm()
+	{
+		if (_period <= 0) {
+			_countdown = INT_MAX;
+			return 0;
+		}
+		if (_random) {
+			_rng ^= _rng << 13; _rng ^= _rng >> 17; _rng ^= _rng << 5; // xorshift32
+			_countdown = 1 + (int)(_rng % (uint32)(2 * _period - 1));
+		} else
+			_countdown = _period;
+		return _histogram != NULL ? Now() : 0;
+	}
+};
+
+/// <summary>Times the operation in its scope if the sampler selects it
+/// (see <see cref="LatencySampler"/>).</summary>
+class LatencySample
+{
+public:
+	explicit LatencySample(LatencySampler& sampler) : _sampler(sampler), _start(sampler.Begin()) { }
+	~LatencySample() { _sampler.End(_start); }
+
+protected:
+	LatencySampler& _sampler;
+	uint64 _start;
+
+private: // not copyable
+	LatencySample(const LatencySample&);
+	LatencySample& operator=(const LatencySample&);
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+#include "num_traits.h"
+#include <string>
+
+#ifndef WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef WIN32
+
+MappedFile::MappedFile() : _data(NULL), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(NULL) {}
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+
+	int length = MultiByteToWideChar(CP_ACP, 0, path, -1, NULL, 0);
+	if (length <= 0)
+		return false;
+	std::wstring wpath(length, L'\0');
+	MultiByteToWideChar(CP_ACP, 0, path, -1, &wpath[0], length);
+
+	#ifdef UNDER_CE
+	_file = CreateFileForMappingW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	#else
+	_file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	#endif
+	if (_file == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD sizeHigh = 0;
+	DWORD sizeLow = GetFileSize(_file, &sizeHigh);
+	uint64 size = ((uint64)sizeHigh << 32) | sizeLow;
+	if ((sizeLow == INVALID_FILE_SIZE && GetLastError() != NO_ERROR) || size == 0 || size != (size_t)size) {
+		Close();
+		return false;
+	}
+	_mapping = CreateFileMappingW(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_mapping == NULL) {
+		Close();
+		return false;
+	}
+	_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (_data == NULL) {
+		Close();
+		return false;
+	}
+	_size = (size_t)size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (_data != NULL)
+		UnmapViewOfFile(_data);
+	if (_mapping != NULL)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+	_data = NULL;
+	_size = 0;
+	_mapping = NULL;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+MappedFile::MappedFile() : _data(NULL), _size(0) {}
+
+bool MappedFile::Open(const char* path)
+{
+	Close();
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || (off_t)(size_t)st.st_size != st.st_size) {
+		close(fd);
+		return false;
+	}
+	// The mapping keeps its own reference to the file, so fd can be closed
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	_data = (const char*)data;
+	_size = (size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (_data != NULL)
+		munmap((void*)_data, _size);
+	_data = NULL;
+	_size = 0;
+}
+
+#endif
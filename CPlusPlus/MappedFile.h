@@ -0,0 +1,46 @@
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#include <stddef.h>
+
+/// <summary>
+/// A read-only view of a whole file, mapped into memory (MapViewOfFile on
+/// Windows, mmap elsewhere).
+/// </summary>
+/// <remarks>
+/// Opening a mapped file costs the same whatever the size of the file: the
+/// OS reads pages in when they are first touched, and pages that are already
+/// in the file cache are shared rather than copied. The data stays valid
+/// until Close() is called or the MappedFile is destroyed.
+/// <para/>
+/// An empty file cannot be mapped; Open() fails for it.
+/// </remarks>
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile() { Close(); }
+
+	/// <summary>Maps the specified file, closing the current one first.
+	/// Returns false if the file could not be opened or mapped.</summary>
+	bool Open(const char* path);
+	void Close();
+
+	bool IsOpen() const { return _data != NULL; }
+	const char* Data() const { return _data; }
+	size_t Size() const { return _size; }
+
+protected:
+	const char* _data;
+	size_t _size;
+	#ifdef WIN32
+	void* _file;    // HANDLE
+	void* _mapping; // HANDLE
+	#endif
+
+private: // not copyable
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+#endif
@@ -0,0 +1,243 @@
+#include "stdafx.h"
+#include "MetricsExporter.h"
+#include "Benchmarker.h"
+
+#include <winsock.h>
+#pragma comment(lib, "wsock32.lib")
+using namespace std;
+
+MetricsExporter::MetricsExporter()
+	: _snapshot(NULL), _listener(INVALID_SOCKET), _thread(NULL), _stopping(false)
+{
+}
+
+bool MetricsExporter::Start(int port)
+{
+	Stop();
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(1, 1), &wsa) != 0)
+		return false;
+	_listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (_listener == INVALID_SOCKET) {
+		WSACleanup();
+		return false;
+	}
+
+	int yes = 1;
+	setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never expose it to the network
+	if (bind(_listener, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		Stop();
+		return false;
+	}
+	return StartThread();
+}
+
+bool MetricsExporter::StartThread()
+{
+	if (listen(_listener, 4) == 0) {
+		_stopping = false;
+		_thread = CreateThread(NULL, 0, &ServerThread, this, 0, NULL);
+		if (_thread != NULL) {
+			SetThreadPriority(_thread, THREAD_PRIORITY_BELOW_NORMAL);
+			return true;
+		}
+	}
+	Stop();
+	return false;
+}
+
+void MetricsExporter::Stop()
+{
+	if (_thread != NULL) {
+		_stopping = true;
+		WaitForSingleObject(_thread, INFINITE);
+		CloseHandle(_thread);
+		_thread = NULL;
+	}
+	if (_listener != INVALID_SOCKET) {
+		closesocket(_listener);
+		_listener = INVALID_SOCKET;
+		WSACleanup();
+	}
+	delete (string*)InterlockedExchangePointer(&_snapshot, NULL);
+}
+
+void MetricsExporter::Publish(const Benchmarker::ResultMap& results, const Benchmarker::ErrorMap& errors, int trialsCompleted)
+{
+	string* fresh = new string(Format(results, errors, trialsCompleted));
+	// If the server has taken the old snapshot, it will notice that a new
+	// one has arrived and delete the old one itself.
+	delete (string*)InterlockedExchangePointer(&_snapshot, fresh);
+}
+
+DWORD WINAPI MetricsExporter::ServerThread(LPVOID param)
+{
+	MetricsExporter* self = (MetricsExporter*)param;
+	while (!self->_stopping)
+	{
+		// Wake up periodically to check _stopping
+		fd_set ready;
+		FD_ZERO(&ready);
+		FD_SET(self->_listener, &ready);
+		timeval timeout = { 0, PollMillisec * 1000 };
+		if (select((int)self->_listener + 1, &ready, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		socket_t client = accept(self->_listener, NULL, NULL);
+		if (client != INVALID_SOCKET) {
+			self->Serve(client);
+			closesocket(client);
+		}
+	}
+	return 0;
+}
+
+bool MetricsExporter::WaitForClient(socket_t client, bool write, const SimpleTimer& timer)
+{
+	// Wake up periodically to check _stopping and the deadline
+	while (!_stopping && timer.Millisec() < ClientTimeoutMillisec)
+	{
+		fd_set ready;
+		FD_ZERO(&ready);
+		FD_SET(client, &ready);
+		timeval timeout = { 0, PollMillisec * 1000 };
+		int n = select((int)client + 1, write ? NULL : &ready, write ? &ready : NULL, NULL, &timeout);
+		if (n != 0)
+			return n > 0;
+	}
+	return false;
+}
+
+void MetricsExporter::Serve(socket_t client)
+{
+	// A client that stalls must not block the server thread, or Stop() would
+	// never return: every recv() and send() waits for the socket with
+	// WaitForClient(), and a send() that blocks anyway (because the client
+	// stopped reading) gives up after PollMillisec.
+	SimpleTimer timer;
+	DWORD sendTimeout = PollMillisec;
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+
+	// Read the request line and headers. Only GET / and GET /metrics are
+	// supported; the request body, if any, is ignored.
+	string request;
+	char buf[512];
+	while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+		if (!WaitForClient(client, false, timer))
+			return;
+		int got = recv(client, buf, sizeof(buf), 0);
+		if (got <= 0)
+			break;
+		request.append(buf, got);
+	}
+
+	string status = "200 OK", body;
+	if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+	{
+		string* snapshot = (string*)InterlockedExchangePointer(&_snapshot, NULL);
+		if (snapshot != NULL) {
+			body = *snapshot;
+			if (InterlockedCompareExchangePointer(&_snapshot, snapshot, NULL) != NULL)
+				delete snapshot; // superseded while we were copying it
+		}
+	}
+	else
+	{
+		status = "404 Not Found";
+		body = "Try /metrics\n";
+	}
+
+	string response = printstring("HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: close\r\n\r\n", status.c_str(), (int)body.size());
+	response += body;
+	for (size_t sent = 0; sent < response.size(); ) {
+		if (!WaitForClient(client, true, timer))
+			break;
+		int n = send(client, response.data() + sent, (int)(response.size() - sent), 0);
+		if (n <= 0)
+			break;
+		sent += n;
+	}
+}
+
+string MetricsExporter::EscapeLabel(const string& value)
+{
+	string out;
+	for (size_t i = 0; i < value.size(); i++) {
+		if (value[i] == '\\' || value[i] == '"')
+			out += '\\';
+		if (value[i] == '\n')
+			out += "\\n";
+		else
+			out += value[i];
+	}
+	return out;
+}
+
+string MetricsExporter::Format(const Benchmarker::ResultMap& results, const Benchmarker::ErrorMap& errors, int trialsCompleted)
+{
+	string out;
+	out += "# HELP benchmark_trials_completed_total Trials finished since the run started.\n"
+	       "# TYPE benchmark_trials_completed_total counter\n";
+	out += printstring("benchmark_trials_completed_total %d\n", trialsCompleted);
+
+	Benchmarker::ResultMap::const_iterator it;
+	// A summary without quantiles: the Benchmarker keeps only the sum, count,
+	// minimum and maximum of trial times, and the extremes are not quantiles.
+	out += "# HELP benchmark_seconds Time per successful trial.\n"
+	       "# TYPE benchmark_seconds summary\n";
+	for (it = results.begin(); it != results.end(); ++it) {
+		string name = EscapeLabel(it->first);
+		out += printstring("benchmark_seconds_sum{benchmark=\"%s\"} %.6g\n", name.c_str(), it->second.SumTotal);
+		out += printstring("benchmark_seconds_count{benchmark=\"%s\"} %d\n", name.c_str(), it->second.Count);
+	}
+	out += "# HELP benchmark_min_seconds Time of the fastest successful trial.\n"
+	       "# TYPE benchmark_min_seconds gauge\n";
+	for (it = results.begin(); it != results.end(); ++it)
+		if (it->second.Count > 0)
+			out += printstring("benchmark_min_seconds{benchmark=\"%s\"} %.6g\n", EscapeLabel(it->first).c_str(), it->second.Min);
+	out += "# HELP benchmark_max_seconds Time of the slowest successful trial.\n"
+	       "# TYPE benchmark_max_seconds gauge\n";
+	for (it = results.begin(); it != results.end(); ++it)
+		if (it->second.Count > 0)
+			out += printstring("benchmark_max_seconds{benchmark=\"%s\"} %.6g\n", EscapeLabel(it->first).c_str(), it->second.Max);
+	out += "# HELP benchmark_mean_seconds Average time per successful trial.\n"
+	       "# TYPE benchmark_mean_seconds gauge\n";
+	for (it = results.begin(); it != results.end(); ++it)
+		if (it->second.Count > 0)
+			out += printstring("benchmark_mean_seconds{benchmark=\"%s\"} %.6g\n", EscapeLabel(it->first).c_str(), it->second.Avg());
+	out += "# HELP benchmark_stddev_seconds Standard deviation of trial times.\n"
+	       "# TYPE benchmark_stddev_seconds gauge\n";
+	for (it = results.begin(); it != results.end(); ++it)
+		if (it->second.Count > 1)
+			out += printstring("benchmark_stddev_seconds{benchmark=\"%s\"} %.6g\n", EscapeLabel(it->first).c_str(), it->second.StdDeviation());
+	out += "# HELP benchmark_op_latency_microseconds Latency of the operations sampled by Benchmarker::Sampler.\n"
+	       "# TYPE benchmark_op_latency_microseconds gauge\n";
+	for (it = results.begin(); it != results.end(); ++it) {
+		const LatencySummary& l = it->second.Latency;
+		if (l.Samples == 0)
+			continue;
+		string name = EscapeLabel(it->first);
+		out += printstring("benchmark_op_latency_microseconds{benchmark=\"%s\",quantile=\"0.5\"} %.6g\n", name.c_str(), l.P50);
+		out += printstring("benchmark_op_latency_microseconds{benchmark=\"%s\",quantile=\"0.99\"} %.6g\n", name.c_str(), l.P99);
+		out += printstring("benchmark_op_latency_microseconds{benchmark=\"%s\",quantile=\"1\"} %.6g\n", name.c_str(), l.Max);
+	}
+	out += "# HELP benchmark_failed_trials_total Trials that ended in an exception.\n"
+	       "# TYPE benchmark_failed_trials_total counter\n";
+	for (it = results.begin(); it != results.end(); ++it)
+		out += printstring("benchmark_failed_trials_total{benchmark=\"%s\"} %d\n", EscapeLabel(it->first).c_str(), it->second.Errors);
+
+	out += "# HELP benchmark_errors_total Exceptions thrown by benchmarks, by message.\n"
+	       "# TYPE benchmark_errors_total counter\n";
+	Benchmarker::ErrorMap::const_iterator e;
+	for (e = errors.begin(); e != errors.end(); ++e)
+		out += printstring("benchmark_errors_total{message=\"%s\"} %d\n", EscapeLabel(e->first).c_str(), e->second);
+	return out;
+}
@@ -0,0 +1,76 @@
+#ifndef _METRICSEXPORTER_H
+#define _METRICSEXPORTER_H
+
+#include <string>
+#include "flat_map.h"
+
+class BenchmarkStatistic;
+struct SimpleTimer;
+
+/// <summary>
+/// Serves the current benchmark statistics in the Prometheus text exposition
+/// format, so that a long-running benchmark or canary can be watched (or
+/// scraped) while it runs.
+/// </summary>
+/// <remarks>
+/// Call Start() to listen on a loopback TCP port and assign the exporter to
+/// Benchmarker::Metrics. Then, while benchmarks are running, try
+/// <code>
+///     curl http://127.0.0.1:9464/metrics
+/// </code>
+/// The benchmark thread is never involved in serving a request. The
+/// Benchmarker's reporter thread formats a complete snapshot after each trial
+/// and publishes it with Publish(), which swaps a pointer; the server thread
+/// takes the latest snapshot with another swap. Neither thread ever waits for
+/// the other. Clients are served one at a time, and a client that has not
+/// sent its request and received the response within ClientTimeoutMillisec
+/// is disconnected, so a stalled client delays later scrapes by at most that
+/// long, and Stop() returns within about PollMillisec.
+/// <para/>
+/// For each benchmark row, the exporter reports the total time and number of
+/// successful trials (benchmark_seconds_sum and _count), the fastest, slowest
+/// and mean trial times and their standard deviation, and the number of
+/// trials that failed. Error messages are reported with their counts.
+/// </remarks>
+class MetricsExporter
+{
+public:
+	MetricsExporter();
+	~MetricsExporter() { Stop(); }
+
+	/// <summary>Listens for HTTP requests on 127.0.0.1:port.</summary>
+	bool Start(int port);
+	void Stop();
+	bool IsRunning() const { return _thread != NULL; }
+
+	/// <summary>Replaces the snapshot that is served to clients.</summary>
+	/// <remarks>May be called by one thread at a time, concurrently with
+	/// the server thread.</remarks>
+	void Publish(const flat_map<std::string, BenchmarkStatistic, case_insensitive_less>& results, const flat_map<std::string, int>& errors, int trialsCompleted);
+
+	/// <summary>Formats results in the Prometheus text format.</summary>
+	static std::string Format(const flat_map<std::string, BenchmarkStatistic, case_insensitive_less>& results, const flat_map<std::string, int>& errors, int trialsCompleted);
+
+protected:
+	// The latest snapshot (a std::string*). Whichever thread swaps a snapshot
+	// out of this slot owns it; the server puts it back when it is done with
+	// it unless a newer one arrived in the meantime.
+	void* volatile _snapshot;
+
+	typedef size_t socket_t;
+	socket_t _listener;
+	HANDLE _thread;
+	volatile bool _stopping;
+	enum { PollMillisec = 250, ClientTimeoutMillisec = 2000 };
+
+	bool StartThread();
+	static DWORD WINAPI ServerThread(LPVOID self);
+	void Serve(socket_t client);
+	// Waits until the client socket is readable (or writable). Returns false
+	// if Stop() was called or the client has had ClientTimeoutMillisec since
+	// 'timer' started.
+	bool WaitForClient(socket_t client, bool write, const SimpleTimer& timer);
+	static std::string EscapeLabel(const std::string& value);
+};
+
+#endif
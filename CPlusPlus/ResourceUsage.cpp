@@ -0,0 +1,39 @@
+#include "stdafx.h"
+#include "ResourceUsage.h"
+
+#ifndef UNDER_CE
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+// QueryThreadCycleTime() is missing before Vista, so it is looked up at run
+// time. This happens during static initialization, before any benchmark
+// thread exists.
+typedef BOOL (WINAPI *QueryThreadCycleTimeFn)(HANDLE thread, PULONG64 cycles);
+static const QueryThreadCycleTimeFn QueryThreadCycles =
+	(QueryThreadCycleTimeFn)GetProcAddress(GetModuleHandleA("kernel32.dll"), "QueryThreadCycleTime");
+#endif
+
+static double FileTimeToSeconds(const FILETIME& ft)
+{
+	uint64 ticks = ((uint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+	return (double)(int64)ticks / 10000000.0; // FILETIME ticks are 100 ns
+}
+
+ResourceUsage ResourceUsage::Now()
+{
+	ResourceUsage u;
+	FILETIME creation, exit, kernel, user;
+	if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+		u.UserSec = FileTimeToSeconds(user);
+		u.SystemSec = FileTimeToSeconds(kernel);
+	}
+	#ifndef UNDER_CE
+	ULONG64 cycles;
+	if (QueryThreadCycles != NULL && QueryThreadCycles(GetCurrentThread(), &cycles))
+		u.CpuCycles = (int64)cycles;
+	PROCESS_MEMORY_COUNTERS mem;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem)))
+		u.ProcessPageFaults = mem.PageFaultCount;
+	#endif
+	return u;
+}
@@ -0,0 +1,62 @@
+#ifndef _RESOURCEUSAGE_H
+#define _RESOURCEUSAGE_H
+
+#include "num_traits.h"
+
+/// <summary>
+/// A snapshot of the resources used so far by the calling thread: CPU time,
+/// CPU cycles and (for the whole process) page faults.
+/// </summary>
+/// <remarks>
+/// Take a snapshot before and after a piece of code and subtract them to
+/// find out whether it was slow because of computation or page faults, or
+/// because the thread was not running at all (wall-clock time much larger
+/// than UserSec + SystemSec).
+/// <para/>
+/// Only counters that Windows documents are collected; counters that are
+/// unavailable are always zero. UserSec and SystemSec come from
+/// GetThreadTimes(), and CpuCycles from QueryThreadCycleTime(), which needs
+/// Windows Vista or later. Windows has no documented per-thread page fault
+/// counter, no split between soft and hard faults, and no context switch
+/// counts, so ProcessPageFaults is the process-wide PageFaultCount (soft and
+/// hard faults of every thread) and context switches are not measured at
+/// all. Windows CE supplies only CPU time.
+/// </remarks>
+struct ResourceUsage
+{
+	double UserSec;          // CPU time the thread spent in user mode
+	double SystemSec;        // CPU time the thread spent in the kernel
+	int64 CpuCycles;         // CPU cycles charged to the thread
+	int64 ProcessPageFaults; // page faults of the whole process, soft or hard
+
+	ResourceUsage() { Clear(); }
+	void Clear()
+	{
+		UserSec = SystemSec = 0;
+		CpuCycles = ProcessPageFaults = 0;
+	}
+
+	/// <summary>Returns the resources used by the calling thread so far.</summary>
+	static ResourceUsage Now();
+
+	ResourceUsage& operator+=(const ResourceUsage& b)
+	{
+		UserSec += b.UserSec;
+		SystemSec += b.SystemSec;
+		CpuCycles += b.CpuCycles;
+		ProcessPageFaults += b.ProcessPageFaults;
+		return *this;
+	}
+	ResourceUsage& operator-=(const ResourceUsage& b)
+	{
+		UserSec -= b.UserSec;
+		SystemSec -= b.SystemSec;
+		CpuCycles -= b.CpuCycles;
+		ProcessPageFaults -= b.ProcessPageFaults;
+		return *this;
+	}
+	ResourceUsage operator-(const ResourceUsage& b) const { ResourceUsage a(*this); return a -= b; }
+	ResourceUsage operator+(const ResourceUsage& b) const { ResourceUsage a(*this); return a += b; }
+};
+
+#endif
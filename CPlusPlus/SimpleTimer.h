@@ -85,4 +85,31 @@ struct SimpleTimer
 	}
 };
 
+// A stopwatch based on QueryPerformanceCounter, for timing operations that
+// take microseconds (GetTickCount() has a resolution of 1 to 16 ms).
+struct PreciseTimer
+{
+	LONGLONG Start;
+	PreciseTimer() { Start = Now(); }
+	double Microsec() const { return (Now() - Start) * MicrosecPerTick(); }
+	void Reset() { Start = Now(); }
+
+	static LONGLONG Now()
+	{
+		LARGE_INTEGER t;
+		QueryPerformanceCounter(&t);
+		return t.QuadPart;
+	}
+	static double MicrosecPerTick()
+	{
+		static double perTick = 0;
+		if (perTick == 0) {
+			LARGE_INTEGER f;
+			QueryPerformanceFrequency(&f);
+			perTick = 1e6 / (double)f.QuadPart;
+		}
+		return perTick;
+	}
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,251 @@
+#include "stdafx.h"
+#include <math.h>
+#include <assert.h>
+#include "Workload.h"
+using namespace std;
+
+/// <summary>SplitMix64: a small, fast random number generator whose output
+/// is the same on every platform, unlike rand().</summary>
+class WorkloadRandom
+{
+public:
+	explicit WorkloadRandom(uint64 seed) : _state(seed) { }
+
+	uint64 Next()
+	{
+		uint64 z = (_state += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+	// Returns a number in [0, 1)
+	double NextDouble() { return (double)(int64)(Next() >> 11) * (1.0 / 9007199254740992.0); }
+	// Returns a number in [0, n)
+	int NextInt(int n) { return (int)(((Next() >> 32) * (uint64)n) >> 32); }
+
+protected:
+	uint64 _state;
+};
+
+/// <summary>Chooses ranks 0 to Count() - 1, rank r with probability
+/// proportional to 1/(r+1)^theta, where 0 &lt; theta &lt; 1.</summary>
+/// <remarks>This is the method of Gray et al., "Quickly Generating
+/// Billion-Record Synthetic Databases", which YCSB also uses. It needs the
+/// sum zeta(n) = 1/1^theta + ... + 1/n^theta, which SetCount extends
+/// incrementally as inserts make n grow.</remarks>
+class ZipfianGenerator
+{
+public:
+	explicit ZipfianGenerator(double theta) : _theta(theta), _n(0), _zetan(0), _eta(0)
+	{
+		assert(theta > 0 && theta < 1);
+		_zeta2 = 1 + pow(0.5, theta);
+		_alpha = 1 / (1 - theta);
+	}
+
+	void SetCount(int n)
+	{
+		assert(n >= _n);
+		for (; _n < n; _n++)
+			_zetan += 1 / pow((double)(_n + 1), _theta);
+		if (_n > 2) // otherwise Next() never uses _eta
+			_eta = (1 - pow(2.0 / _n, 1 - _theta)) / (1 - _zeta2 / _zetan);
+	}
+	int Count() const { return _n; }
+
+	int Next(WorkloadRandom& random) const
+	{
+		double u = random.NextDouble(), uz = u * _zetan;
+		if (uz < 1)
+			return 0;
+		if (uz < _zeta2)
+			return 1;
+		int rank = (int)(_n * pow(_eta * u - _eta + 1, _alpha));
+		return rank < _n ? rank : _n - 1;
+	}
+
+protected:
+	double _theta, _alpha, _zeta2;
+	int _n;
+	double _zetan, _eta;
+};
+
+WorkloadSpec::WorkloadSpec()
+	: RecordCount(1000), OperationCount(10000)
+	, ReadFraction(1), UpdateFraction(0), InsertFraction(0), DeleteFraction(0)
+	, ReadModifyWriteFraction(0), ScanFraction(0), MaxScanLength(100)
+	, Distribution(UniformKeys), ZipfTheta(0.99)
+	, HotKeyFraction(0.2), HotOpFraction(0.8), ShiftPeriod(100000)
+	, KeyLengths(FixedLength), MinKeyLength(8), MaxKeyLength(16)
+	, Seed(314159)
+{
+}
+
+WorkloadSpec WorkloadSpec::Ycsb(char workload, int recordCount, int operationCount)
+{
+	WorkloadSpec spec;
+	spec.Name = printstring("YCSB %c", workload);
+	spec.RecordCount = recordCount;
+	spec.OperationCount = operationCount;
+	spec.Distribution = ZipfianKeys;
+	switch (workload) {
+	case 'A': spec.ReadFraction = 0.5;  spec.UpdateFraction = 0.5; break;
+	case 'B': spec.ReadFraction = 0.95; spec.UpdateFraction = 0.05; break;
+	case 'C': spec.ReadFraction = 1; break;
+	case 'D': spec.ReadFraction = 0.95; spec.InsertFraction = 0.05;
+	          spec.Distribution = LatestKeys; break;
+	case 'E': spec.ReadFraction = 0;    spec.ScanFraction = 0.95; spec.InsertFraction = 0.05; break;
+	case 'F': spec.ReadFraction = 0.5;  spec.ReadModifyWriteFraction = 0.5; break;
+	default: assert(false);
+	}
+	return spec;
+}
+
+string WorkloadSpec::ToString() const
+{
+	string s;
+	const double fractions[] = { ReadFraction, UpdateFraction, InsertFraction,
+		DeleteFraction, ReadModifyWriteFraction, ScanFraction };
+	const char* names[] = { "read", "update", "insert", "delete", "read-modify-write", "scan" };
+	for (int i = 0; i < 6; i++)
+		if (fractions[i] > 0)
+			s += printstring("%s%g%% %s", s.empty() ? "" : ", ", fractions[i] * 100, names[i]);
+	switch (Distribution) {
+	case UniformKeys: s += "; uniform"; break;
+	case ZipfianKeys: s += printstring("; zipfian %g", ZipfTheta); break;
+	case LatestKeys:  s += printstring("; latest %g", ZipfTheta); break;
+	case HotspotKeys: s += printstring("; hotspot %g%%/%g%%", HotOpFraction * 100, HotKeyFraction * 100); break;
+	case ShiftingHotspotKeys:
+		s += printstring("; hotspot %g%%/%g%% shifting every %d", HotOpFraction * 100, HotKeyFraction * 100, ShiftPeriod);
+		break;
+	}
+	return s;
+}
+
+static int ChooseKey(const WorkloadSpec& spec, int keyCount, int opIndex, WorkloadRandom& random, const ZipfianGenerator& zipf)
+{
+	switch (spec.Distribution) {
+	case ZipfianKeys:
+		return zipf.Next(random);
+	case LatestKeys:
+		return keyCount - 1 - zipf.Next(random);
+	case HotspotKeys:
+	case ShiftingHotspotKeys: {
+		int hot = (int)(spec.HotKeyFraction * keyCount);
+		hot = hot < 1 ? 1 : hot > keyCount ? keyCount : hot;
+		int start = 0;
+		if (spec.Distribution == ShiftingHotspotKeys && spec.ShiftPeriod > 0)
+			start = (int)((int64)(opIndex / spec.ShiftPeriod) * hot % keyCount);
+		if (hot == keyCount || random.NextDouble() < spec.HotOpFraction)
+			return (start + random.NextInt(hot)) % keyCount;
+		return (start + hot + random.NextInt(keyCount - hot)) % keyCount;
+	}
+	default:
+		return random.NextInt(keyCount);
+	}
+}
+
+void WorkloadTrace::Generate(const WorkloadSpec& spec)
+{
+	Clear();
+	_spec = spec;
+	_keyCount = spec.RecordCount;
+	_ops.reserve(spec.OperationCount);
+
+	WorkloadRandom random(spec.Seed);
+	bool zipfian = spec.Distribution == ZipfianKeys || spec.Distribution == LatestKeys;
+	ZipfianGenerator zipf(spec.ZipfTheta);
+	if (zipfian)
+		zipf.SetCount(_keyCount);
+
+	// A scan emits (1 + MaxScanLength) / 2 reads on average, so scans are
+	// started that much less often than ScanFraction, in order for
+	// ScanFraction of the emitted operations to be scan reads.
+	int maxScanLength = spec.MaxScanLength > 0 ? spec.MaxScanLength : 1;
+	double scanStartFraction = spec.ScanFraction / ((1 + maxScanLength) / 2.0);
+	double total = 1 - spec.ScanFraction + scanStartFraction;
+
+	while ((int)_ops.size() < spec.OperationCount)
+	{
+		double r = random.NextDouble() * total;
+		WorkloadOpType type = OpRead;
+		bool scan = false;
+		if ((r -= spec.ReadFraction) < 0)
+			type = OpRead;
+		else if ((r -= spec.UpdateFraction) < 0)
+			type = OpUpdate;
+		else if ((r -= spec.InsertFraction) < 0)
+			type = OpInsert;
+		else if ((r -= spec.DeleteFraction) < 0)
+			type = OpDelete;
+		else if ((r -= spec.ReadModifyWriteFraction) < 0)
+			type = OpReadModifyWrite;
+		else
+			scan = (r -= scanStartFraction) < 0;
+
+		if (type == OpInsert || _keyCount == 0) {
+			assert(_keyCount < (1 << WorkloadOp::KeyBits));
+			_ops.push_back(WorkloadOp(OpInsert, _keyCount++));
+			if (zipfian)
+				zipf.SetCount(_keyCount);
+			continue;
+		}
+
+		int key = ChooseKey(spec, _keyCount, (int)_ops.size(), random, zipf);
+		if (scan) {
+			int length = 1 + random.NextInt(maxScanLength);
+			for (int i = 0; i < length && (int)_ops.size() < spec.OperationCount; i++)
+				_ops.push_back(WorkloadOp(OpRead, (key + i) % _keyCount));
+		} else
+			_ops.push_back(WorkloadOp(type, key));
+	}
+}
+
+void WorkloadTrace::Clear()
+{
+	vector<WorkloadOp>().swap(_ops);
+	_keyCount = 0;
+}
+
+int WorkloadTrace::Count(WorkloadOpType type) const
+{
+	int count = 0;
+	for (size_t i = 0; i < _ops.size(); i++)
+		if (_ops[i].Type() == type)
+			count++;
+	return count;
+}
+
+void WorkloadTrace::StringKeys(const WorkloadSpec& spec, int count, OUT vector<string>& keys)
+{
+	static const char Digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+	const int Base = sizeof(Digits) - 1; // 62^6 > 2^32, so 6 digits identify any key
+
+	int minLength = spec.MinKeyLength > KeyIdLength ? spec.MinKeyLength : KeyIdLength;
+	int maxLength = spec.MaxKeyLength > minLength ? spec.MaxKeyLength : minLength;
+	ZipfianGenerator lengths(0.99);
+	if (spec.KeyLengths == ZipfianLength)
+		lengths.SetCount(maxLength - minLength + 1);
+
+	keys.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		// Derive the key's length and padding from the index alone, so
+		// that the key of an index does not depend on count.
+		WorkloadRandom random(spec.Seed ^ ((uint64)(uint32)i * 0xd6e8feb86659fd93ull));
+		int length;
+		switch (spec.KeyLengths) {
+		case UniformLength: length = minLength + random.NextInt(maxLength - minLength + 1); break;
+		case ZipfianLength: length = minLength + lengths.Next(random); break;
+		default: length = maxLength; break;
+		}
+
+		string& key = keys[i];
+		key.resize(length);
+		uint32 id = (uint32)IntKey(i);
+		for (int c = 0; c < KeyIdLength; c++, id /= Base)
+			key[c] = Digits[id % Base];
+		for (int c = KeyIdLength; c < length; c++)
+			key[c] = Digits[random.NextInt(Base)];
+	}
+}
@@ -0,0 +1,154 @@
+#ifndef _WORKLOAD_H
+#define _WORKLOAD_H
+
+#include <string>
+#include <vector>
+#include "Misc.h"
+
+/// <summary>How a workload chooses the key of each operation.</summary>
+enum KeyDistribution
+{
+	UniformKeys,     // every key equally likely
+	ZipfianKeys,     // key of rank r has probability proportional to 1/(r+1)^ZipfTheta
+	LatestKeys,      // Zipfian, but the most recently inserted keys are the most popular
+	HotspotKeys,     // HotOpFraction of the operations go to HotKeyFraction of the keys
+	ShiftingHotspotKeys // like HotspotKeys, but the hot set moves every ShiftPeriod operations
+};
+
+/// <summary>How the lengths of string keys are distributed (see
+/// <see cref="WorkloadTrace::StringKeys"/>).</summary>
+enum KeyLengthDistribution
+{
+	FixedLength,     // every key has MaxKeyLength characters
+	UniformLength,   // lengths from MinKeyLength to MaxKeyLength are equally likely
+	ZipfianLength    // short keys are common and long keys are rare
+};
+
+enum WorkloadOpType
+{
+	OpRead,          // look up a key
+	OpUpdate,        // set the value of a key, which normally exists
+	OpInsert,        // add a key that has never been used before
+	OpDelete,        // remove a key, which may have been removed already
+	OpReadModifyWrite // look up a key and change its value in place
+};
+
+/// <summary>Describes a mix of operations on a table and the keys they use,
+/// in the manner of the Yahoo! Cloud Serving Benchmark (YCSB).</summary>
+/// <remarks>
+/// The fractions of the five operation types (plus scans) should add up to
+/// 1. A table is first loaded with RecordCount keys; then OperationCount
+/// operations run against it.
+/// <para/>
+/// Hashtables cannot scan a range of keys, so a scan (as in YCSB workload E)
+/// is generated as a run of 1 to MaxScanLength reads of consecutive key
+/// indexes, each of which counts as one operation. The fractions apply to
+/// the operations of the trace, not to the scans: in workload E, 95% of the
+/// operations are reads that belong to scans and 5% are inserts.
+/// </remarks>
+struct WorkloadSpec
+{
+	WorkloadSpec();
+
+	std::string Name;
+	int RecordCount;        // keys loaded before the operations run
+	int OperationCount;
+
+	double ReadFraction;
+	double UpdateFraction;
+	double InsertFraction;
+	double DeleteFraction;
+	double ReadModifyWriteFraction;
+	double ScanFraction;
+	int MaxScanLength;
+
+	KeyDistribution Distribution;
+	double ZipfTheta;       // skew of ZipfianKeys and LatestKeys (0.99 in YCSB)
+	double HotKeyFraction;  // size of the hot set of the hotspot distributions
+	double HotOpFraction;   // fraction of the operations that use the hot set
+	int ShiftPeriod;        // operations between moves of a shifting hotspot
+
+	KeyLengthDistribution KeyLengths;
+	int MinKeyLength;       // at least KeyIdLength (see WorkloadTrace::StringKeys)
+	int MaxKeyLength;
+
+	uint64 Seed;            // equal specs with equal seeds give equal traces
+
+	/// <summary>Returns the standard YCSB workload 'A' to 'F'.</summary>
+	/// <remarks>A: 50% reads, 50% updates. B: 95% reads, 5% updates.
+	/// C: reads only. D: 95% reads, 5% inserts, reading the latest keys
+	/// most. E: 95% scans, 5% inserts. F: 50% reads, 50% read-modify-writes.
+	/// All but D use Zipfian keys.</remarks>
+	static WorkloadSpec Ycsb(char workload, int recordCount, int operationCount);
+
+	/// <summary>Summarizes the spec, e.g. "50% read, 50% update; zipfian 0.99".</summary>
+	std::string ToString() const;
+};
+
+/// <summary>One operation of a trace: a type and the index of a key.</summary>
+/// <remarks>Key indexes are 0 to WorkloadTrace::KeyCount() - 1; use
+/// WorkloadTrace::IntKey or WorkloadTrace::StringKeys to get the keys themselves.
+/// An operation takes 4 bytes, so that a trace of millions of operations
+/// disturbs the cache as little as possible while it is replayed.</remarks>
+struct WorkloadOp
+{
+	WorkloadOp(WorkloadOpType type, int key) : Bits((uint32)key | ((uint32)type << KeyBits)) { }
+	WorkloadOpType Type() const { return (WorkloadOpType)(Bits >> KeyBits); }
+	int Key() const { return (int)(Bits & ((1u << KeyBits) - 1)); }
+
+	enum { KeyBits = 29 };
+	uint32 Bits;
+};
+
+/// <summary>A pre-generated sequence of operations that can be replayed
+/// against any kind of table, so that every table sees exactly the same
+/// keys in the same order.</summary>
+/// <remarks>
+/// Generate() is deterministic: the same spec always gives the same trace.
+/// The keys of a trace are identified by index. Keys 0 to RecordCount - 1
+/// are loaded before the trace runs, and each insert uses the next unused
+/// index. IntKey() scrambles an index into an int key, so that popular keys
+/// are not adjacent, and StringKeys() makes string keys of the lengths that
+/// the spec's key-length distribution prescribes.
+/// </remarks>
+class WorkloadTrace
+{
+public:
+	WorkloadTrace() : _keyCount(0) { }
+
+	void Generate(const WorkloadSpec& spec);
+	void Clear();
+
+	const WorkloadSpec& Spec() const { return _spec; }
+	const std::vector<WorkloadOp>& Ops() const { return _ops; }
+	/// <summary>Number of key indexes used: records plus inserts.</summary>
+	int KeyCount() const { return _keyCount; }
+	/// <summary>Number of operations of each type.</summary>
+	int Count(WorkloadOpType type) const;
+
+	/// <summary>Returns the int key of a key index. Different indexes
+	/// give different keys.</summary>
+	static int IntKey(int index)
+	{
+		uint32 h = (uint32)index;
+		h ^= h >> 16; h *= 0x85ebca6bu;
+		h ^= h >> 13; h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return (int)h;
+	}
+	/// <summary>Makes the string keys of key indexes 0 to count - 1. Key
+	/// i consists of KeyIdLength characters that identify IntKey(i), padded
+	/// with pseudo-random characters to a length chosen by spec.KeyLengths.
+	/// </summary><remarks>The key of an index depends only on the index and
+	/// the spec's key-length settings and seed, so traces generated from
+	/// specs that share those settings can share one list of keys.</remarks>
+	static void StringKeys(const WorkloadSpec& spec, int count, OUT std::vector<std::string>& keys);
+	enum { KeyIdLength = 6 };
+
+protected:
+	WorkloadSpec _spec;
+	std::vector<WorkloadOp> _ops;
+	int _keyCount;
+};
+
+#endif
@@ -0,0 +1,245 @@
+//
+// arena_allocator.h
+//
+#ifndef _ARENA_ALLOCATOR_H
+#define _ARENA_ALLOCATOR_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// memory_arena ///////////////////////////////////////////////////////////////
+//
+// A monotonic arena: allocate() bumps a pointer through chunks of chunkBytes
+// (64 KB by default), and memory is only returned all at once, by release()
+// or the destructor. A request larger than a quarter of a chunk gets a chunk
+// of its own. release() keeps one ordinary chunk for reuse, so an arena that
+// is released after every request does not go back to the heap each time.
+//
+// Unlike std::pmr::monotonic_buffer_resource, it needs no C++17 library, so
+// arena_allocator works with every compiler that builds this project.
+///////////////////////////////////////////////////////////////////////////////
+class memory_arena
+{
+public:
+	// Every allocation is aligned to Align bytes
+	enum { Align = 16 };
+
+	explicit memory_arena(size_t chunkBytes = 64 * 1024)
+		: _chunkBytes(chunkBytes), _next(NULL), _end(NULL), _spare(NULL), _bytes(0) { }
+	~memory_arena()
+	{
+		release();
+		::operator delete(_spare);
+	}
+
+	void* allocate(size_t bytes)
+	{
+		bytes = bytes ? (bytes + Align - 1) & ~(size_t)(Align - 1) : Align;
+		if (bytes > _chunkBytes / 4)
+			return NewChunk(_large, bytes);
+		if ((size_t)(_end - _next) < bytes) {
+			_next = NewChunk(_chunks, _chunkBytes);
+			_end = _next + _chunkBytes;
+		}
+		char* p = _next;
+		_next += bytes;
+		return p;
+	}
+	// Frees everything allocated so far
+	void release()
+	{
+		for (size_t i = 0; i < _chunks.size(); i++)
+			if (_spare == NULL)
+				_spare = _chunks[i];
+			else
+				::operator delete(_chunks[i]);
+		for (size_t i = 0; i < _large.size(); i++)
+			::operator delete(_large[i]);
+		_chunks.clear();
+		_large.clear();
+		_next = _end = NULL;
+		_bytes = 0;
+	}
+	// Bytes obtained for the allocations made since the last release()
+	size_t bytes_allocated() const { return _bytes; }
+
+protected:
+	std::vector<char*> _chunks; // Chunks of _chunkBytes
+	std::vector<char*> _large;  // Chunks of their own for large requests
+	size_t _chunkBytes;
+	char* _next;  // Free space in the current chunk
+	char* _end;
+	char* _spare; // A chunk of _chunkBytes kept by release()
+	size_t _bytes;
+
+	char* NewChunk(std::vector<char*>& list, size_t bytes)
+	{
+		list.reserve(list.size() + 1);
+		char* chunk;
+		if (&list == &_chunks && _spare != NULL) {
+			chunk = _spare;
+			_spare = NULL;
+		} else
+			chunk = (char*)::operator new(bytes);
+		list.push_back(chunk);
+		_bytes += bytes;
+		return chunk;
+	}
+
+private: // not copyable, since allocators point to it
+	memory_arena(const memory_arena&);
+	memory_arena& operator=(const memory_arena&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// memory_pool ////////////////////////////////////////////////////////////////
+//
+// A single-threaded pool of blocks in power-of-two size classes from 16 bytes
+// to MaxPooled (64 KB). deallocate() puts a block on the free list of its
+// class, and allocate() takes blocks from that list before carving new ones
+// out of a memory_arena, so a program that keeps allocating and freeing
+// blocks of similar sizes soon stops calling the heap at all. Larger blocks
+// come straight from operator new. Freed blocks are never returned to the
+// heap until release() or the destructor.
+///////////////////////////////////////////////////////////////////////////////
+class memory_pool
+{
+public:
+	enum { MinShift = 4, MaxShift = 16, MaxPooled = 1 << MaxShift };
+
+	explicit memory_pool(size_t chunkBytes = 256 * 1024) : _arena(chunkBytes)
+	{
+		for (int c = 0; c < Classes; c++)
+			_free[c] = NULL;
+	}
+
+	void* allocate(size_t bytes)
+	{
+		if (bytes > MaxPooled)
+			return ::operator new(bytes);
+		int c = ClassOf(bytes);
+		free_block* block = _free[c];
+		if (block == NULL)
+			return _arena.allocate((size_t)1 << (c + MinShift));
+		_free[c] = block->next;
+		return block;
+	}
+	void deallocate(void* p, size_t bytes)
+	{
+		if (p == NULL)
+			return;
+		if (bytes > MaxPooled) {
+			::operator delete(p);
+			return;
+		}
+		int c = ClassOf(bytes);
+		free_block* block = (free_block*)p;
+		block->next = _free[c];
+		_free[c] = block;
+	}
+	// Frees every pooled block, including those still in use. Blocks larger
+	// than MaxPooled must have been deallocated already.
+	void release()
+	{
+		_arena.release();
+		for (int c = 0; c < Classes; c++)
+			_free[c] = NULL;
+	}
+
+protected:
+	enum { Classes = MaxShift - MinShift + 1 };
+	struct free_block { free_block* next; };
+
+	free_block* _free[Classes];
+	memory_arena _arena;
+
+	static int ClassOf(size_t bytes)
+	{
+		int c = 0;
+		while (((size_t)1 << (c + MinShift)) < bytes)
+			c++;
+		return c;
+	}
+
+private: // not copyable, since allocators point to it
+	memory_pool(const memory_pool&);
+	memory_pool& operator=(const memory_pool&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// arena_allocator, pool_allocator ////////////////////////////////////////////
+//
+// Standard (C++03) allocators that get memory from a memory_arena or a
+// memory_pool, e.g. for hash_map<K, V, hash_traits<K>, prime_bucket_policy,
+// arena_allocator< std::pair<const K, V> > >. They hold only a pointer, and
+// copies (including rebound ones and those made when a container is copied)
+// share the arena or pool, which must outlive them. The arena or pool is not
+// thread-safe, so neither are containers that share one.
+///////////////////////////////////////////////////////////////////////////////
+template<class T, class Resource>
+class resource_allocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	resource_allocator(Resource* resource) : _resource(resource) { assert(resource != NULL); }
+	template<class U>
+	resource_allocator(const resource_allocator<U, Resource>& other) : _resource(other.resource()) { }
+
+	pointer allocate(size_type n, const void* = 0)
+		{ return static_cast<pointer>(_resource->allocate(n * sizeof(T))); }
+	void deallocate(pointer p, size_type n)
+		{ Deallocate(_resource, p, n * sizeof(T)); }
+
+	void construct(pointer p, const T& value) { new((void*)p) T(value); }
+	void destroy(pointer p) { p->~T(); }
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+	size_type max_size() const { return (size_t)-1 / sizeof(T); }
+
+	Resource* resource() const { return _resource; }
+	template<class U>
+	bool operator==(const resource_allocator<U, Resource>& other) const { return _resource == other.resource(); }
+	template<class U>
+	bool operator!=(const resource_allocator<U, Resource>& other) const { return _resource != other.resource(); }
+
+protected:
+	Resource* _resource;
+
+	// An arena frees nothing until it is released
+	static void Deallocate(memory_arena*, void*, size_t) { }
+	static void Deallocate(memory_pool* pool, void* p, size_t bytes) { pool->deallocate(p, bytes); }
+};
+
+template<class T>
+class arena_allocator : public resource_allocator<T, memory_arena>
+{
+public:
+	template<class U> struct rebind { typedef arena_allocator<U> other; };
+
+	arena_allocator(memory_arena* arena) : resource_allocator<T, memory_arena>(arena) { }
+	template<class U>
+	arena_allocator(const arena_allocator<U>& other) : resource_allocator<T, memory_arena>(other.resource()) { }
+};
+
+template<class T>
+class pool_allocator : public resource_allocator<T, memory_pool>
+{
+public:
+	template<class U> struct rebind { typedef pool_allocator<U> other; };
+
+	pool_allocator(memory_pool* pool) : resource_allocator<T, memory_pool>(pool) { }
+	template<class U>
+	pool_allocator(const pool_allocator<U>& other) : resource_allocator<T, memory_pool>(other.resource()) { }
+};
+
+#endif
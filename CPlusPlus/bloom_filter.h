@@ -0,0 +1,150 @@
+//
+// bloom_filter.h
+//
+#ifndef _BLOOM_FILTER_H
+#define _BLOOM_FILTER_H
+
+#include <assert.h>
+#include <algorithm>
+#include <memory>
+#include "num_traits.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// blocked_bloom_filter ///////////////////////////////////////////////////////
+//
+// A Bloom filter of 32-bit hash codes that answers "definitely absent" or
+// "maybe present". hash_set and hash_map can keep one in front of their
+// buckets (see hash_set::SetMissFilter) so that most lookups of missing keys
+// end without reading a bucket or walking a chain.
+//
+// This is a "split block" Bloom filter: the bits are divided into blocks of
+// 256 bits (eight 32-bit words, aligned so that a block never straddles a
+// cache line), a key selects one block, and it sets or tests one bit in each
+// of the block's eight words. So every Add or MayContain touches a single
+// cache line, unlike a classic Bloom filter, which reads k random lines. The
+// price is a somewhat higher false-positive rate for the same size: with
+// BitsPerKey = 12 bits per key, about 0.5% of the missing keys get through
+// when the filter is full.
+//
+// Keys cannot be removed; a removed key's bits stay set, which only raises
+// the false-positive rate until the filter is rebuilt with Reset and Add.
+///////////////////////////////////////////////////////////////////////////////
+template<class WordAlloc = std::allocator<uint32> >
+class blocked_bloom_filter : protected WordAlloc
+{
+public:
+	enum { BitsPerKey = 12, WordsPerBlock = 8 };
+
+	blocked_bloom_filter() : _raw(NULL), _rawCount(0), _words(NULL), _blocks(0), _capacity(0), _added(0) {}
+	template<class Alloc>
+	explicit blocked_bloom_filter(const Alloc& alloc)
+		: WordAlloc(alloc), _raw(NULL), _rawCount(0), _words(NULL), _blocks(0), _capacity(0), _added(0) {}
+	~blocked_bloom_filter() { Clear(); }
+
+	// Empties the filter and sizes it for the specified number of keys
+	void Reset(int capacity)
+	{
+		Clear();
+		if (capacity <= 0)
+			return;
+		uint32 blocks = (uint32)(((uint64)capacity * BitsPerKey + 255) / 256);
+		// Allocate enough spare words to align the blocks to 32 bytes
+		size_t count = (size_t)blocks * WordsPerBlock + WordsPerBlock - 1;
+		_raw = WordAlloc::allocate(count); // may throw
+		_rawCount = count;
+		_words = (uint32*)(((size_t)_raw + WordsPerBlock * 4 - 1) & ~(size_t)(WordsPerBlock * 4 - 1));
+		_blocks = blocks;
+		_capacity = capacity;
+		_added = 0;
+		std::fill(_words, _words + (size_t)blocks * WordsPerBlock, 0u);
+	}
+	// Frees the filter's memory; afterward MayContain() returns false for
+	// every key until Reset() is called.
+	void Clear()
+	{
+		if (_raw != NULL)
+			WordAlloc::deallocate(_raw, _rawCount);
+		_raw = _words = NULL;
+		_rawCount = 0;
+		_blocks = 0;
+		_capacity = 0;
+		_added = 0;
+	}
+
+	void Add(unsigned hash)
+	{
+		assert(_blocks > 0);
+		uint32* block = Block(Mix(hash));
+		uint32 bits = Mix(hash ^ 0x5bd1e995u);
+		for (int i = 0; i < WordsPerBlock; i++)
+			block[i] |= Mask(bits, i);
+		_added++;
+	}
+	// Returns false if no key with this hash code was added since Reset()
+	bool MayContain(unsigned hash) const
+	{
+		if (_blocks == 0)
+			return false;
+		const uint32* block = Block(Mix(hash));
+		uint32 bits = Mix(hash ^ 0x5bd1e995u);
+		for (int i = 0; i < WordsPerBlock; i++)
+			if ((block[i] & Mask(bits, i)) == 0)
+				return false;
+		return true;
+	}
+
+	// Number of keys the filter was sized for; past that, the false-positive
+	// rate climbs quickly.
+	int Capacity() const { return _capacity; }
+	// Number of calls to Add() since Reset(), including repeated hash codes
+	// and keys that have since been removed from the table
+	int Added() const { return _added; }
+	size_t Bytes() const { return _rawCount * sizeof(uint32); }
+
+	void swap(blocked_bloom_filter& other)
+	{
+		std::swap(_raw, other._raw);
+		std::swap(_rawCount, other._rawCount);
+		std::swap(_words, other._words);
+		std::swap(_blocks, other._blocks);
+		std::swap(_capacity, other._capacity);
+		std::swap(_added, other._added);
+	}
+
+protected:
+	uint32* _raw;      // Memory from the allocator
+	size_t _rawCount;
+	uint32* _words;    // The blocks, at the first 32-byte boundary in _raw
+	uint32 _blocks;
+	int _capacity;
+	int _added;
+
+	// Hash codes are often poor (e.g. the identity hash of hash_traits<int>),
+	// so they are scrambled with MurmurHash3's finalizer: once to choose the
+	// block and, with a different input, again to choose the bits.
+	static uint32 Mix(uint32 h)
+	{
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+	uint32* Block(uint32 mixed) const
+		{ return _words + (size_t)(((uint64)mixed * _blocks) >> 32) * WordsPerBlock; }
+	// The bit of word i: the top 5 bits of bits * (an odd constant per word)
+	static uint32 Mask(uint32 bits, int i)
+	{
+		static const uint32 Salt[WordsPerBlock] = {
+			0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+			0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u };
+		return 1u << ((bits * Salt[i]) >> 27);
+	}
+
+private: // not copyable
+	blocked_bloom_filter(const blocked_bloom_filter&);
+	blocked_bloom_filter& operator=(const blocked_bloom_filter&);
+};
+
+#endif
@@ -0,0 +1,818 @@
+//
+// btree_map.h
+//
+#ifndef _BTREE_MAP_H
+#define _BTREE_MAP_H
+
+#include <assert.h>
+#include <functional>
+#include <iterator>
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include "mini_vector.h"
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#include <emmintrin.h>
+	#define BTREE_SSE2
+#endif
+
+// Searches the sorted keys of a btree_map node. lower_bound returns the index
+// of the first key that is not less than key and upper_bound the index of
+// the first key that is greater than key (count if there is none).
+template<class TKey, class Compare>
+struct btree_search
+{
+	static int lower_bound(const TKey* keys, int count, const TKey& key, const Compare& less)
+		{ return (int)(std::lower_bound(keys, keys + count, key, less) - keys); }
+	static int upper_bound(const TKey* keys, int count, const TKey& key, const Compare& less)
+		{ return (int)(std::upper_bound(keys, keys + count, key, less) - keys); }
+};
+#ifdef BTREE_SSE2
+// For int keys, the keys of a node are compared with the search key four at
+// a time. Nodes are small enough that this linear scan beats a binary search,
+// whose branches are unpredictable.
+template<>
+struct btree_search< int, std::less<int> >
+{
+	static int lower_bound(const int* keys, int count, int key, const std::less<int>&)
+	{
+		__m128i k = _mm_set1_epi32(key);
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+			// The lanes with keys less than key come first, since keys are sorted
+			__m128i less = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), k);
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(less));
+			if (mask != 0xF)
+				return i + BitCount(mask);
+		}
+		while (i < count && keys[i] < key)
+			i++;
+		return i;
+	}
+	static int upper_bound(const int* keys, int count, int key, const std::less<int>&)
+	{
+		__m128i k = _mm_set1_epi32(key);
+		int i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128i greater = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(keys + i)), k);
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(greater));
+			if (mask != 0)
+				return i + 4 - BitCount(mask);
+		}
+		while (i < count && keys[i] <= key)
+			i++;
+		return i;
+	}
+	static int BitCount(int mask4) { return "\0\1\1\2\1\2\2\3\1\2\2\3\2\3\3\4"[mask4]; }
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// btree_map //////////////////////////////////////////////////////////////////
+//
+// An ordered map implemented as a B+ tree: all key-value pairs are stored in
+// leaf nodes, which are linked together in key order, and the inner nodes
+// above them hold only separator keys and child pointers. Compared with
+// std::map, which allocates a node for each pair and chases a pointer per
+// comparison, each node here holds many keys in a contiguous array of about
+// NodeBytes, so a lookup touches a handful of nodes, and iterating in order
+// reads memory sequentially. The default of 512 bytes (eight cache lines)
+// was faster than smaller nodes with a million int keys, since the tree is
+// shallower. For int keys with the default comparer, the keys of a node are
+// searched with SSE2 (see btree_search).
+//
+// Like EasyMap, btree_map offers .NET-style methods (TryGet, Get, Contains,
+// Remove, TryAdd, Add, GetOrAdd) in addition to the std::map interface.
+// bulk_load builds a tree from sorted data in linear time, with full nodes.
+//
+// Differences from std::map:
+// - Keys and values are stored in separate arrays, so that the keys of a
+//   node can be searched without touching the values. An iterator therefore
+//   yields an entry_ref, a pair of references (it->first and it->second work
+//   as usual), rather than a reference to a std::pair.
+// - Inserting or removing a pair moves other pairs within and between nodes,
+//   so it invalidates all iterators (erase(iterator) returns a valid one).
+// - TKey and TValue must be default-constructible and assignable, because
+//   the arrays of a node are constructed with the node.
+///////////////////////////////////////////////////////////////////////////////
+template<class TKey, class TValue, class Compare = std::less<TKey>, int NodeBytes = 512>
+class btree_map : protected Compare
+{
+public:
+	typedef TKey key_type;
+	typedef TValue mapped_type;
+	typedef std::pair<const TKey, TValue> value_type;
+	typedef Compare key_compare;
+	typedef size_t size_type;
+	typedef btree_map<TKey, TValue, Compare, NodeBytes> btree_map_t;
+
+	// What an iterator points to. operator-> returns the entry_ref itself, so
+	// that it->first and it->second work even though it is not stored.
+	template<class V>
+	struct entry_ref
+	{
+		entry_ref(const TKey& first, V& second) : first(first), second(second) {}
+		const entry_ref* operator->() const { return this; }
+		operator std::pair<TKey, TValue>() const { return std::pair<TKey, TValue>(first, second); }
+
+		const TKey& first;
+		V& second;
+	private:
+		entry_ref& operator=(const entry_ref&);
+	};
+
+protected:
+	enum {
+		// Number of pairs in a leaf and of keys in an inner node
+		LeafSlots = NodeBytes / (sizeof(TKey) + sizeof(TValue)) < 4 ? 4 : NodeBytes / (sizeof(TKey) + sizeof(TValue)),
+		InnerSlots = NodeBytes / (sizeof(TKey) + sizeof(void*)) < 4 ? 4 : NodeBytes / (sizeof(TKey) + sizeof(void*)),
+		// Every node except the root holds at least this many keys
+		MinLeaf = LeafSlots / 2,
+		MinInner = InnerSlots / 2,
+		// Each inner node below the root has at least 3 children, so no tree
+		// that fits in memory is taller than this
+		MaxHeight = 40
+	};
+	// The arrays come first, so that the keys start at the start of the
+	// allocation (Node is an empty base).
+	struct Node {};
+	struct Leaf : Node
+	{
+		Leaf() : count(0), prev(NULL), next(NULL) {}
+		TKey keys[LeafSlots];
+		TValue values[LeafSlots];
+		int count;
+		Leaf* prev;
+		Leaf* next;
+	};
+	struct Inner : Node
+	{
+		Inner() : count(0) {}
+		// children[i] holds the keys k with keys[i - 1] <= k < keys[i]
+		TKey keys[InnerSlots];
+		Node* children[InnerSlots + 1];
+		int count; // number of keys (there are count + 1 children)
+	};
+	typedef btree_search<TKey, Compare> Search;
+	const Compare& comp() const { return *this; }
+
+	Node* _root;   // NULL if the map is empty
+	int _height;   // Number of levels of inner nodes above the leaves
+	Leaf* _first;  // Leftmost leaf
+	Leaf* _last;   // Rightmost leaf
+	size_type _count;
+
+	// Moves a range the way mini_vector does: by moving in C++11, by copying
+	// in C++03.
+	template<class It, class Out>
+	static Out MoveRange(It first, It last, Out dest)
+	{
+		#ifdef MINI_VECTOR_HAS_MOVE
+		return std::move(first, last, dest);
+		#else
+		return std::copy(first, last, dest);
+		#endif
+	}
+	template<class It, class Out>
+	static Out MoveRangeBackward(It first, It last, Out destEnd)
+	{
+		#ifdef MINI_VECTOR_HAS_MOVE
+		return std::move_backward(first, last, destEnd);
+		#else
+		return std::copy_backward(first, last, destEnd);
+		#endif
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// iterators //////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	class iterator;
+	class const_iterator
+	{
+		friend class btree_map;
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef std::pair<const TKey, TValue> value_type;
+		typedef ptrdiff_t difference_type;
+		typedef entry_ref<const TValue> reference;
+		typedef entry_ref<const TValue> pointer;
+
+		const_iterator() : _leaf(NULL), _pos(0) {}
+		reference operator*() const { return reference(_leaf->keys[_pos], _leaf->values[_pos]); }
+		pointer operator->() const { return operator*(); }
+		const_iterator& operator++() { MoveNext(); return *this; }
+		const_iterator& operator--() { MovePrev(); return *this; }
+		const_iterator operator++(int) { const_iterator old(*this); MoveNext(); return old; }
+		const_iterator operator--(int) { const_iterator old(*this); MovePrev(); return old; }
+		bool operator==(const const_iterator& other) const { return _leaf == other._leaf && _pos == other._pos; }
+		bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+	protected:
+		const_iterator(Leaf* leaf, int pos) : _leaf(leaf), _pos(pos) {}
+		// The end iterator points just past the last pair of the last leaf;
+		// other iterators never point past the end of a leaf.
+		void MoveNext()
+		{
+			if (++_pos == _leaf->count && _leaf->next != NULL) {
+				_leaf = _leaf->next;
+				_pos = 0;
+			}
+		}
+		void MovePrev()
+		{
+			if (_pos == 0) {
+				_leaf = _leaf->prev;
+				_pos = _leaf->count;
+			}
+			_pos--;
+		}
+
+		Leaf* _leaf;
+		int _pos;
+	};
+	class iterator : public const_iterator
+	{
+		friend class btree_map;
+	public:
+		typedef entry_ref<TValue> reference;
+		typedef entry_ref<TValue> pointer;
+
+		iterator() {}
+		reference operator*() const { return reference(this->_leaf->keys[this->_pos], this->_leaf->values[this->_pos]); }
+		pointer operator->() const { return operator*(); }
+		iterator& operator++() { this->MoveNext(); return *this; }
+		iterator& operator--() { this->MovePrev(); return *this; }
+		iterator operator++(int) { iterator old(*this); this->MoveNext(); return old; }
+		iterator operator--(int) { iterator old(*this); this->MovePrev(); return old; }
+
+	protected:
+		iterator(Leaf* leaf, int pos) : const_iterator(leaf, pos) {}
+	};
+
+	iterator begin() { return iterator(_first, 0); }
+	const_iterator begin() const { return const_iterator(_first, 0); }
+	iterator end() { return iterator(_last, _last != NULL ? _last->count : 0); }
+	const_iterator end() const { return const_iterator(_last, _last != NULL ? _last->count : 0); }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// construction ///////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	btree_map() : _root(NULL), _height(0), _first(NULL), _last(NULL), _count(0) {}
+	explicit btree_map(const Compare& comp)
+		: Compare(comp), _root(NULL), _height(0), _first(NULL), _last(NULL), _count(0) {}
+	btree_map(const btree_map_t& copy)
+		: Compare(copy), _root(NULL), _height(0), _first(NULL), _last(NULL), _count(0)
+	{
+		bulk_load(copy.begin(), copy.end());
+	}
+	btree_map_t& operator=(const btree_map_t& copy)
+	{
+		if (&copy != this) {
+			btree_map_t temp(copy);
+			swap(temp);
+		}
+		return *this;
+	}
+	~btree_map() { clear(); }
+
+	void swap(btree_map_t& other)
+	{
+		std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+		std::swap(_root, other._root);
+		std::swap(_height, other._height);
+		std::swap(_first, other._first);
+		std::swap(_last, other._last);
+		std::swap(_count, other._count);
+	}
+
+	// Replaces the contents of the map with the pairs in [first, last), whose
+	// keys must be in strictly increasing order (std::invalid_argument is thrown
+	// otherwise, leaving the map empty). The pairs go into full leaves that
+	// are built from left to right, followed by the inner levels, so this is
+	// much faster than inserting the pairs one at a time and the tree uses
+	// less memory (but the first insertions afterward will split nodes).
+	template<class It>
+	void bulk_load(It first, It last)
+	{
+		clear();
+		size_t total = 0;
+		for (It it = first; it != last; ++it, ++total) {
+			It next = it;
+			if (++next != last && !comp()((*it).first, (*next).first))
+				throw std::invalid_argument("btree_map::bulk_load: keys are not in increasing order");
+		}
+		if (total == 0)
+			return;
+
+		// Build the leaves, spreading the pairs evenly over as few leaves as possible
+		std::vector<Node*> level;
+		std::vector<TKey> firstKeys; // smallest key in each node of 'level'
+		size_t leafCount = (total + LeafSlots - 1) / LeafSlots;
+		level.reserve(leafCount);
+		firstKeys.reserve(leafCount);
+		for (size_t n = 0; n < leafCount; n++) {
+			Leaf* leaf = new Leaf();
+			int size = (int)(total * (n + 1) / leafCount - total * n / leafCount);
+			for (; leaf->count < size; ++first, leaf->count++) {
+				leaf->keys[leaf->count] = (*first).first;
+				leaf->values[leaf->count] = (*first).second;
+			}
+			leaf->prev = _last;
+			if (_last != NULL)
+				_last->next = leaf;
+			else
+				_first = leaf;
+			_last = leaf;
+			level.push_back(leaf);
+			firstKeys.push_back(leaf->keys[0]);
+		}
+		_count = total;
+
+		// Build the inner levels the same way until one node remains
+		for (_height = 0; level.size() > 1; _height++) {
+			size_t childCount = level.size(), nodeCount = (childCount + InnerSlots) / (InnerSlots + 1);
+			size_t c = 0;
+			for (size_t n = 0; n < nodeCount; n++) {
+				Inner* inner = new Inner();
+				size_t end = childCount * (n + 1) / nodeCount;
+				TKey firstKey = firstKeys[c];
+				inner->children[0] = level[c++];
+				for (; c < end; c++, inner->count++) {
+					inner->keys[inner->count] = firstKeys[c];
+					inner->children[inner->count + 1] = level[c];
+				}
+				level[n] = inner;
+				firstKeys[n] = firstKey;
+			}
+			level.resize(nodeCount);
+			firstKeys.resize(nodeCount);
+		}
+		_root = level[0];
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	// .NET-style interface (like EasyMap) ////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	// Gets the value associated with a key, returning true if found, false if not.
+	// If the key was not found, then 'value' is left unchanged.
+	bool TryGet(const TKey& key, TValue& value) const
+	{
+		int pos;
+		const Leaf* leaf = FindLeaf(key, pos);
+		if (leaf == NULL)
+			return false;
+		value = leaf->values[pos];
+		return true;
+	}
+	// Gets the value associated with a key, or the specified default value if the
+	// key was not found.
+	TValue Get(const TKey& key, TValue defaultValue = TValue()) const
+	{
+		TryGet(key, defaultValue);
+		return defaultValue;
+	}
+	bool Contains(const TKey& key) const
+	{
+		int pos;
+		return FindLeaf(key, pos) != NULL;
+	}
+	// Removes an entry from the map if it exists, returning true if the key was
+	// found (and removed) or false if the key was not present in the map.
+	bool Remove(const TKey& key)
+	{
+		return RemoveKey(key);
+	}
+	// Adds a key-value pair, or returns false if the key already existed.
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		bool added;
+		InsertKey(key, value, added);
+		return added;
+	}
+	// Adds a key-value pair or throws an exception if the key already existed.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (!TryAdd(key, value))
+			throw exception_t(_T("Key already exists in btree_map"));
+	}
+	// Gets a reference to the existing value if the key exists. If the key does
+	// not exist, adds the specified key-value pair and returns a reference to the
+	// new value. Ex: you could increment a counter with "++map.GetOrAdd(key,0)".
+	TValue& GetOrAdd(const TKey& key, const TValue& initialValue = TValue())
+	{
+		bool added;
+		iterator it = InsertKey(key, initialValue, added);
+		return it._leaf->values[it._pos];
+	}
+	int Count() const { return (int)_count; }
+	void Clear() { clear(); }
+	// Number of levels of inner nodes above the leaves
+	int height() const { return _height; }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	size_type size() const { return _count; }
+	bool empty() const { return _count == 0; }
+	void clear()
+	{
+		if (_root != NULL)
+			FreeSubtree(_root, _height);
+		_root = NULL;
+		_first = _last = NULL;
+		_height = 0;
+		_count = 0;
+	}
+	key_compare key_comp() const { return *this; }
+
+	iterator find(const TKey& key)
+	{
+		int pos;
+		Leaf* leaf = FindLeaf(key, pos);
+		return leaf != NULL ? iterator(leaf, pos) : end();
+	}
+	const_iterator find(const TKey& key) const
+	{
+		return const_cast<btree_map_t*>(this)->find(key);
+	}
+	size_type count(const TKey& key) const
+	{
+		return Contains(key) ? 1 : 0;
+	}
+	// Range queries: iterate from lower_bound(lo) to upper_bound(hi) to visit
+	// the keys from lo to hi inclusive.
+	iterator lower_bound(const TKey& key)
+	{
+		if (_root == NULL)
+			return end();
+		Leaf* leaf = Descend(key, NULL, NULL);
+		return AtOrNext(leaf, Search::lower_bound(leaf->keys, leaf->count, key, comp()));
+	}
+	const_iterator lower_bound(const TKey& key) const
+	{
+		return const_cast<btree_map_t*>(this)->lower_bound(key);
+	}
+	iterator upper_bound(const TKey& key)
+	{
+		if (_root == NULL)
+			return end();
+		Leaf* leaf = Descend(key, NULL, NULL);
+		return AtOrNext(leaf, Search::upper_bound(leaf->keys, leaf->count, key, comp()));
+	}
+	const_iterator upper_bound(const TKey& key) const
+	{
+		return const_cast<btree_map_t*>(this)->upper_bound(key);
+	}
+	std::pair<iterator, iterator> equal_range(const TKey& key)
+	{
+		iterator it = lower_bound(key);
+		iterator next = it;
+		if (it != end() && !comp()(key, it->first))
+			++next;
+		return std::pair<iterator, iterator>(it, next);
+	}
+
+	std::pair<iterator, bool> insert(const value_type& pair)
+	{
+		bool added;
+		iterator it = InsertKey(pair.first, pair.second, added);
+		return std::pair<iterator, bool>(it, added);
+	}
+	template<class It>
+	void insert(It first, It last)
+	{
+		for (; first != last; ++first)
+			InsertKey((*first).first, (*first).second);
+	}
+	size_type erase(const TKey& key)
+	{
+		return RemoveKey(key) ? 1 : 0;
+	}
+	// Removes the pair at pos and returns an iterator to the next pair
+	iterator erase(const const_iterator& pos)
+	{
+		TKey key = pos._leaf->keys[pos._pos];
+		RemoveKey(key);
+		return upper_bound(key);
+	}
+	TValue& operator[](const TKey& key)
+	{
+		return GetOrAdd(key);
+	}
+
+protected:
+	///////////////////////////////////////////////////////////////////////////////
+	// implementation /////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	iterator AtOrNext(Leaf* leaf, int pos)
+	{
+		if (pos == leaf->count && leaf->next != NULL)
+			return iterator(leaf->next, 0);
+		return iterator(leaf, pos);
+	}
+	// Returns the leaf in which key belongs. If path is not NULL, path[d] and
+	// slots[d] receive the inner node at depth d (0 for the root) and the
+	// index of the child that was followed.
+	Leaf* Descend(const TKey& key, Inner** path, int* slots) const
+	{
+		Node* node = _root;
+		for (int depth = 0; depth < _height; depth++) {
+			Inner* inner = static_cast<Inner*>(node);
+			int slot = Search::upper_bound(inner->keys, inner->count, key, comp());
+			if (path != NULL) {
+				path[depth] = inner;
+				slots[depth] = slot;
+			}
+			node = inner->children[slot];
+		}
+		return static_cast<Leaf*>(node);
+	}
+	// Returns the leaf that contains key and its position in the leaf, or NULL
+	Leaf* FindLeaf(const TKey& key, int& pos) const
+	{
+		if (_root == NULL)
+			return NULL;
+		Leaf* leaf = Descend(key, NULL, NULL);
+		pos = Search::lower_bound(leaf->keys, leaf->count, key, comp());
+		if (pos < leaf->count && !comp()(key, leaf->keys[pos]))
+			return leaf;
+		return NULL;
+	}
+	void FreeSubtree(Node* node, int height)
+	{
+		if (height > 0) {
+			Inner* inner = static_cast<Inner*>(node);
+			for (int i = 0; i <= inner->count; i++)
+				FreeSubtree(inner->children[i], height - 1);
+			delete inner;
+		} else
+			delete static_cast<Leaf*>(node);
+	}
+
+	// Returns the position of key, inserting (key, value) first if the key is
+	// not in the map yet (added tells which happened).
+	iterator InsertKey(const TKey& key, const TValue& value, bool& added)
+	{
+		if (_root == NULL)
+			_root = _first = _last = new Leaf();
+		Inner* path[MaxHeight];
+		int slots[MaxHeight];
+		Leaf* leaf = Descend(key, path, slots);
+		int pos = Search::lower_bound(leaf->keys, leaf->count, key, comp());
+		if (pos < leaf->count && !comp()(key, leaf->keys[pos])) {
+			added = false;
+			return iterator(leaf, pos);
+		}
+		added = true;
+		_count++;
+		if (leaf->count < LeafSlots) {
+			InsertIntoLeaf(leaf, pos, key, value);
+			return iterator(leaf, pos);
+		}
+
+		// The leaf is full: move the upper half of it to a new leaf on its
+		// right, so that each has at least MinLeaf pairs afterward.
+		Leaf* right = new Leaf();
+		int half = (LeafSlots + 1) / 2; // size of the left leaf afterward
+		int move = pos < half ? half - 1 : half;
+		MoveRange(leaf->keys + move, leaf->keys + LeafSlots, right->keys);
+		MoveRange(leaf->values + move, leaf->values + LeafSlots, right->values);
+		right->count = LeafSlots - move;
+		leaf->count = move;
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next != NULL)
+			leaf->next->prev = right;
+		else
+			_last = right;
+		leaf->next = right;
+
+		iterator result;
+		if (pos < half) {
+			InsertIntoLeaf(leaf, pos, key, value);
+			result = iterator(leaf, pos);
+		} else {
+			InsertIntoLeaf(right, pos - move, key, value);
+			result = iterator(right, pos - move);
+		}
+		InsertSeparator(path, slots, _height - 1, right->keys[0], right);
+		return result;
+	}
+	void InsertKey(const TKey& key, const TValue& value)
+	{
+		bool added;
+		InsertKey(key, value, added);
+	}
+	void InsertIntoLeaf(Leaf* leaf, int pos, const TKey& key, const TValue& value)
+	{
+		assert(leaf->count < LeafSlots);
+		MoveRangeBackward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+		MoveRangeBackward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+		leaf->keys[pos] = key;
+		leaf->values[pos] = value;
+		leaf->count++;
+	}
+	// Adds a new child, 'right', just after the child that was followed at
+	// path[depth]; key separates it from its left sibling. Splits full inner
+	// nodes on the way up and adds a new root if the root splits.
+	void InsertSeparator(Inner** path, int* slots, int depth, TKey key, Node* right)
+	{
+		for (; depth >= 0; depth--) {
+			Inner* node = path[depth];
+			int slot = slots[depth];
+			if (node->count < InnerSlots) {
+				InsertIntoInner(node, slot, key, right);
+				return;
+			}
+			// The node is full: split its InnerSlots + 1 keys into a left
+			// half, a middle key that moves up, and a right half.
+			TKey keys[InnerSlots + 1];
+			Node* children[InnerSlots + 2];
+			MoveRange(node->keys, node->keys + slot, keys);
+			keys[slot] = key;
+			MoveRange(node->keys + slot, node->keys + InnerSlots, keys + slot + 1);
+			std::copy(node->children, node->children + slot + 1, children);
+			children[slot + 1] = right;
+			std::copy(node->children + slot + 1, node->children + InnerSlots + 1, children + slot + 2);
+
+			int half = InnerSlots / 2;
+			Inner* newRight = new Inner();
+			MoveRange(keys, keys + half, node->keys);
+			std::copy(children, children + half + 1, node->children);
+			node->count = half;
+			MoveRange(keys + half + 1, keys + InnerSlots + 1, newRight->keys);
+			std::copy(children + half + 1, children + InnerSlots + 2, newRight->children);
+			newRight->count = InnerSlots - half;
+			std::fill(node->keys + half, node->keys + InnerSlots, TKey());
+
+			key = keys[half];
+			right = newRight;
+		}
+		// The root was split
+		Inner* root = new Inner();
+		root->keys[0] = key;
+		root->children[0] = _root;
+		root->children[1] = right;
+		root->count = 1;
+		_root = root;
+		_height++;
+		assert(_height < MaxHeight);
+	}
+	void InsertIntoInner(Inner* node, int slot, const TKey& key, Node* right)
+	{
+		MoveRangeBackward(node->keys + slot, node->keys + node->count, node->keys + node->count + 1);
+		std::copy_backward(node->children + slot + 1, node->children + node->count + 1, node->children + node->count + 2);
+		node->keys[slot] = key;
+		node->children[slot + 1] = right;
+		node->count++;
+	}
+
+	bool RemoveKey(const TKey& key)
+	{
+		if (_root == NULL)
+			return false;
+		Inner* path[MaxHeight];
+		int slots[MaxHeight];
+		Leaf* leaf = Descend(key, path, slots);
+		int pos = Search::lower_bound(leaf->keys, leaf->count, key, comp());
+		if (pos == leaf->count || comp()(key, leaf->keys[pos]))
+			return false;
+
+		RemoveFromLeaf(leaf, pos, 1);
+		_count--;
+		if (_height == 0) {
+			if (leaf->count == 0)
+				clear();
+		} else if (leaf->count < MinLeaf)
+			RebalanceLeaf(leaf, path, slots);
+		return true;
+	}
+	// Removes count pairs starting at pos, resetting the vacated slots so
+	// that they do not hold on to memory (e.g. of strings)
+	void RemoveFromLeaf(Leaf* leaf, int pos, int count)
+	{
+		MoveRange(leaf->keys + pos + count, leaf->keys + leaf->count, leaf->keys + pos);
+		MoveRange(leaf->values + pos + count, leaf->values + leaf->count, leaf->values + pos);
+		leaf->count -= count;
+		std::fill(leaf->keys + leaf->count, leaf->keys + leaf->count + count, TKey());
+		std::fill(leaf->values + leaf->count, leaf->values + leaf->count + count, TValue());
+	}
+	// Removes keys[slot - 1] and children[slot] (or keys[0] and children[0] if slot == 0)
+	void RemoveFromInner(Inner* node, int slot)
+	{
+		int keySlot = slot > 0 ? slot - 1 : 0;
+		MoveRange(node->keys + keySlot + 1, node->keys + node->count, node->keys + keySlot);
+		std::copy(node->children + slot + 1, node->children + node->count + 1, node->children + slot);
+		node->count--;
+		node->keys[node->count] = TKey();
+	}
+	// Refills a leaf that has fewer than MinLeaf pairs by borrowing a pair
+	// from a sibling, or merges it with a sibling if neither can spare one.
+	void RebalanceLeaf(Leaf* leaf, Inner** path, int* slots)
+	{
+		Inner* parent = path[_height - 1];
+		int slot = slots[_height - 1];
+		Leaf* left = slot > 0 ? static_cast<Leaf*>(parent->children[slot - 1]) : NULL;
+		Leaf* right = slot < parent->count ? static_cast<Leaf*>(parent->children[slot + 1]) : NULL;
+		if (left != NULL && left->count > MinLeaf) {
+			InsertIntoLeaf(leaf, 0, left->keys[left->count - 1], left->values[left->count - 1]);
+			RemoveFromLeaf(left, left->count - 1, 1);
+			parent->keys[slot - 1] = leaf->keys[0];
+		} else if (right != NULL && right->count > MinLeaf) {
+			InsertIntoLeaf(leaf, leaf->count, right->keys[0], right->values[0]);
+			RemoveFromLeaf(right, 0, 1);
+			parent->keys[slot] = right->keys[0];
+		} else {
+			if (left != NULL)
+				MergeLeaves(left, leaf, parent, slot);
+			else
+				MergeLeaves(leaf, right, parent, slot + 1);
+			RebalanceInner(path, slots, _height - 1);
+		}
+	}
+	// Moves the pairs of 'right' (which is parent->children[slot]) into its
+	// left sibling 'left' and frees it
+	void MergeLeaves(Leaf* left, Leaf* right, Inner* parent, int slot)
+	{
+		assert(left->count + right->count <= LeafSlots);
+		MoveRange(right->keys, right->keys + right->count, left->keys + left->count);
+		MoveRange(right->values, right->values + right->count, left->values + left->count);
+		left->count += right->count;
+		left->next = right->next;
+		if (right->next != NULL)
+			right->next->prev = left;
+		else
+			_last = left;
+		delete right;
+		RemoveFromInner(parent, slot);
+	}
+	// Restores the minimum size of the inner node at path[depth] after one of
+	// its children was merged away, by rotating a key through the parent or
+	// merging with a sibling (and so on up the tree). A root left with a
+	// single child is replaced by that child.
+	void RebalanceInner(Inner** path, int* slots, int depth)
+	{
+		for (;; depth--) {
+			Inner* node = path[depth];
+			if (depth == 0) {
+				if (node->count == 0) {
+					_root = node->children[0];
+					_height--;
+					delete node;
+				}
+				return;
+			}
+			if (node->count >= MinInner)
+				return;
+
+			Inner* parent = path[depth - 1];
+			int slot = slots[depth - 1];
+			Inner* left = slot > 0 ? static_cast<Inner*>(parent->children[slot - 1]) : NULL;
+			Inner* right = slot < parent->count ? static_cast<Inner*>(parent->children[slot + 1]) : NULL;
+			if (left != NULL && left->count > MinInner) {
+				// Rotate right: the parent's key comes down, left's last key goes up
+				MoveRangeBackward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+				std::copy_backward(node->children, node->children + node->count + 1, node->children + node->count + 2);
+				node->keys[0] = parent->keys[slot - 1];
+				node->children[0] = left->children[left->count];
+				node->count++;
+				parent->keys[slot - 1] = left->keys[left->count - 1];
+				left->count--;
+				left->keys[left->count] = TKey();
+				return;
+			} else if (right != NULL && right->count > MinInner) {
+				// Rotate left: the parent's key comes down, right's first key goes up
+				node->keys[node->count] = parent->keys[slot];
+				node->children[node->count + 1] = right->children[0];
+				node->count++;
+				parent->keys[slot] = right->keys[0];
+				RemoveFromInner(right, 0);
+				return;
+			}
+			if (left != NULL)
+				MergeInner(left, node, parent, slot);
+			else
+				MergeInner(node, right, parent, slot + 1);
+		}
+	}
+	// Moves the parent's separator and the keys and children of 'right'
+	// (which is parent->children[slot]) into 'left', and frees 'right'
+	void MergeInner(Inner* left, Inner* right, Inner* parent, int slot)
+	{
+		assert(left->count + 1 + right->count <= InnerSlots);
+		left->keys[left->count] = parent->keys[slot - 1];
+		MoveRange(right->keys, right->keys + right->count, left->keys + left->count + 1);
+		std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+		left->count += 1 + right->count;
+		delete right;
+		RemoveFromInner(parent, slot);
+	}
+};
+
+#endif
@@ -0,0 +1,753 @@
+//
+// compact_hash_map.h
+//
+#ifndef _COMPACT_HASH_MAP_H
+#define _COMPACT_HASH_MAP_H
+
+#include <assert.h>
+#include <new>
+#include <algorithm>
+#include "hash_map.h"
+
+// An entry of a compact_hash_set. In compact mode the hash code is not
+// stored; it is recomputed when the table is resized, and keys are compared
+// directly when searching a chain.
+template<class T, bool CompactMode>
+struct compact_entry
+{
+	compact_entry(const T& t, unsigned hashCode) : t(t), hashCode(hashCode) {}
+	template<class Traits>
+	unsigned Hash(const Traits&) const { return hashCode; }
+	bool HashMatches(unsigned keyHash) const { return hashCode == keyHash; }
+
+	T t;               // Value in this entry
+	unsigned hashCode; // Hash code of t
+};
+template<class T>
+struct compact_entry<T, true>
+{
+	compact_entry(const T& t, unsigned) : t(t) {}
+	template<class Traits>
+	unsigned Hash(const Traits& traits) const { return traits.hash_value(t); }
+	bool HashMatches(unsigned) const { return true; }
+
+	T t;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// compact_hash_set ///////////////////////////////////////////////////////////
+//
+// A chained hash set like hash_set, with the memory-saving layout described
+// in hash_set's header comment:
+//
+// 1. While the table holds at most 32768 entries, bucket heads and 'next'
+//    links are 16-bit, and the head of bucket i is stored next to the 'next'
+//    link of entry i, so the two take the space of one 32-bit 'next' field.
+// 2. Larger tables use 32-bit links, but only half as many buckets as
+//    entries (the average chain has two entries when the table is full).
+// 3. A lookup that finds a key moves it to the front of its chain, so that
+//    frequently used keys are found quickly even when chains are long.
+//
+// In addition, entries store the hash code only when comparing keys is
+// expensive. By default (CompactMode = num_traits<T>::is_numeric), numeric
+// keys are stored without a hash code. Thus a small table costs 4 bytes per
+// entry in compact mode and 8 bytes otherwise, plus sizeof(T), plus unused
+// capacity. Large tables cost 6 and 10 bytes per entry.
+//
+// Entries are kept contiguous: Remove() moves the last entry into the hole.
+// Therefore, removing a key invalidates iterators that point to it and to the
+// last entry, and inserting may invalidate all iterators (when the table
+// grows). Because lookups reorder chains, non-const lookups (Contains, find,
+// TryGet...) are not safe to call from several threads at once, even if no
+// thread modifies the set. Const lookups do not reorder.
+//
+////////////////////////////////////////////////////////////////////////////////
+template<class T, class Traits = hash_traits<T>, class BucketPolicy = prime_bucket_policy,
+         bool CompactMode = Math::num_traits<T>::is_numeric>
+class compact_hash_set : protected Traits {
+public:
+	typedef const T key_type;
+	typedef const T value_type;
+	typedef unsigned int hash_type;
+	typedef unsigned int size_type;
+	typedef compact_hash_set<T, Traits, BucketPolicy, CompactMode> compact_hash_set_t;
+protected:
+	typedef compact_entry<T, CompactMode> Entry;
+
+	// In small tables, _links16[i].head is the first entry in bucket i and
+	// _links16[i].next is the entry after entry i in its chain.
+	struct Link16
+	{
+		uint16 head;
+		uint16 next;
+	};
+	enum { None16 = 0xFFFF, MaxSmallCapacity = 0x8000, LargeEntriesPerBucket = 2 };
+
+	// _entries[0.._count-1] are constructed; the rest is raw storage.
+	Entry* _entries;
+	int _count;
+	int _capacity;
+	int _bucketCount;
+	BucketPolicy _bucketPolicy;
+	// Small tables use _links16 (with _bucketCount == _capacity); large tables
+	// use _heads32 and _next32 instead. -1 (all bits set) means "none".
+	Link16* _links16;
+	uint32* _heads32;
+	uint32* _next32;
+
+	bool IsLarge() const { return _next32 != NULL; }
+	int Head(int bucket) const
+	{
+		if (IsLarge())
+			return (int)_heads32[bucket];
+		uint16 h = _links16[bucket].head;
+		return h == None16 ? -1 : h;
+	}
+	int Next(int entry) const
+	{
+		if (IsLarge())
+			return (int)_next32[entry];
+		uint16 n = _links16[entry].next;
+		return n == None16 ? -1 : n;
+	}
+	// These modify only the link arrays, so they are allowed in const methods
+	// (a const lookup never calls them, but Find with moveToFront does).
+	void SetHead(int bucket, int entry) const
+	{
+		if (IsLarge())
+			_heads32[bucket] = (uint32)entry;
+		else
+			_links16[bucket].head = (uint16)entry;
+	}
+	void SetNext(int entry, int next) const
+	{
+		if (IsLarge())
+			_next32[entry] = (uint32)next;
+		else
+			_links16[entry].next = (uint16)next;
+	}
+	int BucketOf(hash_type keyHash) const
+		{ return _bucketPolicy.Index(keyHash); }
+
+	// Matches an entry against a key, for use by Find()
+	struct KeyMatch
+	{
+		KeyMatch(const Traits& traits, const T& key) : traits(traits), key(key) {}
+		bool operator()(const T& t) const { return traits.equals(t, key); }
+		const Traits& traits;
+		const T& key;
+	};
+
+	// Returns the index of the entry for which match() is true, or -1.
+	template<class Match>
+	int Find(hash_type keyHash, const Match& match, bool moveToFront) const
+	{
+		if (_count == 0)
+			return -1;
+		int bucket = BucketOf(keyHash);
+		int prev = -1;
+		for (int i = Head(bucket); i >= 0; prev = i, i = Next(i))
+		{
+			if (_entries[i].HashMatches(keyHash) && match(_entries[i].t)) {
+				if (moveToFront && prev >= 0) {
+					SetNext(prev, Next(i));
+					SetNext(i, Head(bucket));
+					SetHead(bucket, i);
+				}
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Returns ~index of the matching entry if there is one. Otherwise, makes
+	// room for a new entry and returns its index (_count); the caller must
+	// construct _entries[_count] and then call CommitInsert().
+	template<class Match>
+	int PrepareInsert(hash_type keyHash, const Match& match)
+	{
+		int i = Find(keyHash, match, false);
+		if (i >= 0)
+			return ~i;
+		if (_count == _capacity)
+			Reallocate(_capacity < 4 ? 4 : _capacity * 2);
+		return _count;
+	}
+	void CommitInsert(hash_type keyHash)
+	{
+		int bucket = BucketOf(keyHash);
+		SetNext(_count, Head(bucket));
+		SetHead(bucket, _count);
+		_count++;
+	}
+
+	// Returns an index >= 0 if a new key was inserted; if the key already existed,
+	// a negative value ~index is returned and the hashtable is not modified.
+	int Insert(const T& key)
+	{
+		hash_type keyHash = this->hash_value(key);
+		int i = PrepareInsert(keyHash, KeyMatch(*this, key));
+		if (i >= 0) {
+			new (&_entries[i]) Entry(key, keyHash);
+			CommitInsert(keyHash);
+		}
+		return i;
+	}
+
+	// Unlinks entry i from the chain that starts at 'bucket'
+	void Unlink(int bucket, int i)
+	{
+		int prev = -1;
+		for (int j = Head(bucket); j != i; prev = j, j = Next(j))
+			assert(j >= 0);
+		if (prev < 0)
+			SetHead(bucket, Next(i));
+		else
+			SetNext(prev, Next(i));
+	}
+	void EraseEntry(int i)
+	{
+		assert(i >= 0 && i < _count);
+		Unlink(BucketOf(_entries[i].Hash(traits())), i);
+		try {
+			_entries[i].~Entry();
+		} catch(...) { }
+
+		// Move the last entry into the hole
+		int last = --_count;
+		if (i != last)
+		{
+			int bucket = BucketOf(_entries[last].Hash(traits()));
+			int prev = -1;
+			for (int j = Head(bucket); j != last; prev = j, j = Next(j))
+				assert(j >= 0);
+			if (prev < 0)
+				SetHead(bucket, i);
+			else
+				SetNext(prev, i);
+			SetNext(i, Next(last));
+			new (&_entries[i]) Entry(_entries[last]);
+			_entries[last].~Entry();
+		}
+	}
+
+	void Init()
+	{
+		_entries = NULL;
+		_links16 = NULL;
+		_heads32 = _next32 = NULL;
+		_count = _capacity = _bucketCount = 0;
+	}
+	void FreeLinks()
+	{
+		delete[] _links16;
+		delete[] _heads32;
+		delete[] _next32;
+		_links16 = NULL;
+		_heads32 = _next32 = NULL;
+	}
+	// Moves the entries to an array of the specified capacity and rebuilds
+	// the chains.
+	void Reallocate(int capacity)
+	{
+		assert(capacity >= _count);
+		FreeLinks();
+		bool small = capacity <= MaxSmallCapacity;
+		if (small) {
+			// Every entry index must also be a bucket index, so the capacity
+			// is rounded up to the bucket count that the policy picks.
+			_bucketCount = _bucketPolicy.Resize(capacity);
+			assert(_bucketCount < None16);
+			capacity = _bucketCount;
+		} else
+			_bucketCount = _bucketPolicy.Resize(capacity / LargeEntriesPerBucket);
+
+		Entry* oldEntries = _entries;
+		_entries = (Entry*)::operator new(capacity * sizeof(Entry));
+		for (int i = 0; i < _count; i++) {
+			new (&_entries[i]) Entry(oldEntries[i]);
+			oldEntries[i].~Entry();
+		}
+		::operator delete(oldEntries);
+		_capacity = capacity;
+
+		if (small) {
+			_links16 = new Link16[_capacity];
+			for (int i = 0; i < _capacity; i++)
+				_links16[i].head = _links16[i].next = None16;
+		} else {
+			_heads32 = new uint32[_bucketCount];
+			_next32 = new uint32[_capacity];
+			std::fill(_heads32, _heads32 + _bucketCount, (uint32)-1);
+		}
+
+		for (int i = _count - 1; i >= 0; i--) {
+			int bucket = BucketOf(_entries[i].Hash(traits()));
+			SetNext(i, Head(bucket));
+			SetHead(bucket, i);
+		}
+	}
+	void CopyFrom(const compact_hash_set_t& copy)
+	{
+		Init();
+		if (copy._count == 0)
+			return;
+		Reallocate(copy._count);
+		for (int i = 0; i < copy._count; i++) {
+			const Entry& e = copy._entries[i];
+			hash_type keyHash = e.Hash(copy.traits());
+			new (&_entries[i]) Entry(e);
+			CommitInsert(keyHash);
+		}
+	}
+
+public:
+	compact_hash_set() { Init(); }
+	explicit compact_hash_set(size_type capacity, const Traits& traits = Traits())
+		: Traits(traits)
+	{
+		Init();
+		if (capacity)
+			Reallocate(capacity);
+	}
+	~compact_hash_set() { Clear(); }
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const T& key)
+	{
+		if (Insert(key) < 0)
+			throw exception_t(_T("Key already exists in compact_hash_set"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist). If
+	// the key already existed, the hashtable is not modified.
+	bool TryAdd(const T& key)
+	{
+		return Insert(key) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, it is
+	// overwritten with this new version of the key. Returns true if the specified
+	// key did not already exist.
+	bool Set(const T& key)
+	{
+		int i = Insert(key);
+		if (i < 0)
+			_entries[~i].t = key;
+		return i >= 0;
+	}
+
+	void Clear()
+	{
+		for (int i = 0; i < _count; i++)
+			_entries[i].~Entry();
+		::operator delete(_entries);
+		FreeLinks();
+		Init();
+	}
+
+	// Contains and find move the key to the front of its chain; the const
+	// versions do not.
+	bool Contains(const T& key)
+		{ return FindEntry(key, true) >= 0; }
+	bool Contains(const T& key) const
+		{ return FindEntry(key, false) >= 0; }
+
+	bool Remove(const T& key)
+	{
+		int i = FindEntry(key, false);
+		if (i < 0)
+			return false;
+		EraseEntry(i);
+		return true;
+	}
+
+	int Count() const { return _count; }
+
+protected:
+	// Returns the index of the entry that holds a matching key, or -1.
+	int FindEntry(const T& key, bool moveToFront) const
+	{
+		return Find(this->hash_value(key), KeyMatch(*this, key), moveToFront);
+	}
+	int EndIfMissing(int i) const { return i >= 0 ? i : _count; }
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	compact_hash_set(const compact_hash_set_t& copy) : Traits(copy.traits())
+	{
+		CopyFrom(copy);
+	}
+	compact_hash_set_t& operator=(const compact_hash_set_t& copy)
+	{
+		if (&copy != this) {
+			Clear();
+			Traits::operator=(copy);
+			CopyFrom(copy);
+		}
+		return *this;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	// iterators //////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	// Entries are contiguous, so an iterator is just an index.
+	class const_iterator {
+	protected:
+		typedef const typename compact_hash_set_t::value_type& reference;
+		typedef const typename compact_hash_set_t::value_type* pointer;
+		typedef const compact_hash_set_t hash_t;
+		typedef const_iterator self;
+		friend class compact_hash_set<T, Traits, BucketPolicy, CompactMode>;
+
+		hash_t* _hash;
+		int _pos;
+
+		const_iterator(const hash_t* hash, int pos)
+			: _hash(const_cast<hash_t*>(hash)), _pos(pos) { }
+	public:
+		const_iterator() : _hash(NULL) {}
+
+		bool MoveNext()
+		{
+			if (_hash == NULL || _pos >= _hash->_count)
+				return false;
+			return ++_pos < _hash->_count;
+		}
+		bool MovePrev()
+		{
+			if (_hash == NULL || _pos < 0)
+				return false;
+			return --_pos >= 0;
+		}
+
+		reference operator*() const { assert(is_valid()); return _hash->_entries[_pos].t; }
+		pointer operator->() const { assert(is_valid()); return &_hash->_entries[_pos].t; }
+
+		self& operator++() // prefix ++
+			{ MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ MovePrev(); return *this; }
+		bool operator==(const self& x) const
+			{ return (x._hash == _hash) && (x._pos == _pos); }
+		bool operator<(const self& x) const
+			{ assert(_hash == x._hash); return _pos < x._pos; }
+		bool operator<=(const self& x) const
+			{ assert(_hash == x._hash); return _pos <= x._pos; }
+
+		// Returns true if the iterator can be dereferenced
+		bool is_valid() const
+			{ return _hash != NULL && _pos >= 0 && _pos < _hash->_count; }
+
+		/////////////////////////////////////////////////////////
+		// Operators that are defined in terms of other operators
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			MovePrev();
+			return tmp;
+		}
+		bool operator!=(const self& x) const { return !(*this == x); }
+		bool operator>(const self& x) const { return !(*this <= x); }
+		bool operator>=(const self& x) const { return !(*this < x); }
+
+		const hash_t* collection() const { return _hash; }
+	};
+
+	class iterator : public const_iterator {
+	protected:
+		typedef typename compact_hash_set_t::value_type& reference;
+		typedef typename compact_hash_set_t::value_type* pointer;
+		typedef compact_hash_set_t hash_t;
+		typedef iterator self;
+		friend class compact_hash_set<T, Traits, BucketPolicy, CompactMode>;
+
+		iterator(hash_t* hash, int pos) : const_iterator(hash, pos) {}
+	public:
+		iterator() {}
+
+		reference operator*() const { assert(this->is_valid()); return this->_hash->_entries[this->_pos].t; }
+		pointer operator->() const { assert(this->is_valid()); return &this->_hash->_entries[this->_pos].t; }
+
+		self& operator++() // prefix ++
+			{ this->MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ this->MovePrev(); return *this; }
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			this->MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			this->MovePrev();
+			return tmp;
+		}
+
+		hash_t* collection() const { return const_cast<hash_t*>(this->_hash); }
+	};
+
+	friend class const_iterator;
+	friend class iterator;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	size_type size() const { return _count; }
+	size_type capacity() const { return _capacity; }
+	bool empty() const { return _count == 0; }
+	void clear() { Clear(); }
+
+	iterator begin()
+	{
+		return iterator(this, 0);
+	}
+	const_iterator begin() const
+	{
+		return const_iterator(this, 0);
+	}
+	iterator end()
+	{
+		return iterator(this, _count);
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, _count);
+	}
+	iterator find(const T& key)
+	{
+		return iterator(this, EndIfMissing(FindEntry(key, true)));
+	}
+	const_iterator find(const T& key) const
+	{
+		return const_iterator(this, EndIfMissing(FindEntry(key, false)));
+	}
+	std::pair<iterator, bool> insert(const T& key)
+	{
+		int i = Insert(key);
+		return std::make_pair(at(i >= 0 ? i : ~i), i >= 0);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(*start);
+	}
+	int count(const T& key) const
+	{
+		return (int)(FindEntry(key, false) >= 0);
+	}
+	void erase(const const_iterator& pos)
+	{
+		assert (pos._hash == this);
+		if (pos._hash == this && pos.is_valid())
+			EraseEntry(pos._pos);
+	}
+	const Traits& traits() const { return *this; }
+
+protected:
+	const_iterator at(int index) const { return const_iterator(this, index); }
+	iterator at(int index) { return iterator(this, index); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// compact_hash_map ///////////////////////////////////////////////////////////
+//
+// compact_hash_map is a dictionary with the same interface as hash_map and
+// the same layout as compact_hash_set; see compact_hash_set's header comment.
+// The hash code is omitted from entries if the key type is numeric.
+//
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey>, class BucketPolicy = prime_bucket_policy,
+         bool CompactMode = Math::num_traits<TKey>::is_numeric>
+class compact_hash_map : protected compact_hash_set< std::pair<const TKey,TValue>,
+                             hash_map_traits<std::pair<const TKey,TValue>,KeyTraits>, BucketPolicy, CompactMode >
+{
+public:
+	typedef compact_hash_map<TKey, TValue, KeyTraits, BucketPolicy, CompactMode> compact_hash_map_t;
+	typedef const TKey key_type;
+	typedef const TValue mapped_type;
+	typedef std::pair<const TKey,TValue> value_type;
+	typedef compact_hash_set<value_type, hash_map_traits<value_type,KeyTraits>, BucketPolicy, CompactMode> compact_hash_set_t;
+	typedef typename compact_hash_set_t::size_type size_type;
+	typedef typename compact_hash_set_t::hash_type hash_type;
+
+	compact_hash_map() {}
+	explicit compact_hash_map(size_type capacity, const KeyTraits& traits = KeyTraits())
+		: compact_hash_set_t(capacity, hash_map_traits<value_type,KeyTraits>(traits)) {}
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (Insert(key, value) < 0)
+			throw exception_t(_T("Key already exists in compact_hash_map"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist).
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		return Insert(key, value) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, its
+	// value is overwritten. Returns true if the specified key did not already
+	// exist.
+	bool Set(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		if (i < 0)
+			this->_entries[~i].t.second = value;
+		return i >= 0;
+	}
+
+	bool TryGet(const TKey& key, OUT TValue& value)
+	{
+		int i = FindEntry(key, true);
+		if (i >= 0) {
+			value = this->_entries[i].t.second;
+			return true;
+		}
+		return false;
+	}
+	TValue Get(const TKey& key, TValue defaultValue)
+	{
+		TryGet(key, OUT defaultValue);
+		return defaultValue;
+	}
+
+	void Clear()
+		{ compact_hash_set_t::Clear(); }
+	bool Contains(const TKey& key)
+		{ return FindEntry(key, true) >= 0; }
+	bool Contains(const TKey& key) const
+		{ return FindEntry(key, false) >= 0; }
+	bool Remove(const TKey& key)
+	{
+		int i = FindEntry(key, false);
+		if (i < 0)
+			return false;
+		this->EraseEntry(i);
+		return true;
+	}
+	int Count() const
+		{ return compact_hash_set_t::Count(); }
+
+protected:
+	// Matches an entry against a key, for use by Find()
+	struct KeyMatch
+	{
+		KeyMatch(const KeyTraits& traits, const TKey& key) : traits(traits), key(key) {}
+		bool operator()(const value_type& pair) const { return traits.equals(pair.first, key); }
+		const KeyTraits& traits;
+		const TKey& key;
+	};
+
+	int FindEntry(const TKey& key, bool moveToFront) const
+	{
+		return this->Find(traits().hash_value(key), KeyMatch(traits(), key), moveToFront);
+	}
+	// Like compact_hash_set::Insert, but the pair is only constructed if the
+	// key is new.
+	int Insert(const TKey& key, const TValue& value)
+	{
+		hash_type keyHash = traits().hash_value(key);
+		int i = this->PrepareInsert(keyHash, KeyMatch(traits(), key));
+		if (i >= 0) {
+			new (&this->_entries[i]) typename compact_hash_set_t::Entry(value_type(key, value), keyHash);
+			this->CommitInsert(keyHash);
+		}
+		return i;
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	compact_hash_map(const compact_hash_map_t& copy) : compact_hash_set_t(copy) {}
+	compact_hash_map_t& operator=(const compact_hash_map_t& copy)
+		{ compact_hash_set_t::operator=(copy); return *this; }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	typedef typename compact_hash_set_t::const_iterator const_iterator;
+	typedef typename compact_hash_set_t::iterator       iterator;
+
+	size_type size() const { return compact_hash_set_t::size(); }
+	size_type capacity() const { return compact_hash_set_t::capacity(); }
+	bool empty() const { return compact_hash_set_t::empty(); }
+	void clear() { compact_hash_set_t::Clear(); }
+
+	iterator begin() { return compact_hash_set_t::begin(); }
+	const_iterator begin() const { return compact_hash_set_t::begin(); }
+	iterator end() { return compact_hash_set_t::end(); }
+	const_iterator end() const { return compact_hash_set_t::end(); }
+
+	iterator find(const TKey& key)
+	{
+		return this->at(this->EndIfMissing(FindEntry(key, true)));
+	}
+	const_iterator find(const TKey& key) const
+	{
+		return this->at(this->EndIfMissing(FindEntry(key, false)));
+	}
+	std::pair<iterator, bool> insert(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		return std::make_pair(this->at(i >= 0 ? i : ~i), i >= 0);
+	}
+	std::pair<iterator, bool> insert(const value_type& t)
+	{
+		return insert(t.first, t.second);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(start->first, start->second);
+	}
+	int count(const TKey& key) const
+	{
+		return (int)(FindEntry(key, false) >= 0);
+	}
+	void erase(const const_iterator& pos)
+	{
+		compact_hash_set_t::erase(pos);
+	}
+	bool erase(const TKey& key)
+	{
+		return Remove(key);
+	}
+
+	TValue& operator[](const TKey& key)
+	{
+		int i = Insert(key, TValue());
+		if (i < 0)
+			i = ~i; // key already existed
+		return this->_entries[i].t.second;
+	}
+
+	const KeyTraits& traits() const { return *this; }
+};
+
+#endif // _COMPACT_HASH_MAP_H
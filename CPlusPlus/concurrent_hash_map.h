@@ -0,0 +1,447 @@
+//
+// concurrent_hash_map.h
+//
+#ifndef _CONCURRENT_HASH_MAP_H
+#define _CONCURRENT_HASH_MAP_H
+
+#include <assert.h>
+#include <new>
+#include <vector>
+#include "hash_map.h"
+
+// Orders the loads of an optimistic (seqlock) reader. x86 and x64 never
+// reorder loads with other loads, so only the compiler must be held back;
+// other processors need a real fence.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <intrin.h>
+	#define CHM_READ_BARRIER() _ReadWriteBarrier()
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+	#define CHM_READ_BARRIER() __asm__ __volatile__("" ::: "memory")
+#elif defined(UNDER_CE)
+	inline void chm_fence() { LONG dummy = 0; InterlockedExchange(&dummy, 1); }
+	#define CHM_READ_BARRIER() chm_fence()
+#else
+	#define CHM_READ_BARRIER() MemoryBarrier()
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// concurrent_hash_map ////////////////////////////////////////////////////////
+//
+// A dictionary that any number of threads may read and modify at once. It is
+// split into segments (shards), each an open-addressing table with linear
+// probing that has its own lock, so writers that touch different segments do
+// not wait for each other. The top bits of the (Fibonacci-mixed) hash choose
+// the segment; the low bits choose the slot within it.
+//
+// Readers never take a lock when OptimisticReads is true, which is the
+// default when both the key and the value are numeric. Each segment has a
+// sequence number (a "seqlock") that writers make odd while they modify the
+// segment and even again afterward. A reader notes the sequence number,
+// looks up the key without locking, and then checks that the number has not
+// changed; if it has, the reader tries again. After MaxOptimisticReads failed
+// attempts (i.e. if writers keep the segment busy), the reader falls back to
+// the segment lock so that it cannot starve. Because a reader may see a slot
+// in the middle of being written, this is only safe for types that can be
+// copied and compared while torn (e.g. numbers and pointers); for other types
+// (such as std::string) readers lock the segment, which still spreads
+// contention over all the segments.
+//
+// So that an optimistic reader never touches freed memory, a table that is
+// replaced by a larger one is retired rather than freed, and is deleted in the
+// destructor. The retired tables of a segment always add up to less than the
+// size of its current table. Clear() keeps the tables, too.
+//
+// There are no iterators, since they could not be made safe while other
+// threads modify the map. Count() is exact only while no thread is writing.
+// The destructor must not run concurrently with any other method.
+//
+////////////////////////////////////////////////////////////////////////////////
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey>,
+         bool OptimisticReads = Math::num_traits<TKey>::is_numeric && Math::num_traits<TValue>::is_numeric>
+class concurrent_hash_map : protected KeyTraits
+{
+public:
+	typedef concurrent_hash_map<TKey, TValue, KeyTraits, OptimisticReads> concurrent_hash_map_t;
+	typedef const TKey key_type;
+	typedef const TValue mapped_type;
+	typedef std::pair<const TKey,TValue> value_type;
+	typedef unsigned int hash_type;
+	typedef unsigned int size_type;
+
+	enum {
+		DefaultConcurrency = 64,
+		MaxSegments = 1024,
+		MaxOptimisticReads = 64,
+	};
+
+protected:
+	// Control bytes. A full slot stores 0x80 plus 7 bits of the hash code, so
+	// most mismatches are rejected without comparing keys.
+	enum { Empty = 0, Deleted = 1, CacheLine = 64, MinCapacity = 8 };
+
+	struct Table
+	{
+		int mask;           // capacity - 1 (the capacity is a power of two)
+		uint8* ctrl;        // control byte of each slot
+		value_type* slots;  // slots[i] is constructed only if ctrl[i] is full
+		Table* retired;     // the table this one replaced, if it is still allocated
+
+		explicit Table(int capacity) : mask(capacity - 1), retired(NULL)
+		{
+			ctrl = new uint8[capacity];
+			memset(ctrl, Empty, capacity);
+			slots = (value_type*)::operator new(capacity * sizeof(value_type));
+		}
+		~Table()
+		{
+			delete[] ctrl;
+			::operator delete(slots);
+		}
+		int Capacity() const { return mask + 1; }
+	};
+
+	struct Segment
+	{
+		volatile LONG seq;     // odd while a writer is modifying the segment
+		Table* volatile table;
+		volatile int count;    // number of keys
+		int deleted;           // number of tombstones
+		CRITICAL_SECTION lock;
+		char _pad[CacheLine];  // keep the next segment's seq off our cache line
+
+		Segment() : seq(0), table(NULL), count(0), deleted(0)
+		{
+			#ifdef UNDER_CE
+			InitializeCriticalSection(&lock);
+			#else
+			InitializeCriticalSectionAndSpinCount(&lock, 1000);
+			#endif
+		}
+		~Segment() { DeleteCriticalSection(&lock); }
+	};
+
+	// Holds a segment's lock; if OptimisticReads, also makes its sequence
+	// number odd for the lifetime of the object.
+	class WriteLock
+	{
+		Segment& _s;
+	public:
+		WriteLock(Segment& s) : _s(s)
+		{
+			EnterCriticalSection(&_s.lock);
+			if (OptimisticReads)
+				InterlockedIncrement(&_s.seq);
+		}
+		~WriteLock()
+		{
+			if (OptimisticReads)
+				InterlockedIncrement(&_s.seq);
+			LeaveCriticalSection(&_s.lock);
+		}
+	};
+	class ReadLock
+	{
+		Segment& _s;
+	public:
+		ReadLock(Segment& s) : _s(s) { EnterCriticalSection(&_s.lock); }
+		~ReadLock() { LeaveCriticalSection(&_s.lock); }
+	};
+
+	Segment* _segments;
+	int _segmentCount;
+	int _segmentShift; // 32 - log2(_segmentCount)
+
+	// MurmurHash3's finalizer. The segment comes from the top bits and the
+	// home slot from the bottom bits, so every bit must depend on the whole
+	// hash code; a plain multiply would put keys that differ only in their
+	// high bits (multiples of 2^k, aligned pointers) in the same home slot.
+	static hash_type Mix(hash_type h)
+	{
+		h ^= h >> 16; h *= 0x85ebca6bu;
+		h ^= h >> 13; h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+	static uint8 Tag(hash_type mixed) { return (uint8)(0x80 | ((mixed >> 16) & 0x7F)); }
+	static bool IsFull(uint8 ctrl) { return (ctrl & 0x80) != 0; }
+
+	Segment& SegmentOf(hash_type mixed) const
+	{
+		return _segments[_segmentShift >= 32 ? 0 : (int)(mixed >> _segmentShift)];
+	}
+
+	// Returns the slot that holds the key in t, or -1. The probe gives up
+	// after visiting every slot once, so that an optimistic reader cannot loop
+	// forever in a table that is changing under it.
+	int FindSlot(const Table* t, hash_type mixed, const TKey& key) const
+	{
+		uint8 tag = Tag(mixed);
+		int mask = t->mask;
+		for (int n = 0, i = (int)(mixed & mask); n <= mask; n++, i = (i + 1) & mask) {
+			uint8 c = t->ctrl[i];
+			if (c == Empty)
+				break;
+			if (c == tag && this->equals(t->slots[i].first, key))
+				return i;
+		}
+		return -1;
+	}
+
+	// Returns the first slot (empty or deleted) where the key could be put.
+	static int FindFreeSlot(const Table* t, hash_type mixed)
+	{
+		for (int i = (int)(mixed & t->mask); ; i = (i + 1) & t->mask)
+			if (!IsFull(t->ctrl[i]))
+				return i;
+	}
+
+	// Moves the keys of the segment into a table of the specified capacity.
+	// The caller holds the write lock.
+	void Rehash(Segment& s, int capacity)
+	{
+		Table* old = s.table;
+		if (old != NULL && old->Capacity() == capacity) {
+			// Remove tombstones in place. Optimistic readers may still be using
+			// this table, which is why it is not simply replaced.
+			std::vector<value_type> live;
+			live.reserve(s.count);
+			for (int i = 0; i <= old->mask; i++) {
+				if (IsFull(old->ctrl[i])) {
+					live.push_back(old->slots[i]);
+					old->slots[i].~value_type();
+				}
+			}
+			memset(old->ctrl, Empty, old->Capacity());
+			for (size_t j = 0; j < live.size(); j++)
+				Place(old, live[j]);
+		} else {
+			Table* t = new Table(capacity);
+			if (old != NULL) {
+				for (int i = 0; i <= old->mask; i++) {
+					if (IsFull(old->ctrl[i])) {
+						Place(t, old->slots[i]);
+						old->slots[i].~value_type();
+					}
+				}
+				memset(old->ctrl, Empty, old->Capacity());
+				if (OptimisticReads)
+					t->retired = old;
+				else
+					delete old;
+			}
+			s.table = t;
+		}
+		s.deleted = 0;
+	}
+	void Place(Table* t, const value_type& kv)
+	{
+		hash_type mixed = Mix(this->hash_value(kv.first));
+		int i = FindFreeSlot(t, mixed);
+		new (&t->slots[i]) value_type(kv);
+		t->ctrl[i] = Tag(mixed);
+	}
+
+	// Returns a slot >= 0 if a new key was inserted, or ~slot if the key
+	// already existed (in which case the value is not changed). The caller
+	// holds the write lock.
+	int Insert(Segment& s, hash_type mixed, const TKey& key, const TValue& value)
+	{
+		if (s.table != NULL) {
+			int i = FindSlot(s.table, mixed, key);
+			if (i >= 0)
+				return ~i;
+		}
+		// Keep the load (including tombstones) at or below 3/4
+		int capacity = s.table ? s.table->Capacity() : 0;
+		if ((s.count + s.deleted + 1) * 4 > capacity * 3) {
+			int newCapacity = capacity < MinCapacity ? MinCapacity : capacity;
+			while ((s.count + 1) * 2 > newCapacity)
+				newCapacity *= 2;
+			Rehash(s, newCapacity);
+		}
+		Table* t = s.table;
+		int i = FindFreeSlot(t, mixed);
+		new (&t->slots[i]) value_type(key, value);
+		if (t->ctrl[i] == Deleted)
+			s.deleted--;
+		t->ctrl[i] = Tag(mixed);
+		s.count++;
+		return i;
+	}
+
+	// Looks up the key and copies its value; value is unchanged on failure.
+	bool Lookup(const TKey& key, TValue* value) const
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		Segment& s = SegmentOf(mixed);
+		if (OptimisticReads) {
+			for (int attempt = 0; attempt < MaxOptimisticReads; attempt++) {
+				LONG seq = s.seq;
+				if (seq & 1)
+					continue; // a writer is busy
+				CHM_READ_BARRIER();
+				const Table* t = s.table;
+				int i = t ? FindSlot(t, mixed, key) : -1;
+				TValue found = TValue();
+				if (i >= 0 && value != NULL)
+					found = t->slots[i].second;
+				CHM_READ_BARRIER();
+				if (s.seq == seq) {
+					if (i >= 0 && value != NULL)
+						*value = found;
+					return i >= 0;
+				}
+			}
+		}
+		ReadLock lock(s);
+		const Table* t = s.table;
+		int i = t ? FindSlot(t, mixed, key) : -1;
+		if (i >= 0 && value != NULL)
+			*value = t->slots[i].second;
+		return i >= 0;
+	}
+
+	void Init(int concurrency, int capacity)
+	{
+		_segmentCount = 1;
+		_segmentShift = 32;
+		while (_segmentCount < concurrency && _segmentCount < MaxSegments) {
+			_segmentCount *= 2;
+			_segmentShift--;
+		}
+		_segments = new Segment[_segmentCount];
+		if (capacity > 0) {
+			int perSegment = capacity / _segmentCount + 1;
+			int segmentCapacity = MinCapacity;
+			while (segmentCapacity * 3 < perSegment * 4)
+				segmentCapacity *= 2;
+			for (int i = 0; i < _segmentCount; i++)
+				Rehash(_segments[i], segmentCapacity);
+		}
+	}
+
+	concurrent_hash_map(const concurrent_hash_map_t&);            // not copyable
+	concurrent_hash_map_t& operator=(const concurrent_hash_map_t&);
+
+public:
+	// concurrency is the number of segments (rounded up to a power of two).
+	// It should exceed the number of threads that write at once.
+	explicit concurrent_hash_map(int concurrency = DefaultConcurrency, int capacity = 0, const KeyTraits& traits = KeyTraits())
+		: KeyTraits(traits)
+	{
+		Init(concurrency, capacity);
+	}
+	~concurrent_hash_map()
+	{
+		Clear();
+		for (int i = 0; i < _segmentCount; i++) {
+			for (Table* t = _segments[i].table; t != NULL; ) {
+				Table* retired = t->retired;
+				delete t;
+				t = retired;
+			}
+		}
+		delete[] _segments;
+	}
+
+	// Puts the specified key in the map. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (!TryAdd(key, value))
+			throw exception_t(_T("Key already exists in concurrent_hash_map"));
+	}
+
+	// Puts the specified key in the map if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist).
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		Segment& s = SegmentOf(mixed);
+		WriteLock lock(s);
+		return Insert(s, mixed, key, value) >= 0;
+	}
+
+	// Puts the specified key in the map. If a matching key already exists, its
+	// value is overwritten. Returns true if the specified key did not already
+	// exist.
+	bool Set(const TKey& key, const TValue& value)
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		Segment& s = SegmentOf(mixed);
+		WriteLock lock(s);
+		int i = Insert(s, mixed, key, value);
+		if (i < 0)
+			s.table->slots[~i].second = value;
+		return i >= 0;
+	}
+
+	bool Remove(const TKey& key)
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		Segment& s = SegmentOf(mixed);
+		WriteLock lock(s);
+		Table* t = s.table;
+		int i = t ? FindSlot(t, mixed, key) : -1;
+		if (i < 0)
+			return false;
+		t->slots[i].~value_type();
+		// A slot followed by an empty slot ends no probe sequence but its own
+		if (t->ctrl[(i + 1) & t->mask] == Empty)
+			t->ctrl[i] = Empty;
+		else {
+			t->ctrl[i] = Deleted;
+			s.deleted++;
+		}
+		s.count--;
+		return true;
+	}
+
+	bool Contains(const TKey& key) const
+	{
+		return Lookup(key, NULL);
+	}
+	bool TryGet(const TKey& key, OUT TValue& value) const
+	{
+		return Lookup(key, &value);
+	}
+	TValue Get(const TKey& key, TValue defaultValue) const
+	{
+		Lookup(key, &defaultValue);
+		return defaultValue;
+	}
+
+	// Removes all keys, one segment at a time. The tables are kept.
+	void Clear()
+	{
+		for (int i = 0; i < _segmentCount; i++) {
+			Segment& s = _segments[i];
+			WriteLock lock(s);
+			Table* t = s.table;
+			if (t == NULL)
+				continue;
+			for (int j = 0; j <= t->mask; j++)
+				if (IsFull(t->ctrl[j]))
+					t->slots[j].~value_type();
+			memset(t->ctrl, Empty, t->Capacity());
+			s.count = s.deleted = 0;
+		}
+	}
+
+	int Count() const
+	{
+		int count = 0;
+		for (int i = 0; i < _segmentCount; i++)
+			count += _segments[i].count;
+		return count;
+	}
+	int SegmentCount() const { return _segmentCount; }
+
+	size_type size() const { return Count(); }
+	bool empty() const { return Count() == 0; }
+	void clear() { Clear(); }
+
+	const KeyTraits& traits() const { return *this; }
+};
+
+#endif // _CONCURRENT_HASH_MAP_H
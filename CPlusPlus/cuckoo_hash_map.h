@@ -0,0 +1,968 @@
+//
+// cuckoo_hash_map.h
+//
+#ifndef _CUCKOO_HASH_MAP_H
+#define _CUCKOO_HASH_MAP_H
+
+#include <assert.h>
+#include <string.h>
+#include <new>
+#include "hash_map.h"
+
+// A summary of the layout of a cuckoo_hash_set or cuckoo_hash_map (see
+// cuckoo_hash_set::stats), comparable with hash_table_stats.
+struct cuckoo_table_stats
+{
+	cuckoo_table_stats() : Count(0), BucketCount(0), Capacity(0), InFirstBucket(0), InStash(0), Bytes(0) {}
+
+	int Count;         // Number of items
+	int BucketCount;   // Number of buckets
+	int Capacity;      // Number of slots ((BucketCount + 1) * SlotsPerBucket, with the stash)
+	int InFirstBucket; // Number of items in the first of their two buckets
+	int InStash;       // Number of items in the stash
+	size_t Bytes;      // Memory used by the bucket array
+
+	double LoadFactor() const { return Capacity ? (double)Count / Capacity : 0; }
+	// Average number of buckets read by a successful lookup (1 or 2 each,
+	// 3 for items in the stash); an unsuccessful lookup reads 2, or 3 if
+	// the stash is not empty.
+	double AvgBucketsHit() const { return Count ? 2 - (double)(InFirstBucket - InStash) / Count : 0; }
+	double BytesPerItem() const { return Count ? (double)Bytes / Count : 0; }
+
+	// A one-line summary, e.g. "load 0.93, 71% in first bucket, 1.29 buckets
+	// per hit, 9.7 bytes/item"
+	std::string ToString() const
+	{
+		return printstring("load %.2f, %d%% in first bucket, %.2f buckets per hit, %.1f bytes/item",
+			LoadFactor(), Count ? (int)(InFirstBucket * 100.0 / Count + 0.5) : 0,
+			AvgBucketsHit(), BytesPerItem());
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// cuckoo_hash_set ////////////////////////////////////////////////////////////
+//
+// A bucketized cuckoo hash set with the same hash_traits, .NET-style methods
+// (Add, TryAdd, Set, Remove, Contains) and STL-style interface as hash_set.
+// It is meant for large tables of small items, where memory matters most.
+//
+// hash_set needs 12 bytes per entry besides the key, plus up to twice as
+// many entries and buckets as keys right after it grows. cuckoo_hash_set
+// stores keys directly in buckets of SlotsPerBucket slots, with one tag byte
+// per slot, and each key may live in either of two buckets. When both are
+// full, an insert moves a key from one of them to its other bucket, and that
+// key may displace another, and so on: a breadth-first search finds the
+// shortest such chain of moves (up to MaxPathLength). The table grows only
+// when there is no such chain, which in practice does not happen until
+// 94-99% of the slots are full.
+//
+// A bucket is 8 tag bytes followed by as many slots as fit in the rest of a
+// 64-byte cache line (up to 8), and buckets are aligned so that none
+// straddles two lines. A lookup reads at most two buckets (plus the stash
+// described below, if it is not empty), however full the table is: it
+// compares the key's tag (8 bits of its hash code) with all tags of a bucket
+// at once, and compares the key only with slots whose tag matched. So for
+// items of up to 18 bytes, a lookup touches at most two cache lines besides
+// the stash. Larger items get 4 slots per bucket, in buckets of several
+// lines. An int to int map has 7 slots per bucket and uses 9.2 bytes per
+// item just before it grows (18.4 just after), versus 20 to 40 for hash_map;
+// an int set uses 8 (8 slots, padded from 40 bytes to 64).
+//
+// Growing the table does not help when more than 2 * SlotsPerBucket keys
+// have the same hash code, since they always share the same two buckets
+// (hash_traits<double>, for example, XORs the two halves of a double, so
+// many doubles share a hash code). Such keys go in a "stash", one extra
+// bucket that lookups check only while it is not empty. If the stash is
+// full too, an insert throws an exception instead of growing the table
+// until memory runs out.
+//
+// The second bucket of a key is the first XORed with a function of the tag
+// ("partial-key cuckoo hashing", from MemC3 and cuckoo filters), so a key
+// can be moved to its other bucket without being hashed again. Hash codes
+// are scrambled with MurmurHash3's finalizer first, so hash_traits that
+// return sequential numbers for sequential keys still spread keys evenly.
+//
+// Moving keys means that, unlike hash_set, inserting a key can move other
+// keys (which invalidates iterators and pointers to them). Removing a key
+// invalidates only iterators that point to it. Keys are moved by copying
+// and destroying them, so very large keys are better kept in a hash_set.
+//
+////////////////////////////////////////////////////////////////////////////////
+template<class T, class Traits = hash_traits<T> >
+class cuckoo_hash_set : protected Traits {
+public:
+	typedef const T key_type;
+	typedef const T value_type;
+	typedef unsigned int hash_type;
+	typedef unsigned int size_type;
+	typedef cuckoo_hash_set<T, Traits> cuckoo_hash_set_t;
+
+	// As many slots as fit in a cache line next to the 8 tag bytes, up to 8
+	// (7 for 8-byte items such as int to int pairs). Items too large for 3
+	// slots per line get 4 slots in a bucket of several lines.
+	enum { SlotsPerBucket = (64 - 8) / sizeof(T) > 8 ? 8 : (64 - 8) / sizeof(T) < 3 ? 4 : (64 - 8) / sizeof(T),
+	       MaxPathLength = 5 };
+
+protected:
+	// A bucket is never constructed as a whole; only slots whose tag is
+	// nonzero hold a constructed T.
+	struct bucket
+	{
+		union {
+			uint8 tags[8]; // tags[SlotsPerBucket..7] are always 0
+			uint64 tagWord;
+		};
+		T slots[SlotsPerBucket];
+	};
+	// MaxGrowRounds limits how many times one insert may double the table
+	enum { MinBuckets = 2, MaxSearchNodes = 512, CacheLine = 64, MaxGrowRounds = 4 };
+	// Buckets are BucketBytes apart: a power of two up to a cache line, or a
+	// multiple of cache lines, so that a bucket never straddles more lines
+	// than it must
+	enum { BucketBytes = sizeof(bucket) <= 16 ? 16 : sizeof(bucket) <= 32 ? 32
+	                   : (sizeof(bucket) + CacheLine - 1) / CacheLine * CacheLine };
+
+	// _bucketCount buckets, aligned to a cache line, followed by the stash
+	// (a bucket whose keys may belong to any bucket). Use Bucket(b) to get
+	// bucket b.
+	bucket* _buckets;
+	char* _raw;         // Memory that holds _buckets
+	size_type _bucketCount; // 0 or a power of two >= MinBuckets
+	size_type _capacity;    // Number of slots ((_bucketCount + 1) * SlotsPerBucket)
+	size_type _count;
+	size_type _stashed;     // Number of keys in the stash
+	// 32 - log2(_bucketCount); a key's first bucket is selected by the top
+	// bits of its mixed hash code.
+	int _shift;
+
+	static hash_type Mix(hash_type h)
+	{
+		h ^= h >> 16; h *= 0x85ebca6bu;
+		h ^= h >> 13; h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+	static uint8 Tag(hash_type mixed)
+	{
+		uint8 tag = (uint8)mixed;
+		return tag != 0 ? tag : 1; // 0 marks an empty slot
+	}
+	size_type FirstBucket(hash_type mixed) const { return mixed >> _shift; }
+	size_type OtherBucket(size_type b, uint8 tag) const
+		{ return b ^ ((((uint32)tag * 0x5bd1e995u) >> _shift) | 1); }
+
+	bucket& Bucket(size_type b) const { return *(bucket*)((char*)_buckets + (size_t)b * BucketBytes); }
+	T& Slot(size_type i) const { return Bucket(i / SlotsPerBucket).slots[i % SlotsPerBucket]; }
+	uint8& TagOf(size_type i) const { return Bucket(i / SlotsPerBucket).tags[i % SlotsPerBucket]; }
+	bool IsFree(size_type i) const { return TagOf(i) == 0; }
+	bool InStash(size_type i) const { return i / SlotsPerBucket == _bucketCount; }
+
+	// Returns a mask with bit 8*s+7 set for each slot s of the bucket whose
+	// tag equals 'tag'. Bits above a true match may be set spuriously, so
+	// the result is only good for telling whether any slot matches.
+	static uint64 MatchTags(const bucket& b, uint8 tag)
+	{
+		uint64 x = b.tagWord ^ (0x0101010101010101ull * tag);
+		return (x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull;
+	}
+	int FreeSlotIn(size_type b) const
+	{
+		const bucket& bk = Bucket(b);
+		for (int s = 0; s < SlotsPerBucket; s++)
+			if (bk.tags[s] == 0)
+				return s;
+		return -1;
+	}
+
+	// Matches a slot against a key, for use by FindSlot()
+	struct KeyMatch
+	{
+		KeyMatch(const Traits& traits, const T& key) : traits(traits), key(key) {}
+		bool operator()(const T& t) const { return traits.equals(t, key); }
+		const Traits& traits;
+		const T& key;
+	};
+
+	template<class Match>
+	size_type FindInBucket(size_type b, uint8 tag, const Match& match) const
+	{
+		const bucket& bk = Bucket(b);
+		for (int s = 0; s < SlotsPerBucket; s++)
+			if (bk.tags[s] == tag && match(bk.slots[s]))
+				return b * SlotsPerBucket + s;
+		return _capacity;
+	}
+	// Returns the slot that holds a key for which match() is true, or
+	// _capacity if there is none. 'mixed' is Mix(hash code of the key).
+	template<class Match>
+	size_type FindSlot(hash_type mixed, const Match& match) const
+	{
+		if (_bucketCount == 0)
+			return _capacity;
+		uint8 tag = Tag(mixed);
+		size_type b1 = FirstBucket(mixed);
+		// Check the tags of both buckets before comparing any keys
+		if (MatchTags(Bucket(b1), tag)) {
+			size_type i = FindInBucket(b1, tag, match);
+			if (i < _capacity)
+				return i;
+		}
+		size_type b2 = OtherBucket(b1, tag);
+		if (MatchTags(Bucket(b2), tag)) {
+			size_type i = FindInBucket(b2, tag, match);
+			if (i < _capacity)
+				return i;
+		}
+		if (_stashed != 0 && MatchTags(Bucket(_bucketCount), tag))
+			return FindInBucket(_bucketCount, tag, match);
+		return _capacity;
+	}
+
+	// Moves the key in slot 'from' to the free slot 'to'
+	void MoveSlot(size_type from, size_type to)
+	{
+		assert(!IsFree(from) && IsFree(to));
+		new (&Slot(to)) T(Slot(from));
+		TagOf(to) = TagOf(from);
+		Slot(from).~T();
+		TagOf(from) = 0;
+	}
+
+	// A bucket reached by the breadth-first search of MakeRoom(): the key in
+	// slot 'slot' of the parent's bucket can move to this bucket.
+	struct search_node
+	{
+		size_type bucket;
+		int16 parent;  // -1 for the two buckets of the new key
+		uint8 slot;
+		uint8 depth;
+	};
+	static search_node Node(size_type b, int parent, int slot, int depth)
+	{
+		search_node n = { b, (int16)parent, (uint8)slot, (uint8)depth };
+		return n;
+	}
+	bool OnPath(const search_node* nodes, int n, size_type b) const
+	{
+		for (; n >= 0; n = nodes[n].parent)
+			if (nodes[n].bucket == b)
+				return true;
+		return false;
+	}
+
+	// Frees a slot in bucket b1 or b2, both of which are full, by moving keys
+	// along the shortest chain that ends in a bucket with a free slot.
+	// Returns the freed slot, or -1 if there is no chain of at most
+	// MaxPathLength moves.
+	int MakeRoom(size_type b1, size_type b2)
+	{
+		search_node nodes[MaxSearchNodes];
+		int tail = 0;
+		nodes[tail++] = Node(b1, -1, 0, 0);
+		if (b2 != b1)
+			nodes[tail++] = Node(b2, -1, 0, 0);
+		for (int head = 0; head < tail; head++)
+		{
+			const search_node& n = nodes[head];
+			for (int s = 0; s < SlotsPerBucket; s++)
+			{
+				size_type alt = OtherBucket(n.bucket, Bucket(n.bucket).tags[s]);
+				int freeSlot = FreeSlotIn(alt);
+				if (freeSlot >= 0) {
+					// Move each key along the path into the slot that the
+					// previous move freed, starting at the end.
+					size_type to = alt * SlotsPerBucket + freeSlot;
+					size_type from = n.bucket * SlotsPerBucket + s;
+					for (int node = head; ; node = nodes[node].parent) {
+						MoveSlot(from, to);
+						to = from;
+						if (nodes[node].parent < 0)
+							return (int)to;
+						from = nodes[nodes[node].parent].bucket * SlotsPerBucket + nodes[node].slot;
+					}
+				}
+				// Every bucket on a path is distinct, so no key moves twice
+				if (n.depth + 1 < MaxPathLength && tail < MaxSearchNodes && !OnPath(nodes, head, alt))
+					nodes[tail++] = Node(alt, head, s, n.depth + 1);
+			}
+		}
+		return -1;
+	}
+
+	// Returns a free slot in one of the key's two buckets, making room if
+	// necessary, or -1 if there is no room without growing the table.
+	int FindFreeSlot(hash_type mixed)
+	{
+		uint8 tag = Tag(mixed);
+		size_type b1 = FirstBucket(mixed), b2 = OtherBucket(b1, tag);
+		int s = FreeSlotIn(b1);
+		if (s >= 0)
+			return (int)(b1 * SlotsPerBucket + s);
+		if ((s = FreeSlotIn(b2)) >= 0)
+			return (int)(b2 * SlotsPerBucket + s);
+		return MakeRoom(b1, b2);
+	}
+	// Returns a free slot in the stash, or -1 if the stash is full
+	int FreeStashSlot() const
+	{
+		int s = FreeSlotIn(_bucketCount);
+		return s >= 0 ? (int)(_bucketCount * SlotsPerBucket + s) : -1;
+	}
+	// Returns true if every slot of both buckets of a key holds a key with
+	// the same hash code, so that no table size has room for another one.
+	// Called only when both buckets are full.
+	bool BucketsCollide(hash_type mixed) const
+	{
+		size_type b1 = FirstBucket(mixed), b[2] = { b1, OtherBucket(b1, Tag(mixed)) };
+		for (int k = 0; k < 2; k++)
+			for (int s = 0; s < SlotsPerBucket; s++)
+				if (Mix(this->hash_value(Bucket(b[k]).slots[s])) != mixed)
+					return false;
+		return true;
+	}
+	void ThrowTooManyCollisions() const
+	{
+		throw exception_t(_T("Too many keys with the same hash code in cuckoo_hash_set"));
+	}
+
+	// Returns the index of a free slot in which the caller must construct the
+	// new key and then call CommitInsert(). If a matching key already exists,
+	// returns ~index of the key's slot instead. May move other keys or grow
+	// the table. The key goes in the stash if growing cannot make room for
+	// it, or has not; if the stash is full as well, an exception is thrown.
+	template<class Match>
+	int PrepareInsert(hash_type mixed, const Match& match)
+	{
+		size_type i = FindSlot(mixed, match);
+		if (i < _capacity)
+			return ~(int)i;
+		for (int rounds = 0; ; rounds++) {
+			if (_bucketCount != 0) {
+				int slot = FindFreeSlot(mixed);
+				if (slot >= 0)
+					return slot;
+				bool collide = BucketsCollide(mixed);
+				if (collide || rounds > 0) {
+					if ((slot = FreeStashSlot()) >= 0)
+						return slot;
+					if (collide || rounds >= MaxGrowRounds)
+						ThrowTooManyCollisions();
+				}
+			}
+			Rehash(_bucketCount ? _bucketCount * 2 : (size_type)MinBuckets);
+		}
+	}
+	void CommitInsert(size_type i, hash_type mixed)
+	{
+		TagOf(i) = Tag(mixed);
+		_count++;
+		if (InStash(i))
+			_stashed++;
+	}
+
+	// Returns an index >= 0 if a new key was inserted; if the key already existed,
+	// a negative value ~index is returned and the hashtable is not modified.
+	int Insert(const T& key)
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		int i = PrepareInsert(mixed, KeyMatch(*this, key));
+		if (i >= 0) {
+			new (&Slot(i)) T(key);
+			CommitInsert(i, mixed);
+		}
+		return i;
+	}
+
+	void EraseSlot(size_type i)
+	{
+		assert(i < _capacity && !IsFree(i));
+		try {
+			Slot(i).~T();
+		} catch(...) { }
+		TagOf(i) = 0;
+		_count--;
+		if (InStash(i))
+			_stashed--;
+	}
+
+	void Init(size_type capacity)
+	{
+		_buckets = NULL;
+		_raw = NULL;
+		_bucketCount = _capacity = _count = _stashed = 0;
+		_shift = 32;
+		if (capacity)
+			Rehash(BucketsFor(capacity));
+	}
+	// Number of buckets that can comfortably hold 'count' keys (at 7/8 load)
+	static size_type BucketsFor(size_type count)
+	{
+		size_type buckets = MinBuckets;
+		while (buckets * SlotsPerBucket - buckets * SlotsPerBucket / 8 < count)
+			buckets *= 2;
+		return buckets;
+	}
+	void Allocate(size_type bucketCount)
+	{
+		_raw = (char*)::operator new((size_t)(bucketCount + 1) * BucketBytes + CacheLine - 1);
+		_buckets = (bucket*)(((size_t)_raw + CacheLine - 1) & ~(size_t)(CacheLine - 1));
+		for (size_type b = 0; b <= bucketCount; b++)
+			Bucket(b).tagWord = 0;
+		_bucketCount = bucketCount;
+		_capacity = (bucketCount + 1) * SlotsPerBucket;
+		_shift = 32 - Math::Log2Floor((uint32)bucketCount);
+		_count = _stashed = 0;
+	}
+	void FreeSlots()
+	{
+		for (size_type i = 0; i < _capacity; i++)
+			if (!IsFree(i))
+				Slot(i).~T();
+		::operator delete(_raw);
+	}
+	// Copies the keys to a new bucket array, putting keys that do not fit in
+	// their buckets in the stash. If the stash fills up, the new array is
+	// discarded and a larger one is tried, up to MaxGrowRounds times.
+	void Rehash(size_type newBucketCount)
+	{
+		if (newBucketCount < (size_type)MinBuckets)
+			newBucketCount = MinBuckets;
+		assert((newBucketCount & (newBucketCount - 1)) == 0);
+		cuckoo_hash_set_t old;
+		old.SwapBuckets(*this);
+		for (int rounds = 0; ; rounds++) {
+			Allocate(newBucketCount);
+			size_type i = 0;
+			for (; i < old._capacity; i++)
+				if (!old.IsFree(i)) {
+					hash_type mixed = Mix(this->hash_value(old.Slot(i)));
+					int j = FindFreeSlot(mixed);
+					if (j < 0 && (j = FreeStashSlot()) < 0)
+						break;
+					new (&Slot(j)) T(old.Slot(i));
+					CommitInsert(j, mixed);
+				}
+			if (i >= old._capacity)
+				break;
+			FreeSlots();
+			if (rounds >= MaxGrowRounds) {
+				// Put the old table back
+				Init(0);
+				SwapBuckets(old);
+				ThrowTooManyCollisions();
+			}
+			newBucketCount *= 2;
+		}
+		// old's destructor frees the old keys
+	}
+	void SwapBuckets(cuckoo_hash_set_t& other)
+	{
+		std::swap(_buckets, other._buckets);
+		std::swap(_raw, other._raw);
+		std::swap(_bucketCount, other._bucketCount);
+		std::swap(_capacity, other._capacity);
+		std::swap(_count, other._count);
+		std::swap(_stashed, other._stashed);
+		std::swap(_shift, other._shift);
+	}
+	void CopyFrom(const cuckoo_hash_set_t& copy)
+	{
+		Init(0);
+		if (copy._count == 0)
+			return;
+		// Same bucket count and hash function, so every key goes in the same slot
+		Allocate(copy._bucketCount);
+		for (size_type i = 0; i < _capacity; i++)
+			if (!copy.IsFree(i)) {
+				new (&Slot(i)) T(copy.Slot(i));
+				TagOf(i) = copy.TagOf(i);
+				_count++;
+			}
+		_stashed = copy._stashed;
+	}
+
+public:
+	cuckoo_hash_set() { Init(0); }
+	explicit cuckoo_hash_set(size_type capacity, const Traits& traits = Traits())
+		: Traits(traits)
+	{
+		Init(capacity);
+	}
+	~cuckoo_hash_set() { Clear(); }
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const T& key)
+	{
+		if (Insert(key) < 0)
+			throw exception_t(_T("Key already exists in cuckoo_hash_set"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist). If
+	// the key already existed, the hashtable is not modified.
+	bool TryAdd(const T& key)
+	{
+		return Insert(key) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, it is
+	// overwritten with this new version of the key. Returns true if the specified
+	// key did not already exist.
+	bool Set(const T& key)
+	{
+		int i = Insert(key);
+		if (i < 0)
+			Slot(~i) = key;
+		return i >= 0;
+	}
+
+	void Clear()
+	{
+		if (_raw != NULL)
+			FreeSlots();
+		Init(0);
+	}
+
+	bool Contains(const T& key) const
+	{
+		return FindEntry(key) < _capacity;
+	}
+
+	bool Remove(const T& key)
+	{
+		size_type i = FindEntry(key);
+		if (i >= _capacity)
+			return false;
+		EraseSlot(i);
+		return true;
+	}
+
+	int Count() const { return (int)_count; }
+
+	// Describes how full the table is and how much memory it uses
+	cuckoo_table_stats stats() const
+	{
+		cuckoo_table_stats s;
+		s.Count = Count();
+		s.BucketCount = (int)_bucketCount;
+		s.Capacity = (int)_capacity;
+		s.InStash = (int)_stashed;
+		s.Bytes = _raw != NULL ? (size_t)(_bucketCount + 1) * BucketBytes + CacheLine - 1 : 0;
+		for (size_type i = 0; i < _capacity; i++)
+			if (!IsFree(i) && FirstBucket(Mix(this->hash_value(Slot(i)))) == i / SlotsPerBucket)
+				s.InFirstBucket++;
+		return s;
+	}
+
+protected:
+	// Returns the slot that holds a matching key, or _capacity if the key was
+	// not found.
+	size_type FindEntry(const T& key) const
+	{
+		return FindSlot(Mix(this->hash_value(key)), KeyMatch(*this, key));
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	cuckoo_hash_set(const cuckoo_hash_set_t& copy) : Traits(copy.traits())
+	{
+		CopyFrom(copy);
+	}
+	cuckoo_hash_set_t& operator=(const cuckoo_hash_set_t& copy)
+	{
+		if (&copy != this) {
+			Clear();
+			Traits::operator=(copy);
+			CopyFrom(copy);
+		}
+		return *this;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	// iterators //////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	class const_iterator {
+	protected:
+		typedef const typename cuckoo_hash_set_t::value_type& reference;
+		typedef const typename cuckoo_hash_set_t::value_type* pointer;
+		typedef const cuckoo_hash_set_t hash_t;
+		typedef const_iterator self;
+		friend class cuckoo_hash_set<T, Traits>;
+
+		hash_t* _hash;
+		size_type _pos;
+
+		const_iterator(const hash_t* hash, size_type pos)
+			: _hash(const_cast<hash_t*>(hash)), _pos(pos) { }
+	public:
+		const_iterator() : _hash(NULL) {}
+
+		bool MoveNext()
+		{
+			if (_hash == NULL)
+				return false;
+			do
+				if (++_pos >= _hash->_capacity) {
+					_pos = _hash->_capacity;
+					return false;
+				}
+			while(_hash->IsFree(_pos));
+			return true;
+		}
+		bool MovePrev()
+		{
+			if (_hash == NULL)
+				return false;
+			do
+				if ((int)--_pos < 0) {
+					_pos = (size_type)-1;
+					return false;
+				}
+			while(_hash->IsFree(_pos));
+			return true;
+		}
+
+		reference operator*() const { assert(is_valid()); return _hash->Slot(_pos); }
+		pointer operator->() const { assert(is_valid()); return &_hash->Slot(_pos); }
+
+		self& operator++() // prefix ++
+			{ MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ MovePrev(); return *this; }
+		bool operator==(const self& x) const
+			{ return (x._hash == _hash) && (x._pos == _pos); }
+		bool operator<(const self& x) const
+			{ assert(_hash == x._hash); return _pos < x._pos; }
+		bool operator<=(const self& x) const
+			{ assert(_hash == x._hash); return _pos <= x._pos; }
+
+		// Returns true if the iterator can be dereferenced
+		bool is_valid() const
+			{ return _hash != NULL && _pos < _hash->_capacity && !_hash->IsFree(_pos); }
+
+		/////////////////////////////////////////////////////////
+		// Operators that are defined in terms of other operators
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			MovePrev();
+			return tmp;
+		}
+		bool operator!=(const self& x) const { return !(*this == x); }
+		bool operator>(const self& x) const { return !(*this <= x); }
+		bool operator>=(const self& x) const { return !(*this < x); }
+
+		const hash_t* collection() const { return _hash; }
+	};
+
+	class iterator : public const_iterator {
+	protected:
+		typedef typename cuckoo_hash_set_t::value_type& reference;
+		typedef typename cuckoo_hash_set_t::value_type* pointer;
+		typedef cuckoo_hash_set_t hash_t;
+		typedef iterator self;
+		friend class cuckoo_hash_set<T, Traits>;
+
+		iterator(hash_t* hash, size_type pos) : const_iterator(hash, pos) {}
+	public:
+		iterator() {}
+
+		reference operator*() const { assert(this->is_valid()); return this->_hash->Slot(this->_pos); }
+		pointer operator->() const { assert(this->is_valid()); return &this->_hash->Slot(this->_pos); }
+
+		self& operator++() // prefix ++
+			{ this->MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ this->MovePrev(); return *this; }
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			this->MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			this->MovePrev();
+			return tmp;
+		}
+
+		hash_t* collection() const { return const_cast<hash_t*>(this->_hash); }
+	};
+
+	friend class const_iterator;
+	friend class iterator;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	size_type size() const { return _count; }
+	// Number of slots, including the stash. The table grows when a key does
+	// not fit, which normally happens when size() is 95-98% of capacity().
+	size_type capacity() const { return _capacity; }
+	bool empty() const { return _count == 0; }
+	void clear() { Clear(); }
+	// Makes room for at least 'count' keys, leaving 1/8 of the slots free so
+	// that inserts rarely need to move keys
+	void reserve(size_type count)
+	{
+		size_type buckets = BucketsFor(count);
+		if (buckets > _bucketCount)
+			Rehash(buckets);
+	}
+
+	iterator begin()
+	{
+		iterator it(this, (size_type)-1);
+		return ++it;
+	}
+	const_iterator begin() const
+	{
+		const_iterator it(this, (size_type)-1);
+		return ++it;
+	}
+	iterator end()
+	{
+		return iterator(this, _capacity);
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, _capacity);
+	}
+	iterator find(const T& key)
+	{
+		return iterator(this, FindEntry(key));
+	}
+	const_iterator find(const T& key) const
+	{
+		return const_iterator(this, FindEntry(key));
+	}
+	std::pair<iterator, bool> insert(const T& key)
+	{
+		int i = Insert(key);
+		return std::make_pair(at(i >= 0 ? i : ~i), i >= 0);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(*start);
+	}
+	int count(const T& key) const
+	{
+		return (int)(FindEntry(key) < _capacity);
+	}
+	void erase(const const_iterator& pos)
+	{
+		assert (pos._hash == this);
+		if (pos._hash == this && pos.is_valid())
+			EraseSlot(pos._pos);
+	}
+	const Traits& traits() const { return *this; }
+
+protected:
+	const_iterator at(int index) const { return const_iterator(this, index); }
+	iterator at(int index) { return iterator(this, index); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// cuckoo_hash_map ////////////////////////////////////////////////////////////
+//
+// cuckoo_hash_map is a dictionary: it associates values with keys. Duplicate
+// keys are not allowed. It has the same interface as hash_map and uses
+// cuckoo_hash_set as its implementation; see cuckoo_hash_set's header comment.
+//
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey> >
+class cuckoo_hash_map : protected cuckoo_hash_set< std::pair<const TKey,TValue>,
+                            hash_map_traits<std::pair<const TKey,TValue>,KeyTraits> >
+{
+public:
+	typedef cuckoo_hash_map<TKey, TValue, KeyTraits> cuckoo_hash_map_t;
+	typedef const TKey key_type;
+	typedef const TValue mapped_type;
+	typedef std::pair<const TKey,TValue> value_type;
+	typedef cuckoo_hash_set<value_type, hash_map_traits<value_type,KeyTraits> > cuckoo_hash_set_t;
+	typedef typename cuckoo_hash_set_t::size_type size_type;
+	typedef typename cuckoo_hash_set_t::hash_type hash_type;
+	enum { SlotsPerBucket = cuckoo_hash_set_t::SlotsPerBucket };
+
+	cuckoo_hash_map() {}
+	explicit cuckoo_hash_map(size_type capacity, const KeyTraits& traits = KeyTraits())
+		: cuckoo_hash_set_t(capacity, hash_map_traits<value_type,KeyTraits>(traits)) {}
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (Insert(key, value) < 0)
+			throw exception_t(_T("Key already exists in cuckoo_hash_map"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist).
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		return Insert(key, value) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, its
+	// value is overwritten. Returns true if the specified key did not already
+	// exist.
+	bool Set(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		if (i < 0)
+			this->Slot(~i).second = value;
+		return i >= 0;
+	}
+
+	bool TryGet(const TKey& key, OUT TValue& value) const
+	{
+		size_type i = FindEntry(key);
+		if (i < this->_capacity) {
+			value = this->Slot(i).second;
+			return true;
+		}
+		return false;
+	}
+	TValue Get(const TKey& key, TValue defaultValue) const
+	{
+		TryGet(key, OUT defaultValue);
+		return defaultValue;
+	}
+
+	void Clear()
+		{ cuckoo_hash_set_t::Clear(); }
+	bool Contains(const TKey& key) const
+		{ return FindEntry(key) < this->_capacity; }
+	bool Remove(const TKey& key)
+	{
+		size_type i = FindEntry(key);
+		if (i >= this->_capacity)
+			return false;
+		this->EraseSlot(i);
+		return true;
+	}
+	int Count() const
+		{ return cuckoo_hash_set_t::Count(); }
+	cuckoo_table_stats stats() const
+		{ return cuckoo_hash_set_t::stats(); }
+
+protected:
+	// Matches a slot against a key, for use by FindSlot()
+	struct KeyMatch
+	{
+		KeyMatch(const KeyTraits& traits, const TKey& key) : traits(traits), key(key) {}
+		bool operator()(const value_type& pair) const { return traits.equals(pair.first, key); }
+		const KeyTraits& traits;
+		const TKey& key;
+	};
+
+	// Returns the slot that holds a matching key, or _capacity if the key was
+	// not found.
+	size_type FindEntry(const TKey& key) const
+	{
+		return this->FindSlot(this->Mix(traits().hash_value(key)), KeyMatch(traits(), key));
+	}
+	// Like cuckoo_hash_set::Insert, but the pair is only constructed if the
+	// key is new.
+	int Insert(const TKey& key, const TValue& value)
+	{
+		hash_type mixed = this->Mix(traits().hash_value(key));
+		int i = this->PrepareInsert(mixed, KeyMatch(traits(), key));
+		if (i >= 0) {
+			new (&this->Slot(i)) value_type(key, value);
+			this->CommitInsert(i, mixed);
+		}
+		return i;
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	cuckoo_hash_map(const cuckoo_hash_map_t& copy) : cuckoo_hash_set_t(copy) {}
+	cuckoo_hash_map_t& operator=(const cuckoo_hash_map_t& copy)
+		{ cuckoo_hash_set_t::operator=(copy); return *this; }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	typedef typename cuckoo_hash_set_t::const_iterator const_iterator;
+	typedef typename cuckoo_hash_set_t::iterator       iterator;
+
+	size_type size() const { return cuckoo_hash_set_t::size(); }
+	size_type capacity() const { return cuckoo_hash_set_t::capacity(); }
+	bool empty() const { return cuckoo_hash_set_t::empty(); }
+	void clear() { cuckoo_hash_set_t::Clear(); }
+	void reserve(size_type count) { cuckoo_hash_set_t::reserve(count); }
+
+	iterator begin() { return cuckoo_hash_set_t::begin(); }
+	const_iterator begin() const { return cuckoo_hash_set_t::begin(); }
+	iterator end() { return cuckoo_hash_set_t::end(); }
+	const_iterator end() const { return cuckoo_hash_set_t::end(); }
+
+	iterator find(const TKey& key)
+	{
+		return this->at(FindEntry(key));
+	}
+	const_iterator find(const TKey& key) const
+	{
+		return this->at(FindEntry(key));
+	}
+	std::pair<iterator, bool> insert(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		return std::make_pair(this->at(i >= 0 ? i : ~i), i >= 0);
+	}
+	std::pair<iterator, bool> insert(const value_type& t)
+	{
+		return insert(t.first, t.second);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(start->first, start->second);
+	}
+	int count(const TKey& key) const
+	{
+		return (int)(FindEntry(key) < this->_capacity);
+	}
+	void erase(const const_iterator& pos)
+	{
+		cuckoo_hash_set_t::erase(pos);
+	}
+	bool erase(const TKey& key)
+	{
+		return Remove(key);
+	}
+
+	TValue& operator[](const TKey& key)
+	{
+		int i = Insert(key, TValue());
+		if (i < 0)
+			i = ~i; // key already existed
+		return this->Slot(i).second;
+	}
+
+	const KeyTraits& traits() const { return *this; }
+};
+
+#endif // _CUCKOO_HASH_MAP_H
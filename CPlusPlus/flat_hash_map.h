@@ -0,0 +1,781 @@
+//
+// flat_hash_map.h
+//
+#ifndef _FLAT_HASH_MAP_H
+#define _FLAT_HASH_MAP_H
+
+#include <assert.h>
+#include <new>
+#include <algorithm>
+#include "hash_map.h"
+#if defined(_MSC_VER) && !defined(UNDER_CE)
+#include <intrin.h>
+#endif
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define FLAT_HASH_AVX2
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#include <emmintrin.h>
+	#define FLAT_HASH_SSE2
+#endif
+
+// Returns the index of the lowest 'on' bit in x, which must not be zero.
+inline int LowestBitIndex(uint32 x)
+{
+	assert(x != 0);
+	#if defined(_MSC_VER) && !defined(UNDER_CE)
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return (int)index;
+	#elif defined(__GNUC__)
+	return __builtin_ctz(x);
+	#else
+	int index = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		index++;
+	return index;
+	#endif
+}
+
+// A group of consecutive control bytes of a flat_hash_set, loaded so that all
+// of them can be compared with a value at once. Each Match function returns a
+// bit mask in which bit i is set if control byte i matches.
+struct flat_hash_group
+{
+	enum { Empty = -128, Deleted = -2 };
+
+	#if defined(FLAT_HASH_AVX2)
+	enum { Width = 32 };
+	__m256i _bytes;
+	explicit flat_hash_group(const int8* ctrl) : _bytes(_mm256_loadu_si256((const __m256i*)ctrl)) {}
+	uint32 Match(int8 h2) const
+		{ return (uint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_bytes, _mm256_set1_epi8(h2))); }
+	uint32 MatchEmpty() const { return Match((int8)Empty); }
+	// Empty and Deleted are the only control bytes with the high bit set
+	uint32 MatchFree() const { return (uint32)_mm256_movemask_epi8(_bytes); }
+	#elif defined(FLAT_HASH_SSE2)
+	enum { Width = 16 };
+	__m128i _bytes;
+	explicit flat_hash_group(const int8* ctrl) : _bytes(_mm_loadu_si128((const __m128i*)ctrl)) {}
+	uint32 Match(int8 h2) const
+		{ return (uint32)_mm_movemask_epi8(_mm_cmpeq_epi8(_bytes, _mm_set1_epi8(h2))); }
+	uint32 MatchEmpty() const { return Match((int8)Empty); }
+	uint32 MatchFree() const { return (uint32)_mm_movemask_epi8(_bytes); }
+	#else
+	// Portable version for processors without SSE2 (e.g. ARM under CE)
+	enum { Width = 16 };
+	const int8* _bytes;
+	explicit flat_hash_group(const int8* ctrl) : _bytes(ctrl) {}
+	uint32 Match(int8 h2) const
+	{
+		uint32 mask = 0;
+		for (int i = 0; i < Width; i++)
+			if (_bytes[i] == h2)
+				mask |= 1u << i;
+		return mask;
+	}
+	uint32 MatchEmpty() const { return Match((int8)Empty); }
+	uint32 MatchFree() const
+	{
+		uint32 mask = 0;
+		for (int i = 0; i < Width; i++)
+			if (_bytes[i] < 0)
+				mask |= 1u << i;
+		return mask;
+	}
+	#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// flat_hash_set //////////////////////////////////////////////////////////////
+//
+// An open-addressing hash set with the same hash_traits, .NET-style methods
+// (Add, TryAdd, Set, Remove, Contains) and STL-style interface as hash_set.
+//
+// hash_set finds a key by walking a chain of 'next' indices, and each step
+// depends on the load before it, so a lookup that misses costs several cache
+// misses in a row. flat_hash_set stores the keys directly in a power-of-two
+// array of slots, and keeps one control byte per slot in a separate array:
+//
+// - Empty (0x80): the slot has never been used since the last rehash
+// - Deleted (0xFE): the slot held a key that was removed (a "tombstone")
+// - 0..127: the slot is full; the byte holds 7 bits of the key's hash code.
+//
+// Slots are divided into groups of 16 (32 if AVX2 is enabled). A lookup
+// picks a group from the hash code, compares all of its control bytes with the
+// key's 7 hash bits in one SSE2 (or AVX2) instruction, and compares the key
+// only with the slots whose byte matched, which is almost always at most one.
+// If the group contains an Empty byte, the search is over; otherwise the next
+// group in a triangular probe sequence is searched. With at most 7/8 of the
+// slots in use (full or deleted), most lookups, including misses, read one
+// group of control bytes and at most one slot.
+//
+// Hash codes are multiplied by the golden ratio (Fibonacci hashing) before
+// use, so that hash_traits that return sequential numbers for sequential keys
+// (e.g. the default hash_traits<int>) still spread keys across groups.
+//
+// The overhead is one byte per slot, and the slot array is 1.14x to 2.3x as
+// large as the number of keys. Unlike hash_set, inserting a key can move all
+// the other keys (when the table grows), which invalidates all iterators.
+// Removing a key invalidates only iterators that point to it.
+//
+////////////////////////////////////////////////////////////////////////////////
+template<class T, class Traits = hash_traits<T> >
+class flat_hash_set : protected Traits {
+public:
+	typedef const T key_type;
+	typedef const T value_type;
+	typedef unsigned int hash_type;
+	typedef unsigned int size_type;
+	typedef flat_hash_set<T, Traits> flat_hash_set_t;
+protected:
+	typedef flat_hash_group group_t;
+	enum { GroupWidth = group_t::Width, Empty = group_t::Empty, Deleted = group_t::Deleted };
+
+	// _ctrl[i] describes _slots[i] (see above). Only full slots are constructed.
+	int8* _ctrl;
+	T* _slots;
+	// Number of slots: 0 or a power of two >= GroupWidth. Invariant:
+	// _capacity == 0 if and only if _ctrl and _slots are NULL.
+	size_type _capacity;
+	size_type _count;   // Number of full slots
+	size_type _deleted; // Number of Deleted slots
+	// Rehash when _count + _deleted would exceed this (7/8 of _capacity)
+	size_type _growthLimit;
+	// 32 - log2(number of groups); the group is selected by the top bits of
+	// the mixed hash code.
+	int _groupShift;
+
+	static hash_type Mix(hash_type hash) { return hash * 2654435769u; }
+	static int8 H2(hash_type mixed) { return (int8)(mixed & 0x7F); }
+	size_type FirstGroup(hash_type mixed) const { return (size_type)((uint64)mixed >> _groupShift); }
+	bool IsFree(size_type slot) const { return _ctrl[slot] < 0; }
+
+	// Matches a slot against a key, for use by FindSlot()
+	struct KeyMatch
+	{
+		KeyMatch(const Traits& traits, const T& key) : traits(traits), key(key) {}
+		bool operator()(const T& t) const { return traits.equals(t, key); }
+		const Traits& traits;
+		const T& key;
+	};
+
+	// Returns the slot that holds a key for which match() is true, or
+	// _capacity if there is none. 'mixed' is Mix(hash code of the key).
+	template<class Match>
+	size_type FindSlot(hash_type mixed, const Match& match) const
+	{
+		if (_capacity == 0)
+			return _capacity;
+		size_type groupMask = _capacity / GroupWidth - 1;
+		size_type g = FirstGroup(mixed);
+		int8 h2 = H2(mixed);
+		for (size_type step = 1; ; step++)
+		{
+			size_type first = g * GroupWidth;
+			group_t group(_ctrl + first);
+			for (uint32 m = group.Match(h2); m != 0; m &= m - 1) {
+				size_type i = first + LowestBitIndex(m);
+				if (match(_slots[i]))
+					return i;
+			}
+			if (group.MatchEmpty())
+				return _capacity;
+			g = (g + step) & groupMask;
+		}
+	}
+	// Returns the first Empty or Deleted slot in the key's probe sequence.
+	size_type FindFreeSlot(hash_type mixed) const
+	{
+		assert(_count + _deleted < _capacity);
+		size_type groupMask = _capacity / GroupWidth - 1;
+		size_type g = FirstGroup(mixed);
+		for (size_type step = 1; ; step++)
+		{
+			uint32 m = group_t(_ctrl + g * GroupWidth).MatchFree();
+			if (m != 0)
+				return g * GroupWidth + LowestBitIndex(m);
+			g = (g + step) & groupMask;
+		}
+	}
+
+	// Returns the index of a free slot in which the caller must construct the
+	// new key and then call CommitInsert(). If a matching key already exists,
+	// returns ~index of the key's slot instead. May rehash.
+	template<class Match>
+	int PrepareInsert(hash_type mixed, const Match& match)
+	{
+		size_type i = FindSlot(mixed, match);
+		if (i < _capacity)
+			return ~(int)i;
+		if (_count + _deleted >= _growthLimit)
+			Rehash(_count * 2 < _growthLimit ? _capacity : _capacity * 2);
+		return (int)FindFreeSlot(mixed);
+	}
+	void CommitInsert(size_type i, hash_type mixed)
+	{
+		if (_ctrl[i] == Deleted)
+			_deleted--;
+		_ctrl[i] = H2(mixed);
+		_count++;
+	}
+
+	// Returns an index >= 0 if a new key was inserted; if the key already existed,
+	// a negative value ~index is returned and the hashtable is not modified.
+	int Insert(const T& key)
+	{
+		hash_type mixed = Mix(this->hash_value(key));
+		int i = PrepareInsert(mixed, KeyMatch(*this, key));
+		if (i >= 0) {
+			new (&_slots[i]) T(key);
+			CommitInsert(i, mixed);
+		}
+		return i;
+	}
+
+	void EraseSlot(size_type i)
+	{
+		assert(i < _capacity && !IsFree(i));
+		try {
+			_slots[i].~T();
+		} catch(...) { }
+		// If the slot's group still has an Empty slot, no probe sequence ever
+		// continued past this group, so the slot can become Empty too.
+		if (group_t(_ctrl + (i & ~(size_type)(GroupWidth - 1))).MatchEmpty())
+			_ctrl[i] = (int8)Empty;
+		else {
+			_ctrl[i] = (int8)Deleted;
+			_deleted++;
+		}
+		_count--;
+	}
+
+	void Init(size_type capacity)
+	{
+		_ctrl = NULL;
+		_slots = NULL;
+		_capacity = _count = _deleted = _growthLimit = 0;
+		_groupShift = 32;
+		if (capacity)
+			Rehash(SlotsFor(capacity));
+	}
+	// Number of slots needed to hold 'count' keys without rehashing
+	static size_type SlotsFor(size_type count)
+	{
+		size_type slots = GroupWidth;
+		while (slots - slots / 8 < count)
+			slots *= 2;
+		return slots;
+	}
+	// Moves the keys to a new slot array (which removes all tombstones)
+	void Rehash(size_type newCapacity)
+	{
+		if (newCapacity < (size_type)GroupWidth)
+			newCapacity = GroupWidth;
+		assert((newCapacity & (newCapacity - 1)) == 0);
+		int8* oldCtrl = _ctrl;
+		T* oldSlots = _slots;
+		size_type oldCapacity = _capacity;
+
+		_ctrl = new int8[newCapacity];
+		std::fill(_ctrl, _ctrl + newCapacity, (int8)Empty);
+		_slots = (T*)::operator new(newCapacity * sizeof(T));
+		_capacity = newCapacity;
+		_growthLimit = newCapacity - newCapacity / 8;
+		_groupShift = 32 - Math::Log2Floor((uint32)(newCapacity / GroupWidth));
+		_count = _deleted = 0;
+
+		for (size_type i = 0; i < oldCapacity; i++)
+			if (oldCtrl[i] >= 0) {
+				hash_type mixed = Mix(this->hash_value(oldSlots[i]));
+				size_type j = FindFreeSlot(mixed);
+				new (&_slots[j]) T(oldSlots[i]);
+				CommitInsert(j, mixed);
+				oldSlots[i].~T();
+			}
+		delete[] oldCtrl;
+		::operator delete(oldSlots);
+	}
+	void CopyFrom(const flat_hash_set_t& copy)
+	{
+		Init(0);
+		if (copy._count == 0)
+			return;
+		// Same capacity and hash function, so every key goes in the same slot
+		Rehash(copy._capacity);
+		for (size_type i = 0; i < _capacity; i++)
+			if (copy._ctrl[i] >= 0) {
+				new (&_slots[i]) T(copy._slots[i]);
+				_ctrl[i] = copy._ctrl[i];
+				_count++;
+			}
+	}
+
+public:
+	flat_hash_set() { Init(0); }
+	explicit flat_hash_set(size_type capacity, const Traits& traits = Traits())
+		: Traits(traits)
+	{
+		Init(capacity);
+	}
+	~flat_hash_set() { Clear(); }
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const T& key)
+	{
+		if (Insert(key) < 0)
+			throw exception_t(_T("Key already exists in flat_hash_set"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist). If
+	// the key already existed, the hashtable is not modified.
+	bool TryAdd(const T& key)
+	{
+		return Insert(key) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, it is
+	// overwritten with this new version of the key. Returns true if the specified
+	// key did not already exist.
+	bool Set(const T& key)
+	{
+		int i = Insert(key);
+		if (i < 0)
+			_slots[~i] = key;
+		return i >= 0;
+	}
+
+	void Clear()
+	{
+		for (size_type i = 0; i < _capacity; i++)
+			if (!IsFree(i))
+				_slots[i].~T();
+		delete[] _ctrl;
+		::operator delete(_slots);
+		Init(0);
+	}
+
+	bool Contains(const T& key) const
+	{
+		return FindEntry(key) < _capacity;
+	}
+
+	bool Remove(const T& key)
+	{
+		size_type i = FindEntry(key);
+		if (i >= _capacity)
+			return false;
+		EraseSlot(i);
+		return true;
+	}
+
+	int Count() const { return (int)_count; }
+
+protected:
+	// Returns the slot that holds a matching key, or _capacity if the key was
+	// not found.
+	size_type FindEntry(const T& key) const
+	{
+		return FindSlot(Mix(this->hash_value(key)), KeyMatch(*this, key));
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	flat_hash_set(const flat_hash_set_t& copy) : Traits(copy.traits())
+	{
+		CopyFrom(copy);
+	}
+	flat_hash_set_t& operator=(const flat_hash_set_t& copy)
+	{
+		if (&copy != this) {
+			Clear();
+			Traits::operator=(copy);
+			CopyFrom(copy);
+		}
+		return *this;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	// iterators //////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	class const_iterator {
+	protected:
+		typedef const typename flat_hash_set_t::value_type& reference;
+		typedef const typename flat_hash_set_t::value_type* pointer;
+		typedef const flat_hash_set_t hash_t;
+		typedef const_iterator self;
+		friend class flat_hash_set<T, Traits>;
+
+		hash_t* _hash;
+		size_type _pos;
+
+		const_iterator(const hash_t* hash, size_type pos)
+			: _hash(const_cast<hash_t*>(hash)), _pos(pos) { }
+	public:
+		const_iterator() : _hash(NULL) {}
+
+		bool MoveNext()
+		{
+			if (_hash == NULL)
+				return false;
+			do
+				if (++_pos >= _hash->_capacity) {
+					_pos = _hash->_capacity;
+					return false;
+				}
+			while(_hash->IsFree(_pos));
+			return true;
+		}
+		bool MovePrev()
+		{
+			if (_hash == NULL)
+				return false;
+			do
+				if ((int)--_pos < 0) {
+					_pos = (size_type)-1;
+					return false;
+				}
+			while(_hash->IsFree(_pos));
+			return true;
+		}
+
+		reference operator*() const { assert(is_valid()); return _hash->_slots[_pos]; }
+		pointer operator->() const { assert(is_valid()); return &_hash->_slots[_pos]; }
+
+		self& operator++() // prefix ++
+			{ MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ MovePrev(); return *this; }
+		bool operator==(const self& x) const
+			{ return (x._hash == _hash) && (x._pos == _pos); }
+		bool operator<(const self& x) const
+			{ assert(_hash == x._hash); return _pos < x._pos; }
+		bool operator<=(const self& x) const
+			{ assert(_hash == x._hash); return _pos <= x._pos; }
+
+		// Returns true if the iterator can be dereferenced
+		bool is_valid() const
+			{ return _hash != NULL && _pos < _hash->_capacity && !_hash->IsFree(_pos); }
+
+		/////////////////////////////////////////////////////////
+		// Operators that are defined in terms of other operators
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			MovePrev();
+			return tmp;
+		}
+		bool operator!=(const self& x) const { return !(*this == x); }
+		bool operator>(const self& x) const { return !(*this <= x); }
+		bool operator>=(const self& x) const { return !(*this < x); }
+
+		const hash_t* collection() const { return _hash; }
+	};
+
+	class iterator : public const_iterator {
+	protected:
+		typedef typename flat_hash_set_t::value_type& reference;
+		typedef typename flat_hash_set_t::value_type* pointer;
+		typedef flat_hash_set_t hash_t;
+		typedef iterator self;
+		friend class flat_hash_set<T, Traits>;
+
+		iterator(hash_t* hash, size_type pos) : const_iterator(hash, pos) {}
+	public:
+		iterator() {}
+
+		reference operator*() const { assert(this->is_valid()); return this->_hash->_slots[this->_pos]; }
+		pointer operator->() const { assert(this->is_valid()); return &this->_hash->_slots[this->_pos]; }
+
+		self& operator++() // prefix ++
+			{ this->MoveNext(); return *this; }
+		self& operator--() // prefix --
+			{ this->MovePrev(); return *this; }
+
+		self operator++(int) // postfix ++
+		{
+			self tmp = *this; // copy ourselves
+			this->MoveNext();
+			return tmp;
+		}
+		self operator--(int) // postfix --
+		{
+			self tmp = *this; // copy ourselves
+			this->MovePrev();
+			return tmp;
+		}
+
+		hash_t* collection() const { return const_cast<hash_t*>(this->_hash); }
+	};
+
+	friend class const_iterator;
+	friend class iterator;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	size_type size() const { return _count; }
+	size_type capacity() const { return _growthLimit; }
+	bool empty() const { return _count == 0; }
+	void clear() { Clear(); }
+	// Makes room for at least 'count' keys without rehashing
+	void reserve(size_type count)
+	{
+		size_type slots = SlotsFor(count);
+		if (slots > _capacity)
+			Rehash(slots);
+	}
+
+	iterator begin()
+	{
+		iterator it(this, (size_type)-1);
+		return ++it;
+	}
+	const_iterator begin() const
+	{
+		const_iterator it(this, (size_type)-1);
+		return ++it;
+	}
+	iterator end()
+	{
+		return iterator(this, _capacity);
+	}
+	const_iterator end() const
+	{
+		return const_iterator(this, _capacity);
+	}
+	iterator find(const T& key)
+	{
+		return iterator(this, FindEntry(key));
+	}
+	const_iterator find(const T& key) const
+	{
+		return const_iterator(this, FindEntry(key));
+	}
+	std::pair<iterator, bool> insert(const T& key)
+	{
+		int i = Insert(key);
+		return std::make_pair(at(i >= 0 ? i : ~i), i >= 0);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(*start);
+	}
+	int count(const T& key) const
+	{
+		return (int)(FindEntry(key) < _capacity);
+	}
+	void erase(const const_iterator& pos)
+	{
+		assert (pos._hash == this);
+		if (pos._hash == this && pos.is_valid())
+			EraseSlot(pos._pos);
+	}
+	const Traits& traits() const { return *this; }
+
+protected:
+	const_iterator at(int index) const { return const_iterator(this, index); }
+	iterator at(int index) { return iterator(this, index); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// flat_hash_map //////////////////////////////////////////////////////////////
+//
+// flat_hash_map is a dictionary: it associates values with keys. Duplicate
+// keys are not allowed. It has the same interface as hash_map and uses
+// flat_hash_set as its implementation; see flat_hash_set's header comment.
+//
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey> >
+class flat_hash_map : protected flat_hash_set< std::pair<const TKey,TValue>,
+                          hash_map_traits<std::pair<const TKey,TValue>,KeyTraits> >
+{
+public:
+	typedef flat_hash_map<TKey, TValue, KeyTraits> flat_hash_map_t;
+	typedef const TKey key_type;
+	typedef const TValue mapped_type;
+	typedef std::pair<const TKey,TValue> value_type;
+	typedef flat_hash_set<value_type, hash_map_traits<value_type,KeyTraits> > flat_hash_set_t;
+	typedef typename flat_hash_set_t::size_type size_type;
+	typedef typename flat_hash_set_t::hash_type hash_type;
+
+	flat_hash_map() {}
+	explicit flat_hash_map(size_type capacity, const KeyTraits& traits = KeyTraits())
+		: flat_hash_set_t(capacity, hash_map_traits<value_type,KeyTraits>(traits)) {}
+
+	// Puts the specified key in the set. If a matching key already exists, an
+	// exception is thrown.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (Insert(key, value) < 0)
+			throw exception_t(_T("Key already exists in flat_hash_map"));
+	}
+
+	// Puts the specified key in the set if it is not already there. Returns true
+	// if the specified key was actually added (it did not already exist).
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		return Insert(key, value) >= 0;
+	}
+
+	// Puts the specified key in the set. If a matching key already exists, its
+	// value is overwritten. Returns true if the specified key did not already
+	// exist.
+	bool Set(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		if (i < 0)
+			this->_slots[~i].second = value;
+		return i >= 0;
+	}
+
+	bool TryGet(const TKey& key, OUT TValue& value) const
+	{
+		size_type i = FindEntry(key);
+		if (i < this->_capacity) {
+			value = this->_slots[i].second;
+			return true;
+		}
+		return false;
+	}
+	TValue Get(const TKey& key, TValue defaultValue) const
+	{
+		TryGet(key, OUT defaultValue);
+		return defaultValue;
+	}
+
+	void Clear()
+		{ flat_hash_set_t::Clear(); }
+	bool Contains(const TKey& key) const
+		{ return FindEntry(key) < this->_capacity; }
+	bool Remove(const TKey& key)
+	{
+		size_type i = FindEntry(key);
+		if (i >= this->_capacity)
+			return false;
+		this->EraseSlot(i);
+		return true;
+	}
+	int Count() const
+		{ return flat_hash_set_t::Count(); }
+
+protected:
+	// Matches a slot against a key, for use by FindSlot()
+	struct KeyMatch
+	{
+		KeyMatch(const KeyTraits& traits, const TKey& key) : traits(traits), key(key) {}
+		bool operator()(const value_type& pair) const { return traits.equals(pair.first, key); }
+		const KeyTraits& traits;
+		const TKey& key;
+	};
+
+	// Returns the slot that holds a matching key, or _capacity if the key was
+	// not found.
+	size_type FindEntry(const TKey& key) const
+	{
+		return this->FindSlot(this->Mix(traits().hash_value(key)), KeyMatch(traits(), key));
+	}
+	// Like flat_hash_set::Insert, but the pair is only constructed if the key
+	// is new.
+	int Insert(const TKey& key, const TValue& value)
+	{
+		hash_type mixed = this->Mix(traits().hash_value(key));
+		int i = this->PrepareInsert(mixed, KeyMatch(traits(), key));
+		if (i >= 0) {
+			new (&this->_slots[i]) value_type(key, value);
+			this->CommitInsert(i, mixed);
+		}
+		return i;
+	}
+
+public:
+	///////////////////////////////////////////////////////////////////////////////
+	// support for copying ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	flat_hash_map(const flat_hash_map_t& copy) : flat_hash_set_t(copy) {}
+	flat_hash_map_t& operator=(const flat_hash_map_t& copy)
+		{ flat_hash_set_t::operator=(copy); return *this; }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	typedef typename flat_hash_set_t::const_iterator const_iterator;
+	typedef typename flat_hash_set_t::iterator       iterator;
+
+	size_type size() const { return flat_hash_set_t::size(); }
+	size_type capacity() const { return flat_hash_set_t::capacity(); }
+	bool empty() const { return flat_hash_set_t::empty(); }
+	void clear() { flat_hash_set_t::Clear(); }
+	void reserve(size_type count) { flat_hash_set_t::reserve(count); }
+
+	iterator begin() { return flat_hash_set_t::begin(); }
+	const_iterator begin() const { return flat_hash_set_t::begin(); }
+	iterator end() { return flat_hash_set_t::end(); }
+	const_iterator end() const { return flat_hash_set_t::end(); }
+
+	iterator find(const TKey& key)
+	{
+		return this->at(FindEntry(key));
+	}
+	const_iterator find(const TKey& key) const
+	{
+		return this->at(FindEntry(key));
+	}
+	std::pair<iterator, bool> insert(const TKey& key, const TValue& value)
+	{
+		int i = Insert(key, value);
+		return std::make_pair(this->at(i >= 0 ? i : ~i), i >= 0);
+	}
+	std::pair<iterator, bool> insert(const value_type& t)
+	{
+		return insert(t.first, t.second);
+	}
+	template<class iter>
+	void insert(iter start, const iter& stop)
+	{
+		for (; start != stop; ++start)
+			Insert(start->first, start->second);
+	}
+	int count(const TKey& key) const
+	{
+		return (int)(FindEntry(key) < this->_capacity);
+	}
+	void erase(const const_iterator& pos)
+	{
+		flat_hash_set_t::erase(pos);
+	}
+	bool erase(const TKey& key)
+	{
+		return Remove(key);
+	}
+
+	TValue& operator[](const TKey& key)
+	{
+		int i = Insert(key, TValue());
+		if (i < 0)
+			i = ~i; // key already existed
+		return this->_slots[i].second;
+	}
+
+	const KeyTraits& traits() const { return *this; }
+};
+
+#endif // _FLAT_HASH_MAP_H
@@ -0,0 +1,425 @@
+//
+// flat_map.h
+//
+#ifndef _FLAT_MAP_H
+#define _FLAT_MAP_H
+
+#include <assert.h>
+#include <string.h>
+#include <functional>
+#include <algorithm>
+#include <vector>
+#include <string>
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#include <emmintrin.h>
+	#define FLAT_MAP_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+	#define FLAT_MAP_PREFETCH(p)
+#endif
+
+// Orders strings case-insensitively, e.g. for a flat_map whose keys are
+// displayed in order. Strings that differ only in case are ordered
+// case-sensitively, so that they remain different keys.
+struct case_insensitive_less
+{
+	bool operator()(const std::string& a, const std::string& b) const
+	{
+		int c = _stricmp(a.c_str(), b.c_str());
+		return c != 0 ? c < 0 : a < b;
+	}
+};
+
+// Search policies for flat_map. lower_bound returns the first of the sorted
+// pairs in [first, last) whose key is not less than key, like std::lower_bound.
+// flat_map calls Rebuild with the sorted pairs whenever they change, for the
+// benefit of policies that keep an index of their own, so that lookups never
+// modify the map and may run concurrently.
+struct flat_binary_search
+{
+	template<class It>
+	void Rebuild(It, It) {}
+
+	// The loop runs log2(n) times whatever the outcome of each comparison, and
+	// for simple keys the comparison compiles to a conditional move rather
+	// than a branch that is mispredicted half of the time.
+	template<class It, class TKey, class Compare>
+	It lower_bound(It first, It last, const TKey& key, const Compare& less) const
+	{
+		size_t n = last - first;
+		if (n == 0)
+			return last;
+		while (n > 1) {
+			size_t half = n / 2;
+			first = less(first[half - 1].first, key) ? first + half : first;
+			n -= half;
+		}
+		return less(first->first, key) ? first + 1 : first;
+	}
+};
+
+// Keeps a copy of the keys in Eytzinger (breadth-first) order: the root of an
+// implicit binary search tree is at index 1 and the children of node k are at
+// 2k and 2k+1. Every search visits the first levels of the tree, which are
+// packed together at the start of the array, and the search prefetches the
+// cache line holding the descendants of the current node several levels
+// down, so once the keys no longer fit in cache it stalls on memory far less
+// often than a binary search over the pairs. The price is a second copy of
+// the keys, plus an int per key, and a rebuild after every change. Inserting
+// or erasing one pair moves O(n) pairs anyway, so the rebuild does not change
+// its complexity, but it makes it several times slower; this suits maps that
+// are built in one go (with Append and Sort, or insert of a range, which
+// rebuild once) and then queried many times.
+template<class TKey>
+class flat_eytzinger_search
+{
+	std::vector<TKey> _keys; // _keys[k] for k = 1..n; _keys[0] is unused
+	std::vector<int> _rank;  // _rank[k] is the position of _keys[k] among the sorted pairs
+	enum { KeysPerLine = 64 / sizeof(TKey) > 0 ? 64 / sizeof(TKey) : 1 };
+
+	template<class It>
+	void Fill(It sorted, int& i, size_t k)
+	{
+		if (k < _keys.size()) {
+			Fill(sorted, i, 2 * k);
+			_keys[k] = sorted[i].first;
+			_rank[k] = i++;
+			Fill(sorted, i, 2 * k + 1);
+		}
+	}
+
+public:
+	template<class It>
+	void Rebuild(It first, It last)
+	{
+		size_t n = last - first;
+		_keys.resize(n + 1);
+		_rank.resize(n + 1);
+		int i = 0;
+		Fill(first, i, 1);
+	}
+
+	template<class It, class Compare>
+	It lower_bound(It first, It last, const TKey& key, const Compare& less) const
+	{
+		size_t n = _keys.size();
+		if (n <= 1)
+			return last;
+		const TKey* keys = &_keys[0];
+		size_t k = 1;
+		while (k < n) {
+			if (k * KeysPerLine < n)
+				FLAT_MAP_PREFETCH(keys + k * KeysPerLine);
+			k = 2 * k + (less(keys[k], key) ? 1 : 0);
+		}
+		// The answer is the last node at which the search went left; the
+		// right turns after it are the trailing 1 bits of k.
+		while (k & 1)
+			k >>= 1;
+		k >>= 1;
+		return k == 0 ? last : first + _rank[k];
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// flat_map ///////////////////////////////////////////////////////////////////
+//
+// An ordered map stored as a sorted std::vector of key-value pairs. Lookups
+// are binary searches (or use the index kept by another Search policy, such
+// as flat_eytzinger_search) over contiguous memory, and iterating visits the
+// pairs in order with no pointer chasing, so for small maps, and for maps
+// that are built once and then read, flat_map is faster and several times
+// smaller than std::map, which allocates a node per pair. Inserting or
+// removing a pair moves the pairs after it, which costs O(n), so flat_map is
+// a poor choice for a large map that changes often.
+//
+// To build a large map quickly, add the pairs in any order with Append() and
+// then call Sort(), which costs O(n log n) in total rather than O(n^2). In
+// between, the map must not be searched or modified in any other way (debug
+// builds assert this), but it can be iterated, in the order of addition.
+//
+// Like EasyMap, flat_map offers .NET-style methods (TryGet, Get, Contains,
+// Remove, TryAdd, Add, GetOrAdd) in addition to the std::map interface.
+//
+// Differences from std::map:
+// - Inserting or removing a pair invalidates all iterators and references
+//   (erase(iterator) returns a valid iterator).
+// - The pairs are std::pair<TKey, TValue>, not std::pair<const TKey, TValue>,
+//   because they are moved around; do not change a key through an iterator.
+///////////////////////////////////////////////////////////////////////////////
+template<class TKey, class TValue, class Compare = std::less<TKey>, class Search = flat_binary_search>
+class flat_map : protected Compare
+{
+public:
+	typedef TKey key_type;
+	typedef TValue mapped_type;
+	typedef std::pair<TKey, TValue> value_type;
+	typedef Compare key_compare;
+	typedef size_t size_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+	typedef flat_map<TKey, TValue, Compare, Search> flat_map_t;
+
+protected:
+	std::vector<value_type> _items;
+	size_t _sorted; // Number of pairs in _items that are sorted; the rest were appended
+	Search _search; // Rebuilt by Reindex() whenever _items changes
+
+	const Compare& comp() const { return *this; }
+
+	// Compares pairs by key
+	struct PairLess
+	{
+		PairLess(const Compare& less) : less(less) {}
+		bool operator()(const value_type& a, const value_type& b) const { return less(a.first, b.first); }
+		const Compare& less;
+	};
+
+public:
+	flat_map() : _sorted(0) {}
+	explicit flat_map(const Compare& comp) : Compare(comp), _sorted(0) {}
+	template<class It>
+	flat_map(It first, It last, const Compare& comp = Compare()) : Compare(comp), _sorted(0)
+	{
+		insert(first, last);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	// .NET-style interface (like EasyMap) ////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	// Gets the value associated with a key, returning true if found, false if not.
+	// If the key was not found, then 'value' is left unchanged.
+	bool TryGet(const TKey& key, TValue& value) const
+	{
+		const_iterator it = find(key);
+		if (it == end())
+			return false;
+		value = it->second;
+		return true;
+	}
+	// Gets the value associated with a key, or the specified default value if the
+	// key was not found.
+	TValue Get(const TKey& key, TValue defaultValue = TValue()) const
+	{
+		TryGet(key, defaultValue);
+		return defaultValue;
+	}
+	bool Contains(const TKey& key) const
+	{
+		return find(key) != end();
+	}
+	// Removes an entry from the map if it exists, returning true if the key was
+	// found (and removed) or false if the key was not present in the map.
+	bool Remove(const TKey& key)
+	{
+		return erase(key) > 0;
+	}
+	// Adds a key-value pair, or returns false if the key already existed.
+	bool TryAdd(const TKey& key, const TValue& value)
+	{
+		bool added;
+		InsertKey(key, value, added);
+		return added;
+	}
+	// Adds a key-value pair or throws an exception if the key already existed.
+	void Add(const TKey& key, const TValue& value)
+	{
+		if (!TryAdd(key, value))
+			throw exception_t(_T("Key already exists in flat_map"));
+	}
+	// Gets a reference to the existing value if the key exists. If the key does
+	// not exist, adds the specified key-value pair and returns a reference to the
+	// new value. Ex: you could increment a counter with "++map.GetOrAdd(key,0)".
+	TValue& GetOrAdd(const TKey& key, const TValue& initialValue = TValue())
+	{
+		bool added;
+		return InsertKey(key, initialValue, added)->second;
+	}
+	int Count() const { return (int)_items.size(); }
+	void Clear() { clear(); }
+
+	// Batch mode: adds a pair at the end of the map without searching or
+	// sorting. Call Sort() before using the map as a map again.
+	void Append(const TKey& key, const TValue& value)
+	{
+		_items.push_back(value_type(key, value));
+	}
+	// Sorts the pairs added by Append() into the map. If a key was appended
+	// more than once, or was already in the map, the value appended last wins.
+	void Sort()
+	{
+		Merge(true);
+	}
+	// Returns false between Append() and Sort()
+	bool IsSorted() const { return _sorted == _items.size(); }
+
+	///////////////////////////////////////////////////////////////////////////////
+	// STL-style interface ////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	iterator begin() { return _items.begin(); }
+	iterator end() { return _items.end(); }
+	const_iterator begin() const { return _items.begin(); }
+	const_iterator end() const { return _items.end(); }
+
+	size_type size() const { return _items.size(); }
+	bool empty() const { return _items.empty(); }
+	void clear()
+	{
+		_items.clear();
+		_sorted = 0;
+		Reindex();
+	}
+	size_type capacity() const { return _items.capacity(); }
+	void reserve(size_type n) { _items.reserve(n); }
+	void shrink_to_fit() { std::vector<value_type>(_items).swap(_items); }
+	void swap(flat_map_t& other)
+	{
+		std::swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+		_items.swap(other._items);
+		std::swap(_sorted, other._sorted);
+		std::swap(_search, other._search);
+	}
+	key_compare key_comp() const { return *this; }
+
+	iterator find(const TKey& key)
+	{
+		iterator it = lower_bound(key);
+		return it != end() && !comp()(key, it->first) ? it : end();
+	}
+	const_iterator find(const TKey& key) const
+	{
+		const_iterator it = lower_bound(key);
+		return it != end() && !comp()(key, it->first) ? it : end();
+	}
+	size_type count(const TKey& key) const
+	{
+		return Contains(key) ? 1 : 0;
+	}
+	// Range queries: iterate from lower_bound(lo) to upper_bound(hi) to visit
+	// the keys from lo to hi inclusive.
+	iterator lower_bound(const TKey& key)
+	{
+		assert(IsSorted());
+		return _search.lower_bound(_items.begin(), _items.end(), key, comp());
+	}
+	const_iterator lower_bound(const TKey& key) const
+	{
+		assert(IsSorted());
+		return _search.lower_bound(_items.begin(), _items.end(), key, comp());
+	}
+	iterator upper_bound(const TKey& key)
+	{
+		iterator it = lower_bound(key);
+		if (it != end() && !comp()(key, it->first))
+			++it;
+		return it;
+	}
+	const_iterator upper_bound(const TKey& key) const
+	{
+		const_iterator it = lower_bound(key);
+		if (it != end() && !comp()(key, it->first))
+			++it;
+		return it;
+	}
+	std::pair<iterator, iterator> equal_range(const TKey& key)
+	{
+		iterator it = lower_bound(key);
+		iterator next = it;
+		if (it != end() && !comp()(key, it->first))
+			++next;
+		return std::pair<iterator, iterator>(it, next);
+	}
+
+	std::pair<iterator, bool> insert(const value_type& pair)
+	{
+		bool added;
+		iterator it = InsertKey(pair.first, pair.second, added);
+		return std::pair<iterator, bool>(it, added);
+	}
+	// Inserts a range of pairs in O((n + m) log m) time for m new pairs. As
+	// with std::map, a key that is already in the map keeps its value.
+	template<class It>
+	void insert(It first, It last)
+	{
+		assert(IsSorted());
+		for (; first != last; ++first)
+			_items.push_back(value_type((*first).first, (*first).second));
+		Merge(false);
+	}
+	size_type erase(const TKey& key)
+	{
+		iterator it = lower_bound(key);
+		if (it == end() || comp()(key, it->first))
+			return 0;
+		erase(it);
+		return 1;
+	}
+	// Removes the pair at pos and returns an iterator to the next pair
+	iterator erase(iterator pos)
+	{
+		assert(IsSorted());
+		size_t i = pos - begin();
+		_items.erase(pos);
+		_sorted--;
+		Reindex();
+		return begin() + i;
+	}
+	TValue& operator[](const TKey& key)
+	{
+		return GetOrAdd(key);
+	}
+
+protected:
+	///////////////////////////////////////////////////////////////////////////////
+	// implementation /////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+
+	// Brings the index of _search up to date after _items changed
+	void Reindex()
+	{
+		_search.Rebuild(_items.begin(), _items.end());
+	}
+	// Returns the position of key, inserting (key, value) first if the key is
+	// not present.
+	iterator InsertKey(const TKey& key, const TValue& value, bool& added)
+	{
+		iterator it = lower_bound(key);
+		added = it == end() || comp()(key, it->first);
+		if (added) {
+			it = _items.insert(it, value_type(key, value));
+			_sorted++;
+			Reindex();
+		}
+		return it;
+	}
+	// Sorts the pairs after _sorted and merges them with the sorted ones,
+	// keeping the last or the first pair with each key.
+	void Merge(bool lastWins)
+	{
+		if (IsSorted())
+			return;
+		PairLess less(comp());
+		iterator middle = _items.begin() + _sorted;
+		std::stable_sort(middle, _items.end(), less);
+		std::inplace_merge(_items.begin(), middle, _items.end(), less);
+
+		// The merge is stable, so pairs with equal keys are in order of addition
+		iterator out = _items.begin(), it = out;
+		while (it != _items.end()) {
+			iterator next = it + 1;
+			while (next != _items.end() && !less(*it, *next))
+				++next;
+			iterator keep = lastWins ? next - 1 : it;
+			if (out != keep)
+				*out = *keep;
+			++out;
+			it = next;
+		}
+		_items.erase(out, _items.end());
+		_sorted = _items.size();
+		Reindex();
+	}
+};
+
+#endif
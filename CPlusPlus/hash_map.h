@@ -7,9 +7,30 @@
 #define _COMMON_HASHTABLE_H
 
 #include <assert.h>
+#include <algorithm>
 #include "mini_vector.h"
+#include "bloom_filter.h"
 #include "Misc.h"
 
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <string_view>
+#define HASH_MAP_HAS_STRING_VIEW
+#endif
+#ifdef MINI_VECTOR_HAS_MOVE
+#include <tuple>
+#endif
+
+// Asks the processor to start loading the cache line at address p; used by
+// the batched lookups of hash_set and hash_map.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	#include <xmmintrin.h>
+	#define HASH_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+	#define HASH_PREFETCH(p) __builtin_prefetch(p)
+#else
+	#define HASH_PREFETCH(p) ((void)0)
+#endif
+
 #ifndef ARRAY_AUTO_PTR
 #define ARRAY_AUTO_PTR
 template<class T>
@@ -21,6 +42,7 @@ public:
 	T& operator[] (int index) const { return ptr[index]; }
 	operator T*() const { return ptr; }
 	T* get() const { return ptr; }
+	T* release() { T* p = ptr; ptr = NULL; return p; }
 	void reset(T* newArray = NULL)
 	{
 		delete[] ptr;
@@ -29,6 +51,50 @@ public:
 };
 #endif
 
+// Like array_auto_ptr, but for an array of bucket heads (ints) obtained from
+// an allocator. hash_set uses it for its bucket arrays so that they come from
+// the table's allocator too. reset(count) replaces the array with a new one
+// in which every bucket is empty (-1).
+template<class IntAlloc>
+class bucket_array : protected IntAlloc {
+	int* ptr;
+	int count;
+public:
+	bucket_array() : ptr(NULL), count(0) {}
+	template<class Alloc>
+	explicit bucket_array(const Alloc& alloc) : IntAlloc(alloc), ptr(NULL), count(0) {}
+	~bucket_array() { reset(); }
+	int& operator[] (int index) const { return ptr[index]; }
+	operator int*() const { return ptr; }
+	int* get() const { return ptr; }
+	// (exact matches, so that the allocator's operators are not candidates)
+	bool operator==(const int* p) const { return ptr == p; }
+	bool operator!=(const int* p) const { return ptr != p; }
+	void reset()
+	{
+		if (ptr != NULL)
+			IntAlloc::deallocate(ptr, count);
+		ptr = NULL;
+		count = 0;
+	}
+	void reset(int newCount)
+	{
+		int* newArray = IntAlloc::allocate(newCount); // may throw
+		reset();
+		ptr = newArray;
+		count = newCount;
+		std::fill(ptr, ptr + count, -1);
+	}
+	void swap(bucket_array& other)
+	{
+		std::swap(ptr, other.ptr);
+		std::swap(count, other.count);
+	}
+private: // not copyable
+	bucket_array(const bucket_array&);
+	bucket_array& operator=(const bucket_array&);
+};
+
 // A hash_traits class needs to have this form, with equals() and hash_value()
 // functions. The TR1 unordered_map seems to have chosen a different way for hashing
 // to work, with a pair of structures "hasher" and "is_equal", but I don't like that
@@ -79,6 +145,16 @@ struct hash_traits<float> {
 	}
 };
 
+// hash_lookup_key<Traits, K>::type exists if Traits can hash a K and compare
+// it with the keys of a hashtable, so that hash_set and hash_map can look up a
+// K without converting it to the key type first ("heterogeneous lookup"). For
+// example, a hash_map<string, V> can be searched with a C string. Specialize
+// this template to enable heterogeneous lookup with your own traits classes;
+// the traits must then provide hash_value(K) and equals(key, K), and
+// hash_value(K) must return the same hash code as the equivalent key.
+template<class Traits, class K>
+struct hash_lookup_key {};
+
 // Specialization of hash_traits for basic_string.
 template<typename CHAR>
 struct hash_traits< std::basic_string<CHAR> >
@@ -86,13 +162,50 @@ struct hash_traits< std::basic_string<CHAR> >
 	typedef std::basic_string<CHAR> value_type;
 	bool equals(const value_type& a, const value_type& b) const { return a == b; }
 	unsigned hash_value(const value_type& k) const
+		{ return hash_chars(k.data(), k.size()); }
+
+	// Overloads for heterogeneous lookup by C string, by (pointer, length) pair
+	// and by basic_string_view, without building a temporary string.
+	unsigned hash_value(const CHAR* s) const
+	{
+		unsigned v = 0;
+		for(; *s != 0; s++, v = 16777619u * v)
+			v ^= (unsigned)(size_t)*s;
+		return v;
+	}
+	unsigned hash_value(const std::pair<const CHAR*, size_t>& s) const
+		{ return hash_chars(s.first, s.second); }
+	bool equals(const value_type& a, const CHAR* b) const
+		{ return a.compare(b) == 0; }
+	bool equals(const value_type& a, const std::pair<const CHAR*, size_t>& b) const
+		{ return a.size() == b.second && a.compare(0, a.size(), b.first, b.second) == 0; }
+	#ifdef HASH_MAP_HAS_STRING_VIEW
+	unsigned hash_value(std::basic_string_view<CHAR> s) const
+		{ return hash_chars(s.data(), s.size()); }
+	bool equals(const value_type& a, std::basic_string_view<CHAR> b) const
+		{ return a == b; }
+	#endif
+
+	static unsigned hash_chars(const CHAR* s, size_t length)
 	{
 		unsigned v = 0;
-		for(int i = 0; i < (int)k.size(); i++, v = 16777619u * v)
-			v ^= (unsigned)(size_t)k[i];
+		for(size_t i = 0; i < length; i++, v = 16777619u * v)
+			v ^= (unsigned)(size_t)s[i];
 		return v;
 	}
 };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< std::basic_string<CHAR> >, const CHAR* > { typedef void type; };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< std::basic_string<CHAR> >, CHAR* > { typedef void type; };
+template<typename CHAR, size_t N>
+struct hash_lookup_key< hash_traits< std::basic_string<CHAR> >, CHAR[N] > { typedef void type; };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< std::basic_string<CHAR> >, std::pair<const CHAR*, size_t> > { typedef void type; };
+#ifdef HASH_MAP_HAS_STRING_VIEW
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< std::basic_string<CHAR> >, std::basic_string_view<CHAR> > { typedef void type; };
+#endif
 
 // Like hash_traits, except that the T values are assumed to be pointers and are
 // dereferenced.
@@ -112,6 +225,170 @@ struct hash_value_traits {
 	unsigned hash_value(const T& key) const { return (unsigned)(size_t)key.hash_value(); }
 };
 
+#ifdef MINI_VECTOR_HAS_MOVE
+// hash_relocate(t) returns an rvalue from which a hashtable entry's value can
+// be move-constructed when the entry array grows. The key of a hash_map pair
+// is const to protect it from users, but the old entry is destroyed right
+// after it is moved from, so the key can be moved too instead of copied.
+template<class T>
+inline T&& hash_relocate(T& t) { return std::move(t); }
+template<class K, class V>
+inline std::pair<K&&, V&&> hash_relocate(std::pair<const K, V>& p)
+	{ return std::pair<K&&, V&&>(std::move(const_cast<K&>(p.first)), std::move(p.second)); }
+
+template<class T>
+struct hash_relocate_is_nothrow
+	{ enum { value = std::is_nothrow_move_constructible<T>::value }; };
+template<class K, class V>
+struct hash_relocate_is_nothrow< std::pair<const K, V> >
+	{ enum { value = std::is_nothrow_move_constructible<K>::value && std::is_nothrow_move_constructible<V>::value }; };
+#endif
+
+// A bucket policy decides how many buckets a hash_set has and which bucket
+// each hash code belongs to. Resize(n) picks a bucket count of at least n and
+// returns it; Index(hash) then returns a bucket index below that count.
+// 
+// The default, prime_bucket_policy, uses a prime number of buckets and takes
+// the hash code modulo the bucket count. This tolerates poor hash codes (e.g.
+// the identity hash of hash_traits<int>), but an integer division takes 20-40
+// cycles, which is a large part of the cost of a lookup. The other policies
+// avoid division:
+// 
+// - fibonacci_bucket_policy: a power of two buckets; the bucket is taken from
+//   the top bits of hash * 2^32/phi (one multiply and a shift).
+// - murmur_bucket_policy: a power of two buckets; the hash is scrambled with
+//   MurmurHash3's 32-bit finalizer and then masked. Slower than Fibonacci, but
+//   every input bit affects every output bit.
+// - fastrange_bucket_policy: any number of buckets; the bucket is
+//   (mixed * count) >> 32 (Lemire's "fastrange"), where mixed is the hash
+//   multiplied by 2^32/phi as in fibonacci_bucket_policy. Without that mixing,
+//   small keys with the identity hash would all land in bucket 0.
+struct prime_bucket_policy
+{
+	prime_bucket_policy() : _count(1) {}
+	int Resize(int minCount) { _count = Math::GetNextPrime(minCount); return (int)_count; }
+	int Index(unsigned hash) const { return (int)(hash % _count); }
+protected:
+	unsigned _count;
+};
+
+struct fibonacci_bucket_policy
+{
+	fibonacci_bucket_policy() : _shift(32) {}
+	int Resize(int minCount)
+	{
+		int bits = Math::Log2Floor((uint32)(minCount - 1)) + 1;
+		_shift = 32 - bits;
+		return 1 << bits;
+	}
+	int Index(unsigned hash) const { return (int)((uint64)(uint32)(hash * 2654435769u) >> _shift); }
+protected:
+	int _shift; // 32 - log2(bucket count); may be 32, hence the uint64 above
+};
+
+struct murmur_bucket_policy
+{
+	murmur_bucket_policy() : _mask(0) {}
+	int Resize(int minCount)
+	{
+		int count = 1 << (Math::Log2Floor((uint32)(minCount - 1)) + 1);
+		_mask = count - 1;
+		return count;
+	}
+	int Index(unsigned hash) const
+	{
+		hash ^= hash >> 16;
+		hash *= 0x85ebca6bu;
+		hash ^= hash >> 13;
+		hash *= 0xc2b2ae35u;
+		hash ^= hash >> 16;
+		return (int)(hash & _mask);
+	}
+protected:
+	unsigned _mask;
+};
+
+struct fastrange_bucket_policy
+{
+	fastrange_bucket_policy() : _count(1) {}
+	int Resize(int minCount) { _count = minCount; return minCount; }
+	int Index(unsigned hash) const { return (int)(((uint64)(uint32)(hash * 2654435769u) * _count) >> 32); }
+protected:
+	uint32 _count;
+};
+
+// Describes how the items of a hash_set or hash_map are spread over its
+// buckets (see hash_set::stats()). A bad hash function shows up as a long
+// longest chain and many probes per lookup even though the load is low.
+struct hash_table_stats
+{
+	hash_table_stats() : Count(0), BucketCount(0), UsedBuckets(0), LongestChain(0),
+		FreeCount(0), Capacity(0), Bytes(0), HitProbes(0), MissProbes(0)
+		{ std::fill(ChainLengths, ChainLengths + HistogramSize, 0); }
+
+	int Count;        // Number of items
+	int BucketCount;  // Number of buckets
+	int UsedBuckets;  // Number of buckets with at least one item
+	int LongestChain; // Number of items in the fullest bucket
+	// ChainLengths[n] is the number of buckets that hold n items; the last
+	// element counts all buckets that hold HistogramSize - 1 or more.
+	enum { HistogramSize = 9 };
+	int ChainLengths[HistogramSize];
+	int FreeCount;    // Number of free (removed) slots in the entry array
+	int Capacity;     // Size of the entry array, including free slots
+	size_t Bytes;     // Memory used by the entry and bucket arrays
+	// Number of entries compared when each item is looked up once
+	double HitProbes;
+	// Sum over items of the length of the item's chain, i.e. the number of
+	// entries compared when looking up, once per item, a missing key that
+	// lands in the same bucket as that item
+	double MissProbes;
+
+	double LoadFactor() const { return BucketCount ? (double)Count / BucketCount : 0; }
+	// Average number of entries compared by a successful lookup
+	double AvgProbesHit() const { return Count ? HitProbes / Count : 0; }
+	// Average number of entries compared by an unsuccessful lookup, if the
+	// missing keys hash like the keys in the table
+	double AvgProbesMiss() const { return Count ? MissProbes / Count : 0; }
+	double BytesPerItem() const { return Count ? (double)Bytes / Count : 0; }
+
+	// Adds a bucket whose chain holds the specified number of items
+	void AddChain(int length)
+	{
+		ChainLengths[length < HistogramSize - 1 ? length : HistogramSize - 1]++;
+		if (length > 0)
+			UsedBuckets++;
+		if (LongestChain < length)
+			LongestChain = length;
+		HitProbes += length * (length + 1.0) / 2;
+		MissProbes += (double)length * length;
+	}
+
+	// A one-line summary, e.g. "load 0.51, 40% used, chains 60/30/8/2 (max 5),
+	// probes 1.26 hit 1.52 miss, 0 free, 20.1 bytes/item". The chains part
+	// lists the percentage of buckets that hold 0, 1, 2... items. (During an
+	// incremental resize, the chains still in the old bucket array count as
+	// buckets too.)
+	std::string ToString() const
+	{
+		int buckets = 0, last = HistogramSize - 1;
+		for (int n = 0; n < HistogramSize; n++)
+			buckets += ChainLengths[n];
+		while (last > 1 && ChainLengths[last] == 0)
+			last--;
+		std::string chains;
+		for (int n = 0; n <= last; n++)
+			chains += printstring(n ? "/%d" : "%d", Percent(ChainLengths[n], buckets));
+		return printstring("load %.2f, %d%% used, chains %s (max %d), probes %.2f hit %.2f miss, %d free, %.1f bytes/item",
+			LoadFactor(), Percent(UsedBuckets, buckets), chains.c_str(), LongestChain,
+			AvgProbesHit(), AvgProbesMiss(), FreeCount, BytesPerItem());
+	}
+
+protected:
+	static int Percent(int part, int whole)
+		{ return whole ? (int)((part * 100.0 + whole / 2) / whole) : 0; }
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // 
 // HH                     HH                             TT
@@ -140,7 +417,56 @@ struct hash_value_traits {
 // 
 // By default, the hash code of T is obtained by casting T to size_t. Use a custom
 // hash_traits class (or one of the other traits classes above) to change the way
-// the hash code is retrieved or the way that Ts are compared for equality.
+// the hash code is retrieved or the way that Ts are compared for equality. The
+// BucketPolicy chooses how hash codes are mapped to buckets (see above).
+// Contains, Remove and find also accept keys of other types that the traits
+// can hash and compare directly (see hash_lookup_key), e.g. a hash_set<string>
+// can be searched with a C string without building a temporary string.
+// 
+// Normally, when the number of entries reaches the number of buckets, the
+// bucket array is doubled and every entry is relinked at once, which stalls
+// a single insert for milliseconds in a table of millions of entries. If
+// that is unacceptable, call SetIncrementalResize(true): the old bucket array
+// is then kept after an enlargement and its chains are moved to the new
+// array a few buckets per insert (see MigrateBuckets), while lookups search
+// whichever array a key's chain currently lives in. The entry array itself
+// still doubles by relocating every entry, one move constructor call per
+// entry (entries have a destructor and a move constructor of their own, so
+// they are never memcpy'd, even if T is trivially copyable); construct the
+// table with a capacity to avoid that, too.
+// 
+// The entry and bucket arrays are allocated with Alloc, a standard allocator
+// (rebound to the entry type and to int). With C++17, a
+// std::pmr::polymorphic_allocator places a table in any memory_resource,
+// e.g. an arena that is released all at once when a request completes.
+// 
+// When a table is much larger than the cache, each lookup waits for a chain
+// of dependent cache misses (the bucket, then each entry in the chain).
+// find_batch and contains_batch look up many keys at once and overlap the
+// misses of different keys by prefetching (see FindBatch), which helps when
+// the keys are scattered across a large table.
+// 
+// Removing items leaves free slots in the entry array. Later insertions reuse
+// them, but until then they waste memory and slow down iteration. Compact()
+// moves the remaining entries into the free slots (and can also sort them by
+// bucket, so that each chain lies in consecutive entries), shrink_to_fit()
+// also returns the unused memory, and SetAutoCompact(f) makes Remove() call
+// shrink_to_fit() whenever more than the fraction f of the slots are free.
+// erase(iterator) never compacts, because compacting moves entries and would
+// invalidate the iterators of a loop that erases as it goes; call
+// shrink_to_fit() after such a loop instead.
+// 
+// A lookup of a missing key still reads a bucket and walks its chain, which
+// in a table larger than the cache means one or two cache misses that find
+// nothing. SetMissFilter(true) keeps a blocked Bloom filter of the hash codes
+// (bloom_filter.h, 1.5 to 3 bytes per item) in front of the buckets, so that all
+// but about 0.5% of the lookups and removals of missing keys end after
+// reading a single cache line of the filter, and inserting a new key skips
+// the search of its chain. The filter is updated on every insert and
+// rebuilt when the table has doubled since the last rebuild and whenever the
+// table is compacted; until then, removed keys still pass the filter. It
+// costs a little on every insert and on every lookup that hits, so enable it
+// only if most lookups miss.
 // 
 // hash_set normally stores a hashcode with each entry so that when resolving 
 // hash collisions, it is not necessary compare the key with each entry in a
@@ -163,8 +489,8 @@ struct hash_value_traits {
 // "dictionary.find(k) != dictionary.end()", so I provide .NET-style methods like 
 // "dictionary.Remove(k)" and "dictionary.Contains(k)" in addition.
 // 
-// I have a memory-saving idea to try in the future, inspired by some paper about 
-// tries:
+// compact_hash_set and compact_hash_map (compact_hash_map.h) implement a 
+// memory-saving idea inspired by some paper about tries:
 // 
 // 1. Use uint16 for the bucket array when there are less than 65536 entries.
 //    Actually, you could store a bucket and an (unrelated) 'next' pointer in the
@@ -178,16 +504,18 @@ struct hash_value_traits {
 // 
 // This idea reduces the per-entry overhead by up to 4 bytes, down to 4 bytes in 
 // compact mode and 8 bytes otherwise. Unlike hash_set, this approach is not 
-// thread-safe for concurrent readers, so it should be implemented in a separate
-// class. Also, it would invalidate more iterators than the current code does.
+// thread-safe for concurrent readers, so it is implemented in a separate class.
+// Also, it invalidates more iterators than the current code does.
 //
 // Oh yes, iterators. Obviously, it's a hashtable so the elements will be enumerated
 // in no particular order. Good news though! When you insert a new value, no
 // existing iterators are invalidated. When you remove a value, only iterators that
-// pointed to the removed value are invalidated.
+// pointed to the removed value are invalidated. (Compact(), shrink_to_fit() and
+// a Remove() that auto-compacts invalidate all iterators; erase(iterator)
+// never compacts, so erasing items while iterating is safe.)
 // 
 ////////////////////////////////////////////////////////////////////////////////
-template<class T, class Traits = hash_traits<T> >
+template<class T, class Traits = hash_traits<T>, class BucketPolicy = prime_bucket_policy, class Alloc = std::allocator<T> >
 	//CompactMode = boost::mpl::or_<boost::is_pointer<T>, boost::mpl::bool_<Math::num_traits<T>::is_numeric> >::value >
 class hash_set : protected Traits {
 public:
@@ -195,7 +523,8 @@ public:
 	typedef const T value_type;
 	typedef unsigned int hash_type;
 	typedef unsigned int size_type;
-	typedef hash_set<T, Traits/*, CompactMode*/> hash_set_t;
+	typedef hash_set<T, Traits, BucketPolicy, Alloc/*, CompactMode*/> hash_set_t;
+	typedef Alloc allocator_type;
 protected:
 	// Note: when an entry is removed from the hashtable, it is marked "free" by
 	// setting the high bit of the "next" field so that the value of next is less
@@ -203,11 +532,24 @@ protected:
 	// chain). The "next" field is also used as a linked list of free slots, so
 	// next & 0x7FFFFFFF points to the next free slot. At the end of the free list, 
 	// next is -2 (EndOfFreeList).
+	//
+	// When the entry array grows, entries are moved rather than copied if T
+	// can be moved without throwing (see mini_vector::relocate). Entries are
+	// not trivially copyable, so they are moved one by one, not memcpy'd.
+	enum EmplaceTag { Emplace };
 	struct SmallEntry
 	{
 		SmallEntry() {}
 		SmallEntry(const T& t, hash_type hashCode, int next)
 			: t(t), next(next) {}
+		#ifdef MINI_VECTOR_HAS_MOVE
+		template<class... Args>
+		SmallEntry(EmplaceTag, hash_type hashCode, int next, Args&&... args)
+			: t(std::forward<Args>(args)...), next(next) {}
+		SmallEntry(const SmallEntry&) = default;
+		SmallEntry(SmallEntry&& e) noexcept(hash_relocate_is_nothrow<T>::value)
+			: t(hash_relocate(e.t)), next(e.next) {}
+		#endif
 		~SmallEntry() { assert (next >= -1); }
 
 		T t;
@@ -223,6 +565,14 @@ protected:
 		NormalEntry() {}
 		NormalEntry(const T& t, hash_type hashCode, int next)
 			: t(t), hashCode(hashCode), next(next) {}
+		#ifdef MINI_VECTOR_HAS_MOVE
+		template<class... Args>
+		NormalEntry(EmplaceTag, hash_type hashCode, int next, Args&&... args)
+			: t(std::forward<Args>(args)...), hashCode(hashCode), next(next) {}
+		NormalEntry(const NormalEntry&) = default;
+		NormalEntry(NormalEntry&& e) noexcept(hash_relocate_is_nothrow<T>::value)
+			: t(hash_relocate(e.t)), hashCode(e.hashCode), next(e.next) {}
+		#endif
 		~NormalEntry() { assert (next >= -1); }
 
 		T t;          // Value in this entry
@@ -237,8 +587,11 @@ protected:
 	// destructed right then, so the caller doesn't have to wait for the whole
 	// hashtable to be destroyed before the elements are destructed. A standard
 	// vector cannot be abused this way, so use mini_vector as the base class.
-	class EntryList : public mini_vector<Entry, 1> {
+	typedef typename allocator_rebind<Alloc, Entry>::type EntryAlloc;
+	class EntryList : public mini_vector<Entry, 1, EntryAlloc> {
 	public:
+		EntryList() {}
+		explicit EntryList(const EntryAlloc& alloc) : mini_vector<Entry, 1, EntryAlloc>(alloc) {}
 		~EntryList() { clear(); }
 		void clear()
 		{
@@ -255,6 +608,20 @@ protected:
 			} catch(...) { }
 		}
 		void construct(int index, const T& t, hash_type hashCode, int next)
+		{
+			Grow(index);
+			new (begin() + index) Entry(t, hashCode, next);
+		}
+		#ifdef MINI_VECTOR_HAS_MOVE
+		// Constructs the T of a new entry from args
+		template<class... Args>
+		void emplace(int index, hash_type hashCode, int next, Args&&... args)
+		{
+			Grow(index);
+			new (begin() + index) Entry(Emplace, hashCode, next, std::forward<Args>(args)...);
+		}
+		#endif
+		void Grow(int index)
 		{
 			if (index == size()) {
 				if (!capacity_left())
@@ -262,10 +629,40 @@ protected:
 				set_size(size() + 1);
 			} else
 				assert (IsFree(index));
-			new (begin() + index) Entry(t, hashCode, next);
 		}
 		bool IsFree(int entryIndex) const
 			{ return operator[](entryIndex).next < -1; }
+		// Moves the allocated entry src[from] into slot 'to' of this list (src
+		// may be this list). Slot 'to' must be below capacity() and hold no
+		// entry; afterward src[from] holds no entry, and is not a free slot
+		// either, so the caller must overwrite or truncate it.
+		void relocate_entry(int to, EntryList& src, int from)
+			{ relocate(begin() + to, src.begin() + from, 1); }
+		// Changes size() without constructing or destructing any entries
+		void resize_raw(int newSize)
+		{
+			assert((size_type)newSize <= capacity());
+			set_size(newSize);
+		}
+		// Frees this list's array, which must hold no entries, and takes over
+		// the array of other, which must not be inline (mini_vector::swap
+		// would need assignable entries); other is left empty.
+		void take_array(EntryList& other)
+		{
+			assert(size() == 0 && !other.is_inline());
+			assert(get_allocator() == other.get_allocator());
+			reallocate(0);
+			set_array(other.begin(), other.capacity());
+			set_size(other.size());
+			other.set_size(0);
+			other.go_inline_again();
+		}
+		// Frees the capacity beyond size()
+		void shrink()
+		{
+			if (capacity() > size())
+				reallocate(size());
+		}
 	};
 	// An array of T values and "next" pointers. In general, some of the elements of
 	// this array are free and some are allocated. If items are not removed from the
@@ -274,12 +671,28 @@ protected:
 	// removed, that entry becomes the head of the free list (_freeList = e).
 	EntryList _entries;
 	// _entries[_buckets[b]] is the beginning of a linked list of items for which
-	// (hash code % _bucketCount) == b.
-	array_auto_ptr<int> _buckets;
-	// Size of _buckets array (a prime number). The current policy is to roughly
-	// double the size of _buckets when _entries.size() reaches _bucketCount.
-	// Invariant: _bucketCount == 0 if and only if _buckets is NULL.
+	// _bucketPolicy.Index(hash code) == b.
+	bucket_array<typename allocator_rebind<Alloc, int>::type> _buckets;
+	// Size of _buckets array (chosen by _bucketPolicy). The current policy is to
+	// roughly double the size of _buckets when _entries.size() reaches
+	// _bucketCount. Invariant: _bucketCount == 0 if and only if _buckets is NULL.
 	int _bucketCount;
+	// Maps hash codes to indexes in _buckets
+	BucketPolicy _bucketPolicy;
+	// During an incremental resize, the previous bucket array and its policy.
+	// Chains of old buckets below _migrated have been moved to _buckets; the
+	// others are still in _oldBuckets. _oldBuckets is NULL when not resizing.
+	bucket_array<typename allocator_rebind<Alloc, int>::type> _oldBuckets;
+	BucketPolicy _oldBucketPolicy;
+	int _oldBucketCount;
+	int _migrated;
+	bool _incrementalResize;
+	// Hash codes of the items, if _missFilter is set (see SetMissFilter)
+	blocked_bloom_filter<typename allocator_rebind<Alloc, uint32>::type> _filter;
+	bool _missFilter;
+	// Fraction of free entry slots at which Remove() calls shrink_to_fit(),
+	// or 0 if it never does (see SetAutoCompact)
+	float _autoCompact;
     // Number of free slots in _entries, or 0 if _entries is full
 	int _freeCount;
     // Points to the first free slot in _entries, or EndOfFreeList if _entries is full
@@ -293,15 +706,43 @@ protected:
 		{ return hash_value(entry.t); }
 	hash_type Hash(const NormalEntry& entry) const
 		{ return entry.hashCode; }
-	bool IsMatch(const SmallEntry& entry, const T& t, hash_type keyHash) const
-		{ return equals(entry.t, t); }
-	bool IsMatch(const NormalEntry& entry, const T& t, hash_type keyHash) const
-		{ return entry.hashCode == keyHash && equals(entry.t, t); }
+	template<class K>
+	bool IsMatch(const SmallEntry& entry, const K& key, hash_type keyHash) const
+		{ return equals(entry.t, key); }
+	template<class K>
+	bool IsMatch(const NormalEntry& entry, const K& key, hash_type keyHash) const
+		{ return entry.hashCode == keyHash && equals(entry.t, key); }
+	int BucketOf(hash_type keyHash) const
+		{ return _bucketPolicy.Index(keyHash); }
+	// Returns the head of the chain that holds (or would hold) keys with the
+	// specified hash code, which is in _oldBuckets if that part of the table
+	// has not been migrated yet.
+	int& Head(hash_type keyHash)
+	{
+		if (_oldBuckets != NULL) {
+			int oldI = _oldBucketPolicy.Index(keyHash);
+			if (oldI >= _migrated)
+				return _oldBuckets[oldI];
+		}
+		return _buckets[BucketOf(keyHash)];
+	}
+	int Head(hash_type keyHash) const
+		{ return const_cast<hash_set_t*>(this)->Head(keyHash); }
+	// Returns false if the miss filter shows that no item has this hash code
+	bool MayContain(hash_type keyHash) const
+		{ return !_missFilter || _filter.MayContain(keyHash); }
 	
 public:
-	hash_set() { Init(0); }
-	explicit hash_set(size_type capacity, const Traits& traits = Traits())
-		: Traits(traits)
+	hash_set() : _incrementalResize(false), _missFilter(false), _autoCompact(0) { Init(0); }
+	explicit hash_set(const Alloc& alloc)
+		: _entries(EntryAlloc(alloc)), _buckets(alloc), _oldBuckets(alloc), _incrementalResize(false),
+		  _filter(alloc), _missFilter(false), _autoCompact(0)
+	{
+		Init(0);
+	}
+	explicit hash_set(size_type capacity, const Traits& traits = Traits(), const Alloc& alloc = Alloc())
+		: Traits(traits), _entries(EntryAlloc(alloc)), _buckets(alloc), _oldBuckets(alloc), _incrementalResize(false),
+		  _filter(alloc), _missFilter(false), _autoCompact(0)
 	{
 		Init(capacity);
 	}
@@ -344,15 +785,33 @@ protected:
 		
 		// Look for an existing matching entry
 		hash_type keyHash = hash_value(key);
-		int bucketI = keyHash % _bucketCount;
 		int entryI;
-		for (entryI = _buckets[bucketI]; entryI >= 0; entryI = _entries[entryI].next)
-		{
-			if (IsMatch(_entries[entryI], key, keyHash))
-				return ~entryI;
-		}
+		if (MayContain(keyHash))
+			for (entryI = Head(keyHash); entryI >= 0; entryI = _entries[entryI].next)
+			{
+				if (IsMatch(_entries[entryI], key, keyHash))
+					return ~entryI;
+			}
 
 		// Existing entry not found; add new
+		int* head;
+		entryI = ReserveEntry(keyHash, head);
+		_entries.construct(entryI, key, keyHash, *head);
+		*head = entryI;
+
+		return entryI;
+	}
+
+	// Chooses the entry in which to store a new key with the specified hash
+	// code, enlarging the table if necessary (or advancing an incremental
+	// resize), and sets head to the head of the key's chain. The caller must
+	// construct the entry right away with *head as its 'next' link, then set
+	// *head to the new entry.
+	int ReserveEntry(hash_type keyHash, int*& head)
+	{
+		if (_oldBuckets != NULL)
+			MigrateBuckets(ResizeStep);
+		int entryI;
 		assert ((_freeCount == 0) == (_freeList == EndOfFreeList));
 		if (_freeCount > 0)
 		{
@@ -366,44 +825,67 @@ protected:
 		else
 		{
 			if (_entries.size() == _bucketCount)
-			{
 				EnlargeBuckets();
-				bucketI = keyHash % _bucketCount;
-			}
 			entryI = (int)_entries.size();
 		}
-		_entries.construct(entryI, key, keyHash, _buckets[bucketI]);
-		_buckets[bucketI] = entryI;
-
+		if (_missFilter) {
+			// Count adds rather than items: when keys are removed and others
+			// added at a steady size, each new key still sets more bits.
+			if (_filter.Added() >= _filter.Capacity())
+				RebuildFilter();
+			_filter.Add(keyHash);
+		}
+		head = &Head(keyHash);
 		return entryI;
 	}
+	// Sizes the miss filter for twice the current number of items and adds
+	// the items to it, which also forgets the items that were removed.
+	enum { MinFilterCapacity = 64 };
+	void RebuildFilter()
+	{
+		_filter.Reset(Count() * 2 > MinFilterCapacity ? Count() * 2 : MinFilterCapacity);
+		for (int i = 0; i < (int)_entries.size(); i++)
+			if (!IsFree(i))
+				_filter.Add(Hash(_entries[i]));
+	}
 
 public:
     void Clear()
 	{
 		_entries.clear();
 		_buckets.reset();
+		_oldBuckets.reset();
+		_oldBucketCount = _migrated = 0;
 		_bucketCount = 0;
 		_freeCount = 0;
 		_freeList = EndOfFreeList;
+		_filter.Clear();
 	}
 	 
 	bool Contains(const T& key) const
 	{
 		return FindEntry(key) < _entries.size();
 	}
+	// Heterogeneous lookup; see hash_lookup_key.
+	template<class K>
+	bool Contains(const K& key, typename hash_lookup_key<Traits, K>::type* = 0) const
+	{
+		return FindEntry(key) < _entries.size();
+	}
 
 protected:
 	// Returns the index of the entry that holds a matching key, or _entries.size()
-	// if the key was not found.
-	size_type FindEntry(const T& key) const
+	// if the key was not found. K is T or a lookup key type for T.
+	template<class K>
+	size_type FindEntry(const K& key) const
 	{
 		if (_buckets != NULL)
 		{
 			hash_type keyHash = hash_value(key);
-			for (int i = _buckets[keyHash % _bucketCount]; i >= 0; i = _entries[i].next)
-				if (IsMatch(_entries[i], key, keyHash))
-					return i;
+			if (MayContain(keyHash))
+				for (int i = Head(keyHash); i >= 0; i = _entries[i].next)
+					if (IsMatch(_entries[i], key, keyHash))
+						return i;
 		}
 		return _entries.size();
 	}
@@ -414,56 +896,181 @@ protected:
 		_bucketCount = 0;
 		_freeCount = 0;
 		_freeList = EndOfFreeList;
+		_oldBucketCount = _migrated = 0;
 		
 		if (capacity)
 			AllocBuckets(capacity);
 	}
 	void EnlargeBuckets()
 	{
-		AllocBuckets(_bucketCount * 2);
+		if (_incrementalResize && _entries.size() > 0) {
+			// Keep the old buckets; their chains move over in MigrateBuckets
+			FinishResize();
+			_oldBucketCount = _bucketCount;
+			_oldBucketPolicy = _bucketPolicy;
+			_oldBuckets.swap(_buckets);
+			_migrated = 0;
+			_bucketCount = _bucketPolicy.Resize(_bucketCount * 2);
+			_buckets.reset(_bucketCount);
+		} else
+			AllocBuckets(_bucketCount * 2);
+	}
+	// Number of old buckets migrated per insert during an incremental resize.
+	// The table has at least twice as many buckets as the old table, so it
+	// takes at least _oldBucketCount inserts to need the next enlargement;
+	// migrating two buckets per insert finishes well before that.
+	enum { ResizeStep = 2 };
+	// Moves the chains of up to count old buckets to the new bucket array.
+	void MigrateBuckets(int count)
+	{
+		int stop = _migrated + count < _oldBucketCount ? _migrated + count : _oldBucketCount;
+		for (; _migrated < stop; _migrated++) {
+			for (int j = _oldBuckets[_migrated]; j >= 0; ) {
+				int next = _entries[j].next;
+				int index = BucketOf(Hash(_entries[j]));
+				_entries[j].next = _buckets[index];
+				_buckets[index] = j;
+				j = next;
+			}
+		}
+		if (_migrated == _oldBucketCount) {
+			_oldBuckets.reset();
+			_oldBucketCount = _migrated = 0;
+		}
+	}
+	void FinishResize()
+	{
+		if (_oldBuckets != NULL)
+			MigrateBuckets(_oldBucketCount);
 	}
 	void AllocBuckets(int size)
 	{
-		assert (size > (int)_entries.size());
-		_bucketCount = Math::GetNextPrime(size);
-		_buckets.reset(new int[_bucketCount]);
-		fill(_buckets.get(), _buckets.get() + _bucketCount, -1);
-
-		for (int j = 0; j < (int)_entries.size(); j++)
+		assert (size >= (int)_entries.size());
+		_oldBuckets.reset();
+		_oldBucketCount = _migrated = 0;
+		_bucketCount = _bucketPolicy.Resize(size);
+		_buckets.reset(_bucketCount);
+		LinkEntries();
+	}
+	int ChainLength(int head) const
+	{
+		int length = 0;
+		for (int i = head; i >= 0; i = _entries[i].next)
+			length++;
+		return length;
+	}
+	// Adds every entry to the chain of its bucket. The buckets must be empty
+	// and there must be no free slots. The entries are visited backward so
+	// that each chain lists its entries in increasing order of index (Insert
+	// later adds new entries at the front of their chains).
+	void LinkEntries()
+	{
+		for (int j = (int)_entries.size() - 1; j >= 0; j--)
 		{
-			int index = Hash(_entries[j]) % _bucketCount;
+			assert (!IsFree(j));
+			int index = BucketOf(Hash(_entries[j]));
 			_entries[j].next = _buckets[index];
 			_buckets[index] = j;
 		}
 	}
+	// Moves the allocated entries down into the free slots, keeping their
+	// order, and rebuilds the chains.
+	void SlideEntries()
+	{
+		int count = Count();
+		for (int from = 0, to = 0; to < count; from++)
+			if (!IsFree(from)) {
+				if (from != to)
+					_entries.relocate_entry(to, _entries, from);
+				to++;
+			}
+		_entries.resize_raw(count);
+		_freeCount = 0;
+		_freeList = EndOfFreeList;
+		std::fill(_buckets.get(), _buckets.get() + _bucketCount, -1);
+		LinkEntries();
+	}
+	// Moves the allocated entries to a new entry array of the same capacity
+	// in which the entries of each bucket are adjacent, in order of bucket
+	// (a counting sort), and rebuilds the chains. Requires Count() > 1.
+	void SortByBucket()
+	{
+		int count = Count(), size = (int)_entries.size();
+		assert (count > 1);
+		// After counting, start[b + 1] is the number of entries in bucket b;
+		// after the running sum, start[b] is the index of the first one.
+		bucket_array<typename allocator_rebind<Alloc, int>::type> start(_entries.get_allocator());
+		start.reset(_bucketCount + 1);
+		std::fill(start.get(), start.get() + _bucketCount + 1, 0);
+		for (int i = 0; i < size; i++)
+			if (!IsFree(i))
+				start[BucketOf(Hash(_entries[i])) + 1]++;
+		for (int b = 0; b < _bucketCount; b++)
+			start[b + 1] += start[b];
+
+		// Afterward, start[b] is the end of bucket b
+		EntryList sorted(_entries.get_allocator());
+		sorted.reserve(_entries.capacity());
+		sorted.resize_raw(count);
+		for (int i = 0; i < size; i++)
+			if (!IsFree(i))
+				sorted.relocate_entry(start[BucketOf(Hash(_entries[i]))]++, _entries, i);
+		for (int b = 0, lo = 0; b < _bucketCount; lo = start[b++]) {
+			int hi = start[b];
+			_buckets[b] = lo < hi ? lo : -1;
+			for (int j = lo; j < hi; j++)
+				sorted[j].next = j + 1 < hi ? j + 1 : -1;
+		}
+		_entries.resize_raw(0);
+		_entries.take_array(sorted);
+		_freeCount = 0;
+		_freeList = EndOfFreeList;
+	}
+	// Called after a removal; shrinks the table if auto-compaction is enabled
+	// and enough of it is free. Small tables are left alone so that a table
+	// does not reallocate over and over when a few items come and go.
+	bool CompactIfSparse(bool removed)
+	{
+		if (removed && _autoCompact > 0 && _entries.size() >= 16 &&
+			_freeCount > _autoCompact * _entries.size())
+			shrink_to_fit();
+		return removed;
+	}
 
-public:
-	bool Remove(const T& key)
+	// Unlinks entry i, which follows entry prevI (or -1 if i is first) in
+	// the chain that starts at head, and puts it on the free list.
+	void RemoveAt(int& head, int prevI, int i)
+	{
+		if (prevI < 0)
+			head = _entries[i].next;
+		else
+			_entries[prevI].next = _entries[i].next;
+		
+		assert ((uint)_freeList < _entries.size() || _freeList == EndOfFreeList);
+		_entries.destruct(i);
+		// We must guarantee .next < -1 so that iterators can detect
+		// that it is a free slot, so use _freeList | 0x80000000.
+		_entries[i].next = _freeList | 0x80000000u;
+		_freeList = i;
+		_freeCount++;
+	}
+	template<class K>
+	bool RemoveKey(const K& key)
 	{
 		if (_buckets == NULL)
 			return false;
 
 		hash_type keyHash = hash_value(key);
-		int bucketI = keyHash % _bucketCount;
+		if (!MayContain(keyHash))
+			return false;
+		int& head = Head(keyHash);
 		int prevI = -1;
-		for (int i = _buckets[bucketI]; i >= 0; i = _entries[i].next)
+		for (int i = head; i >= 0; i = _entries[i].next)
 		{
 			assert ((uint)i < _entries.size() && !IsFree(i));
 			if (IsMatch(_entries[i], key, keyHash))
 			{
-				if (prevI < 0)
-					_buckets[bucketI] = _entries[i].next;
-				else
-					_entries[prevI].next = _entries[i].next;
-				
-				assert ((uint)_freeList < _entries.size() || _freeList == EndOfFreeList);
-				_entries.destruct(i);
-				// We must guarantee .next < -1 so that iterators can detect
-				// that it is a free slot, so use _freeList | 0x80000000.
-				_entries[i].next = _freeList | 0x80000000u;
-				_freeList = i;
-				_freeCount++;
-
+				RemoveAt(head, prevI, i);
 				return true;
 			}
 			prevI = i;
@@ -471,34 +1078,150 @@ public:
 		return false;
 	}
 
+public:
+	bool Remove(const T& key)
+		{ return CompactIfSparse(RemoveKey(key)); }
+	// Heterogeneous removal; see hash_lookup_key.
+	template<class K>
+	bool Remove(const K& key, typename hash_lookup_key<Traits, K>::type* = 0)
+		{ return CompactIfSparse(RemoveKey(key)); }
+
 	int Count() const { return (size_type)_entries.size() - _freeCount; }
 
+	// Enables or disables incremental resizing (see the header comment).
+	// Disabling it completes a resize in progress.
+	void SetIncrementalResize(bool enable)
+	{
+		_incrementalResize = enable;
+		if (!enable)
+			FinishResize();
+	}
+	bool IsIncrementalResize() const { return _incrementalResize; }
+
+	// Enables or disables the miss filter (see the header comment). Enabling
+	// it builds the filter from the current items.
+	void SetMissFilter(bool enable)
+	{
+		_missFilter = enable;
+		if (enable && Count() > 0)
+			RebuildFilter();
+		else
+			_filter.Clear();
+	}
+	bool HasMissFilter() const { return _missFilter; }
+
+	allocator_type get_allocator() const { return allocator_type(_entries.get_allocator()); }
+	// Returns true while an incremental resize is in progress.
+	bool IsResizing() const { return _oldBuckets != NULL; }
+
+	// Measures the chain lengths and memory use of the table, which reveals
+	// whether the hash function spreads the keys well. Takes time proportional
+	// to the number of buckets plus the number of items.
+	hash_table_stats stats() const
+	{
+		hash_table_stats s;
+		s.Count = Count();
+		s.BucketCount = _bucketCount;
+		s.FreeCount = _freeCount;
+		s.Capacity = (int)_entries.capacity();
+		s.Bytes = _entries.capacity() * sizeof(Entry) + (_bucketCount + _oldBucketCount) * sizeof(int) + _filter.Bytes();
+		for (int b = 0; b < _bucketCount; b++)
+			s.AddChain(ChainLength(_buckets[b]));
+		// During an incremental resize, some chains are still in the old array
+		for (int b = _migrated; b < _oldBucketCount; b++)
+			s.AddChain(ChainLength(_oldBuckets[b]));
+		return s;
+	}
+
+	// Moves the remaining entries into the slots of removed entries, so that
+	// the entries are contiguous again, and rebuilds the chains. If byBucket
+	// is true, the entries are also sorted by bucket, so that each chain lies
+	// in consecutive entries; this makes lookups in a table that is larger
+	// than the cache touch fewer cache lines, but temporarily needs a second
+	// entry array. Compact() does not free memory (see shrink_to_fit) and it
+	// invalidates all iterators. It also rebuilds the miss filter, if any.
+	void Compact(bool byBucket = false)
+	{
+		FinishResize();
+		if (byBucket && Count() > 1)
+			SortByBucket();
+		else if (_freeCount > 0)
+			SlideEntries();
+		if (_missFilter)
+			RebuildFilter();
+	}
+	// Compacts the table and frees the entry and bucket capacity that it does
+	// not need for its current size. An empty table frees all of its memory.
+	// Invalidates all iterators.
+	void shrink_to_fit()
+	{
+		if (Count() == 0) {
+			Clear();
+			_entries.shrink();
+			return;
+		}
+		Compact();
+		_entries.shrink();
+		int size = Count() > 3 ? Count() : 3;
+		BucketPolicy policy = _bucketPolicy;
+		if (policy.Resize(size) < _bucketCount)
+			AllocBuckets(size);
+	}
+	// Makes Remove() (and erase(key)) call shrink_to_fit() when more than the
+	// specified fraction of the entry slots are free, e.g. 0.5 to keep the
+	// table at least half full. 0, the default, disables auto-compaction.
+	// erase(iterator) does not compact, so that it leaves other iterators
+	// valid; call shrink_to_fit() after erasing items while iterating.
+	void SetAutoCompact(float maxFreeFraction) { _autoCompact = maxFreeFraction; }
+	float GetAutoCompact() const { return _autoCompact; }
+
 	///////////////////////////////////////////////////////////////////////////////
 	// support for copying ////////////////////////////////////////////////////////
 	///////////////////////////////////////////////////////////////////////////////
 	
-	hash_set(const hash_set_t& copy) : Traits(copy.traits()), _entries(copy._entries)
+	hash_set(const hash_set_t& copy) : Traits(copy.traits()),
+		_entries(allocator_for_copy(copy._entries.get_allocator())),
+		_buckets(_entries.get_allocator()), _oldBuckets(_entries.get_allocator()), _filter(_entries.get_allocator())
 	{
-		_bucketCount = copy._bucketCount;
-		_freeCount = copy._freeCount;
-		_freeList = copy._freeList;
-		if (size())
-			AllocBuckets(size());
+		_incrementalResize = copy._incrementalResize;
+		_missFilter = copy._missFilter;
+		_autoCompact = copy._autoCompact;
+		Init(0);
+		CopyFrom(copy);
 	}
 	hash_set_t& operator=(const hash_set_t& copy)
 	{
 		if (&copy != this) {
+			Clear();
 			Traits::operator=(copy);
-			_entries = copy._entries;
-			_bucketCount = copy._bucketCount;
-			_freeCount = copy._freeCount;
-			_freeList = copy._freeList;
-			if (size())
-				AllocBuckets(size());
+			_incrementalResize = copy._incrementalResize;
+			_missFilter = copy._missFilter;
+			_autoCompact = copy._autoCompact;
+			CopyFrom(copy);
 		}
 		return *this;
 	}
 
+protected:
+	// Copies the allocated entries of another table into this empty table,
+	// so the copy has no free slots.
+	void CopyFrom(const hash_set_t& copy)
+	{
+		assert (_entries.size() == 0 && _buckets == NULL);
+		_bucketPolicy = copy._bucketPolicy;
+		if (copy.Count() == 0)
+			return;
+		_entries.reserve(copy.Count());
+		for (int i = 0, j = 0; i < (int)copy._entries.size(); i++)
+			if (!copy.IsFree(i))
+				_entries.construct(j++, copy._entries[i].t, copy.Hash(copy._entries[i]), -1);
+		AllocBuckets(copy._bucketCount);
+		if (_missFilter)
+			RebuildFilter();
+	}
+
+public:
+
 	///////////////////////////////////////////////////////////////////////////////
 	// iterators //////////////////////////////////////////////////////////////////
 	///////////////////////////////////////////////////////////////////////////////
@@ -657,6 +1380,22 @@ public:
 	{
 		return const_iterator(this, FindEntry(key));
 	}
+	template<class K>
+	iterator find(const K& key, typename hash_lookup_key<Traits, K>::type* = 0)
+	{
+		return iterator(this, FindEntry(key));
+	}
+	template<class K>
+	const_iterator find(const K& key, typename hash_lookup_key<Traits, K>::type* = 0) const
+	{
+		return const_iterator(this, FindEntry(key));
+	}
+	// Batched lookup: sets results[k] to find(keys[k]), or to Contains(keys[k]),
+	// for k < count, and returns the number of keys found.
+	int find_batch(const T* keys, int count, const_iterator* results) const
+		{ return FindBatch(keys, count, results); }
+	int contains_batch(const T* keys, int count, bool* results) const
+		{ return FindBatch(keys, count, results); }
 	std::pair<iterator, bool> insert(const T& key)
 	{
 		int i = Insert(key);
@@ -672,11 +1411,13 @@ public:
 	{
 		return (int)(FindEntry(key) < _entries.size());
 	}
+	// Unlike Remove(), never compacts (see SetAutoCompact), so iterators to
+	// other items stay valid
 	void erase(const const_iterator& pos)
 	{
 		assert (pos._hash == this);
 		if (pos._hash == this && pos.is_valid()) {
-			bool success = Remove(*pos);
+			bool success = RemoveKey(*pos);
 			assert(success);
 		}
 	}
@@ -685,6 +1426,73 @@ public:
 protected:
 	const_iterator at(int index) const { return const_iterator(this, index); }
 	iterator at(int index) { return iterator(this, index); }
+
+	// Looks up keys[0..count), stores an iterator or a bool in results[k] for
+	// each key, and returns the number of keys found. Rather than following
+	// one chain to the end before starting the next, each key goes through
+	// three stages, BatchDistance keys apart: (1) hash the key and prefetch
+	// its bucket; (2) read the bucket and prefetch the first entry of the
+	// chain; (3) search the chain. While one key is searched, the buckets
+	// and entries of the next 2*BatchDistance keys are on their way from
+	// memory. Tables small enough to stay in the cache are searched one key
+	// at a time, since for them prefetching is pure overhead, as are tables
+	// in the middle of an incremental resize. With a miss filter, a key that
+	// the filter rejects in stage 1 skips the other two stages.
+	enum { BatchDistance = 16, BatchWindow = 64, BatchMinBuckets = 65536 };
+	template<class K, class R>
+	int FindBatch(const K* keys, int count, R* results) const
+	{
+		size_type notFound = _entries.size();
+		int found = 0;
+		if (_bucketCount < BatchMinBuckets || _oldBuckets != NULL) {
+			for (int k = 0; k < count; k++) {
+				size_type i = FindEntry(keys[k]);
+				found += i < notFound;
+				SetBatchResult(results[k], i);
+			}
+			return found;
+		}
+
+		// Local copies, so that the compiler need not reload them after
+		// each store to results
+		const int* buckets = _buckets.get();
+		const Entry* entries = _entries.begin();
+		hash_type hashes[BatchWindow];
+		int cur[BatchWindow]; // bucket index, then entry index
+		for (int k = 0; k < count + 2 * BatchDistance; k++) {
+			if (k < count) {
+				int w = k & (BatchWindow - 1);
+				hashes[w] = hash_value(keys[k]);
+				if (MayContain(hashes[w])) {
+					cur[w] = BucketOf(hashes[w]);
+					HASH_PREFETCH(&buckets[cur[w]]);
+				} else
+					cur[w] = -1;
+			}
+			int k1 = k - BatchDistance;
+			if (k1 >= 0 && k1 < count) {
+				int w = k1 & (BatchWindow - 1);
+				if (cur[w] >= 0 && (cur[w] = buckets[cur[w]]) >= 0)
+					HASH_PREFETCH(&entries[cur[w]]);
+			}
+			int k2 = k - 2 * BatchDistance;
+			if (k2 >= 0) {
+				int w = k2 & (BatchWindow - 1), i;
+				for (i = cur[w]; i >= 0; i = entries[i].next)
+					if (IsMatch(entries[i], keys[k2], hashes[w]))
+						break;
+				found += i >= 0;
+				SetBatchResult(results[k2], i >= 0 ? (size_type)i : notFound);
+			}
+		}
+		return found;
+	}
+	void SetBatchResult(bool& result, size_type i) const
+		{ result = i < _entries.size(); }
+	void SetBatchResult(const_iterator& result, size_type i) const
+		{ result = at(i); }
+	void SetBatchResult(iterator& result, size_type i) const
+		{ result = const_cast<hash_set_t*>(this)->at(i); }
 };
 
 template<class Pair, class KeyTraits>
@@ -701,6 +1509,15 @@ struct hash_map_traits : KeyTraits
 		{ return KeyTraits::equals(a.first, b.first); }
 	unsigned hash_value(const Pair& pair) const
 		{ return KeyTraits::hash_value(pair.first); }
+
+	// Compare and hash keys alone, so that hash_set code that looks up keys
+	// (FindBatch) works for hash_map, whose entries hold pairs.
+	template<class K>
+	bool equals(const Pair& a, const K& key) const
+		{ return KeyTraits::equals(a.first, key); }
+	template<class K>
+	unsigned hash_value(const K& key) const
+		{ return KeyTraits::hash_value(key); }
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -721,25 +1538,30 @@ struct hash_map_traits : KeyTraits
 // not allowed. hash_map uses the same underlying implementation as hash_set;
 // see hash_set's header comment for details.
 // 
-template<class TKey, class TValue, class KeyTraits = hash_traits<TKey> >//, bool CompactMode = Math::num_traits<TKey>::is_numeric>
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey>, class BucketPolicy = prime_bucket_policy,
+         class Alloc = std::allocator< std::pair<const TKey,TValue> > >//, bool CompactMode = Math::num_traits<TKey>::is_numeric>
 class hash_map : protected hash_set< std::pair<const TKey,TValue>, 
-                     hash_map_traits<std::pair<const TKey,TValue>,KeyTraits> >//, CompactMode >
+                     hash_map_traits<std::pair<const TKey,TValue>,KeyTraits>, BucketPolicy, Alloc >//, CompactMode >
 {
 public:
-	typedef hash_map<TKey, TValue, KeyTraits/*, CompactMode*/> hash_map_t;
+	typedef hash_map<TKey, TValue, KeyTraits, BucketPolicy, Alloc/*, CompactMode*/> hash_map_t;
 	typedef const TKey key_type;
 	typedef const TValue mapped_type;
 	typedef std::pair<const TKey,TValue> value_type;
+	typedef Alloc allocator_type;
 	
 	hash_map() {}
-	explicit hash_map(size_type capacity, const KeyTraits& traits = KeyTraits())
-		: hash_set(capacity, hash_map_traits(traits)) {}
+	explicit hash_map(const Alloc& alloc) : hash_set(alloc) {}
+	explicit hash_map(size_type capacity, const KeyTraits& traits = KeyTraits(), const Alloc& alloc = Alloc())
+		: hash_set(capacity, hash_map_traits(traits), alloc) {}
 
 	// Puts the specified key in the set. If a matching key already exists, an
 	// exception is thrown.
     void Add(const TKey& key, const TValue& value)
 	{
-		if (Insert(value_type(key, value)) < 0)
+		bool added;
+		FindOrAdd(key, value, added);
+		if (!added)
 			throw exception_t(_T("Key already exists in hash_map"));
 	}
 
@@ -747,7 +1569,9 @@ public:
 	// if the specified key was actually added (it did not already exist).
 	bool TryAdd(const TKey& key, const TValue& value)
 	{
-		return Insert(value_type(key, value)) >= 0;
+		bool added;
+		FindOrAdd(key, value, added);
+		return added;
 	}
 
 	// Puts the specified key in the set. If a matching key already exists, it is
@@ -755,10 +1579,11 @@ public:
 	// key did not already exist.
 	bool Set(const TKey& key, const TValue& value)
 	{
-		int i = Insert(value_type(key, value));
-		if (i < 0)
-			_entries[~i].t.second = value;
-		return i >= 0;
+		bool added;
+		int i = FindOrAdd(key, value, added);
+		if (!added)
+			_entries[i].t.second = value;
+		return added;
 	}
 
 	bool TryGet(const TKey& key, OUT TValue& value)
@@ -770,6 +1595,17 @@ public:
 		}
 		return false;
 	}
+	// Heterogeneous lookup; see hash_lookup_key.
+	template<class K>
+	bool TryGet(const K& key, OUT TValue& value, typename hash_lookup_key<KeyTraits, K>::type* = 0)
+	{
+		size_type i = FindEntry(key);
+		if (i < _entries.size()) {
+			value = _entries[i].t.second;
+			return true;
+		}
+		return false;
+	}
 	TValue Get(const TKey& key, TValue defaultValue)
 	{
 		TryGet(key, OUT defaultValue);
@@ -780,29 +1616,132 @@ public:
 		{ hash_set::Clear(); }
 	bool Contains(const TKey& key)
 		{ return FindEntry(key) < _entries.size(); }
+	template<class K>
+	bool Contains(const K& key, typename hash_lookup_key<KeyTraits, K>::type* = 0)
+		{ return FindEntry(key) < _entries.size(); }
 	bool Remove(const TKey& key)
-		{ return hash_set::Remove(value_type(key, TValue())); }
+		{ return CompactIfSparse(RemoveKey(key)); }
+	template<class K>
+	bool Remove(const K& key, typename hash_lookup_key<KeyTraits, K>::type* = 0)
+		{ return CompactIfSparse(RemoveKey(key)); }
 	int Count() const
 		{ return hash_set::Count(); }
+	void SetIncrementalResize(bool enable)
+		{ hash_set::SetIncrementalResize(enable); }
+	bool IsIncrementalResize() const
+		{ return hash_set::IsIncrementalResize(); }
+	bool IsResizing() const
+		{ return hash_set::IsResizing(); }
+	void SetMissFilter(bool enable)
+		{ hash_set::SetMissFilter(enable); }
+	bool HasMissFilter() const
+		{ return hash_set::HasMissFilter(); }
+	hash_table_stats stats() const
+		{ return hash_set::stats(); }
+	void Compact(bool byBucket = false)
+		{ hash_set::Compact(byBucket); }
+	void shrink_to_fit()
+		{ hash_set::shrink_to_fit(); }
+	void SetAutoCompact(float maxFreeFraction)
+		{ hash_set::SetAutoCompact(maxFreeFraction); }
+	float GetAutoCompact() const
+		{ return hash_set::GetAutoCompact(); }
+	allocator_type get_allocator() const
+		{ return hash_set::get_allocator(); }
 
 protected:
 	// Returns the index of the entry that holds a matching key, or _entries.size()
-	// if the key was not found.
-	size_type FindEntry(const TKey& key) const
+	// if the key was not found. K is TKey or a lookup key type for TKey.
+	template<class K>
+	size_type FindEntry(const K& key) const
 	{
 		if (_buckets != NULL)
 		{
 			hash_type keyHash = (hash_type)KeyTraits::hash_value(key);
-			for (int i = _buckets[keyHash % _bucketCount]; i >= 0; i = _entries[i].next)
-				if (IsMatch(_entries[i], key, keyHash))
-					return i;
+			int i = MayContain(keyHash) ? FindInChain(Head(keyHash), key, keyHash) : -1;
+			if (i >= 0)
+				return i;
 		}
 		return (size_type)_entries.size();
 	}
-	bool IsMatch(const SmallEntry& entry, const TKey& key, hash_type keyHash) const
+	// Returns the index of the entry in the chain starting at entry i that
+	// matches key, or -1.
+	template<class K>
+	int FindInChain(int i, const K& key, hash_type keyHash) const
+	{
+		for (; i >= 0; i = _entries[i].next)
+			if (IsMatch(_entries[i], key, keyHash))
+				return i;
+		return -1;
+	}
+	// Returns the index of the entry for key, adding (key, value) first if the
+	// key is new. Unlike Insert(value_type(key, value)), this does not copy the
+	// key or the value unless the key is new.
+	int FindOrAdd(const TKey& key, const TValue& value, OUT bool& added)
+	{
+		if (_buckets == NULL)
+			Init(3);
+		hash_type keyHash = (hash_type)KeyTraits::hash_value(key);
+		int i = MayContain(keyHash) ? FindInChain(Head(keyHash), key, keyHash) : -1;
+		added = (i < 0);
+		if (added) {
+			int* head;
+			i = ReserveEntry(keyHash, head);
+			#ifdef MINI_VECTOR_HAS_MOVE
+			_entries.emplace(i, keyHash, *head, key, value);
+			#else
+			_entries.construct(i, value_type(key, value), keyHash, *head);
+			#endif
+			*head = i;
+		}
+		return i;
+	}
+	#ifdef MINI_VECTOR_HAS_MOVE
+	// Constructs the value for key from args if the key is new; otherwise,
+	// neither the key nor args are touched. Returns an index like Insert().
+	template<class K, class... Args>
+	int TryEmplace(K&& key, Args&&... args)
+	{
+		if (_buckets == NULL)
+			Init(3);
+		hash_type keyHash = (hash_type)KeyTraits::hash_value(key);
+		int i = MayContain(keyHash) ? FindInChain(Head(keyHash), key, keyHash) : -1;
+		if (i >= 0)
+			return ~i;
+		int* head;
+		i = ReserveEntry(keyHash, head);
+		_entries.emplace(i, keyHash, *head, std::piecewise_construct,
+			std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+		*head = i;
+		return i;
+	}
+	#endif
+	template<class K>
+	bool IsMatch(const SmallEntry& entry, const K& key, hash_type keyHash) const
 		{ return KeyTraits::equals(entry.t.first, key); }
-	bool IsMatch(const NormalEntry& entry, const TKey& key, hash_type keyHash) const
+	template<class K>
+	bool IsMatch(const NormalEntry& entry, const K& key, hash_type keyHash) const
 		{ return entry.hashCode == keyHash && KeyTraits::equals(entry.t.first, key); }
+	// Removes the entry for a key without constructing a value_type
+	template<class K>
+	bool RemoveKey(const K& key)
+	{
+		if (_buckets == NULL)
+			return false;
+
+		hash_type keyHash = (hash_type)KeyTraits::hash_value(key);
+		if (!MayContain(keyHash))
+			return false;
+		int& head = Head(keyHash);
+		for (int prevI = -1, i = head; i >= 0; prevI = i, i = _entries[i].next)
+		{
+			if (IsMatch(_entries[i], key, keyHash)) {
+				RemoveAt(head, prevI, i);
+				return true;
+			}
+		}
+		return false;
+	}
 
 public:
 	///////////////////////////////////////////////////////////////////////////////
@@ -822,7 +1761,7 @@ public:
 
 	size_type size() const { return hash_set::Count(); }
 	size_type capacity() const { return hash_set::capacity(); }
-	bool empty() const { return _entries.empty(); }
+	bool empty() const { return hash_set::empty(); }
 	void clear() { hash_set::Clear(); }
 
 	iterator begin() { return hash_set::begin(); }
@@ -838,6 +1777,24 @@ public:
 	{
 		return at(FindEntry(key));
 	}
+	template<class K>
+	iterator find(const K& key, typename hash_lookup_key<KeyTraits, K>::type* = 0)
+	{
+		return at(FindEntry(key));
+	}
+	template<class K>
+	const_iterator find(const K& key, typename hash_lookup_key<KeyTraits, K>::type* = 0) const
+	{
+		return at(FindEntry(key));
+	}
+	// Batched lookup: sets results[k] to find(keys[k]), or to Contains(keys[k]),
+	// for k < count, and returns the number of keys found. See hash_set.
+	int find_batch(const TKey* keys, int count, iterator* results)
+		{ return hash_set::FindBatch(keys, count, results); }
+	int find_batch(const TKey* keys, int count, const_iterator* results) const
+		{ return hash_set::FindBatch(keys, count, results); }
+	int contains_batch(const TKey* keys, int count, bool* results) const
+		{ return hash_set::FindBatch(keys, count, results); }
 	std::pair<iterator, bool> insert(const TKey& key, const TValue& value)
 	{
 		int i = Insert(value_type(key, value));
@@ -858,22 +1815,88 @@ public:
 	{
 		return (int)(FindEntry(key) < _entries.size());
 	}
+	// Never compacts, unlike erase(key); see hash_set::erase
 	void erase(const const_iterator& pos)
 	{
 		hash_set::erase(pos);
 	}
 	bool erase(const TKey& key)
 	{
-		return hash_set::Remove(value_type(key, TValue()));
+		return Remove(key);
+	}
+	template<class K>
+	bool erase(const K& key, typename hash_lookup_key<KeyTraits, K>::type* = 0)
+	{
+		return Remove(key);
 	}
 
 	TValue& operator[](const TKey& key)
 	{
-		int i = Insert(value_type(key, TValue()));
+		#ifdef MINI_VECTOR_HAS_MOVE
+		int i = TryEmplace(key);
+		return _entries[i >= 0 ? i : ~i].t.second;
+		#else
+		bool added;
+		return _entries[FindOrAdd(key, TValue(), added)].t.second;
+		#endif
+	}
+
+	#ifdef MINI_VECTOR_HAS_MOVE
+	TValue& operator[](TKey&& key)
+	{
+		int i = TryEmplace(std::move(key));
+		return _entries[i >= 0 ? i : ~i].t.second;
+	}
+	std::pair<iterator, bool> insert(value_type&& t)
+	{
+		return InsertResult(TryEmplace(t.first, std::move(t.second)));
+	}
+	// Constructs a value_type from args, and moves it into the map if its key
+	// is new. Use try_emplace to avoid constructing the value when the key
+	// may exist already.
+	template<class... Args>
+	std::pair<iterator, bool> emplace(Args&&... args)
+	{
+		value_type t(std::forward<Args>(args)...);
+		// t is a temporary, so its key can be moved
+		return InsertResult(TryEmplace(std::move(const_cast<TKey&>(t.first)), std::move(t.second)));
+	}
+	// Constructs the value from args if the key is new. If the key exists,
+	// nothing is constructed, copied or moved.
+	template<class... Args>
+	std::pair<iterator, bool> try_emplace(const TKey& key, Args&&... args)
+	{
+		return InsertResult(TryEmplace(key, std::forward<Args>(args)...));
+	}
+	template<class... Args>
+	std::pair<iterator, bool> try_emplace(TKey&& key, Args&&... args)
+	{
+		return InsertResult(TryEmplace(std::move(key), std::forward<Args>(args)...));
+	}
+	// Assigns the value if the key exists, or inserts (key, value) if not
+	template<class M>
+	std::pair<iterator, bool> insert_or_assign(const TKey& key, M&& value)
+	{
+		int i = TryEmplace(key, std::forward<M>(value));
 		if (i < 0)
-			i = ~i; // key already existed
-		return _entries[i].t.second;
+			_entries[~i].t.second = std::forward<M>(value);
+		return InsertResult(i);
 	}
+	template<class M>
+	std::pair<iterator, bool> insert_or_assign(TKey&& key, M&& value)
+	{
+		int i = TryEmplace(std::move(key), std::forward<M>(value));
+		if (i < 0)
+			_entries[~i].t.second = std::forward<M>(value);
+		return InsertResult(i);
+	}
+protected:
+	std::pair<iterator, bool> InsertResult(int i)
+	{
+		return std::make_pair(at(i >= 0 ? i : ~i), i >= 0);
+	}
+public:
+	#endif
 
 	const KeyTraits& traits() const { return *this; }
 };
@@ -0,0 +1,423 @@
+//
+// hash_map_snapshot.h
+//
+#ifndef _HASH_MAP_SNAPSHOT_H
+#define _HASH_MAP_SNAPSHOT_H
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "hash_map.h"
+#include "MappedFile.h"
+#ifdef MINI_VECTOR_HAS_MOVE
+#include <type_traits>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// hash_map_snapshot //////////////////////////////////////////////////////////
+//
+// A read-only dictionary stored in a file that is used in place: Save()
+// writes the contents of a hash_map to a file, and Open() maps the file into
+// memory (see MappedFile) and is ready for lookups right away. Nothing is
+// deserialized, so opening takes the same time for any size of table, and
+// the pages of the table are read in by the OS as lookups touch them. This
+// replaces rebuilding a large table at every start of a process, and
+// processes that open the same snapshot share one copy of it in memory.
+//
+// Values, and keys other than strings, are stored byte by byte, so they must
+// be trivially copyable and must not contain pointers. basic_string keys are
+// stored as (offset, length) references into a character arena at the end of
+// the file (see snapshot_key). The file is only readable on a machine with
+// the same byte order and type sizes as the one that saved it. Open() checks
+// this and the consistency of the header, and returns false rather than
+// misreading a foreign or truncated file. It does not scan the whole file, so
+// a file that was damaged or tampered with inside the buckets, slots or arena
+// can make lookups read outside the mapping. Call Verify() after Open() to
+// check every bucket and slot in one pass, unless the file is trusted (e.g.
+// written by the same program).
+//
+// The hash codes are saved with the table, so KeyTraits must compute the same
+// hash codes in every process. In particular seeded_string_hash_traits must
+// be given a fixed seed. Open() recomputes the hash code of one key to catch
+// a mismatch.
+//
+// File layout (offsets are from the start of the file):
+//
+//   hash_map_snapshot_header
+//   uint32 buckets[bucketCount + 1]  // bucket b holds slots buckets[b] to buckets[b+1]-1
+//   Slot slots[count]                // at a multiple of 64 bytes, sorted by bucket
+//   char arena[arenaSize]            // characters of string keys, if any
+//
+// Because the slots of a bucket are adjacent, a lookup reads one bucket
+// offset and then scans a short run of slots, without following links. The
+// BucketPolicy (see hash_set) chooses about as many buckets as slots, so the
+// runs are about one slot long. A snapshot must be opened with the same
+// BucketPolicy it was saved with; Open() checks that the bucket count is one
+// the policy could have chosen, and that one key is in the expected bucket.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct hash_map_snapshot_header
+{
+	char Magic[8];        // "HMSNAP\r\n"
+	uint32 Version;       // hash_map_snapshot_header::CurrentVersion
+	uint32 ByteOrder;     // 0x01020304, as written by the saving machine
+	uint32 KeySize;       // size of a stored key (an arena reference for strings)
+	uint32 ValueSize;
+	uint32 SlotSize;
+	uint32 CharSize;      // size of an arena character, or 0 if keys are inline
+	uint32 Count;         // number of slots
+	uint32 BucketCount;   // as chosen by the BucketPolicy
+	uint32 Reserved;      // zero
+	uint64 BucketsOffset;
+	uint64 SlotsOffset;
+	uint64 ArenaOffset;
+	uint64 ArenaSize;     // in bytes
+	uint64 FileSize;
+
+	enum { CurrentVersion = 1, ByteOrderMark = 0x01020304, SlotAlignment = 64 };
+	static const char* MagicBytes() { return "HMSNAP\r\n"; }
+};
+
+// snapshot_key<K> describes how a hash_map_snapshot stores a key of type K.
+// By default a key is stored as-is. Specialize it for key types that hold
+// pointers; the basic_string specialization below stores the characters in
+// the snapshot's arena.
+template<class K>
+struct snapshot_key
+{
+	typedef K stored_type;
+	enum { CharSize = 0 };
+
+	static stored_type Store(const K& key, std::vector<char>& /*arena*/)
+		{ return key; }
+	static K Load(const stored_type& stored, const char* /*arena*/)
+		{ return stored; }
+	static bool IsValid(const stored_type&, uint64 /*arenaSize*/)
+		{ return true; }
+	template<class Traits>
+	static bool Equals(const Traits& traits, const stored_type& stored, const char* /*arena*/, const K& key)
+		{ return traits.equals(stored, key); }
+};
+
+// Strings are compared character by character, so traits that consider
+// different strings equal (e.g. case-insensitive traits) are not supported.
+template<typename CHAR>
+struct snapshot_key< std::basic_string<CHAR> >
+{
+	typedef std::basic_string<CHAR> key_type;
+	struct stored_type
+	{
+		uint32 Offset; // in bytes from the start of the arena
+		uint32 Length; // in characters
+	};
+	enum { CharSize = sizeof(CHAR) };
+
+	static stored_type Store(const key_type& key, std::vector<char>& arena)
+	{
+		stored_type stored;
+		stored.Offset = (uint32)arena.size();
+		stored.Length = (uint32)key.size();
+		const char* chars = reinterpret_cast<const char*>(key.data());
+		arena.insert(arena.end(), chars, chars + key.size() * sizeof(CHAR));
+		return stored;
+	}
+	static key_type Load(const stored_type& stored, const char* arena)
+	{
+		return key_type(reinterpret_cast<const CHAR*>(arena + stored.Offset), stored.Length);
+	}
+	static bool IsValid(const stored_type& stored, uint64 arenaSize)
+	{
+		return stored.Offset % sizeof(CHAR) == 0 &&
+			(uint64)stored.Offset + (uint64)stored.Length * sizeof(CHAR) <= arenaSize;
+	}
+	template<class Traits>
+	static bool Equals(const Traits&, const stored_type& stored, const char* arena, const key_type& key)
+	{
+		return stored.Length == key.size() && std::char_traits<CHAR>::compare(
+			reinterpret_cast<const CHAR*>(arena + stored.Offset), key.data(), stored.Length) == 0;
+	}
+};
+
+template<class TKey, class TValue, class KeyTraits = hash_traits<TKey>, class BucketPolicy = prime_bucket_policy>
+class hash_map_snapshot : protected KeyTraits
+{
+public:
+	typedef hash_map_snapshot<TKey, TValue, KeyTraits, BucketPolicy> hash_map_snapshot_t;
+	typedef const TKey key_type;
+	typedef const TValue mapped_type;
+	typedef unsigned int hash_type;
+	typedef snapshot_key<TKey> key_policy;
+	typedef typename key_policy::stored_type stored_key;
+
+	struct Slot
+	{
+		hash_type Hash;
+		stored_key Key;
+		TValue Value;
+	};
+
+	#ifdef MINI_VECTOR_HAS_MOVE
+	static_assert(std::is_trivially_copyable<TValue>::value,
+		"hash_map_snapshot: TValue must be trivially copyable");
+	static_assert(std::is_trivially_copyable<stored_key>::value,
+		"hash_map_snapshot: TKey must be trivially copyable (or specialize snapshot_key)");
+	#endif
+
+	explicit hash_map_snapshot(const KeyTraits& traits = KeyTraits()) : KeyTraits(traits)
+		{ Reset(); }
+
+	// Writes the contents of map to a new snapshot file, replacing any file
+	// at that path. Returns false if the file could not be written.
+	template<class MapBucketPolicy>
+	static bool Save(const hash_map<TKey, TValue, KeyTraits, MapBucketPolicy>& map, const char* path)
+	{
+		const KeyTraits& traits = map.traits();
+		uint32 count = (uint32)map.Count();
+		BucketPolicy policy;
+		uint32 bucketCount = (uint32)policy.Resize(count > 3 ? (int)count : 3);
+
+		// Group the slots by bucket (a counting sort): first count the
+		// entries of each bucket, then turn the counts into offsets.
+		std::vector<uint32> buckets(bucketCount + 1, 0);
+		std::vector<hash_type> hashes;
+		hashes.reserve(count);
+		typename hash_map<TKey, TValue, KeyTraits, MapBucketPolicy>::const_iterator it;
+		for (it = map.begin(); it != map.end(); ++it) {
+			hash_type hash = traits.hash_value(it->first);
+			hashes.push_back(hash);
+			buckets[policy.Index(hash) + 1]++;
+		}
+		for (uint32 b = 0; b < bucketCount; b++)
+			buckets[b + 1] += buckets[b];
+
+		std::vector<uint32> next(buckets.begin(), buckets.end() - 1);
+		std::vector<char> slots((size_t)count * sizeof(Slot), 0);
+		std::vector<char> arena;
+		uint32 i = 0;
+		for (it = map.begin(); it != map.end(); ++it, i++) {
+			Slot slot;
+			memset(&slot, 0, sizeof(slot)); // so that padding bytes are saved as zeros
+			slot.Hash = hashes[i];
+			slot.Key = key_policy::Store(it->first, arena);
+			slot.Value = it->second;
+			memcpy(&slots[(size_t)next[policy.Index(slot.Hash)]++ * sizeof(Slot)], &slot, sizeof(slot));
+		}
+
+		hash_map_snapshot_header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.Magic, h.MagicBytes(), sizeof(h.Magic));
+		h.Version = h.CurrentVersion;
+		h.ByteOrder = h.ByteOrderMark;
+		h.KeySize = sizeof(stored_key);
+		h.ValueSize = sizeof(TValue);
+		h.SlotSize = sizeof(Slot);
+		h.CharSize = key_policy::CharSize;
+		h.Count = count;
+		h.BucketCount = bucketCount;
+		h.BucketsOffset = Align(sizeof(h), 8);
+		h.SlotsOffset = Align(h.BucketsOffset + buckets.size() * sizeof(uint32), h.SlotAlignment);
+		h.ArenaOffset = Align(h.SlotsOffset + slots.size(), 8);
+		h.ArenaSize = arena.size();
+		h.FileSize = h.ArenaOffset + h.ArenaSize;
+
+		FILE* fp = fopen(path, "wb");
+		if (fp == NULL)
+			return false;
+		uint64 pos = 0;
+		bool ok = Write(fp, pos, 0, &h, sizeof(h))
+			&& Write(fp, pos, h.BucketsOffset, &buckets[0], buckets.size() * sizeof(uint32))
+			&& Write(fp, pos, h.SlotsOffset, slots.empty() ? NULL : &slots[0], slots.size())
+			&& Write(fp, pos, h.ArenaOffset, arena.empty() ? NULL : &arena[0], arena.size());
+		ok = (fclose(fp) == 0) && ok;
+		if (!ok)
+			remove(path);
+		return ok;
+	}
+
+	// Maps the specified snapshot file, closing the current one first.
+	// Returns false if the file is missing, damaged, or was saved for other
+	// types, another byte order or another hash function.
+	bool Open(const char* path)
+	{
+		Close();
+		if (!_file.Open(path))
+			return false;
+		if (!Attach(_file.Data(), _file.Size())) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+	void Close()
+	{
+		_file.Close();
+		Reset();
+	}
+	bool IsOpen() const { return _buckets != NULL; }
+
+	// Checks the whole open snapshot, in time proportional to its size: that
+	// the bucket offsets are ascending, that every slot is in the bucket its
+	// saved hash code belongs to, and that every string key lies inside the
+	// arena. Returns false if not, or if no snapshot is open. Once it returns
+	// true, no lookup reads outside the file. It does not recompute hash
+	// codes, so a damaged hash code or value goes unnoticed.
+	bool Verify() const
+	{
+		if (_buckets == NULL)
+			return false;
+		for (uint32 b = 0; b < _bucketCount; b++) {
+			uint32 end = _buckets[b + 1];
+			if (end < _buckets[b] || end > _count)
+				return false;
+			for (uint32 i = _buckets[b]; i < end; i++)
+				if ((uint32)_bucketPolicy.Index(_slots[i].Hash) != b ||
+					!key_policy::IsValid(_slots[i].Key, _arenaSize))
+					return false;
+		}
+		return true;
+	}
+	// Size of the open snapshot file in bytes
+	size_t FileSize() const { return _file.Size(); }
+
+	int Count() const { return (int)_count; }
+	size_t size() const { return _count; }
+	bool empty() const { return _count == 0; }
+
+	// Returns a pointer to the value associated with key, or NULL if the key
+	// is not in the snapshot (or no snapshot is open). The pointer refers to
+	// the mapped file and is valid until Close().
+	const TValue* Find(const TKey& key) const
+	{
+		if (_buckets == NULL)
+			return NULL;
+		hash_type hash = traits().hash_value(key);
+		uint32 b = (uint32)_bucketPolicy.Index(hash);
+		const Slot* slot = _slots + _buckets[b];
+		const Slot* end = _slots + _buckets[b + 1];
+		for (; slot < end; slot++)
+			if (slot->Hash == hash && key_policy::Equals(traits(), slot->Key, _arena, key))
+				return &slot->Value;
+		return NULL;
+	}
+	bool Contains(const TKey& key) const
+	{
+		return Find(key) != NULL;
+	}
+	bool TryGet(const TKey& key, TValue& value) const
+	{
+		const TValue* found = Find(key);
+		if (found == NULL)
+			return false;
+		value = *found;
+		return true;
+	}
+
+	// Access to slot i (0 <= i < Count()), for enumerating the contents.
+	TKey KeyAt(int i) const
+	{
+		assert((uint32)i < _count);
+		return key_policy::Load(_slots[i].Key, _arena);
+	}
+	const TValue& ValueAt(int i) const
+	{
+		assert((uint32)i < _count);
+		return _slots[i].Value;
+	}
+
+	const KeyTraits& traits() const { return *this; }
+
+protected:
+	MappedFile _file;
+	const uint32* _buckets;
+	const Slot* _slots;
+	const char* _arena;
+	uint64 _arenaSize;
+	uint32 _count;
+	uint32 _bucketCount;
+	BucketPolicy _bucketPolicy;
+
+	void Reset()
+	{
+		_buckets = NULL;
+		_slots = NULL;
+		_arena = NULL;
+		_arenaSize = 0;
+		_count = _bucketCount = 0;
+	}
+
+	static uint64 Align(uint64 offset, uint64 alignment)
+		{ return (offset + alignment - 1) / alignment * alignment; }
+
+	// Writes size bytes at offset 'at', padding with zeros from pos.
+	static bool Write(FILE* fp, uint64& pos, uint64 at, const void* data, size_t size)
+	{
+		assert(at >= pos);
+		for (; pos < at; pos++)
+			if (fputc(0, fp) == EOF)
+				return false;
+		if (size != 0 && fwrite(data, 1, size, fp) != size)
+			return false;
+		pos += size;
+		return true;
+	}
+
+	// Checks the header of a mapped snapshot, in constant time, and sets up
+	// the pointers into it. Verify() checks the rest.
+	bool Attach(const char* data, size_t size)
+	{
+		if (size < sizeof(hash_map_snapshot_header))
+			return false;
+		const hash_map_snapshot_header& h = *reinterpret_cast<const hash_map_snapshot_header*>(data);
+		if (memcmp(h.Magic, h.MagicBytes(), sizeof(h.Magic)) != 0 ||
+			h.Version != h.CurrentVersion || h.ByteOrder != h.ByteOrderMark ||
+			h.KeySize != sizeof(stored_key) || h.ValueSize != sizeof(TValue) ||
+			h.SlotSize != sizeof(Slot) || h.CharSize != (uint32)key_policy::CharSize ||
+			h.BucketCount == 0 || h.BucketCount > 0x7FFFFFFF || h.FileSize != size)
+			return false;
+		uint64 bucketCount = h.BucketCount;
+		if (h.BucketsOffset % sizeof(uint32) != 0 || h.SlotsOffset % h.SlotAlignment != 0 ||
+			h.BucketsOffset < sizeof(h) ||
+			h.BucketsOffset + (bucketCount + 1) * sizeof(uint32) > h.SlotsOffset ||
+			h.SlotsOffset + (uint64)h.Count * sizeof(Slot) > h.ArenaOffset ||
+			h.ArenaOffset > h.FileSize || h.ArenaSize != h.FileSize - h.ArenaOffset)
+			return false;
+
+		const uint32* buckets = reinterpret_cast<const uint32*>(data + h.BucketsOffset);
+		const Slot* slots = reinterpret_cast<const Slot*>(data + h.SlotsOffset);
+		const char* arena = data + h.ArenaOffset;
+		if (buckets[0] != 0 || buckets[bucketCount] != h.Count)
+			return false;
+		BucketPolicy policy;
+		if ((uint32)policy.Resize((int)h.BucketCount) != h.BucketCount)
+			return false;
+		if (h.Count != 0) {
+			// Make sure that this process hashes keys the way the saving one
+			// did, and that the first slot is in the bucket the policy picks
+			// for it (the last bucket whose run starts at slot 0).
+			const Slot& first = slots[0];
+			uint32 b = (uint32)(std::upper_bound(buckets, buckets + bucketCount, 0u) - buckets) - 1;
+			if (!key_policy::IsValid(first.Key, h.ArenaSize) ||
+				traits().hash_value(key_policy::Load(first.Key, arena)) != first.Hash ||
+				(uint32)policy.Index(first.Hash) != b)
+				return false;
+		}
+		_buckets = buckets;
+		_slots = slots;
+		_arena = arena;
+		_arenaSize = h.ArenaSize;
+		_count = h.Count;
+		_bucketCount = h.BucketCount;
+		_bucketPolicy = policy;
+		return true;
+	}
+
+private: // not copyable, since it owns the mapping
+	hash_map_snapshot(const hash_map_snapshot_t&);
+	hash_map_snapshot_t& operator=(const hash_map_snapshot_t&);
+};
+
+#endif
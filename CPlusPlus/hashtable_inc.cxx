@@ -7,6 +7,7 @@
 #define PASSTHRU(_x_) _x_
 #define CONCAT(_x_, _y_) PASSTHRU(_x_) ## PASSTHRU(_y_)
 
+#ifndef HASHTABLE_STRING_ONLY
 namespace CONCAT(Int, HASHTABLE_NAMESPACE)
 {
 	HASHTABLE<int, int> _dict;
@@ -17,6 +18,7 @@ namespace CONCAT(Int, HASHTABLE_NAMESPACE)
 		for (int i = 0; i < Iterations; i++) {
 			if ((int)dict.size() >= MapSizeLimit)
 				dict.clear();
+			LatencySample sample(_b.Sampler);
 			dict[i ^ 314159] = i;
 		}
 		return string();
@@ -27,40 +29,299 @@ namespace CONCAT(Int, HASHTABLE_NAMESPACE)
 		int misses = 0;
 		for (int i = 0; i < Iterations; i++)
 		{
+			LatencySample sample(_b.Sampler);
 			HASHTABLE<int,int>::iterator it = dict.find(i ^ 314159);
 			if (it == dict.end())
 				misses++;
 		}
 		return printstring("%d%% misses", misses * 100 / Iterations);
 	}
+	#ifdef HASHTABLE_BATCH_LOOKUP
+	// The same keys as TestQueries in a scattered order, so that most lookups
+	// in a large table miss the cache: first with find, then with find_batch.
+	int ScatteredKey(int i)
+	{
+		return (int)((uint64)i * 2654435761u % (uint64)Iterations) ^ 314159;
+	}
+	string TestScatteredQueries()
+	{
+		HASHTABLE<int, int>& dict = _dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			HASHTABLE<int,int>::iterator it = dict.find(ScatteredKey(i));
+			if (it == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	string TestBatchQueries()
+	{
+		const int BatchSize = 64;
+		HASHTABLE<int, int>& dict = _dict;
+		int keys[BatchSize];
+		HASHTABLE<int,int>::iterator results[BatchSize];
+		int misses = 0;
+		for (int i = 0; i < Iterations; i += BatchSize)
+		{
+			int n = min(BatchSize, Iterations - i);
+			for (int k = 0; k < n; k++)
+				keys[k] = ScatteredKey(i + k);
+			dict.find_batch(keys, n, results);
+			for (int k = 0; k < n; k++)
+				if (results[k] == dict.end())
+					misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	#endif
+	#ifdef HASHTABLE_MISS_FILTER
+	// Runs Iterations queries of which MissPercent% miss. The table holds
+	// the keys of the last dict.size() values of i added by TestAdding; the
+	// missing keys are those of values of i that TestAdding never reached.
+	template<int MissPercent>
+	string TestQueriesMissing()
+	{
+		HASHTABLE<int, int>& dict = _dict;
+		int present = max((int)dict.size(), 1), misses = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			int k = i % 100 < MissPercent ? Iterations + i : Iterations - present + i % present;
+			if (dict.find(k ^ 314159) == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	// Builds the miss filter from the items in the table
+	string TestEnableMissFilter()
+	{
+		_dict.SetMissFilter(true);
+		return string();
+	}
+	#endif
+	#ifdef HASHTABLE_STATS
+	// Summarizes how the keys added by TestAdding are spread over the buckets
+	// (see hash_table_stats)
+	string TestStats()
+	{
+		return _dict.stats().ToString();
+	}
+	#endif
+	#ifdef HASHTABLE_INSERT_LATENCY
+	// Times every insert into an empty table of MapSizeLimit items. Most take
+	// well under a microsecond, but an insert that resizes the whole table at
+	// once takes milliseconds, which the total time hides.
+	string TestInsertLatency()
+	{
+		HASHTABLE<int, int> dict;
+		vector<float> ticks(MapSizeLimit);
+		for (int i = 0; i < MapSizeLimit; i++) {
+			LONGLONG start = PreciseTimer::Now();
+			dict[i ^ 314159] = i;
+			ticks[i] = (float)(PreciseTimer::Now() - start);
+		}
+		int p999 = MapSizeLimit - MapSizeLimit / 1000 - 1;
+		nth_element(ticks.begin(), ticks.begin() + p999, ticks.end());
+		float maxTicks = *max_element(ticks.begin() + p999, ticks.end());
+		double us = PreciseTimer::MicrosecPerTick();
+		return printstring("p99.9 %.2f us, max %.0f us", ticks[p999] * us, maxTicks * us);
+	}
+	#endif
 	string TestRemoval()
 	{
 		HASHTABLE<int, int>& dict = _dict;
 		int removed = 0;
-		for (int i = 0; i < Iterations; i++)
+		for (int i = 0; i < Iterations; i++) {
+			LatencySample sample(_b.Sampler);
 			if (dict.erase(i ^ 314159))
 				removed++;
+		}
 		return printstring("%d removed", removed);
 	}
+	#ifdef HASHTABLE_COMPACT
+	// Fills the table and removes three items out of four, which leaves most
+	// entry slots free. Iteration and lookups are measured in this sparse
+	// table, then again after Compact(true) packs the remaining entries and
+	// sorts them by bucket.
+	string TestSparseTable()
+	{
+		HASHTABLE<int, int>& dict = _dict;
+		dict.clear();
+		for (int i = 0; i < MapSizeLimit; i++)
+			dict[i ^ 314159] = i;
+		for (int i = 0; i < MapSizeLimit; i++)
+			if (i & 3)
+				dict.erase(i ^ 314159);
+		return printstring("%d items, capacity %d", (int)dict.size(), (int)dict.capacity());
+	}
+	string TestIteration()
+	{
+		HASHTABLE<int, int>& dict = _dict;
+		int sum = 0;
+		for (int pass = 0; pass < 10; pass++)
+			for (HASHTABLE<int,int>::iterator it = dict.begin(); it != dict.end(); ++it)
+				sum += it->second;
+		return printstring("10 passes (sum %d)", sum);
+	}
+	// Looks up the remaining keys in a scattered order (every lookup hits)
+	string TestSparseQueries()
+	{
+		HASHTABLE<int, int>& dict = _dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			int k = (int)((uint64)i * 2654435761u % (uint64)MapSizeLimit) & ~3;
+			if (dict.find(k ^ 314159) == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	string TestCompacting()
+	{
+		_dict.Compact(true);
+		return printstring("capacity %d", (int)_dict.capacity());
+	}
+	string TestShrinking()
+	{
+		_dict.shrink_to_fit();
+		return printstring("capacity %d", (int)_dict.capacity());
+	}
+	#endif
 	string Tests()
 	{
 		_dict.clear();
+		#ifdef HASHTABLE_MISS_FILTER
+		_dict.SetMissFilter(false);
+		#endif
 		_b.MeasureAndRecord("1 Adding items", TestAdding);
+		#ifdef HASHTABLE_STATS
+		_b.MeasureAndRecord("1 Table stats", TestStats);
+		#endif
+		#ifdef HASHTABLE_INSERT_LATENCY
+		_b.MeasureAndRecord("1 Adding items (latency)", TestInsertLatency);
+		#endif
 		_b.MeasureAndRecord("2 Running queries", TestQueries);
+		#ifdef HASHTABLE_BATCH_LOOKUP
+		_b.MeasureAndRecord("2 Running queries (scattered)", TestScatteredQueries);
+		_b.MeasureAndRecord("2 Running queries (scattered, batch)", TestBatchQueries);
+		#endif
+		#ifdef HASHTABLE_MISS_FILTER
+		_b.MeasureAndRecord("2 Queries, 10% misses", TestQueriesMissing<10>);
+		_b.MeasureAndRecord("2 Queries, 50% misses", TestQueriesMissing<50>);
+		_b.MeasureAndRecord("2 Queries, 90% misses", TestQueriesMissing<90>);
+		_b.MeasureAndRecord("2 Queries, 99% misses", TestQueriesMissing<99>);
+		_b.MeasureAndRecord("2 Enabling miss filter", TestEnableMissFilter);
+		_b.MeasureAndRecord("2 Queries, 10% misses (filtered)", TestQueriesMissing<10>);
+		_b.MeasureAndRecord("2 Queries, 50% misses (filtered)", TestQueriesMissing<50>);
+		_b.MeasureAndRecord("2 Queries, 90% misses (filtered)", TestQueriesMissing<90>);
+		_b.MeasureAndRecord("2 Queries, 99% misses (filtered)", TestQueriesMissing<99>);
+		// The later steps measure the table without the filter
+		_dict.SetMissFilter(false);
+		#endif
 		_b.MeasureAndRecord("3 Removing items", TestRemoval);
+		#ifdef HASHTABLE_COMPACT
+		_b.MeasureAndRecord("4 Sparse table", TestSparseTable);
+		_b.MeasureAndRecord("4 Iterating (sparse)", TestIteration);
+		_b.MeasureAndRecord("4 Running queries (sparse)", TestSparseQueries);
+		_b.MeasureAndRecord("5 Compacting by bucket", TestCompacting);
+		_b.MeasureAndRecord("5 Iterating (compacted)", TestIteration);
+		_b.MeasureAndRecord("5 Running queries (compacted)", TestSparseQueries);
+		_b.MeasureAndRecord("5 Shrinking to fit", TestShrinking);
+		#endif
+		return Benchmarker::DiscardResult;
+	}
+}
+#ifdef BENCHMARK_WORKLOADS
+// Replays the traces of Benchmarks.cpp's Workloads namespace. Each step loads
+// the workload's records into an empty table (untimed) and then times its
+// operations; the result is the percentage of reads that found their key.
+namespace CONCAT(IntWorkload, HASHTABLE_NAMESPACE)
+{
+	HASHTABLE<int, int> _dict;
+
+	template<int W>
+	string TestWorkload()
+	{
+		const WorkloadTrace& trace = Workloads::_traces[W];
+		const vector<WorkloadOp>& ops = trace.Ops();
+		HASHTABLE<int, int>& dict = _dict;
+		_b.PauseTiming();
+		dict.clear();
+		for (int i = 0; i < trace.Spec().RecordCount; i++)
+			dict[WorkloadTrace::IntKey(i)] = i;
+		int reads = max(trace.Count(OpRead) + trace.Count(OpReadModifyWrite), 1);
+		_b.ResumeTiming();
+
+		int found = 0;
+		for (int i = 0; i < (int)ops.size(); i++)
+		{
+			int key = WorkloadTrace::IntKey(ops[i].Key());
+			switch (ops[i].Type()) {
+			case OpRead:
+				if (dict.find(key) != dict.end())
+					found++;
+				break;
+			case OpUpdate:
+			case OpInsert:
+				dict[key] = i;
+				break;
+			case OpDelete:
+				dict.erase(key);
+				break;
+			case OpReadModifyWrite:
+				// The iterators of this repo's tables are read-only, so the
+				// value is modified through operator[], a second lookup.
+				if (dict.find(key) != dict.end()) {
+					dict[key] += i;
+					found++;
+				}
+				break;
+			}
+		}
+		return printstring("%d%% found", (int)((int64)found * 100 / reads));
+	}
+	string Tests()
+	{
+		_b.MeasureAndRecord("YCSB A", TestWorkload<Workloads::YcsbA>);
+		_b.MeasureAndRecord("YCSB B", TestWorkload<Workloads::YcsbB>);
+		_b.MeasureAndRecord("YCSB C", TestWorkload<Workloads::YcsbC>);
+		_b.MeasureAndRecord("YCSB D", TestWorkload<Workloads::YcsbD>);
+		_b.MeasureAndRecord("YCSB E", TestWorkload<Workloads::YcsbE>);
+		_b.MeasureAndRecord("YCSB F", TestWorkload<Workloads::YcsbF>);
+		_b.MeasureAndRecord("Hotspot", TestWorkload<Workloads::Hotspot>);
+		_b.MeasureAndRecord("Shifting hotspot", TestWorkload<Workloads::ShiftingHotspot>);
+		_b.MeasureAndRecord("Churn", TestWorkload<Workloads::Churn>);
+		_dict.clear();
 		return Benchmarker::DiscardResult;
 	}
 }
+#endif
+#endif
 
+#ifndef HASHTABLE_INT_ONLY
 namespace CONCAT(String, HASHTABLE_NAMESPACE)
 {
 	HASHTABLE<string, string> _dict;
+	vector<string> _keys; // _keys[i] == ToString(i ^ 314159)
 
 	char* ToString(int i)
 	{
 		static char temp[20];
 		return _itoa(i, temp, 10);
 	}
+	// Fixture: the keys are generated before the suite is timed, so the tests
+	// below measure only the hashtable. "0 Ints to strings" shows what the
+	// generation would have cost.
+	void GenerateKeys()
+	{
+		_keys.resize(Iterations);
+		for (int i = 0; i < Iterations; i++)
+			_keys[i] = ToString(i ^ 314159);
+	}
+	void FreeKeys()
+	{
+		vector<string>().swap(_keys);
+	}
 	string TestGenerateStrings()
 	{
 		// This just measures how long it takes to generate the strings used 
@@ -77,7 +338,8 @@ namespace CONCAT(String, HASHTABLE_NAMESPACE)
 		for (int i = 0; i < Iterations; i++) {
 			if ((int)dict.size() >= MapSizeLimit)
 				dict.clear();
-			string s = ToString(i ^ 314159);
+			const string& s = _keys[i];
+			LatencySample sample(_b.Sampler);
 			dict[s] = s;
 		}
 		return string();
@@ -88,33 +350,138 @@ namespace CONCAT(String, HASHTABLE_NAMESPACE)
 		int misses = 0;
 		for (int i = 0; i < Iterations; i++)
 		{
-			string s = ToString(i ^ 314159);
-			HASHTABLE<string,string>::iterator it = dict.find(s);
+			LatencySample sample(_b.Sampler);
+			HASHTABLE<string,string>::iterator it = dict.find(_keys[i]);
 			if (it == dict.end())
 				misses++;
 		}
 		return printstring("%d%% misses", misses * 100 / Iterations);
 	}
-	string TestRemoval()
+	#ifdef HASHTABLE_STATS
+	string TestStats()
+	{
+		return _dict.stats().ToString();
+	}
+	#endif
+	#ifdef HASHTABLE_LOOKUP_KEYS
+	// Like TestQueries, but the keys are not generated in advance: ToString's
+	// buffer is looked up directly, without building a temporary string (see
+	// hash_lookup_key in hash_map.h). Compare this with "0 Ints to strings"
+	// plus "2 Running queries".
+	string TestQueriesByCString()
 	{
 		HASHTABLE<string, string>& dict = _dict;
-		int removed = 0;
+		int misses = 0;
 		for (int i = 0; i < Iterations; i++)
 		{
-			string s = ToString(i ^ 314159);
-			if (dict.erase(s))
+			HASHTABLE<string,string>::iterator it = dict.find(ToString(i ^ 314159));
+			if (it == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	#endif
+	string TestRemoval()
+	{
+		HASHTABLE<string, string>& dict = _dict;
+		int removed = 0;
+		for (int i = 0; i < Iterations; i++) {
+			LatencySample sample(_b.Sampler);
+			if (dict.erase(_keys[i]))
 				removed++;
 		}
 		return printstring("%d removed", removed);
 	}
+	// Fills the table with MapSizeLimit items (untimed) and then clears it,
+	// which frees every key and value
+	string TestClearing()
+	{
+		_b.PauseTiming();
+		HASHTABLE<string, string>& dict = _dict;
+		for (int i = 0; i < MapSizeLimit; i++)
+			dict[_keys[i]] = _keys[i];
+		_b.ResumeTiming();
+		dict.clear();
+		return string();
+	}
 	string Tests()
 	{
 		_dict.clear();
 		_b.MeasureAndRecord("0 Ints to strings", TestGenerateStrings);
 		_b.MeasureAndRecord("1 Adding/setting", TestAddSet);
+		#ifdef HASHTABLE_STATS
+		_b.MeasureAndRecord("1 Table stats", TestStats);
+		#endif
 		_b.MeasureAndRecord("2 Running queries", TestQueries);
+		#ifdef HASHTABLE_LOOKUP_KEYS
+		_b.MeasureAndRecord("2 Running queries (char*)", TestQueriesByCString);
+		#endif
 		_b.MeasureAndRecord("3 Removing items", TestRemoval);
+		_b.MeasureAndRecord("4 Clearing", TestClearing);
 		return Benchmarker::DiscardResult;
 	}
 }
+#ifdef BENCHMARK_WORKLOADS
+// The workloads of the IntWorkload suite, with the string keys of
+// Workloads::_stringKeys. Values are copies of the keys.
+namespace CONCAT(StringWorkload, HASHTABLE_NAMESPACE)
+{
+	HASHTABLE<string, string> _dict;
 
+	template<int W>
+	string TestWorkload()
+	{
+		const WorkloadTrace& trace = Workloads::_traces[W];
+		const vector<WorkloadOp>& ops = trace.Ops();
+		const vector<string>& keys = Workloads::_stringKeys;
+		HASHTABLE<string, string>& dict = _dict;
+		_b.PauseTiming();
+		dict.clear();
+		for (int i = 0; i < trace.Spec().RecordCount; i++)
+			dict[keys[i]] = keys[i];
+		int reads = max(trace.Count(OpRead) + trace.Count(OpReadModifyWrite), 1);
+		_b.ResumeTiming();
+
+		int found = 0;
+		for (int i = 0; i < (int)ops.size(); i++)
+		{
+			const string& key = keys[ops[i].Key()];
+			switch (ops[i].Type()) {
+			case OpRead:
+				if (dict.find(key) != dict.end())
+					found++;
+				break;
+			case OpUpdate:
+			case OpInsert:
+				dict[key] = key;
+				break;
+			case OpDelete:
+				dict.erase(key);
+				break;
+			case OpReadModifyWrite:
+				if (dict.find(key) != dict.end()) {
+					dict[key][0] ^= 1;
+					found++;
+				}
+				break;
+			}
+		}
+		return printstring("%d%% found", (int)((int64)found * 100 / reads));
+	}
+	string Tests()
+	{
+		_b.MeasureAndRecord("YCSB A", TestWorkload<Workloads::YcsbA>);
+		_b.MeasureAndRecord("YCSB B", TestWorkload<Workloads::YcsbB>);
+		_b.MeasureAndRecord("YCSB C", TestWorkload<Workloads::YcsbC>);
+		_b.MeasureAndRecord("YCSB D", TestWorkload<Workloads::YcsbD>);
+		_b.MeasureAndRecord("YCSB E", TestWorkload<Workloads::YcsbE>);
+		_b.MeasureAndRecord("YCSB F", TestWorkload<Workloads::YcsbF>);
+		_b.MeasureAndRecord("Hotspot", TestWorkload<Workloads::Hotspot>);
+		_b.MeasureAndRecord("Shifting hotspot", TestWorkload<Workloads::ShiftingHotspot>);
+		_b.MeasureAndRecord("Churn", TestWorkload<Workloads::Churn>);
+		_dict.clear();
+		return Benchmarker::DiscardResult;
+	}
+}
+#endif
+#endif
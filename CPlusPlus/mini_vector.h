@@ -8,17 +8,53 @@
 #define MINI_VECTOR
 
 #include <assert.h>
+#include <string.h>
 #include <iterator>
+#include <memory>
 
 #ifndef NULL
 #define NULL 0
 #endif
 
+/// MINI_VECTOR_HAS_MOVE is defined if the compiler supports the C++11 features
+/// that mini_vector, hash_set and hash_map use for move-aware relocation and
+/// emplacement (rvalue references, variadic templates and noexcept).
+#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+#define MINI_VECTOR_HAS_MOVE
+#include <utility>
+#include <type_traits>
+#endif
+
 typedef int int32;
 typedef unsigned int uint32;
 typedef short int16;
 typedef unsigned short uint16;
 
+/// allocator_rebind<Alloc, U>::type is the allocator type that Alloc uses
+/// for objects of type U (e.g. hash_set allocates entries and buckets with
+/// the allocator given for its items).
+template<class Alloc, class U>
+struct allocator_rebind
+{
+	#ifdef MINI_VECTOR_HAS_MOVE
+	typedef typename std::allocator_traits<Alloc>::template rebind_alloc<U> type;
+	#else
+	typedef typename Alloc::template rebind<U>::other type;
+	#endif
+};
+
+/// Returns the allocator that a copy of a container that uses alloc should
+/// use (std::pmr allocators, for example, do not propagate to copies).
+template<class Alloc>
+inline Alloc allocator_for_copy(const Alloc& alloc)
+{
+	#ifdef MINI_VECTOR_HAS_MOVE
+	return std::allocator_traits<Alloc>::select_on_container_copy_construction(alloc);
+	#else
+	return alloc;
+	#endif
+}
+
 /// If COMPACT_MINI_VECTOR is defined, the mini_vector is 4 bytes smaller (in fact
 /// it is only 4 bytes plus the size of the inline elements!), but it aligns
 /// objects on a 4-byte boundary instead of an 8-byte boundary. Whether this is
@@ -103,10 +139,17 @@ typedef unsigned short uint16;
 ///	suppressed in order to maintain the validity of the mini_vector.
 ///	
 ///	The size of a mini_vector is limited to 2^31-1 elements.
-template<class T, int BaseSize = 2>
-class mini_vector {
+///	
+///	External arrays are obtained from Alloc, a standard allocator of T (which
+///	may be stateful, e.g. a std::pmr::polymorphic_allocator). A copy uses the
+///	allocator that allocator_for_copy() returns, assignment keeps the target's
+///	allocator, and swap() requires both allocators to be equal, as for
+///	std::vector.
+template<class T, int BaseSize = 2, class Alloc = std::allocator<T> >
+class mini_vector : protected Alloc {
 public:
 	typedef size_t size_type;
+	typedef Alloc allocator_type;
 protected:
 	//BOOST_STATIC_ASSERT(BaseSize >= 1);
 	///////////////////////////////////////////////////////////////////////////////
@@ -172,7 +215,9 @@ protected:
 
 	#endif
 	
-	char* go_inline_again()
+	// Moves the items back into the object. Returns the external array, which
+	// the caller must free or reuse, or NULL if the items were already inline.
+	T* go_inline_again()
 	{
 		assert(size() <= BaseSize);
 		if (!is_inline()) {
@@ -182,16 +227,18 @@ protected:
 			#else
 				_size &= ~0x80000000;
 			#endif
-			for (int i = 0; i < (int)size(); i++) {
-				construct(&begin()[i], oldArray[i]);
-				destruct(&oldArray[i]);
-			}
-			return reinterpret_cast<char*>(oldArray);
+			relocate(begin(), oldArray, (int)size());
+			return oldArray;
 		}
 		return NULL;
 	}
+	void free_array(T* array, size_type capacity)
+	{
+		if (array != NULL)
+			Alloc::deallocate(array, capacity);
+	}
 
-	typedef mini_vector<T, BaseSize> mini_vector_t;
+	typedef mini_vector<T, BaseSize, Alloc> mini_vector_t;
 public:
 	typedef T value_type;
 	typedef T* pointer;
@@ -359,16 +406,19 @@ public:
 	safe_iterator iterator_at(int n) { return safe_iterator(this, n); }
 	
 	mini_vector() { init(); }
-	mini_vector(size_type n) { init(); resize(n); }
-	mini_vector(size_type n, const T& t) { init(); resize(n, t); }
-	mini_vector(const mini_vector_t& copy) {
+	explicit mini_vector(const Alloc& alloc) : Alloc(alloc) { init(); }
+	mini_vector(size_type n, const Alloc& alloc = Alloc()) : Alloc(alloc) { init(); resize(n); }
+	mini_vector(size_type n, const T& t, const Alloc& alloc = Alloc()) : Alloc(alloc) { init(); resize(n, t); }
+	mini_vector(const mini_vector_t& copy) : Alloc(allocator_for_copy(copy.get_allocator())) {
 		init();
 		reserve(copy.size()); 
 		add_range(copy.begin(), copy.end());
 	}
 	template <class InputIterator>
-	mini_vector(InputIterator from, InputIterator to) { init(); add_range(from, to); }
+	mini_vector(InputIterator from, InputIterator to, const Alloc& alloc = Alloc()) : Alloc(alloc) { init(); add_range(from, to); }
 	~mini_vector() { clear_nothrow(); }
+
+	allocator_type get_allocator() const { return *this; }
 	
 	mini_vector_t& operator=(const mini_vector_t& copy) 
 	{
@@ -445,7 +495,7 @@ public:
 		if (pos == end())
 			add_range(f, l);
 		else {
-			mini_vector_t temp;
+			mini_vector_t temp(get_allocator());
 			temp.add_range(f, l);
 			prepare_to_insert(pos, temp.size());
 			for (iterator it = temp.begin(); it != temp.end(); ++it, ++pos) {
@@ -540,6 +590,7 @@ public:
 	}
 	void swap(mini_vector_t& other)
 	{
+		assert(get_allocator() == other.get_allocator());
 		if (!is_inline() && !other.is_inline())
 		{
 			T* tempArray = other.begin();
@@ -614,17 +665,15 @@ protected:
 	void reallocate(size_type capacity)
 	{
 		assert(size() <= capacity);
+		size_type oldCapacity = mini_vector_t::capacity();
 		if (capacity <= BaseSize)
-			delete[] go_inline_again();
+			free_array(go_inline_again(), oldCapacity);
 		else {
-			T* newArray = reinterpret_cast<T*>(new char[capacity * sizeof(T)]); // may throw
+			T* newArray = Alloc::allocate(capacity); // may throw
 			T* oldArray = begin();
-			for (int i = 0; i < (int)size(); i++) {
-				construct(&newArray[i], oldArray[i]);
-				destruct(&oldArray[i]);
-			}
+			relocate(newArray, oldArray, (int)size());
 			if (!is_inline())
-				delete[] reinterpret_cast<char*>(oldArray);
+				free_array(oldArray, oldCapacity);
 			set_array(newArray, capacity);
 		}
 	}
@@ -644,6 +693,27 @@ protected:
 			new(it) T();
 		} catch(...) { }
 	}
+	// Moves count items to uninitialized memory and destructs the originals.
+	// Trivially copyable items are copied with memcpy. Other items are moved
+	// if their move constructor cannot throw; otherwise they are copied, as
+	// they always are in C++03.
+	static void relocate(T* dest, T* src, int count)
+	{
+		#ifdef MINI_VECTOR_HAS_MOVE
+		if (std::is_trivially_copyable<T>::value) {
+			memcpy((void*)dest, (const void*)src, count * sizeof(T));
+			return;
+		}
+		#endif
+		for (int i = 0; i < count; i++) {
+			#ifdef MINI_VECTOR_HAS_MOVE
+			new(&dest[i]) T(std::move_if_noexcept(src[i]));
+			#else
+			construct(&dest[i], src[i]);
+			#endif
+			destruct(&src[i]);
+		}
+	}
 	#pragma pop_macro("new")
 
 	static void destruct(T* it)
@@ -661,8 +731,9 @@ protected:
 		for (iterator it = begin(); it != end(); ++it)
 			destruct_nothrow(it);
 
+		size_type oldCapacity = capacity();
 		set_size(0);
-		delete[] go_inline_again();
+		free_array(go_inline_again(), oldCapacity);
 	}
 	
 	// Prepares to insert elements (amt is the # of new elements).
@@ -706,35 +777,35 @@ protected:
 	}
 };
 
-template<class T, int s>
-bool operator==(const mini_vector<T,s>& a, const mini_vector<T,s>& b)
+template<class T, int s, class A>
+bool operator==(const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b)
 {
 	if (a.size() != b.size())
 		return false;
-	mini_vector<T,s>::const_iterator ai = a.begin(), bi = b.begin();
+	typename mini_vector<T,s,A>::const_iterator ai = a.begin(), bi = b.begin();
 	for (; ai != a.end(); ++ai, ++bi)
 		if (*ai != *bi)
 			return false;
 	return true;
 }
-template<class T, int s>
-bool operator<(const mini_vector<T,s>& a, const mini_vector<T,s>& b)
+template<class T, int s, class A>
+bool operator<(const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b)
 {
 	if (a.size() != b.size())
 		return a.size() < b.size();
-	mini_vector<T,s>::const_iterator ai = a.begin(), bi = b.begin();
+	typename mini_vector<T,s,A>::const_iterator ai = a.begin(), bi = b.begin();
 	for (; ai != a.end(); ++ai, ++bi)
 		if (*ai != *bi)
 			return *ai < *bi;
 	return false;
 }
-template<class T, int s>
-bool operator!=(const mini_vector<T,s>& a, const mini_vector<T,s>& b) { return !(a == b); }
-template<class T, int s>
-bool operator>=(const mini_vector<T,s>& a, const mini_vector<T,s>& b) { return !(a < b); }
-template<class T, int s>
-bool operator> (const mini_vector<T,s>& a, const mini_vector<T,s>& b) { return b < a; }
-template<class T, int s>
-bool operator<=(const mini_vector<T,s>& a, const mini_vector<T,s>& b) { return !(b < a); }
+template<class T, int s, class A>
+bool operator!=(const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b) { return !(a == b); }
+template<class T, int s, class A>
+bool operator>=(const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b) { return !(a < b); }
+template<class T, int s, class A>
+bool operator> (const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b) { return b < a; }
+template<class T, int s, class A>
+bool operator<=(const mini_vector<T,s,A>& a, const mini_vector<T,s,A>& b) { return !(b < a); }
 
 #endif
@@ -0,0 +1,107 @@
+//
+// DO NOT COMPILE ALONE.
+//
+// This is included from Benchmarks.cpp. Like hashtable_inc.cxx, but for
+// ordered maps with int keys: SORTEDMAP_NAMESPACE names the test and
+// SORTEDMAP is the map template. Define SORTEDMAP_BULK_LOAD if the map can
+// be built from sorted data with bulk_load().
+//
+
+namespace SORTEDMAP_NAMESPACE
+{
+	SORTEDMAP<int, int> _dict;
+	vector< pair<int, int> > _sorted; // MapSizeLimit pairs in key order
+
+	string TestAdding()
+	{
+		SORTEDMAP<int, int>& dict = _dict;
+		for (int i = 0; i < Iterations; i++) {
+			if ((int)dict.size() >= MapSizeLimit)
+				dict.clear();
+			LatencySample sample(_b.Sampler);
+			dict[i ^ 314159] = i;
+		}
+		return string();
+	}
+	string TestQueries()
+	{
+		SORTEDMAP<int, int>& dict = _dict;
+		int misses = 0;
+		for (int i = 0; i < Iterations; i++)
+		{
+			LatencySample sample(_b.Sampler);
+			SORTEDMAP<int,int>::iterator it = dict.find(i ^ 314159);
+			if (it == dict.end())
+				misses++;
+		}
+		return printstring("%d%% misses", misses * 100 / Iterations);
+	}
+	// Visits the 100 pairs that follow each of Iterations / 100 scattered keys
+	string TestRangeScans()
+	{
+		const int ScanLength = 100;
+		SORTEDMAP<int, int>& dict = _dict;
+		int visited = 0, sum = 0;
+		for (int i = 0; i < Iterations / ScanLength; i++)
+		{
+			int key = (int)((uint64)i * 2654435761u % (uint64)Iterations) ^ 314159;
+			SORTEDMAP<int,int>::iterator it = dict.lower_bound(key);
+			for (int n = 0; n < ScanLength && it != dict.end(); n++, ++it) {
+				sum += it->second;
+				visited++;
+			}
+		}
+		return printstring("%d visited (sum %d)", visited, sum);
+	}
+	string TestIteration()
+	{
+		SORTEDMAP<int, int>& dict = _dict;
+		int sum = 0;
+		for (int pass = 0; pass < 10; pass++)
+			for (SORTEDMAP<int,int>::iterator it = dict.begin(); it != dict.end(); ++it)
+				sum += it->second;
+		return printstring("10 passes (sum %d)", sum);
+	}
+	string TestRemoval()
+	{
+		SORTEDMAP<int, int>& dict = _dict;
+		int removed = 0;
+		for (int i = 0; i < Iterations; i++) {
+			LatencySample sample(_b.Sampler);
+			if (dict.erase(i ^ 314159))
+				removed++;
+		}
+		return printstring("%d removed", removed);
+	}
+	// Builds a map of MapSizeLimit pairs from sorted data
+	string TestBuildingFromSorted()
+	{
+		SORTEDMAP<int, int>& dict = _dict;
+		dict.clear();
+		#ifdef SORTEDMAP_BULK_LOAD
+		dict.bulk_load(_sorted.begin(), _sorted.end());
+		#else
+		dict.insert(_sorted.begin(), _sorted.end());
+		#endif
+		return printstring("%d items", (int)dict.size());
+	}
+	string Tests()
+	{
+		_dict.clear();
+		_sorted.resize(MapSizeLimit);
+		for (int i = 0; i < MapSizeLimit; i++)
+			_sorted[i] = pair<int, int>(i * 2, i);
+
+		_b.MeasureAndRecord("1 Adding items", TestAdding);
+		_b.MeasureAndRecord("2 Running queries", TestQueries);
+		_b.MeasureAndRecord("2 Range scans", TestRangeScans);
+		_b.MeasureAndRecord("2 Iterating", TestIteration);
+		_b.MeasureAndRecord("3 Removing items", TestRemoval);
+		_b.MeasureAndRecord("4 Building from sorted data", TestBuildingFromSorted);
+		_b.MeasureAndRecord("4 Running queries (sorted build)", TestQueries);
+		_b.MeasureAndRecord("4 Range scans (sorted build)", TestRangeScans);
+		_dict.clear();
+		vector< pair<int, int> >().swap(_sorted);
+		return Benchmarker::DiscardResult;
+	}
+}
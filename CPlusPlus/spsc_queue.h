@@ -0,0 +1,81 @@
+//
+// spsc_queue.h
+//
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+// A full memory fence. Windows CE does not have MemoryBarrier(), but its
+// Interlocked functions imply a fence.
+#ifdef UNDER_CE
+	inline void spsc_fence() { LONG dummy = 0; InterlockedExchange(&dummy, 1); }
+	#define SPSC_FENCE() spsc_fence()
+#else
+	#define SPSC_FENCE() MemoryBarrier()
+#endif
+
+// A bounded single-producer, single-consumer queue (ring buffer) that
+// requires no locks. Exactly one thread may call TryPush and exactly one
+// (other) thread may call TryPop; both operations are wait-free, i.e. they
+// finish in a bounded number of steps no matter what the other thread is
+// doing. If the queue is full, TryPush returns false instead of waiting.
+//
+// Capacity must be a power of two. The head and tail indexes are kept on
+// separate cache lines so that the two threads do not fight over the line
+// that holds them. The indexes increase without bound (wrapping at 2^32 is
+// harmless because only their difference and their low bits are used).
+//
+// Popped slots are overwritten with T() so that a T holding heap memory
+// (e.g. std::string) releases it on the consumer's thread rather than when the
+// producer reuses the slot.
+template<class T, int Capacity>
+class spsc_queue
+{
+	enum { Mask = Capacity - 1, CacheLine = 64 };
+	// Fails to compile (negative array size) unless Capacity is a power of two
+	typedef char CapacityMustBeAPowerOfTwo[Capacity > 0 && (Capacity & (Capacity - 1)) == 0 ? 1 : -1];
+
+	volatile unsigned _head; // next slot to pop; written only by the consumer
+	char _pad1[CacheLine - sizeof(unsigned)];
+	volatile unsigned _tail; // next slot to push; written only by the producer
+	char _pad2[CacheLine - sizeof(unsigned)];
+	T _items[Capacity];
+
+	spsc_queue(const spsc_queue&);            // not copyable
+	spsc_queue& operator=(const spsc_queue&);
+public:
+	spsc_queue() : _head(0), _tail(0) { }
+
+	// Called by the producer. Returns false if the queue is full.
+	bool TryPush(const T& item)
+	{
+		unsigned tail = _tail;
+		if (tail - _head == (unsigned)Capacity)
+			return false;
+		_items[tail & Mask] = item;
+		SPSC_FENCE(); // publish the item before the new tail
+		_tail = tail + 1;
+		return true;
+	}
+
+	// Called by the consumer. Returns false if the queue is empty.
+	bool TryPop(T& item)
+	{
+		unsigned head = _head;
+		if (head == _tail)
+			return false;
+		SPSC_FENCE(); // read the tail before the item it guards
+		T& slot = _items[head & Mask];
+		item = slot;
+		slot = T();
+		SPSC_FENCE(); // finish with the slot before handing it back
+		_head = head + 1;
+		return true;
+	}
+
+	// Approximate number of queued items (exact if called by either thread
+	// while the other is idle).
+	int Count() const { return (int)(_tail - _head); }
+	bool IsEmpty() const { return _tail == _head; }
+};
+
+#endif
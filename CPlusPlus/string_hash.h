@@ -0,0 +1,307 @@
+//
+// string_hash.h
+//
+#ifndef _STRING_HASH_H
+#define _STRING_HASH_H
+
+#include <string.h>
+#include <time.h>
+#include <string>
+#include "hash_map.h"
+
+// AES-NI is available as intrinsics in Visual C++ on x86 and x64. GCC and
+// Clang compile the AES functions for the AES instruction set individually
+// (target attribute), so the rest of the program need not be built with -maes;
+// aes_hasher checks at run time that the processor actually supports AES.
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64)) && !defined(UNDER_CE)
+	#include <intrin.h>
+	#include <wmmintrin.h>
+	#define STRING_HASH_HAS_AES
+	#define STRING_HASH_AES_TARGET
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__i386__) || defined(__x86_64__))
+	#include <cpuid.h>
+	#include <wmmintrin.h>
+	#define STRING_HASH_HAS_AES
+	#define STRING_HASH_AES_TARGET __attribute__((target("aes,sse2")))
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// String hash functions ///////////////////////////////////////////////////////
+//
+// hash_traits<basic_string<CHAR>> uses a simple multiplicative hash that
+// processes one character per step and has no seed. That is fine for short
+// keys that the program chooses itself, but it is slow for long keys, and an
+// attacker who controls the keys can easily craft thousands of keys with the
+// same hash code, turning every lookup into a linear search.
+//
+// This file offers seeded 64-bit hash functions that read 8 or 16 bytes per
+// step. Each is a "hasher" class with a static function
+//
+//     uint64 hash(const void* data, size_t length, uint64 seed);
+//
+// and seeded_string_hash_traits<CHAR, Hasher> plugs one into hash_set,
+// hash_map and the other hashtables. By default each traits object (and
+// therefore each table) gets its own random seed, so that hash codes and
+// collisions differ from one table, and one run, to the next.
+//
+// - wy_hasher: based on wyhash by Wang Yi (public domain). Mixes with a 64x64
+//   -> 128-bit multiply; very fast for keys of every length.
+// - aes_hasher: mixes 16 bytes per step with AES encryption rounds, two
+//   streams in parallel. Faster than wy_hasher on long keys. Falls back to
+//   wy_hasher (giving different hash codes) on processors without AES-NI.
+//
+// Both are designed for hashtables, not cryptography: the seed makes
+// collisions hard to predict, but a determined attacker who can observe
+// timing may still learn something about it.
+
+namespace string_hash
+{
+	// Reads a little-endian value of 8 or 4 bytes, or 1-3 bytes spread out.
+	inline uint64 Read8(const uint8* p) { uint64 v; memcpy(&v, p, 8); return v; }
+	inline uint64 Read4(const uint8* p) { uint32 v; memcpy(&v, p, 4); return v; }
+	inline uint64 Read3(const uint8* p, size_t k)
+		{ return ((uint64)p[0] << 16) | ((uint64)p[k >> 1] << 8) | p[k - 1]; }
+
+	// Multiplies a by b, giving the low 64 bits of the product in a and the
+	// high 64 bits in b.
+	inline void Multiply128(uint64& a, uint64& b)
+	{
+		#if defined(_MSC_VER) && defined(_M_X64)
+			a = _umul128(a, b, &b);
+		#elif defined(__SIZEOF_INT128__)
+			unsigned __int128 r = (unsigned __int128)a * b;
+			a = (uint64)r;
+			b = (uint64)(r >> 64);
+		#else
+			uint64 ha = a >> 32, hb = b >> 32, la = (uint32)a, lb = (uint32)b;
+			uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+			uint64 t = rl + (rm0 << 32), carry = t < rl;
+			uint64 lo = t + (rm1 << 32);
+			carry += lo < t;
+			a = lo;
+			b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+		#endif
+	}
+	inline uint64 Mix(uint64 a, uint64 b) { Multiply128(a, b); return a ^ b; }
+
+	// Returns a seed that is different for each call and each run of the
+	// program. The counter is not updated atomically; if two threads race,
+	// the worst outcome is that two tables share a seed.
+	inline uint64 RandomSeed()
+	{
+		static uint64 counter = 0;
+		uint64 entropy = (uint64)time(NULL) ^ ((uint64)clock() << 32);
+		entropy ^= (uint64)(size_t)&counter ^ ((uint64)(size_t)&entropy << 24);
+		return Mix(entropy ^ 0x2d358dccaa6c78a5ull, ++counter ^ 0x8bb84b93962eacc9ull);
+	}
+}
+
+struct wy_hasher
+{
+	static uint64 hash(const void* data, size_t length, uint64 seed)
+	{
+		using namespace string_hash;
+		static const uint64 s0 = 0x2d358dccaa6c78a5ull, s1 = 0x8bb84b93962eacc9ull;
+		static const uint64 s2 = 0x4b33a62ed433d4a3ull, s3 = 0x4d5a2da51de1aa47ull;
+		const uint8* p = (const uint8*)data;
+		uint64 a, b;
+		seed ^= Mix(seed ^ s0, s1);
+		if (length <= 16) {
+			if (length >= 4) {
+				size_t mid = (length >> 3) << 2;
+				a = (Read4(p) << 32) | Read4(p + mid);
+				b = (Read4(p + length - 4) << 32) | Read4(p + length - 4 - mid);
+			} else if (length > 0) {
+				a = Read3(p, length);
+				b = 0;
+			} else
+				a = b = 0;
+		} else {
+			size_t i = length;
+			if (i > 48) {
+				// Three independent streams keep the multiplier busy
+				uint64 see1 = seed, see2 = seed;
+				do {
+					seed = Mix(Read8(p) ^ s1, Read8(p + 8) ^ seed);
+					see1 = Mix(Read8(p + 16) ^ s2, Read8(p + 24) ^ see1);
+					see2 = Mix(Read8(p + 32) ^ s3, Read8(p + 40) ^ see2);
+					p += 48;
+					i -= 48;
+				} while (i > 48);
+				seed ^= see1 ^ see2;
+			}
+			while (i > 16) {
+				seed = Mix(Read8(p) ^ s1, Read8(p + 8) ^ seed);
+				p += 16;
+				i -= 16;
+			}
+			a = Read8(p + i - 16);
+			b = Read8(p + i - 8);
+		}
+		a ^= s1;
+		b ^= seed;
+		Multiply128(a, b);
+		return Mix(a ^ s0 ^ length, b ^ s1);
+	}
+};
+
+struct aes_hasher
+{
+	// Returns true if the processor has AES-NI, so that hash() uses AES.
+	static bool is_supported()
+	{
+		// 0 until the first call, then 1 (no AES) or 2 (AES). A local static
+		// with an initializer would not be thread-safe before VC++ 2015, but
+		// this one is zeroed before the program starts. Threads that race on
+		// the first call each run DetectAes(), which gives them all the same
+		// answer.
+		static volatile LONG state;
+		LONG s = state;
+		if (s == 0) {
+			s = DetectAes() ? 2 : 1;
+			InterlockedCompareExchange(&state, s, 0);
+		}
+		return s == 2;
+	}
+
+	static uint64 hash(const void* data, size_t length, uint64 seed)
+	{
+		#ifdef STRING_HASH_HAS_AES
+		if (is_supported())
+			return AesHash((const uint8*)data, length, seed);
+		#endif
+		return wy_hasher::hash(data, length, seed);
+	}
+
+protected:
+	static bool DetectAes()
+	{
+		#if defined(STRING_HASH_HAS_AES) && defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 1);
+			return (info[2] & (1 << 25)) != 0;
+		#elif defined(STRING_HASH_HAS_AES)
+			unsigned eax, ebx, ecx, edx;
+			return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1 << 25)) != 0;
+		#else
+			return false;
+		#endif
+	}
+
+	#ifdef STRING_HASH_HAS_AES
+	// Each 16-byte block is used as the round key of one AES round of one of
+	// two states; the final rounds mix the states and spread every input bit
+	// over all 128 bits. A key of 16 bytes or less is read with two
+	// overlapping loads, as in wy_hasher, which is unambiguous because the
+	// length is part of the initial state. (Copying it to a zeroed buffer
+	// instead makes short keys twice as slow, as the 16-byte load cannot be
+	// forwarded from the smaller stores.)
+	STRING_HASH_AES_TARGET
+	static uint64 AesHash(const uint8* p, size_t length, uint64 seed)
+	{
+		const __m128i k0 = _mm_set_epi32(0x243f6a88, (int)0x85a308d3, 0x13198a2e, 0x03707344);
+		const __m128i k1 = _mm_set_epi32((int)0xa4093822, 0x299f31d0, 0x082efa98, (int)0xec4e6c89);
+		uint64 lenSeed = seed ^ (length * 0x9e3779b97f4a7c15ull);
+		__m128i a = _mm_xor_si128(k0, _mm_set_epi32((int)(seed >> 32), (int)seed,
+			(int)(lenSeed >> 32), (int)lenSeed));
+		__m128i b = _mm_aesenc_si128(_mm_xor_si128(a, k1), k0);
+
+		if (length > 16) {
+			const uint8* end = p + length;
+			for (; end - p > 32; p += 32) {
+				a = _mm_aesenc_si128(a, _mm_loadu_si128((const __m128i*)p));
+				b = _mm_aesenc_si128(b, _mm_loadu_si128((const __m128i*)(p + 16)));
+			}
+			// 1 to 32 bytes remain. Load the last 32 bytes of the key (or all
+			// of it, if it has 17 to 32), overlapping the previous block
+			// and/or each other, so that no byte past the end is read.
+			const uint8* tail = length > 32 ? end - 32 : p;
+			a = _mm_aesenc_si128(a, _mm_loadu_si128((const __m128i*)tail));
+			b = _mm_aesenc_si128(b, _mm_loadu_si128((const __m128i*)(end - 16)));
+		} else if (length > 0) {
+			using namespace string_hash;
+			uint64 lo, hi;
+			if (length >= 8)
+				lo = Read8(p), hi = Read8(p + length - 8);
+			else if (length >= 4)
+				lo = Read4(p), hi = Read4(p + length - 4);
+			else
+				lo = Read3(p, length), hi = 0;
+			b = _mm_aesenc_si128(b, _mm_set_epi32((int)(hi >> 32), (int)hi, (int)(lo >> 32), (int)lo));
+		}
+
+		a = _mm_aesenc_si128(a, b);
+		a = _mm_aesenc_si128(a, k1);
+		a = _mm_aesenc_si128(a, k0);
+		a = _mm_aesenc_si128(a, k1);
+		uint64 halves[2];
+		_mm_storeu_si128((__m128i*)halves, a);
+		return halves[0] ^ halves[1];
+	}
+	#endif
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// seeded_string_hash_traits ///////////////////////////////////////////////////
+//
+// A hash_traits class for basic_string<CHAR> that hashes with Hasher and a
+// seed. The default constructor picks a random seed; pass a seed explicitly
+// to get the same hash codes on every run. Copies of a table share its seed
+// (they must, since hash codes are stored in the table).
+//
+// Like hash_traits<basic_string<CHAR>>, it supports heterogeneous lookup by
+// C string, by (pointer, length) pair and by basic_string_view.
+//
+//     hash_map<string, int, seeded_string_hash_traits<char> > map;
+//     hash_map<string, int, seeded_string_hash_traits<char, aes_hasher> > map2;
+template<typename CHAR, class Hasher = wy_hasher>
+struct seeded_string_hash_traits
+{
+	typedef std::basic_string<CHAR> value_type;
+
+	seeded_string_hash_traits() : _seed(string_hash::RandomSeed()) {}
+	explicit seeded_string_hash_traits(uint64 seed) : _seed(seed) {}
+
+	bool equals(const value_type& a, const value_type& b) const { return a == b; }
+	unsigned hash_value(const value_type& k) const
+		{ return hash_chars(k.data(), k.size()); }
+
+	unsigned hash_value(const CHAR* s) const
+		{ return hash_chars(s, std::char_traits<CHAR>::length(s)); }
+	unsigned hash_value(const std::pair<const CHAR*, size_t>& s) const
+		{ return hash_chars(s.first, s.second); }
+	bool equals(const value_type& a, const CHAR* b) const
+		{ return a.compare(b) == 0; }
+	bool equals(const value_type& a, const std::pair<const CHAR*, size_t>& b) const
+		{ return a.size() == b.second && a.compare(0, a.size(), b.first, b.second) == 0; }
+	#ifdef HASH_MAP_HAS_STRING_VIEW
+	unsigned hash_value(std::basic_string_view<CHAR> s) const
+		{ return hash_chars(s.data(), s.size()); }
+	bool equals(const value_type& a, std::basic_string_view<CHAR> b) const
+		{ return a == b; }
+	#endif
+
+	unsigned hash_chars(const CHAR* s, size_t length) const
+	{
+		uint64 h = Hasher::hash(s, length * sizeof(CHAR), _seed);
+		return (unsigned)(h ^ (h >> 32));
+	}
+	uint64 seed() const { return _seed; }
+
+protected:
+	uint64 _seed;
+};
+template<typename CHAR, class Hasher>
+struct hash_lookup_key< seeded_string_hash_traits<CHAR, Hasher>, const CHAR* > { typedef void type; };
+template<typename CHAR, class Hasher>
+struct hash_lookup_key< seeded_string_hash_traits<CHAR, Hasher>, CHAR* > { typedef void type; };
+template<typename CHAR, class Hasher, size_t N>
+struct hash_lookup_key< seeded_string_hash_traits<CHAR, Hasher>, CHAR[N] > { typedef void type; };
+template<typename CHAR, class Hasher>
+struct hash_lookup_key< seeded_string_hash_traits<CHAR, Hasher>, std::pair<const CHAR*, size_t> > { typedef void type; };
+#ifdef HASH_MAP_HAS_STRING_VIEW
+template<typename CHAR, class Hasher>
+struct hash_lookup_key< seeded_string_hash_traits<CHAR, Hasher>, std::basic_string_view<CHAR> > { typedef void type; };
+#endif
+
+#endif
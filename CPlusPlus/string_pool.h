@@ -0,0 +1,261 @@
+//
+// string_pool.h
+//
+#ifndef _STRING_POOL_H
+#define _STRING_POOL_H
+
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "hash_map.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// pooled_string //////////////////////////////////////////////////////////////
+//
+// A handle to an immutable string stored in a string_pool: a single pointer
+// to the string's hash code, length and characters, which lie together in the
+// pool's arena. Copying a handle copies only the pointer, and the string's
+// hash code is computed once, when the string enters the pool.
+//
+// Because string_pool::Intern stores each distinct string once, two handles
+// from the same pool are equal exactly when they point to the same place, so
+// operator== and hash_traits<pooled_string> compare pointers, not characters.
+// Do not compare handles from different pools. A handle is valid until its
+// pool is cleared or destroyed; the default handle is an empty string that
+// belongs to no pool.
+///////////////////////////////////////////////////////////////////////////////
+template<typename CHAR>
+class pooled_string
+{
+public:
+	typedef CHAR value_type;
+	typedef size_t size_type;
+
+	// Layout of a string in the arena. The characters (and a terminating 0)
+	// follow the header.
+	struct header
+	{
+		unsigned hash;
+		uint32 length;
+		CHAR* chars() { return reinterpret_cast<CHAR*>(this + 1); }
+		const CHAR* chars() const { return reinterpret_cast<const CHAR*>(this + 1); }
+	};
+
+	pooled_string() : _p(NULL) {}
+	explicit pooled_string(const header* p) : _p(p) {}
+
+	const CHAR* data() const { return _p ? _p->chars() : Empty(); }
+	const CHAR* c_str() const { return data(); }
+	size_type size() const { return _p ? _p->length : 0; }
+	size_type length() const { return size(); }
+	bool empty() const { return size() == 0; }
+	// The hash code computed by the pool (see string_pool::Hash)
+	unsigned hash_code() const { return _p ? _p->hash : 0; }
+	std::basic_string<CHAR> str() const { return std::basic_string<CHAR>(data(), size()); }
+
+	bool operator==(const pooled_string& other) const { return _p == other._p; }
+	bool operator!=(const pooled_string& other) const { return _p != other._p; }
+
+	// Compares the characters with those of another string
+	bool equals(const CHAR* s, size_t length) const
+	{
+		return size() == length && memcmp(data(), s, length * sizeof(CHAR)) == 0;
+	}
+
+protected:
+	const header* _p;
+
+	static const CHAR* Empty() { static const CHAR empty = 0; return &empty; }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// string_pool ////////////////////////////////////////////////////////////////
+//
+// Stores strings in a chunked arena and hands out pooled_string handles.
+// Intern() stores each distinct string once: interning an equal string
+// again returns the same handle. So a hash_map<pooled_string<char>,
+// pooled_string<char> > holds two pointers per entry instead of two
+// std::strings, each of which may own a separate heap block, and its keys
+// are compared by pointer.
+//
+// The arena grows by chunks of chunkBytes (64 KB by default); a string too
+// large for a quarter of a chunk gets a block of its own. Individual strings
+// cannot be freed: they stay in the pool until Clear(), which releases the
+// chunks all at once. That is much faster than freeing millions of small
+// strings one by one, but it means that a pool serving a table that keeps
+// removing and adding different keys grows without limit, unless it is
+// cleared from time to time along with the table.
+//
+//     string_pool<char> pool;
+//     hash_map<pooled_string<char>, int> map;
+//     map[pool.Intern("apple")] = 1;
+//     map.find("apple"); // heterogeneous lookup, without interning
+//     map.clear(); pool.Clear();
+///////////////////////////////////////////////////////////////////////////////
+template<typename CHAR = char>
+class string_pool
+{
+public:
+	typedef pooled_string<CHAR> string_type;
+
+	explicit string_pool(size_t chunkBytes = 65536)
+		: _chunkBytes(chunkBytes), _next(NULL), _end(NULL), _bytes(0) {}
+	~string_pool() { FreeChunks(); }
+
+	// Returns the handle of the string s[0..length), adding a copy of the
+	// string to the pool if it is not there yet.
+	string_type Intern(const CHAR* s, size_t length)
+	{
+		std::pair<const CHAR*, size_t> key(s, length);
+		typename set_type::const_iterator it = _strings.find(key);
+		if (it != _strings.end())
+			return *it;
+		string_type added = Store(s, length, _strings.traits().hash_value(key));
+		_strings.insert(added);
+		return added;
+	}
+	string_type Intern(const CHAR* s)
+		{ return Intern(s, std::char_traits<CHAR>::length(s)); }
+	string_type Intern(const std::basic_string<CHAR>& s)
+		{ return Intern(s.data(), s.size()); }
+
+	// Returns the handle of s if s is in the pool, or the default handle if not.
+	string_type Find(const CHAR* s, size_t length) const
+	{
+		std::pair<const CHAR*, size_t> key(s, length);
+		typename set_type::const_iterator it = _strings.find(key);
+		return it != _strings.end() ? *it : string_type();
+	}
+	string_type Find(const std::basic_string<CHAR>& s) const
+		{ return Find(s.data(), s.size()); }
+
+	// Copies s[0..length) into the arena without checking whether the pool
+	// already has it. The handle is not equal to any other handle, so use
+	// this only for strings that are never compared by handle (e.g. values
+	// that are unlikely to repeat), to skip the interning lookup.
+	string_type Store(const CHAR* s, size_t length)
+		{ return Store(s, length, Hash(s, length)); }
+
+	// Frees every string in the pool. All handles from the pool become invalid.
+	void Clear()
+	{
+		_strings.Clear();
+		FreeChunks();
+	}
+
+	// Number of distinct interned strings
+	int Count() const { return _strings.Count(); }
+	// Bytes allocated for the arena (not counting the interning table)
+	size_t ArenaBytes() const { return _bytes; }
+
+	// The hash code of a pooled string, which hash_traits<pooled_string>
+	// must reproduce for heterogeneous lookups.
+	static unsigned Hash(const CHAR* s, size_t length)
+		{ return hash_traits< std::basic_string<CHAR> >::hash_chars(s, length); }
+
+protected:
+	typedef hash_set<string_type> set_type;
+
+	set_type _strings;         // Interned strings, for Intern() and Find()
+	std::vector<char*> _chunks;
+	size_t _chunkBytes;
+	char* _next;               // Free space in the current chunk
+	char* _end;
+	size_t _bytes;             // Total size of _chunks
+
+	// Strings are allocated on a header-aligned boundary
+	enum { Align = sizeof(uint32) };
+
+	string_type Store(const CHAR* s, size_t length, unsigned hash)
+	{
+		typedef typename string_type::header header;
+		header* h = (header*)Allocate(sizeof(header) + (length + 1) * sizeof(CHAR));
+		h->hash = hash;
+		h->length = (uint32)length;
+		memcpy(h->chars(), s, length * sizeof(CHAR));
+		h->chars()[length] = 0;
+		return string_type(h);
+	}
+	void* Allocate(size_t bytes)
+	{
+		bytes = (bytes + Align - 1) & ~(size_t)(Align - 1);
+		if (bytes > _chunkBytes / 4)
+			return NewChunk(bytes);
+		if ((size_t)(_end - _next) < bytes) {
+			_next = NewChunk(_chunkBytes);
+			_end = _next + _chunkBytes;
+		}
+		char* p = _next;
+		_next += bytes;
+		return p;
+	}
+	char* NewChunk(size_t bytes)
+	{
+		_chunks.reserve(_chunks.size() + 1);
+		char* chunk = new char[bytes];
+		_chunks.push_back(chunk);
+		_bytes += bytes;
+		return chunk;
+	}
+	void FreeChunks()
+	{
+		for (size_t i = 0; i < _chunks.size(); i++)
+			delete[] _chunks[i];
+		std::vector<char*>().swap(_chunks);
+		_next = _end = NULL;
+		_bytes = 0;
+	}
+
+private: // not copyable, since handles point into the arena
+	string_pool(const string_pool&);
+	string_pool& operator=(const string_pool&);
+};
+
+// Specialization of hash_traits for pooled_string: returns the stored hash
+// code and compares handles by pointer (see pooled_string). Like
+// hash_traits<basic_string<CHAR>>, it supports heterogeneous lookup by C
+// string, by (pointer, length) pair, by basic_string and by
+// basic_string_view; these hash and compare the characters.
+template<typename CHAR>
+struct hash_traits< pooled_string<CHAR> >
+{
+	typedef pooled_string<CHAR> value_type;
+	bool equals(const value_type& a, const value_type& b) const { return a == b; }
+	unsigned hash_value(const value_type& k) const { return k.hash_code(); }
+
+	unsigned hash_value(const CHAR* s) const
+		{ return string_pool<CHAR>::Hash(s, std::char_traits<CHAR>::length(s)); }
+	unsigned hash_value(const std::pair<const CHAR*, size_t>& s) const
+		{ return string_pool<CHAR>::Hash(s.first, s.second); }
+	unsigned hash_value(const std::basic_string<CHAR>& s) const
+		{ return string_pool<CHAR>::Hash(s.data(), s.size()); }
+	bool equals(const value_type& a, const CHAR* b) const
+		{ return a.equals(b, std::char_traits<CHAR>::length(b)); }
+	bool equals(const value_type& a, const std::pair<const CHAR*, size_t>& b) const
+		{ return a.equals(b.first, b.second); }
+	bool equals(const value_type& a, const std::basic_string<CHAR>& b) const
+		{ return a.equals(b.data(), b.size()); }
+	#ifdef HASH_MAP_HAS_STRING_VIEW
+	unsigned hash_value(std::basic_string_view<CHAR> s) const
+		{ return string_pool<CHAR>::Hash(s.data(), s.size()); }
+	bool equals(const value_type& a, std::basic_string_view<CHAR> b) const
+		{ return a.equals(b.data(), b.size()); }
+	#endif
+};
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, const CHAR* > { typedef void type; };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, CHAR* > { typedef void type; };
+template<typename CHAR, size_t N>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, CHAR[N] > { typedef void type; };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, std::pair<const CHAR*, size_t> > { typedef void type; };
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, std::basic_string<CHAR> > { typedef void type; };
+#ifdef HASH_MAP_HAS_STRING_VIEW
+template<typename CHAR>
+struct hash_lookup_key< hash_traits< pooled_string<CHAR> >, std::basic_string_view<CHAR> > { typedef void type; };
+#endif
+
+#endif